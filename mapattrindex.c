@@ -0,0 +1,499 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  .aix attribute index implementation, maps the values of a DBF
+ *           field to the records holding them.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** An attribute index covers one field of a DBF file and is stored next to
+** the shapefile as <basename>.<field>.aix. It starts with a 24 byte header:
+**
+**   0  "SAIX"
+**   4  byte order of the file (MS_NEW_LSB_ORDER or MS_NEW_MSB_ORDER)
+**   5  format version (1)
+**   6  'N' for numeric fields, 'C' for character fields
+**   8  number of records indexed, must match the DBF file
+**  12  number of buckets (character fields only)
+**  16  size of the key pool (character fields only)
+**  20  reserved
+**
+** Numeric fields (ordered lookups): the values of all the records, sorted,
+** as doubles, followed by the matching record numbers. Range lookups
+** bisect the value array on disk and read one contiguous run of records.
+**
+** Character fields (equality lookups): numbuckets+1 bucket start offsets,
+** then one (key offset, record) pair per record grouped by bucket, then the
+** pool of distinct nul terminated keys. A lookup reads one bucket and the
+** keys it references.
+*/
+
+#include "mapserver.h"
+#include "maptree.h"
+
+#define MS_ATTRINDEX_MAGIC "SAIX"
+#define MS_ATTRINDEX_VERSION 1
+#define MS_ATTRINDEX_HEADER_SIZE 24
+
+typedef struct {
+  double value;
+  int id;
+} attrIndexNumericEntry;
+
+typedef struct {
+  char *key;
+  int id;
+} attrIndexStringEntry;
+
+typedef struct {
+  ms_int32 bucket;
+  ms_int32 keyoffset;
+  ms_int32 id;
+} attrIndexBucketEntry;
+
+typedef struct {
+  FILE *fp;
+  int swap;
+  char type;
+  int numrecords;
+  int numbuckets;
+  int poolsize;
+} attrIndexObj;
+
+static void SwapWord( int length, void * wordP )
+{
+  int i;
+  uchar temp;
+
+  for( i=0; i < length/2; i++ ) {
+    temp = ((uchar *) wordP)[i];
+    ((uchar *)wordP)[i] = ((uchar *) wordP)[length-i-1];
+    ((uchar *) wordP)[length-i-1] = temp;
+  }
+}
+
+/* FNV-1a, the bucket of a key is part of the file format */
+static ms_uint32 attrIndexHash(const char *key)
+{
+  ms_uint32 hash = 2166136261U;
+
+  for(; *key; key++) {
+    hash ^= (uchar) *key;
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static int attrIndexCompareNumeric(const void *a, const void *b)
+{
+  const attrIndexNumericEntry *ea = a, *eb = b;
+
+  if(ea->value < eb->value) return -1;
+  if(ea->value > eb->value) return 1;
+  return ea->id - eb->id;
+}
+
+static int attrIndexCompareString(const void *a, const void *b)
+{
+  const attrIndexStringEntry *ea = a, *eb = b;
+  int cmp = strcmp(ea->key, eb->key);
+
+  return cmp ? cmp : ea->id - eb->id;
+}
+
+static int attrIndexCompareBucket(const void *a, const void *b)
+{
+  const attrIndexBucketEntry *ea = a, *eb = b;
+
+  if(ea->bucket != eb->bucket) return ea->bucket < eb->bucket ? -1 : 1;
+  if(ea->keyoffset != eb->keyoffset) return ea->keyoffset < eb->keyoffset ? -1 : 1;
+  return ea->id - eb->id;
+}
+
+/*
+** Returns the path of the attribute index of a field: <basename>.<field>.aix
+*/
+char *msShapefileGetAttrIndexFilename(char *pszReturnPath, const char *pszShapefile, const char *pszField)
+{
+  int i;
+
+  strlcpy(pszReturnPath, pszShapefile, MS_MAXPATHLEN);
+
+  /* clean off any extention the filename might have, like msSHPOpen() does */
+  for (i = strlen(pszReturnPath) - 1;
+       i > 0 && pszReturnPath[i] != '.' && pszReturnPath[i] != '/' && pszReturnPath[i] != '\\';
+       i-- ) {}
+
+  if( pszReturnPath[i] == '.' )
+    pszReturnPath[i] = '\0';
+
+  strlcat(pszReturnPath, ".", MS_MAXPATHLEN);
+  strlcat(pszReturnPath, pszField, MS_MAXPATHLEN);
+  strlcat(pszReturnPath, MS_ATTRINDEX_EXTENSION, MS_MAXPATHLEN);
+
+  return pszReturnPath;
+}
+
+/*
+** Writes the attribute index of field iField of a DBF file, in the byte order of
+** this machine.
+*/
+int msWriteAttrIndex(DBFHandle hDBF, int iField, const char *pszFilename)
+{
+  FILE *fp;
+  int i, numrecords, numkeys, numbuckets, poolsize, status = MS_SUCCESS;
+  uchar header[MS_ATTRINDEX_HEADER_SIZE];
+  ms_int32 value32;
+  DBFFieldType type;
+  const char *value;
+
+  type = msDBFGetFieldInfo(hDBF, iField, NULL, NULL, NULL);
+  if(type == FTInvalid) {
+    msSetError(MS_DBFERR, "Invalid field index %d.", "msWriteAttrIndex()", iField);
+    return MS_FAILURE;
+  }
+  numrecords = msDBFGetRecordCount(hDBF);
+
+  if((fp = fopen(pszFilename, "wb")) == NULL) {
+    msSetError(MS_IOERR, "Unable to open %s for writing.", "msWriteAttrIndex()", pszFilename);
+    return MS_FAILURE;
+  }
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, MS_ATTRINDEX_MAGIC, 4);
+  i = 1;
+  header[4] = (*((uchar *) &i) == 1) ? MS_NEW_LSB_ORDER : MS_NEW_MSB_ORDER;
+  header[5] = MS_ATTRINDEX_VERSION;
+  header[6] = (type == FTString) ? 'C' : 'N';
+  value32 = numrecords;
+  memcpy(header+8, &value32, 4);
+
+  if(type != FTString) {
+    attrIndexNumericEntry *entries;
+
+    entries = (attrIndexNumericEntry *) msSmallMalloc(sizeof(attrIndexNumericEntry)*MS_MAX(numrecords, 1));
+    for(i=0; i<numrecords; i++) {
+      if((value = msDBFReadStringAttribute(hDBF, i, iField)) == NULL) {
+        free(entries);
+        fclose(fp);
+        return MS_FAILURE;
+      }
+      entries[i].value = atof(value); /* the way expressions see numeric bindings */
+      entries[i].id = i;
+    }
+    qsort(entries, numrecords, sizeof(attrIndexNumericEntry), attrIndexCompareNumeric);
+
+    fwrite(header, sizeof(header), 1, fp);
+    for(i=0; i<numrecords; i++)
+      fwrite(&(entries[i].value), sizeof(double), 1, fp);
+    for(i=0; i<numrecords; i++) {
+      value32 = entries[i].id;
+      fwrite(&value32, 4, 1, fp);
+    }
+    free(entries);
+  } else {
+    attrIndexStringEntry *entries;
+    attrIndexBucketEntry *buckets;
+    ms_int32 *bucketstarts;
+    int offset = 0, b;
+
+    entries = (attrIndexStringEntry *) msSmallMalloc(sizeof(attrIndexStringEntry)*MS_MAX(numrecords, 1));
+    for(i=0; i<numrecords; i++) {
+      if((value = msDBFReadStringAttribute(hDBF, i, iField)) == NULL) {
+        while(--i >= 0) free(entries[i].key);
+        free(entries);
+        fclose(fp);
+        return MS_FAILURE;
+      }
+      entries[i].key = msStrdup(value);
+      entries[i].id = i;
+    }
+    qsort(entries, numrecords, sizeof(attrIndexStringEntry), attrIndexCompareString);
+
+    /* assign each distinct key its offset in the pool */
+    buckets = (attrIndexBucketEntry *) msSmallMalloc(sizeof(attrIndexBucketEntry)*MS_MAX(numrecords, 1));
+    numkeys = 0;
+    poolsize = 0;
+    for(i=0; i<numrecords; i++) {
+      if(i == 0 || strcmp(entries[i].key, entries[i-1].key) != 0) {
+        offset = poolsize;
+        poolsize += strlen(entries[i].key) + 1;
+        numkeys++;
+      }
+      buckets[i].keyoffset = offset;
+      buckets[i].id = entries[i].id;
+    }
+    numbuckets = MS_MAX(numkeys, 1);
+    for(i=0; i<numrecords; i++)
+      buckets[i].bucket = attrIndexHash(entries[i].key) % numbuckets;
+
+    value32 = numbuckets;
+    memcpy(header+12, &value32, 4);
+    value32 = poolsize;
+    memcpy(header+16, &value32, 4);
+    fwrite(header, sizeof(header), 1, fp);
+
+    /* the pool is written in key order, so from the sorted entries */
+    qsort(buckets, numrecords, sizeof(attrIndexBucketEntry), attrIndexCompareBucket);
+    bucketstarts = (ms_int32 *) msSmallCalloc(numbuckets+1, sizeof(ms_int32));
+    for(i=0; i<numrecords; i++)
+      bucketstarts[buckets[i].bucket+1]++;
+    for(b=0; b<numbuckets; b++)
+      bucketstarts[b+1] += bucketstarts[b];
+    fwrite(bucketstarts, sizeof(ms_int32), numbuckets+1, fp);
+    free(bucketstarts);
+
+    for(i=0; i<numrecords; i++) {
+      fwrite(&(buckets[i].keyoffset), 4, 1, fp);
+      fwrite(&(buckets[i].id), 4, 1, fp);
+    }
+    free(buckets);
+
+    for(i=0; i<numrecords; i++) {
+      if(i == 0 || strcmp(entries[i].key, entries[i-1].key) != 0)
+        fwrite(entries[i].key, strlen(entries[i].key)+1, 1, fp);
+    }
+    for(i=0; i<numrecords; i++)
+      free(entries[i].key);
+    free(entries);
+  }
+
+  if(ferror(fp)) {
+    msSetError(MS_IOERR, "Error writing %s.", "msWriteAttrIndex()", pszFilename);
+    status = MS_FAILURE;
+  }
+  if(fclose(fp) != 0 && status == MS_SUCCESS) {
+    msSetError(MS_IOERR, "Error writing %s.", "msWriteAttrIndex()", pszFilename);
+    status = MS_FAILURE;
+  }
+
+  return status;
+}
+
+/*
+** Opens an attribute index and checks it still matches a DBF file of numrecords
+** records. Missing or stale indexes are not an error, the caller falls back to
+** reading the DBF.
+*/
+static int attrIndexOpen(attrIndexObj *index, const char *pszFilename, char type, int numrecords, int debug)
+{
+  uchar header[MS_ATTRINDEX_HEADER_SIZE];
+  ms_int32 value32;
+  int i;
+  char byteorder;
+
+  if((index->fp = fopen(pszFilename, "rb")) == NULL)
+    return MS_FALSE;
+
+  if(fread(header, sizeof(header), 1, index->fp) != 1 || memcmp(header, MS_ATTRINDEX_MAGIC, 4) != 0 ||
+      header[5] != MS_ATTRINDEX_VERSION || (header[4] != MS_NEW_LSB_ORDER && header[4] != MS_NEW_MSB_ORDER)) {
+    if(debug)
+      msDebug("attrIndexOpen(): %s is not a valid attribute index, ignoring it.\n", pszFilename);
+    fclose(index->fp);
+    return MS_FALSE;
+  }
+
+  i = 1;
+  byteorder = (*((uchar *) &i) == 1) ? MS_NEW_LSB_ORDER : MS_NEW_MSB_ORDER;
+  index->swap = (header[4] != byteorder);
+  index->type = header[6];
+
+  memcpy(&value32, header+8, 4);
+  if(index->swap) SwapWord(4, &value32);
+  index->numrecords = value32;
+  memcpy(&value32, header+12, 4);
+  if(index->swap) SwapWord(4, &value32);
+  index->numbuckets = value32;
+  memcpy(&value32, header+16, 4);
+  if(index->swap) SwapWord(4, &value32);
+  index->poolsize = value32;
+
+  if(index->type != type || index->numrecords != numrecords || (type == 'C' && index->numbuckets < 1)) {
+    if(debug)
+      msDebug("attrIndexOpen(): %s doesn't match the DBF file, ignoring it.\n", pszFilename);
+    fclose(index->fp);
+    return MS_FALSE;
+  }
+
+  return MS_TRUE;
+}
+
+static int attrIndexReadInt32s(attrIndexObj *index, long offset, ms_int32 *values, int count)
+{
+  int i;
+
+  if(fseek(index->fp, offset, SEEK_SET) != 0 || (int) fread(values, 4, count, index->fp) != count)
+    return MS_FAILURE;
+  if(index->swap)
+    for(i=0; i<count; i++) SwapWord(4, values+i);
+  return MS_SUCCESS;
+}
+
+static int attrIndexReadDouble(attrIndexObj *index, int position, double *value)
+{
+  if(fseek(index->fp, MS_ATTRINDEX_HEADER_SIZE + (long) position*sizeof(double), SEEK_SET) != 0 ||
+      fread(value, sizeof(double), 1, index->fp) != 1)
+    return MS_FAILURE;
+  if(index->swap) SwapWord(sizeof(double), value);
+  return MS_SUCCESS;
+}
+
+/* first position whose value is > bound (bUpper) or >= bound */
+static int attrIndexBisect(attrIndexObj *index, double bound, int bUpper, int *position)
+{
+  int lo = 0, hi = index->numrecords, mid;
+  double value;
+
+  while(lo < hi) {
+    mid = lo + (hi - lo)/2;
+    if(attrIndexReadDouble(index, mid, &value) != MS_SUCCESS)
+      return MS_FAILURE;
+    if(value < bound || (bUpper && value == bound))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *position = lo;
+  return MS_SUCCESS;
+}
+
+/* clears the bits of status that are not set in found */
+static void attrIndexMergeStatus(ms_bitarray status, ms_bitarray found, int numbits)
+{
+  int i;
+
+  for(i = msGetNextBit(status, 0, numbits); i != -1; i = msGetNextBit(status, i+1, numbits))
+    if(!msGetBit(found, i)) msSetBit(status, i, 0);
+}
+
+/*
+** Keeps in status only the records whose numeric value lies between dfMin and dfMax
+** (bounds included if bMinIncluded / bMaxIncluded, use +/-HUGE_VAL for open ranges).
+** Returns MS_TRUE if the index could be used, MS_FALSE if status was left untouched.
+*/
+int msSearchAttrIndexRange(const char *pszFilename, int numrecords, double dfMin, int bMinIncluded,
+                           double dfMax, int bMaxIncluded, ms_bitarray status, int debug)
+{
+  attrIndexObj index;
+  ms_bitarray found;
+  ms_int32 ids[1024];
+  int first, last, i, n;
+
+  if(!attrIndexOpen(&index, pszFilename, 'N', numrecords, debug))
+    return MS_FALSE;
+
+  if(attrIndexBisect(&index, dfMin, !bMinIncluded, &first) != MS_SUCCESS ||
+      attrIndexBisect(&index, dfMax, bMaxIncluded, &last) != MS_SUCCESS ||
+      (found = msAllocBitArray(MS_MAX(numrecords, 1))) == NULL) {
+    fclose(index.fp);
+    return MS_FALSE;
+  }
+
+  for(i=first; i<last; i+=n) {
+    int j;
+    n = MS_MIN(last - i, 1024);
+    if(attrIndexReadInt32s(&index, MS_ATTRINDEX_HEADER_SIZE + (long) numrecords*sizeof(double) + (long) i*4, ids, n) != MS_SUCCESS) {
+      free(found);
+      fclose(index.fp);
+      return MS_FALSE;
+    }
+    for(j=0; j<n; j++)
+      if(ids[j] >= 0 && ids[j] < numrecords) msSetBit(found, ids[j], 1);
+  }
+  fclose(index.fp);
+
+  if(debug >= MS_DEBUGLEVEL_VV)
+    msDebug("msSearchAttrIndexRange(): %d of %d records match in %s.\n", MS_MAX(last - first, 0), numrecords, pszFilename);
+
+  attrIndexMergeStatus(status, found, numrecords);
+  free(found);
+
+  return MS_TRUE;
+}
+
+/*
+** Keeps in status only the records whose value is pszValue. Returns MS_TRUE if the
+** index could be used, MS_FALSE if status was left untouched.
+*/
+int msSearchAttrIndexString(const char *pszFilename, int numrecords, const char *pszValue,
+                            ms_bitarray status, int debug)
+{
+  attrIndexObj index;
+  ms_bitarray found;
+  ms_int32 range[2], *entries;
+  long pooloffset;
+  char *key;
+  int i, count, len, matches = 0, lastoffset = -1, lastmatch = MS_FALSE;
+
+  if(!attrIndexOpen(&index, pszFilename, 'C', numrecords, debug))
+    return MS_FALSE;
+
+  if(attrIndexReadInt32s(&index, MS_ATTRINDEX_HEADER_SIZE + (long) (attrIndexHash(pszValue) % index.numbuckets)*4, range, 2) != MS_SUCCESS ||
+      range[0] < 0 || range[1] < range[0] || range[1] > numrecords ||
+      (found = msAllocBitArray(MS_MAX(numrecords, 1))) == NULL) {
+    fclose(index.fp);
+    return MS_FALSE;
+  }
+
+  count = range[1] - range[0];
+  entries = (ms_int32 *) msSmallMalloc(sizeof(ms_int32)*2*MS_MAX(count, 1));
+  if(count > 0 &&
+      attrIndexReadInt32s(&index, MS_ATTRINDEX_HEADER_SIZE + (long) (index.numbuckets+1)*4 + (long) range[0]*8, entries, 2*count) != MS_SUCCESS) {
+    free(entries);
+    free(found);
+    fclose(index.fp);
+    return MS_FALSE;
+  }
+
+  pooloffset = MS_ATTRINDEX_HEADER_SIZE + (long) (index.numbuckets+1)*4 + (long) numrecords*8;
+  len = strlen(pszValue) + 1;
+  key = (char *) msSmallMalloc(len);
+
+  /* entries sharing a key are stored together, each key is read once */
+  for(i=0; i<count; i++) {
+    if(entries[2*i] != lastoffset) {
+      lastoffset = entries[2*i];
+      lastmatch = (lastoffset >= 0 && lastoffset + len <= index.poolsize &&
+                   fseek(index.fp, pooloffset + lastoffset, SEEK_SET) == 0 &&
+                   (int) fread(key, 1, len, index.fp) == len && memcmp(key, pszValue, len) == 0);
+    }
+    if(lastmatch && entries[2*i+1] >= 0 && entries[2*i+1] < numrecords) {
+      msSetBit(found, entries[2*i+1], 1);
+      matches++;
+    }
+  }
+  free(key);
+  free(entries);
+  fclose(index.fp);
+
+  if(debug >= MS_DEBUGLEVEL_VV)
+    msDebug("msSearchAttrIndexString(): %d of %d records match in %s.\n", matches, numrecords, pszFilename);
+
+  attrIndexMergeStatus(status, found, numrecords);
+  free(found);
+
+  return MS_TRUE;
+}
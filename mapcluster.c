@@ -31,6 +31,8 @@
 
 /* $Id$ */
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "mapserver.h"
 
 
@@ -50,6 +52,7 @@
 typedef struct cluster_tree_node clusterTreeNode;
 typedef struct cluster_info clusterInfo;
 typedef struct cluster_layer_info msClusterLayerInfo;
+typedef struct cluster_pyramid clusterPyramid;
 
 /* forward declarations */
 void msClusterLayerCopyVirtualTable(layerVTableObj* vtable);
@@ -129,6 +132,9 @@ struct cluster_layer_info {
   clusterCompareRegionFunc fnCompare;
   /* diagnostics */
   int depth;
+  /* precomputed cluster pyramid (CLUSTER_PYRAMID) */
+  clusterPyramid* pyramid;
+  int pyramidChecked;
 };
 
 
@@ -505,52 +511,61 @@ static void InitShapeAttributes(layerObj* layer, clusterInfo* base)
   }
 }
 
-/* update the shape attributes (aggregate) */
-static void UpdateShapeAttributes(layerObj* layer, clusterInfo* base, clusterInfo* current)
+/* aggregate an attribute array into the attributes of the base cluster, */
+/* aggregated is set if the values belong to a cluster instead of a single feature */
+static void AggregateAttributeValues(layerObj* layer, char** basevalues, int numbasevalues,
+                                     char** values, int numvalues, int aggregated)
 {
   int i;
   int* itemindexes = layer->iteminfo;
 
   for (i = 0; i < layer->numitems; i++) {
-    if (base->shape.numvalues <= i)
+    if (numbasevalues <= i)
       break;
 
     if (itemindexes[i] == MSCLUSTER_FEATURECOUNTINDEX ||
         itemindexes[i] == MSCLUSTER_GROUPINDEX)
       continue;
 
-    if (current->shape.numvalues <= i)
+    if (numvalues <= i)
       break;
 
-    if (current->shape.values[i]) {
+    if (values[i]) {
       if (EQUALN(layer->items[i], "Min:", 4)) {
-        if (strcasecmp(base->shape.values[i], current->shape.values[i]) > 0) {
-          msFree(base->shape.values[i]);
-          base->shape.values[i] = msStrdup(current->shape.values[i]);
+        if (strcasecmp(basevalues[i], values[i]) > 0) {
+          msFree(basevalues[i]);
+          basevalues[i] = msStrdup(values[i]);
         }
       } else if (EQUALN(layer->items[i], "Max:", 4)) {
-        if (strcasecmp(base->shape.values[i], current->shape.values[i]) < 0) {
-          msFree(base->shape.values[i]);
-          base->shape.values[i] = msStrdup(current->shape.values[i]);
+        if (strcasecmp(basevalues[i], values[i]) < 0) {
+          msFree(basevalues[i]);
+          basevalues[i] = msStrdup(values[i]);
         }
       } else if (EQUALN(layer->items[i], "Sum:", 4)) {
-        double sum = atof(base->shape.values[i]) + atof(current->shape.values[i]);
-        msFree(base->shape.values[i]);
-        base->shape.values[i] = msDoubleToString(sum, MS_FALSE);
+        double sum = atof(basevalues[i]) + atof(values[i]);
+        msFree(basevalues[i]);
+        basevalues[i] = msDoubleToString(sum, MS_FALSE);
       } else if (EQUALN(layer->items[i], "Count:", 6)) {
-        int count = atoi(base->shape.values[i]) + 1;
-        msFree(base->shape.values[i]);
-        base->shape.values[i] = msIntToString(count);
-      } else if (!EQUAL(base->shape.values[i], current->shape.values[i])
-                 && !EQUAL(base->shape.values[i], "")) {
+        int count = atoi(basevalues[i]) + (aggregated ? atoi(values[i]) : 1);
+        msFree(basevalues[i]);
+        basevalues[i] = msIntToString(count);
+      } else if (!EQUAL(basevalues[i], values[i])
+                 && !EQUAL(basevalues[i], "")) {
         /* clear the value if that doesn't match */
-        msFree(base->shape.values[i]);
-        base->shape.values[i] = msStrdup("");
+        msFree(basevalues[i]);
+        basevalues[i] = msStrdup("");
       }
     }
   }
 }
 
+/* update the shape attributes (aggregate) */
+static void UpdateShapeAttributes(layerObj* layer, clusterInfo* base, clusterInfo* current)
+{
+  AggregateAttributeValues(layer, base->shape.values, base->shape.numvalues,
+                           current->shape.values, current->shape.numvalues, MS_FALSE);
+}
+
 static int BuildFeatureAttributes(layerObj* layer, msClusterLayerInfo* layerinfo, shapeObj* shape)
 {
   char** values;
@@ -854,6 +869,720 @@ static int ValidateTree(msClusterLayerInfo* layerinfo, clusterTreeNode *node)
 }
 #endif
 
+/* -------------------------------------------------------------------- */
+/*      Precomputed cluster pyramid                                     */
+/*                                                                      */
+/*      With PROCESSING "CLUSTER_PYRAMID=ON" (or a base file name) the  */
+/*      features of the source layer are aggregated once into a stack  */
+/*      of regular grids, each level doubling the cell size of the     */
+/*      previous one, and persisted in a file next to the source.      */
+/*      At render time the level matching the cluster distance is      */
+/*      selected and the clusters of the visible cells are read back   */
+/*      instead of rebuilding the quadtree from the source features.   */
+/* -------------------------------------------------------------------- */
+
+#define MSCLUSTER_PYRAMID_MAGIC "MSCLPYR1"
+#define MSCLUSTER_PYRAMID_LEVELS 16
+#define MSCLUSTER_PYRAMID_MAXLEVELS 24
+
+/* a cluster of one pyramid level */
+typedef struct {
+  int ix;
+  int iy;
+  double x; /* weighted average position of the members */
+  double y;
+  int count;
+  long shapeindex; /* first member, used as the identity of the cluster */
+  int tileindex;
+  char* group;
+  char** values;
+  int numvalues;
+} clusterPyramidEntry;
+
+/* a row of cells of one pyramid level */
+typedef struct {
+  int iy;
+  int numclusters;
+  long offset;
+} clusterPyramidRow;
+
+typedef struct {
+  double cellsize;
+  int numclusters;
+  int numrows;
+  long rowoffset;
+  clusterPyramidRow* rows; /* loaded on demand */
+} clusterPyramidLevel;
+
+struct cluster_pyramid {
+  FILE* fp;
+  double originx;
+  double originy;
+  int numlevels;
+  clusterPyramidLevel* levels;
+};
+
+static void clusterPyramidClose(clusterPyramid* pyramid)
+{
+  int i;
+
+  if (!pyramid)
+    return;
+
+  if (pyramid->fp)
+    fclose(pyramid->fp);
+
+  for (i = 0; i < pyramid->numlevels; i++)
+    msFree(pyramid->levels[i].rows);
+
+  msFree(pyramid->levels);
+  msFree(pyramid);
+}
+
+static void clusterPyramidFreeEntry(clusterPyramidEntry* entry)
+{
+  if (entry->values)
+    msFreeCharArray(entry->values, entry->numvalues);
+  msFree(entry->group);
+  entry->values = NULL;
+  entry->numvalues = 0;
+  entry->group = NULL;
+}
+
+static int clusterPyramidWriteString(FILE* fp, const char* str)
+{
+  int len = str ? (int)strlen(str) : -1;
+
+  if (fwrite(&len, sizeof(int), 1, fp) != 1)
+    return MS_FAILURE;
+  if (len > 0 && fwrite(str, len, 1, fp) != 1)
+    return MS_FAILURE;
+
+  return MS_SUCCESS;
+}
+
+static int clusterPyramidReadString(FILE* fp, char** str)
+{
+  int len;
+
+  *str = NULL;
+  if (fread(&len, sizeof(int), 1, fp) != 1)
+    return MS_FAILURE;
+  if (len < 0)
+    return MS_SUCCESS;
+
+  *str = (char*)msSmallMalloc(len + 1);
+  if (len > 0 && fread(*str, len, 1, fp) != 1) {
+    msFree(*str);
+    *str = NULL;
+    return MS_FAILURE;
+  }
+  (*str)[len] = '\0';
+
+  return MS_SUCCESS;
+}
+
+static int clusterPyramidWriteEntry(FILE* fp, clusterPyramidEntry* entry)
+{
+  int i;
+
+  if (fwrite(&entry->ix, sizeof(int), 1, fp) != 1 ||
+      fwrite(&entry->x, sizeof(double), 1, fp) != 1 ||
+      fwrite(&entry->y, sizeof(double), 1, fp) != 1 ||
+      fwrite(&entry->count, sizeof(int), 1, fp) != 1 ||
+      fwrite(&entry->shapeindex, sizeof(long), 1, fp) != 1 ||
+      fwrite(&entry->tileindex, sizeof(int), 1, fp) != 1 ||
+      clusterPyramidWriteString(fp, entry->group) != MS_SUCCESS ||
+      fwrite(&entry->numvalues, sizeof(int), 1, fp) != 1)
+    return MS_FAILURE;
+
+  for (i = 0; i < entry->numvalues; i++) {
+    if (clusterPyramidWriteString(fp, entry->values[i]) != MS_SUCCESS)
+      return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+static int clusterPyramidReadEntry(FILE* fp, clusterPyramidEntry* entry)
+{
+  int i;
+
+  entry->group = NULL;
+  entry->values = NULL;
+  entry->numvalues = 0;
+
+  if (fread(&entry->ix, sizeof(int), 1, fp) != 1 ||
+      fread(&entry->x, sizeof(double), 1, fp) != 1 ||
+      fread(&entry->y, sizeof(double), 1, fp) != 1 ||
+      fread(&entry->count, sizeof(int), 1, fp) != 1 ||
+      fread(&entry->shapeindex, sizeof(long), 1, fp) != 1 ||
+      fread(&entry->tileindex, sizeof(int), 1, fp) != 1 ||
+      clusterPyramidReadString(fp, &entry->group) != MS_SUCCESS ||
+      fread(&entry->numvalues, sizeof(int), 1, fp) != 1 ||
+      entry->numvalues < 0) {
+    entry->numvalues = 0;
+    return MS_FAILURE;
+  }
+
+  if (entry->numvalues > 0) {
+    entry->values = (char**)msSmallCalloc(entry->numvalues, sizeof(char*));
+    for (i = 0; i < entry->numvalues; i++) {
+      if (clusterPyramidReadString(fp, &entry->values[i]) != MS_SUCCESS)
+        return MS_FAILURE;
+    }
+  }
+
+  return MS_SUCCESS;
+}
+
+/* order the clusters by cell (row first) and group */
+static int clusterPyramidCompareEntries(const void* a, const void* b)
+{
+  const clusterPyramidEntry* e1 = (const clusterPyramidEntry*)a;
+  const clusterPyramidEntry* e2 = (const clusterPyramidEntry*)b;
+
+  if (e1->iy != e2->iy)
+    return (e1->iy < e2->iy) ? -1 : 1;
+  if (e1->ix != e2->ix)
+    return (e1->ix < e2->ix) ? -1 : 1;
+  if (e1->group == NULL || e2->group == NULL)
+    return (e1->group != NULL) - (e2->group != NULL);
+  return strcasecmp(e1->group, e2->group);
+}
+
+/* sort the clusters and merge those falling into the same cell, returns the new count */
+static int clusterPyramidMergeEntries(layerObj* layer, clusterPyramidEntry* entries, int numentries)
+{
+  int i, n;
+
+  if (numentries == 0)
+    return 0;
+
+  qsort(entries, numentries, sizeof(clusterPyramidEntry), clusterPyramidCompareEntries);
+
+  n = 0;
+  for (i = 1; i < numentries; i++) {
+    clusterPyramidEntry* base = &entries[n];
+    clusterPyramidEntry* current = &entries[i];
+
+    if (clusterPyramidCompareEntries(base, current) == 0) {
+      base->x = (base->x * base->count + current->x * current->count) / (base->count + current->count);
+      base->y = (base->y * base->count + current->y * current->count) / (base->count + current->count);
+      base->count += current->count;
+      if (current->shapeindex < base->shapeindex) {
+        base->shapeindex = current->shapeindex;
+        base->tileindex = current->tileindex;
+      }
+      if (layer->iteminfo)
+        AggregateAttributeValues(layer, base->values, base->numvalues,
+                                 current->values, current->numvalues, MS_TRUE);
+      clusterPyramidFreeEntry(current);
+    } else {
+      ++n;
+      if (n != i) {
+        entries[n] = *current;
+        current->group = NULL;
+        current->values = NULL;
+        current->numvalues = 0;
+      }
+    }
+  }
+
+  return n + 1;
+}
+
+/* write the clusters of a level row by row followed by the row table */
+static int clusterPyramidWriteLevel(FILE* fp, clusterPyramidLevel* level,
+                                    clusterPyramidEntry* entries, int numentries)
+{
+  int i, numrows = 0, maxrows = 0;
+  clusterPyramidRow* rows = NULL;
+
+  level->numclusters = numentries;
+  level->numrows = 0;
+
+  for (i = 0; i < numentries; i++) {
+    if (numrows == 0 || rows[numrows - 1].iy != entries[i].iy) {
+      if (numrows == maxrows) {
+        maxrows = maxrows ? maxrows * 2 : 256;
+        rows = (clusterPyramidRow*)msSmallRealloc(rows, sizeof(clusterPyramidRow) * maxrows);
+      }
+      rows[numrows].iy = entries[i].iy;
+      rows[numrows].numclusters = 0;
+      rows[numrows].offset = ftell(fp);
+      ++numrows;
+    }
+    ++rows[numrows - 1].numclusters;
+
+    if (clusterPyramidWriteEntry(fp, &entries[i]) != MS_SUCCESS) {
+      msFree(rows);
+      return MS_FAILURE;
+    }
+  }
+
+  level->numrows = numrows;
+  level->rowoffset = ftell(fp);
+  if (numrows > 0 && fwrite(rows, sizeof(clusterPyramidRow), numrows, fp) != (size_t)numrows) {
+    msFree(rows);
+    return MS_FAILURE;
+  }
+
+  msFree(rows);
+  return MS_SUCCESS;
+}
+
+/* write the header and the level table */
+static int clusterPyramidWriteHeader(FILE* fp, const char* signature, double originx, double originy,
+                                     int numlevels, clusterPyramidLevel* levels)
+{
+  int i;
+  int byteorder = 1;
+  int longsize = sizeof(long);
+
+  if (fseek(fp, 0, SEEK_SET) != 0 ||
+      fwrite(MSCLUSTER_PYRAMID_MAGIC, 8, 1, fp) != 1 ||
+      fwrite(&byteorder, sizeof(int), 1, fp) != 1 ||
+      fwrite(&longsize, sizeof(int), 1, fp) != 1 ||
+      clusterPyramidWriteString(fp, signature) != MS_SUCCESS ||
+      fwrite(&originx, sizeof(double), 1, fp) != 1 ||
+      fwrite(&originy, sizeof(double), 1, fp) != 1 ||
+      fwrite(&numlevels, sizeof(int), 1, fp) != 1)
+    return MS_FAILURE;
+
+  for (i = 0; i < numlevels; i++) {
+    if (fwrite(&levels[i].cellsize, sizeof(double), 1, fp) != 1 ||
+        fwrite(&levels[i].numclusters, sizeof(int), 1, fp) != 1 ||
+        fwrite(&levels[i].numrows, sizeof(int), 1, fp) != 1 ||
+        fwrite(&levels[i].rowoffset, sizeof(long), 1, fp) != 1)
+      return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+/* read the source features and write the cluster pyramid into a file, */
+/* returns MS_DONE if the file could not be written */
+static int clusterPyramidBuild(layerObj* layer, msClusterLayerInfo* layerinfo, const char* path,
+                               const char* signature, int numlevels)
+{
+  layerObj* srcLayer = &layerinfo->srcLayer;
+  rectObj extent;
+  double size, cellsize;
+  clusterPyramidEntry* entries = NULL;
+  clusterPyramidLevel* levels;
+  int numentries = 0, maxentries = 0;
+  int i, j, status;
+  shapeObj shape;
+  FILE* fp;
+  char szTmpPath[MS_MAXPATHLEN], szSuffix[32];
+
+  if (msLayerGetExtent(srcLayer, &extent) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  size = MS_MAX(extent.maxx - extent.minx, extent.maxy - extent.miny);
+  if (size <= 0)
+    size = 1;
+  /* the top level covers the whole extent with a single cell */
+  cellsize = size / (1 << (numlevels - 1));
+
+  status = msLayerWhichShapes(srcLayer, extent, MS_FALSE);
+  if (status != MS_SUCCESS && status != MS_DONE)
+    return MS_FAILURE;
+
+  msInitShape(&shape);
+  while (status == MS_SUCCESS && (status = msLayerNextShape(srcLayer, &shape)) == MS_SUCCESS) {
+    clusterPyramidEntry* entry;
+
+    if (shape.numlines == 0 || shape.line[0].numpoints == 0) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if (numentries == maxentries) {
+      maxentries = maxentries ? maxentries * 2 : 1024;
+      entries = (clusterPyramidEntry*)msSmallRealloc(entries, sizeof(clusterPyramidEntry) * maxentries);
+    }
+    entry = &entries[numentries++];
+
+    entry->x = shape.bounds.minx;
+    entry->y = shape.bounds.miny;
+    entry->ix = (int)floor((entry->x - extent.minx) / cellsize);
+    entry->iy = (int)floor((entry->y - extent.miny) / cellsize);
+    entry->count = 1;
+    entry->shapeindex = shape.index;
+    entry->tileindex = shape.tileindex;
+    entry->group = NULL;
+
+    /* construct the item array */
+    if (layer->iteminfo) {
+      BuildFeatureAttributes(layer, layerinfo, &shape);
+      for (i = 0; i < layer->numitems && i < shape.numvalues; i++) {
+        if (EQUALN(layer->items[i], "Count:", 6)) {
+          msFree(shape.values[i]);
+          shape.values[i] = msStrdup("1"); /* initial count */
+        }
+      }
+    }
+
+    /* evaluate the group expression */
+    if (layer->cluster.group.string)
+      entry->group = msClusterGetGroupText(&layer->cluster.group, &shape);
+
+    /* take over the attributes */
+    entry->values = shape.values;
+    entry->numvalues = shape.numvalues;
+    shape.values = NULL;
+    shape.numvalues = 0;
+    msFreeShape(&shape);
+  }
+
+  if (status != MS_DONE) {
+    for (i = 0; i < numentries; i++)
+      clusterPyramidFreeEntry(&entries[i]);
+    msFree(entries);
+    return MS_FAILURE;
+  }
+
+  /* write to a temporary file and move it in place when completed */
+  snprintf(szSuffix, sizeof(szSuffix), ".%ld.tmp", (long)getpid());
+  strlcpy(szTmpPath, path, sizeof(szTmpPath));
+  strlcat(szTmpPath, szSuffix, sizeof(szTmpPath));
+  if ((fp = fopen(szTmpPath, "wb")) == NULL) {
+    if (layer->debug)
+      msDebug("RebuildClusters(): unable to write the cluster pyramid %s.\n", szTmpPath);
+    for (i = 0; i < numentries; i++)
+      clusterPyramidFreeEntry(&entries[i]);
+    msFree(entries);
+    return MS_DONE;
+  }
+
+  levels = (clusterPyramidLevel*)msSmallCalloc(numlevels, sizeof(clusterPyramidLevel));
+  status = clusterPyramidWriteHeader(fp, signature, extent.minx, extent.miny, numlevels, levels);
+
+  /* each level merges the cells of the previous one by pairs in both directions */
+  for (i = 0; i < numlevels && status == MS_SUCCESS; i++) {
+    if (i > 0) {
+      for (j = 0; j < numentries; j++) {
+        entries[j].ix >>= 1;
+        entries[j].iy >>= 1;
+      }
+    }
+    numentries = clusterPyramidMergeEntries(layer, entries, numentries);
+    levels[i].cellsize = cellsize * (1 << i);
+    status = clusterPyramidWriteLevel(fp, &levels[i], entries, numentries);
+  }
+
+  if (status == MS_SUCCESS)
+    status = clusterPyramidWriteHeader(fp, signature, extent.minx, extent.miny, numlevels, levels);
+
+  for (i = 0; i < numentries; i++)
+    clusterPyramidFreeEntry(&entries[i]);
+  msFree(entries);
+  msFree(levels);
+
+  if (fclose(fp) != 0 || status != MS_SUCCESS || rename(szTmpPath, path) != 0) {
+    unlink(szTmpPath);
+    if (layer->debug)
+      msDebug("RebuildClusters(): unable to write the cluster pyramid %s.\n", path);
+    return MS_DONE;
+  }
+
+  if (layer->debug)
+    msDebug("RebuildClusters(): cluster pyramid %s created.\n", path);
+
+  return MS_SUCCESS;
+}
+
+/* open a pyramid file, returns NULL if missing or not matching the signature */
+static clusterPyramid* clusterPyramidOpen(const char* path, const char* signature)
+{
+  clusterPyramid* pyramid;
+  char magic[8];
+  char* filesignature = NULL;
+  int byteorder, longsize, i;
+  FILE* fp;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return NULL;
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, MSCLUSTER_PYRAMID_MAGIC, 8) != 0 ||
+      fread(&byteorder, sizeof(int), 1, fp) != 1 || byteorder != 1 ||
+      fread(&longsize, sizeof(int), 1, fp) != 1 || longsize != sizeof(long) ||
+      clusterPyramidReadString(fp, &filesignature) != MS_SUCCESS ||
+      !filesignature || strcmp(filesignature, signature) != 0) {
+    msFree(filesignature);
+    fclose(fp);
+    return NULL;
+  }
+  msFree(filesignature);
+
+  pyramid = (clusterPyramid*)msSmallCalloc(1, sizeof(clusterPyramid));
+  pyramid->fp = fp;
+
+  if (fread(&pyramid->originx, sizeof(double), 1, fp) != 1 ||
+      fread(&pyramid->originy, sizeof(double), 1, fp) != 1 ||
+      fread(&pyramid->numlevels, sizeof(int), 1, fp) != 1 ||
+      pyramid->numlevels < 1 || pyramid->numlevels > MSCLUSTER_PYRAMID_MAXLEVELS) {
+    pyramid->numlevels = 0;
+    clusterPyramidClose(pyramid);
+    return NULL;
+  }
+
+  pyramid->levels = (clusterPyramidLevel*)msSmallCalloc(pyramid->numlevels, sizeof(clusterPyramidLevel));
+  for (i = 0; i < pyramid->numlevels; i++) {
+    if (fread(&pyramid->levels[i].cellsize, sizeof(double), 1, fp) != 1 ||
+        fread(&pyramid->levels[i].numclusters, sizeof(int), 1, fp) != 1 ||
+        fread(&pyramid->levels[i].numrows, sizeof(int), 1, fp) != 1 ||
+        fread(&pyramid->levels[i].rowoffset, sizeof(long), 1, fp) != 1 ||
+        pyramid->levels[i].cellsize <= 0 || pyramid->levels[i].numrows < 0) {
+      clusterPyramidClose(pyramid);
+      return NULL;
+    }
+  }
+
+  return pyramid;
+}
+
+/* get the pyramid file of the layer, building it if required */
+/* returns MS_DONE if the pyramid should not be used */
+static int clusterPyramidPrepare(layerObj* layer, msClusterLayerInfo* layerinfo)
+{
+  const char* value;
+  char szPath[MS_MAXPATHLEN], szSrcPath[MS_MAXPATHLEN], szBase[MS_MAXPATHLEN], szSuffix[32];
+  char* signature = NULL;
+  unsigned int hash = 2166136261U;
+  int numlevels = MSCLUSTER_PYRAMID_LEVELS;
+  int i, status, isStale = MS_FALSE;
+  struct stat sPyramidStat, sSrcStat;
+  const unsigned char* c;
+
+  if (layerinfo->pyramid)
+    return MS_SUCCESS;
+  if (layerinfo->pyramidChecked)
+    return MS_DONE;
+  layerinfo->pyramidChecked = MS_TRUE;
+
+#ifdef USE_CLUSTER_EXTERNAL
+  /* the source features may need to be reprojected */
+  return MS_DONE;
+#endif
+
+  if ((value = msLayerGetProcessingKey(layer, "CLUSTER_PYRAMID")) == NULL ||
+      EQUAL(value, "OFF") || EQUAL(value, "FALSE"))
+    return MS_DONE;
+
+  /* these require the individual features when clustering */
+  if (layer->cluster.filter.string || layerinfo->get_all_shapes) {
+    if (layer->debug)
+      msDebug("RebuildClusters(): cluster pyramid ignored due to CLUSTER_GET_ALL_SHAPES or cluster FILTER in layer %s.\n", layer->name);
+    return MS_DONE;
+  }
+
+  if (EQUAL(value, "ON") || EQUAL(value, "TRUE")) {
+    if (!layer->data || (layer->connectiontype != MS_SHAPEFILE &&
+                         layer->connectiontype != MS_TILED_SHAPEFILE &&
+                         layer->connectiontype != MS_OGR)) {
+      if (layer->debug)
+        msDebug("RebuildClusters(): CLUSTER_PYRAMID requires a file name for the data source of layer %s.\n", layer->name);
+      return MS_DONE;
+    }
+    value = layer->data;
+  }
+
+  msBuildPath3(szBase, layer->map->mappath, layer->map->shapepath, value);
+
+  if ((value = msLayerGetProcessingKey(layer, "CLUSTER_PYRAMID_LEVELS")) != NULL) {
+    numlevels = atoi(value);
+    if (numlevels < 1 || numlevels > MSCLUSTER_PYRAMID_MAXLEVELS) {
+      msSetError(MS_MISCERR, "Invalid CLUSTER_PYRAMID_LEVELS value in layer %s, must be between 1 and %d.",
+                 "RebuildClusters()", layer->name, MSCLUSTER_PYRAMID_MAXLEVELS);
+      return MS_FAILURE;
+    }
+  }
+  /* the pyramid content depends on the requested items and the expressions */
+  snprintf(szPath, sizeof(szPath), "levels=%d;group=%s;filteritem=%s;filter=%s;items=", numlevels,
+           layer->cluster.group.string ? layer->cluster.group.string : "",
+           layer->filteritem ? layer->filteritem : "",
+           layer->filter.string ? layer->filter.string : "");
+  signature = msStringConcatenate(signature, szPath);
+  for (i = 0; i < layer->numitems; i++) {
+    if (i > 0)
+      signature = msStringConcatenate(signature, ",");
+    signature = msStringConcatenate(signature, layer->items[i]);
+  }
+
+  /* FNV-1a hash of the signature to keep the variants of the same source apart */
+  for (c = (const unsigned char*)signature; *c; c++)
+    hash = (hash ^ *c) * 16777619U;
+  snprintf(szSuffix, sizeof(szSuffix), ".%08x.cpy", hash);
+  strlcpy(szPath, szBase, sizeof(szPath));
+  strlcat(szPath, szSuffix, sizeof(szPath));
+
+  /* rebuild the pyramid if the source has been modified since */
+  if (stat(szPath, &sPyramidStat) == 0 && layer->data) {
+    msBuildPath3(szSrcPath, layer->map->mappath, layer->map->shapepath, layer->data);
+    if (stat(szSrcPath, &sSrcStat) != 0) {
+      strlcat(szSrcPath, ".shp", sizeof(szSrcPath));
+      if (stat(szSrcPath, &sSrcStat) != 0)
+        sSrcStat.st_mtime = 0;
+    }
+    if (sSrcStat.st_mtime > sPyramidStat.st_mtime)
+      isStale = MS_TRUE;
+  }
+
+  if (!isStale)
+    layerinfo->pyramid = clusterPyramidOpen(szPath, signature);
+
+  if (!layerinfo->pyramid) {
+    status = clusterPyramidBuild(layer, layerinfo, szPath, signature, numlevels);
+    if (status == MS_SUCCESS)
+      layerinfo->pyramid = clusterPyramidOpen(szPath, signature);
+    if (status == MS_FAILURE) {
+      msFree(signature);
+      return MS_FAILURE;
+    }
+  }
+
+  msFree(signature);
+
+  if (!layerinfo->pyramid) {
+    if (layer->debug)
+      msDebug("RebuildClusters(): cluster pyramid %s not available, clustering from the source.\n", szPath);
+    return MS_DONE;
+  }
+
+  return MS_SUCCESS;
+}
+
+/* create the cluster features from the pyramid clusters covering the search rectangle */
+/* returns MS_DONE if the pyramid has no level for the cluster distance */
+static int clusterPyramidLookup(layerObj* layer, msClusterLayerInfo* layerinfo, rectObj searchrect, double distance)
+{
+  clusterPyramid* pyramid = layerinfo->pyramid;
+  clusterPyramidLevel* level = NULL;
+  clusterPyramidEntry entry;
+  int* itemindexes = layer->iteminfo;
+  int i, j, lo, hi, ix0, ix1, iy0, iy1;
+
+  /* pick the coarsest level not exceeding the cluster distance */
+  for (i = pyramid->numlevels - 1; i >= 0; i--) {
+    if (pyramid->levels[i].cellsize <= distance) {
+      level = &pyramid->levels[i];
+      break;
+    }
+  }
+
+  if (!level)
+    return MS_DONE;
+
+  if (!level->rows && level->numrows > 0) {
+    level->rows = (clusterPyramidRow*)msSmallMalloc(sizeof(clusterPyramidRow) * level->numrows);
+    if (fseek(pyramid->fp, level->rowoffset, SEEK_SET) != 0 ||
+        fread(level->rows, sizeof(clusterPyramidRow), level->numrows, pyramid->fp) != (size_t)level->numrows) {
+      msFree(level->rows);
+      level->rows = NULL;
+      msSetError(MS_IOERR, "Failed to read the cluster pyramid of layer %s.", "RebuildClusters()", layer->name);
+      return MS_FAILURE;
+    }
+  }
+
+  if (layer->debug >= MS_DEBUGLEVEL_VV)
+    msDebug("RebuildClusters(): using cluster pyramid level %d (cellsize=%g).\n", i, level->cellsize);
+
+  ix0 = (int)floor((searchrect.minx - pyramid->originx) / level->cellsize);
+  ix1 = (int)floor((searchrect.maxx - pyramid->originx) / level->cellsize);
+  iy0 = (int)floor((searchrect.miny - pyramid->originy) / level->cellsize);
+  iy1 = (int)floor((searchrect.maxy - pyramid->originy) / level->cellsize);
+
+  /* find the first row of the search rectangle */
+  lo = 0;
+  hi = level->numrows;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (level->rows[mid].iy < iy0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (i = lo; i < level->numrows && level->rows[i].iy <= iy1; i++) {
+    if (fseek(pyramid->fp, level->rows[i].offset, SEEK_SET) != 0) {
+      msSetError(MS_IOERR, "Failed to read the cluster pyramid of layer %s.", "RebuildClusters()", layer->name);
+      return MS_FAILURE;
+    }
+
+    for (j = 0; j < level->rows[i].numclusters; j++) {
+      clusterInfo* current;
+      lineObj line;
+      pointObj point;
+      int k;
+
+      if (clusterPyramidReadEntry(pyramid->fp, &entry) != MS_SUCCESS) {
+        clusterPyramidFreeEntry(&entry);
+        msSetError(MS_IOERR, "Failed to read the cluster pyramid of layer %s.", "RebuildClusters()", layer->name);
+        return MS_FAILURE;
+      }
+
+      if (entry.ix > ix1) {
+        clusterPyramidFreeEntry(&entry);
+        break;
+      }
+
+      /* only keep the clusters positioned inside the search rectangle */
+      if (entry.ix < ix0 || entry.x < searchrect.minx || entry.x > searchrect.maxx ||
+          entry.y < searchrect.miny || entry.y > searchrect.maxy) {
+        clusterPyramidFreeEntry(&entry);
+        continue;
+      }
+
+      if ((current = clusterInfoCreate(layerinfo)) == NULL) {
+        clusterPyramidFreeEntry(&entry);
+        return MS_FAILURE;
+      }
+
+      point.x = entry.x;
+      point.y = entry.y;
+      line.numpoints = 1;
+      line.point = &point;
+      msAddLine(&current->shape, &line);
+      current->shape.type = MS_SHAPE_POINT;
+      current->shape.bounds.minx = current->shape.bounds.maxx = entry.x;
+      current->shape.bounds.miny = current->shape.bounds.maxy = entry.y;
+      current->shape.index = entry.shapeindex;
+      current->shape.tileindex = entry.tileindex;
+      current->shape.values = entry.values;
+      current->shape.numvalues = entry.numvalues;
+      current->avgx = current->x = entry.x;
+      current->avgy = current->y = entry.y;
+      current->varx = current->vary = 0;
+      current->numsiblings = entry.count - 1;
+      current->group = entry.group;
+      current->filter = 1;
+
+      /* set up the cluster attributes */
+      for (k = 0; itemindexes && k < layer->numitems && k < current->shape.numvalues; k++) {
+        if (itemindexes[k] == MSCLUSTER_FEATURECOUNTINDEX) {
+          msFree(current->shape.values[k]);
+          current->shape.values[k] = msIntToString(entry.count);
+        } else if (itemindexes[k] == MSCLUSTER_GROUPINDEX) {
+          msFree(current->shape.values[k]);
+          current->shape.values[k] = msStrdup(current->group ? current->group : "");
+        }
+      }
+
+      current->next = layerinfo->finalized;
+      layerinfo->finalized = current;
+      ++layerinfo->numFinalized;
+    }
+  }
+
+  /* set the pointer to the first shape */
+  layerinfo->current = layerinfo->finalized;
+
+  return MS_SUCCESS;
+}
+
 /* rebuild the clusters according to the current extent */
 int RebuildClusters(layerObj *layer, int isQuery)
 {
@@ -950,6 +1679,13 @@ int RebuildClusters(layerObj *layer, int isQuery)
   searchrect.miny -= layer->cluster.buffer * cellSizeY;
   searchrect.maxy += layer->cluster.buffer * cellSizeY;
 
+  /* use the precomputed clusters if available */
+  status = clusterPyramidPrepare(layer, layerinfo);
+  if (status == MS_SUCCESS)
+    status = clusterPyramidLookup(layer, layerinfo, searchrect, 2 * MS_MAX(maxDistanceX, maxDistanceY));
+  if (status != MS_DONE)
+    return status;
+
   /* create the root node */
   if (layerinfo->root)
     clusterTreeNodeDestroy(layerinfo, layerinfo->root);
@@ -1152,6 +1888,7 @@ int msClusterLayerClose(layerObj *layer)
     return MS_SUCCESS;
 
   clusterDestroyData(layerinfo);
+  clusterPyramidClose(layerinfo->pyramid);
 
   msLayerClose(&layerinfo->srcLayer);
   freeLayer(&layerinfo->srcLayer);
@@ -1380,6 +2117,9 @@ msClusterLayerInfo* msClusterInitialize(layerObj *layer)
   layerinfo->finalizedNodes = NULL;
   layerinfo->numFinalizedNodes = 0;
 
+  layerinfo->pyramid = NULL;
+  layerinfo->pyramidChecked = MS_FALSE;
+
   return layerinfo;
 }
 
@@ -1461,6 +2201,8 @@ void msClusterLayerCopyVirtualTable(layerVTableObj* vtable)
   vtable->LayerIsOpen = msClusterLayerIsOpen;
   vtable->LayerWhichShapes = msClusterLayerWhichShapes;
   vtable->LayerNextShape = msClusterLayerNextShape;
+  /* not the batch reader of the source layer: the clusters are in memory */
+  vtable->LayerNextShapes = LayerDefaultNextShapes;
   vtable->LayerGetShape = msClusterLayerGetShape;
 
   vtable->LayerClose = msClusterLayerClose;
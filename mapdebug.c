@@ -98,6 +98,9 @@ debugInfoObj *msGetDebugInfoObj()
       new_link->debug_mode = MS_DEBUGMODE_OFF;
       new_link->errorfile = NULL;
       new_link->fp = NULL;
+      new_link->buffer = NULL;
+      new_link->buffer_len = 0;
+      new_link->buffer_size = 0;
     } else
       msSetError(MS_MEMERR, "Out of memory allocating %u bytes.\n", "msGetDebugInfoObj()", sizeof(debugInfoObj));
 
@@ -207,6 +210,10 @@ void msCloseErrorFile()
 
     debuginfo->fp = NULL;
 
+    msFree(debuginfo->buffer);
+    debuginfo->buffer = NULL;
+    debuginfo->buffer_len = debuginfo->buffer_size = 0;
+
     msFree(debuginfo->errorfile);
     debuginfo->errorfile = NULL;
 
@@ -318,6 +325,67 @@ void msDebugCleanup()
 
 }
 
+/* msDebugStartBuffer()
+**
+** Called by a worker thread to keep its debug output in memory, with the
+** global debug level of the thread that started it, until
+** msDebugEndBuffer(). That thread then writes it with msDebugWriteBuffer(),
+** so that the output of the workers is not lost nor interleaved.
+*/
+void msDebugStartBuffer(debugLevel level)
+{
+  debugInfoObj *debuginfo = msGetDebugInfoObj();
+
+  if (debuginfo == NULL)
+    return;
+
+  msCloseErrorFile();
+  debuginfo->global_debug_level = level;
+  debuginfo->debug_mode = MS_DEBUGMODE_BUFFER;
+}
+
+/* msDebugEndBuffer()
+**
+** Returns the output kept since msDebugStartBuffer() (NULL if there is
+** none, to be freed by the caller) and releases the debug object of the
+** calling thread.
+*/
+char *msDebugEndBuffer()
+{
+  char *buffer = NULL;
+  debugInfoObj *debuginfo = msGetDebugInfoObj();
+
+  if (debuginfo && debuginfo->debug_mode == MS_DEBUGMODE_BUFFER) {
+    buffer = debuginfo->buffer;
+    debuginfo->buffer = NULL;
+    debuginfo->buffer_len = debuginfo->buffer_size = 0;
+  }
+
+  msDebugCleanup();
+
+  return buffer;
+}
+
+/* msDebugWriteBuffer()
+**
+** Writes the output returned by msDebugEndBuffer() as it is to the
+** MS_ERRORFILE of the calling thread.
+*/
+void msDebugWriteBuffer(const char *buffer)
+{
+  debugInfoObj *debuginfo = msGetDebugInfoObj();
+
+  if (buffer == NULL || debuginfo == NULL)
+    return;
+
+  if (debuginfo->fp)
+    msIO_fprintf(debuginfo->fp, "%s", buffer);
+#ifdef _WIN32
+  else if (debuginfo->debug_mode == MS_DEBUGMODE_WINDOWSDEBUG)
+    OutputDebugStringA(buffer);
+#endif
+}
+
 /* msDebug()
 **
 ** Outputs/logs messages to the MS_ERRORFILE if one is set
@@ -367,6 +435,41 @@ void msDebug( const char * pszFormat, ... )
     OutputDebugStringA(szMessage);
   }
 #endif
+  else if (debuginfo->debug_mode == MS_DEBUGMODE_BUFFER) {
+    /* Keeping the output of a worker thread, see msDebugStartBuffer() */
+
+    char szMessage[MESSAGELENGTH];
+    struct mstimeval tv;
+    time_t t;
+    int nLength;
+
+    msGettimeofday(&tv, NULL);
+    t = tv.tv_sec;
+    /* ctime() is not reentrant and the other workers are logging too */
+    msAcquireLock( TLOCK_DEBUGOBJ );
+    nLength = snprintf(szMessage, MESSAGELENGTH, "[%s].%ld ",
+                       msStringChop(ctime(&t)), (long)tv.tv_usec);
+    msReleaseLock( TLOCK_DEBUGOBJ );
+
+    va_start(args, pszFormat);
+    vsnprintf( szMessage + nLength, MESSAGELENGTH - nLength, pszFormat, args );
+    va_end(args);
+
+    szMessage[MESSAGELENGTH-1] = '\0';
+    nLength = strlen(szMessage);
+
+    if (debuginfo->buffer_len + nLength + 1 > debuginfo->buffer_size) {
+      int nNewSize = MS_MAX(2 * debuginfo->buffer_size,
+                            debuginfo->buffer_len + nLength + 1);
+      char *pszNewBuffer = (char *) realloc(debuginfo->buffer, nNewSize);
+      if (pszNewBuffer == NULL)
+        return; /* we cannot report it from here */
+      debuginfo->buffer = pszNewBuffer;
+      debuginfo->buffer_size = nNewSize;
+    }
+    memcpy(debuginfo->buffer + debuginfo->buffer_len, szMessage, nLength + 1);
+    debuginfo->buffer_len += nLength;
+  }
 
 }
 
@@ -264,6 +264,542 @@ imageObj *msPrepareImage(mapObj *map, int allow_nonsquare)
 }
 
 
+/*
+** Strip rendering of large maps, enabled with CONFIG "MS_DRAW_STRIPS" set to
+** the number of threads. The image is cut in horizontal strips and each strip
+** is drawn by one of the threads from its own copy of the map, with enough rows
+** of overlap for the symbols straddling a strip edge to be complete, then the
+** strips are stitched into the map image. Only the features are drawn in the
+** strips: the strips keep a copy of the features to label, and these are
+** labelled afterwards over the whole map, so the label cache stays global and
+** no label is cut or repeated at the edge of a strip. The errors and debug
+** output of the threads are handed over to the calling thread.
+*/
+#if defined(USE_THREAD) && !defined(_WIN32)
+
+#include <pthread.h>
+
+#define MS_DRAW_STRIP_MIN_HEIGHT 128
+
+typedef struct {
+  mapObj *map; /* copy of the map covering the strip and its overlap */
+  imageObj *image;
+  int y; /* first row of the strip in the map image */
+  int height; /* number of rows of the strip, overlap excluded */
+  int overlap; /* number of rows drawn above the strip */
+  int status;
+  errorObj *errors; /* errors raised while drawing the strip */
+  char *debug; /* debug output of the strip */
+  featureListNodeObjPtr *labels; /* per layer, the features to label */
+} drawStripObj;
+
+typedef struct {
+  drawStripObj *strips;
+  int numstrips;
+  int next; /* next strip to pick up */
+  int threaded; /* MS_FALSE if the work is done in the calling thread */
+  int debuglevel; /* global debug level of the calling thread, -1 if it doesn't log */
+  pthread_mutex_t mutex;
+} drawStripPoolObj;
+
+static void *msDrawStripWorker(void *arg)
+{
+  drawStripPoolObj *pool = (drawStripPoolObj *) arg;
+  drawStripObj *strip;
+  layerObj *lp;
+  int i, l;
+
+  while(1) {
+    pthread_mutex_lock(&pool->mutex);
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->mutex);
+    if(i >= pool->numstrips) break;
+
+    strip = &(pool->strips[i]);
+    if(pool->threaded && pool->debuglevel >= 0)
+      msDebugStartBuffer((debugLevel) pool->debuglevel);
+
+    strip->image = msPrepareImage(strip->map, MS_FALSE);
+    strip->status = (strip->image) ? MS_SUCCESS : MS_FAILURE;
+
+    for(l=0; strip->status == MS_SUCCESS && l<strip->map->numlayers; l++) {
+      if(strip->map->layerorder[l] == -1) continue;
+      lp = GET_LAYER(strip->map, strip->map->layerorder[l]);
+      if(lp->postlabelcache) continue;
+
+      if(msDrawLayer(strip->map, lp, strip->image) != MS_SUCCESS) {
+        msSetError(MS_IMGERR, "Failed to draw layer named '%s'.", "msDrawMap()", lp->name);
+        strip->status = MS_FAILURE;
+      }
+    }
+
+    if(pool->threaded) { /* also releases the error and debug objects of this thread */
+      strip->errors = msDetachErrorList();
+      strip->debug = msDebugEndBuffer();
+    }
+  }
+
+  return NULL;
+}
+
+/*
+** Returns MS_TRUE if the layer can put anything in the label cache.
+*/
+static int msDrawStripLayerHasLabels(layerObj *lp)
+{
+  int c;
+
+  if(lp->type == MS_LAYER_ANNOTATION)
+    return MS_TRUE;
+  if(lp->type != MS_LAYER_POINT && lp->type != MS_LAYER_LINE && lp->type != MS_LAYER_POLYGON)
+    return MS_FALSE;
+  for(c=0; c<lp->numclasses; c++) {
+    if(lp->class[c]->numlabels > 0)
+      return MS_TRUE;
+  }
+  return MS_FALSE;
+}
+
+/*
+** Number of rows a symbol of the layer can spread over, i.e. the overlap
+** needed between two strips for the layer to be drawn without seams. The
+** same sizes are used as for the clipping buffer in msDrawShape().
+*/
+static int msDrawStripLayerOverlap(mapObj *map, layerObj *lp)
+{
+  styleObj *style;
+  double size, maxsize = 0;
+  int c, s;
+
+  for(c=0; c<lp->numclasses; c++) {
+    for(s=0; s<lp->class[c]->numstyles; s++) {
+      style = lp->class[c]->styles[s];
+      size = MS_MAX(style->size, style->width);
+      if(style->numbindings > 0) /* attribute bound sizes are limited by maxsize */
+        size = MS_MAX(size, MS_MAX(style->maxsize, style->maxwidth));
+      if(size <= 0 && MS_IS_VALID_ARRAY_INDEX(style->symbol, map->symbolset.numsymbols))
+        size = msSymbolGetDefaultSize(map->symbolset.symbol[style->symbol]);
+      size += 2 * style->outlinewidth + MS_MAX(fabs(style->offsetx), fabs(style->offsety)) + fabs(style->polaroffsetpixel);
+      maxsize = MS_MAX(maxsize, size * lp->scalefactor);
+    }
+  }
+
+  return (int) ceil(maxsize) + 2;
+}
+
+typedef struct {
+  shapeObj *shape;
+  int order; /* strip, then read order within the strip */
+} drawStripLabelObj;
+
+/*
+** Orders the features kept by the strips as they were read (by tile and shape
+** index), a feature crossing several strips coming once for each of them.
+*/
+static int msDrawStripLabelCompare(const void *a, const void *b)
+{
+  const drawStripLabelObj *la = (const drawStripLabelObj *) a;
+  const drawStripLabelObj *lb = (const drawStripLabelObj *) b;
+
+  if(la->shape->tileindex != lb->shape->tileindex)
+    return (la->shape->tileindex < lb->shape->tileindex) ? -1 : 1;
+  if(la->shape->index != lb->shape->index)
+    return (la->shape->index < lb->shape->index) ? -1 : 1;
+  return la->order - lb->order;
+}
+
+/*
+** Adds the labels of the features of a layer kept by the strips to the label
+** cache, in the order a serial draw would. The layer is opened for its items
+** only, the features are not read again. Returns MS_DONE if the features can't
+** be told apart (no shape index), the caller then reads the layer again.
+*/
+static int msDrawStripLabels(mapObj *map, layerObj *lp, imageObj *image, drawStripObj *strips, int numstrips)
+{
+  drawStripLabelObj *labels;
+  featureListNodeObjPtr node;
+  int numlabels = 0, drawmode, status, i;
+
+  for(i=0; i<numstrips; i++) {
+    for(node=strips[i].labels[lp->index]; node; node=node->next) {
+      if(node->shape.index < 0)
+        return MS_DONE;
+      numlabels++;
+    }
+  }
+  if(numlabels == 0)
+    return MS_SUCCESS;
+
+  labels = (drawStripLabelObj *) msSmallMalloc(sizeof(drawStripLabelObj) * numlabels);
+  numlabels = 0;
+  for(i=0; i<numstrips; i++) {
+    for(node=strips[i].labels[lp->index]; node; node=node->next) {
+      labels[numlabels].shape = &(node->shape);
+      labels[numlabels].order = numlabels;
+      numlabels++;
+    }
+  }
+  qsort(labels, numlabels, sizeof(drawStripLabelObj), msDrawStripLabelCompare);
+
+  status = msLayerOpen(lp);
+  if(status == MS_SUCCESS) {
+    status = msLayerWhichItems(lp, MS_FALSE, NULL);
+
+    drawmode = MS_DRAWMODE_LABELS;
+    if(msLayerGetProcessingKey(lp, "LABEL_NO_CLIP"))
+      drawmode |= MS_DRAWMODE_UNCLIPPEDLABELS;
+    if(lp->type == MS_LAYER_LINE && msLayerGetProcessingKey(lp, "POLYLINE_NO_CLIP"))
+      drawmode |= MS_DRAWMODE_UNCLIPPEDLINES;
+
+    lp->project = MS_FALSE; /* the strips kept the features in map coordinates */
+    for(i=0; status == MS_SUCCESS && i<numlabels; i++) {
+      if(i > 0 && labels[i].shape->tileindex == labels[i-1].shape->tileindex && labels[i].shape->index == labels[i-1].shape->index)
+        continue; /* same feature, kept by an earlier strip too */
+      msShapeGetAnnotation(lp, labels[i].shape);
+      status = msDrawShape(map, lp, labels[i].shape, image, -1, drawmode);
+    }
+    lp->project = MS_TRUE;
+
+    msLayerClose(lp);
+  }
+
+  free(labels);
+
+  return status;
+}
+
+/*
+** Draws the layers that come before the label cache in strips, and adds their
+** labels to the label cache. Returns MS_DONE when the map can't be drawn that
+** way and the caller has to draw the layers itself: the output has no pixel
+** buffer, the map is small, rotated or with non square pixels, or a layer is a
+** remote one, is limited to a number of features, is drawn as a chart, is
+** clustered or not in map coordinates, or draws its labels without the label
+** cache, or the map has a draw budget.
+*/
+static int msDrawMapStrips(mapObj *map, imageObj *image)
+{
+  drawStripPoolObj pool;
+  drawStripObj *strip;
+  pthread_t *threads;
+  rendererVTableObj *renderer;
+  rasterBufferObj rb, dst;
+  outputFormatObj *format;
+  const char *value;
+  layerObj *lp;
+  int numthreads, overlap, top, bottom, i, l, row, status = MS_SUCCESS;
+
+  value = msGetConfigOption(map, "MS_DRAW_STRIPS");
+  if(value == NULL || (numthreads = atoi(value)) < 2)
+    return MS_DONE;
+
+  /* the strips would each count against the draw budget on their own */
+  if(map->drawbudget.enabled)
+    return MS_DONE;
+
+  pool.numstrips = MS_MIN(numthreads, map->height / MS_DRAW_STRIP_MIN_HEIGHT);
+  if(pool.numstrips < 2)
+    return MS_DONE;
+
+  if(!MS_RENDERER_PLUGIN(image->format) || !MS_IMAGE_RENDERER(image)->supports_pixel_buffer)
+    return MS_DONE;
+  if(image->format->imagemode != MS_IMAGEMODE_RGB && image->format->imagemode != MS_IMAGEMODE_RGBA)
+    return MS_DONE;
+  if(map->gt.need_geotransform || msTestConfigOption(map, "MS_NONSQUARE", MS_FALSE))
+    return MS_DONE;
+
+  overlap = 2;
+  for(l=0; l<map->numlayers; l++) {
+    if(map->layerorder[l] == -1) continue;
+    lp = GET_LAYER(map, map->layerorder[l]);
+    if(lp->postlabelcache || !msLayerIsVisible(map, lp)) continue;
+
+    if(lp->connectiontype == MS_WMS || lp->connectiontype == MS_WFS || lp->type == MS_LAYER_CHART)
+      return MS_DONE;
+    if(lp->cluster.region || lp->transform != MS_TRUE) /* drawn differently in each strip */
+      return MS_DONE;
+    if(msLayerGetMaxFeaturesToDraw(lp, image->format) >= 0)
+      return MS_DONE;
+    if(!lp->labelcache && msDrawStripLayerHasLabels(lp))
+      return MS_DONE;
+    overlap = MS_MAX(overlap, msDrawStripLayerOverlap(map, lp));
+  }
+
+  if(map->debug >= MS_DEBUGLEVEL_DEBUG)
+    msDebug("msDrawMap(): drawing the map in %d strips, %d rows of overlap.\n", pool.numstrips, overlap);
+
+  /* the copies are made here, the threads only read their own */
+  pool.strips = (drawStripObj *) msSmallCalloc(pool.numstrips, sizeof(drawStripObj));
+  pool.next = 0;
+  pool.threaded = MS_TRUE;
+  pool.debuglevel = msGetErrorFile() ? (int) msGetGlobalDebugLevel() : -1;
+  for(i=0; i<pool.numstrips; i++) {
+    strip = &(pool.strips[i]);
+    strip->y = i * map->height / pool.numstrips;
+    strip->height = (i+1) * map->height / pool.numstrips - strip->y;
+    top = MS_MIN(overlap, strip->y);
+    bottom = MS_MIN(overlap, map->height - strip->y - strip->height);
+    strip->overlap = top;
+
+    strip->map = msNewMapObj();
+    if(!strip->map || msCopyMap(strip->map, map) != MS_SUCCESS) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    /* the format of the image may differ from the map ones (e.g. TRANSPARENT) */
+    format = msCloneOutputFormat(image->format);
+    msApplyOutputFormat(&(strip->map->outputformat), format, MS_NOOVERRIDE, MS_NOOVERRIDE, MS_NOOVERRIDE);
+
+    strip->map->height = top + strip->height + bottom;
+    strip->map->extent.maxy = map->extent.maxy - (strip->y - top) * map->cellsize;
+    strip->map->extent.miny = strip->map->extent.maxy - (strip->map->height - 1) * map->cellsize;
+    strip->map->drawmode = MS_DRAWMODE_FEATURES;
+    strip->labels = (featureListNodeObjPtr *) msSmallCalloc(map->numlayers, sizeof(featureListNodeObjPtr));
+    strip->map->striplabels = strip->labels;
+  }
+
+  if(status == MS_SUCCESS) {
+    threads = (pthread_t *) msSmallMalloc(sizeof(pthread_t) * pool.numstrips);
+    pthread_mutex_init(&pool.mutex, NULL);
+
+    for(i=0; i<pool.numstrips; i++) {
+      if(pthread_create(&threads[i], NULL, msDrawStripWorker, &pool) != 0)
+        break;
+    }
+    if(i == 0) { /* no thread at all, do the work here */
+      pool.threaded = MS_FALSE;
+      msDrawStripWorker(&pool);
+    }
+    numthreads = i;
+    for(i=0; i<numthreads; i++)
+      pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&pool.mutex);
+    free(threads);
+
+    /* debug output of all the strips, errors of the first failed one */
+    for(i=0; i<pool.numstrips; i++) {
+      strip = &(pool.strips[i]);
+      msDebugWriteBuffer(strip->debug);
+      if(status == MS_SUCCESS && strip->status != MS_SUCCESS) {
+        msAttachErrorList(strip->errors);
+        strip->errors = NULL;
+        status = MS_FAILURE;
+      }
+    }
+  }
+
+  if(status == MS_SUCCESS) {
+    /* stitch the strips, leaving out their overlap */
+    renderer = MS_IMAGE_RENDERER(image);
+    for(i=0; i<pool.numstrips; i++) {
+      strip = &(pool.strips[i]);
+      memset(&rb, 0, sizeof(rasterBufferObj));
+      memset(&dst, 0, sizeof(rasterBufferObj));
+      if(MS_IMAGE_RENDERER(strip->image)->getRasterBufferHandle(strip->image, &rb) != MS_SUCCESS) {
+        status = MS_FAILURE;
+        break;
+      }
+      if(rb.type == MS_BUFFER_BYTE_RGBA && renderer->getRasterBufferHandle(image, &dst) == MS_SUCCESS &&
+          dst.type == MS_BUFFER_BYTE_RGBA && dst.data.rgba.pixel_step == rb.data.rgba.pixel_step) {
+        /* nothing is drawn yet on these rows, copy them rather than blending them */
+        for(row=0; row<strip->height; row++)
+          memcpy(dst.data.rgba.pixels + (strip->y + row) * dst.data.rgba.row_step,
+                 rb.data.rgba.pixels + (strip->overlap + row) * rb.data.rgba.row_step,
+                 rb.width * rb.data.rgba.pixel_step);
+      } else if(renderer->mergeRasterBuffer(image, &rb, 1.0, 0, strip->overlap, 0, strip->y, rb.width, strip->height) != MS_SUCCESS) {
+        status = MS_FAILURE;
+        break;
+      }
+    }
+  }
+
+  for(i=0; i<pool.numstrips; i++) {
+    strip = &(pool.strips[i]);
+    if(strip->image) msFreeImage(strip->image);
+    strip->image = NULL;
+    if(strip->map) msFreeMap(strip->map);
+    strip->map = NULL;
+  }
+
+  /* the labels, over the whole map */
+  for(l=0; status == MS_SUCCESS && l<map->numlayers; l++) {
+    if(map->layerorder[l] == -1) continue;
+    lp = GET_LAYER(map, map->layerorder[l]);
+    if(lp->postlabelcache || lp->opacity == 0 || !msDrawStripLayerHasLabels(lp) || !msLayerIsVisible(map, lp)) continue;
+
+    status = (lp->styleitem) ? MS_DONE : msDrawStripLabels(map, lp, image, pool.strips, pool.numstrips);
+    if(status == MS_DONE) { /* the strips didn't keep the features, read them again */
+      map->drawmode = MS_DRAWMODE_LABELS;
+      lp->project = MS_TRUE;
+      status = msDrawVectorLayer(map, lp, image);
+      map->drawmode = MS_DRAWMODE_FEATURES|MS_DRAWMODE_LABELS;
+    }
+    if(status != MS_SUCCESS)
+      msSetError(MS_IMGERR, "Failed to draw layer named '%s'.", "msDrawMap()", lp->name);
+  }
+
+  for(i=0; i<pool.numstrips; i++) {
+    strip = &(pool.strips[i]);
+    msFree(strip->debug);
+    while(strip->errors) {
+      errorObj *next = strip->errors->next;
+      free(strip->errors);
+      strip->errors = next;
+    }
+    for(l=0; strip->labels && l<map->numlayers; l++)
+      freeFeatureList(strip->labels[l]);
+    msFree(strip->labels);
+  }
+  free(pool.strips);
+
+  return (status == MS_SUCCESS) ? MS_SUCCESS : MS_FAILURE;
+}
+#endif /* USE_THREAD && !_WIN32 */
+
+/*
+** Sets up the draw budget of the map from the MS_DRAW_MAX_FEATURES,
+** MS_DRAW_MAX_VERTICES and MS_DRAW_MAX_TIME (in milliseconds) config options.
+** With MS_DRAW_BUDGET_ACTION set to ERROR, msDrawMap() fails once the budget
+** is used up, by default the map is degraded instead.
+*/
+static void msDrawBudgetInit(mapObj *map)
+{
+  drawBudgetObj *budget = &(map->drawbudget);
+  struct mstimeval now;
+  const char *value;
+
+  memset(budget, 0, sizeof(drawBudgetObj));
+
+  if((value = msGetConfigOption(map, "MS_DRAW_MAX_FEATURES")) != NULL)
+    budget->maxfeatures = MS_MAX(0, atoi(value));
+  if((value = msGetConfigOption(map, "MS_DRAW_MAX_VERTICES")) != NULL)
+    budget->maxvertices = MS_MAX(0, atoi(value));
+  if((value = msGetConfigOption(map, "MS_DRAW_MAX_TIME")) != NULL)
+    budget->maxtime = MS_MAX(0, atoi(value));
+
+  budget->enabled = (budget->maxfeatures > 0 || budget->maxvertices > 0 || budget->maxtime > 0);
+  if(!budget->enabled)
+    return;
+
+  value = msGetConfigOption(map, "MS_DRAW_BUDGET_ACTION");
+  budget->abort = (value && strcasecmp(value, "ERROR") == 0);
+
+  msGettimeofday(&now, NULL);
+  budget->starttime = now.tv_sec+now.tv_usec/1.0e6;
+}
+
+/*
+** Updates the degradation level of the map from the work done so far: the
+** map is simplified once any of its limits is reached, and nothing more is
+** drawn at twice a limit. Returns MS_FAILURE, with an error set, if the limit
+** is reached on a map that must not be degraded.
+*/
+static int msDrawBudgetCheck(mapObj *map, layerObj *layer)
+{
+  drawBudgetObj *budget = &(map->drawbudget);
+  double usage = 0;
+  int level;
+
+  if(budget->maxfeatures > 0)
+    usage = MS_MAX(usage, (double) budget->numfeatures / budget->maxfeatures);
+  if(budget->maxvertices > 0)
+    usage = MS_MAX(usage, (double) budget->numvertices / budget->maxvertices);
+  if(budget->maxtime > 0) {
+    struct mstimeval now;
+    msGettimeofday(&now, NULL);
+    usage = MS_MAX(usage, (now.tv_sec+now.tv_usec/1.0e6 - budget->starttime) * 1000.0 / budget->maxtime);
+  }
+
+  if(usage >= 2)
+    level = MS_DRAWBUDGET_STOP;
+  else if(usage >= 1)
+    level = MS_DRAWBUDGET_SIMPLIFY;
+  else
+    level = MS_DRAWBUDGET_NONE;
+
+  if(level > budget->level) {
+    if(budget->abort) {
+      msSetError(MS_MISCERR, "Draw budget exceeded in layer '%s' after %d features and %d vertices.", "msDrawBudgetCheck()",
+                 layer->name?layer->name:"(null)", budget->numfeatures, budget->numvertices);
+      return MS_FAILURE;
+    }
+    if(map->debug || layer->debug)
+      msDebug("msDrawBudgetCheck(): draw budget exceeded in layer %s after %d features and %d vertices, %s.\n",
+              layer->name?layer->name:"(null)", budget->numfeatures, budget->numvertices,
+              (level == MS_DRAWBUDGET_STOP) ? "skipping the remaining features" : "simplifying the remaining features");
+    budget->level = level;
+  }
+
+  return MS_SUCCESS;
+}
+
+/*
+** Drops, in place, the vertices of a shape closer than tolerance to the last
+** vertex kept. The first and last vertex of each part are always kept.
+*/
+static void msDrawBudgetSimplifyShape(shapeObj *shape, double tolerance)
+{
+  int i, j, n;
+  double dx, dy, sqtolerance = tolerance*tolerance;
+  lineObj *line;
+
+  for(i=0; i<shape->numlines; i++) {
+    line = &(shape->line[i]);
+    if(line->numpoints <= 4)
+      continue;
+    for(j=1, n=1; j<line->numpoints-1; j++) {
+      dx = line->point[j].x - line->point[n-1].x;
+      dy = line->point[j].y - line->point[n-1].y;
+      if(dx*dx + dy*dy >= sqtolerance)
+        line->point[n++] = line->point[j];
+    }
+    line->point[n++] = line->point[line->numpoints-1];
+    line->numpoints = n;
+  }
+}
+
+/*
+** Pre-flight check for msDrawMap(): returns MS_TRUE if, judging from the
+** stored extents of their data, none of the visible layers can draw anything
+** in the map extent. Layers of unknown extent are assumed to contribute.
+*/
+static int msMapIsBlank(mapObj *map)
+{
+  int i;
+  layerObj *lp;
+  rectObj searchrect, extent;
+
+  if(map->scalebar.status == MS_EMBED || map->legend.status == MS_EMBED)
+    return MS_FALSE;
+
+  for(i=0; i<map->numlayers; i++) {
+    if(map->layerorder[i] == -1)
+      continue;
+    lp = GET_LAYER(map, map->layerorder[i]);
+    if(!msLayerIsVisible(map, lp))
+      continue;
+
+    if(lp->transform != MS_TRUE || msLayerGetStoredExtent(map, lp, &extent) != MS_SUCCESS)
+      return MS_FALSE;
+
+    /* same search rectangle as msDrawVectorLayer() */
+    searchrect = map->extent;
+#ifdef USE_PROJ
+    if((map->projection.numargs > 0) && (lp->projection.numargs > 0) &&
+        msProjectRect(&map->projection, &lp->projection, &searchrect) != MS_SUCCESS)
+      return MS_FALSE;
+#endif
+    if(msRectOverlap(&searchrect, &extent))
+      return MS_FALSE;
+  }
+
+  return MS_TRUE;
+}
+
+static imageObj *msDrawMapLow(mapObj *map, int querymap);
+
 /*
  * Generic function to render the map file.
  * The type of the image created is based on the imagetype parameter in the map file.
@@ -272,6 +808,18 @@ imageObj *msPrepareImage(mapObj *map, int allow_nonsquare)
  * int querymap - is this map the result of a query operation, MS_TRUE|MS_FALSE
 */
 imageObj *msDrawMap(mapObj *map, int querymap)
+{
+  imageObj *image = msDrawMapLow(map, querymap);
+
+  /* the budget only applies while the map is drawn, layers drawn on their */
+  /* own afterwards (MapScript, WCS masks, SLD) are never skipped. The     */
+  /* counters are kept for the caller to look at. */
+  map->drawbudget.enabled = MS_FALSE;
+
+  return image;
+}
+
+static imageObj *msDrawMapLow(mapObj *map, int querymap)
 {
   int i;
   layerObj *lp=NULL;
@@ -279,10 +827,12 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   imageObj *image = NULL;
   struct mstimeval mapstarttime, mapendtime;
   struct mstimeval starttime, endtime;
+  int stripsdrawn = MS_FALSE;
 
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
   enum MS_CONNECTION_TYPE lastconnectiontype;
   httpRequestObj *pasOWSReqInfo=NULL;
+  httpRequestBatchObj *psOWSBatch=NULL;
   int numOWSLayers=0, numOWSRequests=0;
   wmsParamsObj sLastWMSParams;
 #endif
@@ -295,6 +845,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   }
 
   msApplyMapConfigOptions(map);
+  msDrawBudgetInit(map);
   image = msPrepareImage(map, MS_TRUE);
 
   if(!image) {
@@ -307,6 +858,23 @@ imageObj *msDrawMap(mapObj *map, int querymap)
              map->outputformat->name,
              map->outputformat->driver );
 
+  /* Nothing to draw: skip opening the layers, msSaveImage() can then */
+  /* write the background from its cache of encoded blank images. */
+  if(!querymap && msMapIsBlank(map)) {
+    if( map->debug >= MS_DEBUGLEVEL_DEBUG )
+      msDebug( "msDrawMap(): no layer data intersects the map extent, returning the background image.\n" );
+    if(map->gt.need_geotransform)
+      msMapRestoreRealExtent(map);
+    image->blank = MS_TRUE;
+    if(map->debug >= MS_DEBUGLEVEL_TUNING) {
+      msGettimeofday(&mapendtime, NULL);
+      msDebug("msDrawMap() total time: %.3fs\n",
+              (mapendtime.tv_sec+mapendtime.tv_usec/1.0e6)-
+              (mapstarttime.tv_sec+mapstarttime.tv_usec/1.0e6) );
+    }
+    return(image);
+  }
+
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
 
   /* Time the OWS query phase */
@@ -336,7 +904,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     msHTTPInitRequestObj(pasOWSReqInfo, numOWSLayers+1);
     msInitWmsParamsObj(&sLastWMSParams);
 
-    /* Pre-download all WMS/WFS layers in parallel before starting to draw map */
+    /* Pre-download all WMS/WFS layers in parallel while drawing the map */
     lastconnectiontype = MS_SHAPEFILE;
     for(i=0; numOWSLayers && i<map->numlayers; i++) {
       if(map->layerorder[i] == -1 || !msLayerIsVisible(map, GET_LAYER(map,map->layerorder[i])))
@@ -374,23 +942,49 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 #endif
   } /* if numOWSLayers > 0 */
 
-  if(numOWSRequests && msOWSExecuteRequests(pasOWSReqInfo, numOWSRequests, map, MS_TRUE) == MS_FAILURE) {
-    msFreeImage(image);
-    msFree(pasOWSReqInfo);
-    return NULL;
+  /* The requests are only started here, they complete in the background */
+  /* while the local layers are drawn. Each WMS/WFS layer then waits for */
+  /* its own request(s) when its turn comes. */
+  if(numOWSRequests) {
+    psOWSBatch = msOWSStartRequests(pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
+    if(psOWSBatch == NULL) {
+      msFreeImage(image);
+      msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
+      msFree(pasOWSReqInfo);
+      return NULL;
+    }
   }
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&endtime, NULL);
-    msDebug("msDrawMap(): WMS/WFS set-up and query, %.3fs\n",
+    msDebug("msDrawMap(): WMS/WFS set-up, %.3fs\n",
             (endtime.tv_sec+endtime.tv_usec/1.0e6)-
             (starttime.tv_sec+starttime.tv_usec/1.0e6) );
   }
 
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
 
+#if defined(USE_THREAD) && !defined(_WIN32)
+  /* Large maps may be drawn in strips by several threads */
+  if(!querymap) {
+    status = msDrawMapStrips(map, image);
+    if(status == MS_FAILURE) {
+      msFreeImage(image);
+#if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
+      if (pasOWSReqInfo) {
+        msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
+        msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
+        msFree(pasOWSReqInfo);
+      }
+#endif /* USE_WMS_LYR || USE_WFS_LYR */
+      return(NULL);
+    }
+    stripsdrawn = (status == MS_SUCCESS);
+  }
+#endif
+
   /* OK, now we can start drawing */
-  for(i=0; i<map->numlayers; i++) {
+  for(i=0; !stripsdrawn && i<map->numlayers; i++) {
 
     if(map->layerorder[i] != -1) {
       lp = (GET_LAYER(map,  map->layerorder[i]));
@@ -402,6 +996,19 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
       if(!msLayerIsVisible(map, lp)) continue;
 
+#if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
+      /* Make sure the remote data of this layer has arrived, or just give */
+      /* the pending WMS/WFS transfers a chance to progress. */
+      if(psOWSBatch &&
+          msOWSWaitRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, map->layerorder[i]) == MS_FAILURE) {
+        msFreeImage(image);
+        msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
+        msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
+        msFree(pasOWSReqInfo);
+        return(NULL);
+      }
+#endif
+
       if(lp->connectiontype == MS_WMS) {
 #ifdef USE_WMS_LYR
         if(MS_RENDERER_PLUGIN(image->format) || MS_RENDERER_RAWDATA(image->format))
@@ -419,6 +1026,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
                      "and make sure that the layer's connection URL is valid.",
                      "msDrawMap()", lp->name);
           msFreeImage(image);
+          msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
           msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
           msFree(pasOWSReqInfo);
           return(NULL);
@@ -440,6 +1048,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           msFreeImage(image);
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
           if (pasOWSReqInfo) {
+            msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
             msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
             msFree(pasOWSReqInfo);
           }
@@ -489,6 +1098,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     msFreeImage(image);
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
     if (pasOWSReqInfo) {
+      msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
       msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
       msFree(pasOWSReqInfo);
     }
@@ -512,6 +1122,19 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
     if(map->debug >= MS_DEBUGLEVEL_TUNING || lp->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&starttime, NULL);
 
+#if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
+    /* Make sure the remote data of this layer has arrived, or just give */
+    /* the pending WMS/WFS transfers a chance to progress. */
+    if(psOWSBatch &&
+        msOWSWaitRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, map->layerorder[i]) == MS_FAILURE) {
+      msFreeImage(image);
+      msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
+      msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
+      msFree(pasOWSReqInfo);
+      return(NULL);
+    }
+#endif
+
     if(lp->connectiontype == MS_WMS) {
 #ifdef USE_WMS_LYR
       if(MS_RENDERER_PLUGIN(image->format) || MS_RENDERER_RAWDATA(image->format))
@@ -531,6 +1154,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
       msFreeImage(image);
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
       if (pasOWSReqInfo) {
+        msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
         msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
         msFree(pasOWSReqInfo);
       }
@@ -577,12 +1201,16 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
   /* Cleanup WMS/WFS Request stuff */
   if (pasOWSReqInfo) {
+    msOWSEndRequests(psOWSBatch, pasOWSReqInfo, numOWSRequests, map, MS_TRUE);
     msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
     msFree(pasOWSReqInfo);
   }
 #endif
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) {
+    if(map->drawbudget.enabled)
+      msDebug("msDrawMap(): draw budget used: %d features, %d vertices, degradation level %d\n",
+              map->drawbudget.numfeatures, map->drawbudget.numvertices, map->drawbudget.level);
     msGettimeofday(&mapendtime, NULL);
     msDebug("msDrawMap() total time: %.3fs\n",
             (mapendtime.tv_sec+mapendtime.tv_usec/1.0e6)-
@@ -688,6 +1316,12 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
 
   if(layer->opacity == 0) return MS_SUCCESS; /* layer is completely transparent, skip it */
 
+  if(map->drawbudget.enabled && map->drawbudget.level >= MS_DRAWBUDGET_STOP) {
+    if(map->debug >= MS_DEBUGLEVEL_V || layer->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msDrawLayer(): skipping layer %s, the draw budget is exhausted.\n", layer->name?layer->name:"(null)");
+    return MS_SUCCESS;
+  }
+
   /* conditions may have changed since this layer last drawn, so set
      layer->project true to recheck projection needs (Bug #673) */
   layer->project = MS_TRUE;
@@ -901,10 +1535,328 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
   return(retcode);
 }
 
+/*
+** Returns MS_TRUE if the shape has to be drawn, i.e. if it passes the
+** LAYER::MINFEATURESIZE test and gets a class that is not turned off. The
+** class index is stored in the shape.
+*/
+static int msDrawShapeFilter(mapObj *map, layerObj *layer, shapeObj *shape, int *classgroup, int nclasses, double minfeaturesize)
+{
+  /* Check if the shape size is ok to be drawn */
+  if((shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) && (msShapeCheckSize(shape, minfeaturesize) == MS_FALSE)) {
+    if(layer->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msDrawVectorLayer(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape->index);
+    return MS_FALSE;
+  }
+
+  shape->classindex = msShapeGetClass(layer, map, shape, classgroup, nclasses);
+  if((shape->classindex == -1) || (layer->class[shape->classindex]->status == MS_OFF))
+    return MS_FALSE;
+
+  return MS_TRUE;
+}
+
+/*
+** Feature pipeline for msDrawVectorLayer(), enabled with PROCESSING
+** "DRAW_PIPELINE=ON". A reader thread fetches the shapes from the data
+** source while a second thread filters, classifies and reprojects them, so
+** that I/O and decoding overlap with rendering. Shapes are passed through
+** two bounded queues (size set with PROCESSING "DRAW_PIPELINE_SIZE") and
+** reach the rendering thread in read order, so the output is identical to
+** the serial loop.
+**
+** The debug output and errors of the worker threads are handed over to the
+** rendering thread when the pipeline ends, the reader's before the
+** classifier's.
+*/
+#if defined(USE_THREAD) && !defined(_WIN32)
+#define MS_DRAW_PIPELINE
+#include <pthread.h>
+
+#define MS_DRAW_PIPELINE_SIZE 64
+
+typedef struct {
+  shapeObj *shapes;
+  int size;
+  int head;
+  int count;
+  int closed; /* producer is finished, status is its final return code */
+  int status;
+} drawShapeQueueObj;
+
+typedef struct {
+  mapObj *map;
+  layerObj *layer;
+  int *classgroup;
+  int nclasses;
+  double minfeaturesize;
+  int project;
+  int layerproject; /* value of layer->project to restore */
+
+  drawShapeQueueObj readqueue; /* reader -> classifier */
+  drawShapeQueueObj drawqueue; /* classifier -> rendering thread */
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t reader;
+  pthread_t classifier;
+  int cancel;
+  int debuglevel; /* global debug level of the rendering thread, -1 if it doesn't log */
+  errorObj *readerrors, *classifyerrors; /* errors raised by the worker threads */
+  char *readdebug, *classifydebug; /* debug output of the worker threads */
+} drawPipelineObj;
+
+static int msDrawPipelinePush(drawPipelineObj *pipeline, drawShapeQueueObj *queue, shapeObj *shape)
+{
+  pthread_mutex_lock(&pipeline->mutex);
+  while(queue->count == queue->size && !pipeline->cancel)
+    pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+  if(pipeline->cancel) {
+    pthread_mutex_unlock(&pipeline->mutex);
+    return MS_FALSE;
+  }
+
+  /* the queue takes over the shape */
+  queue->shapes[(queue->head + queue->count) % queue->size] = *shape;
+  queue->count++;
+  pthread_cond_broadcast(&pipeline->cond);
+  pthread_mutex_unlock(&pipeline->mutex);
+
+  msInitShape(shape);
+  return MS_TRUE;
+}
+
+static int msDrawPipelinePop(drawPipelineObj *pipeline, drawShapeQueueObj *queue, shapeObj *shape)
+{
+  int status;
+
+  pthread_mutex_lock(&pipeline->mutex);
+  while(queue->count == 0 && !queue->closed && !pipeline->cancel)
+    pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+  if(pipeline->cancel) {
+    status = MS_DONE;
+  } else if(queue->count > 0) {
+    *shape = queue->shapes[queue->head];
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+    pthread_cond_broadcast(&pipeline->cond);
+    status = MS_SUCCESS;
+  } else {
+    status = queue->status;
+  }
+  pthread_mutex_unlock(&pipeline->mutex);
+
+  return status;
+}
+
+/*
+** Called by a worker thread when it is done: keeps its errors and debug
+** output for the rendering thread (this also releases the per thread error
+** and debug objects) and closes its output queue.
+*/
+static void msDrawPipelineFinish(drawPipelineObj *pipeline, drawShapeQueueObj *queue, int status,
+                                 errorObj **errors, char **debug)
+{
+  *errors = msDetachErrorList();
+  *debug = msDebugEndBuffer();
+
+  pthread_mutex_lock(&pipeline->mutex);
+  queue->closed = MS_TRUE;
+  queue->status = status;
+  pthread_cond_broadcast(&pipeline->cond);
+  pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static void *msDrawPipelineReader(void *arg)
+{
+  drawPipelineObj *pipeline = (drawPipelineObj *)arg;
+  shapeBatchObj batch;
+  shapeObj shape;
+  int status;
+
+  if(pipeline->debuglevel >= 0)
+    msDebugStartBuffer((debugLevel) pipeline->debuglevel);
+
+  msInitShape(&shape);
+  msInitShapeBatch(pipeline->layer, &batch);
+  while((status = msLayerNextShapeFromBatch(pipeline->layer, &batch, &shape)) == MS_SUCCESS) {
+    if(!msDrawPipelinePush(pipeline, &pipeline->readqueue, &shape)) {
+      msFreeShape(&shape);
+      status = MS_DONE;
+      break;
+    }
+  }
+  msFreeShapeBatch(&batch);
+
+  msDrawPipelineFinish(pipeline, &pipeline->readqueue, status, &pipeline->readerrors, &pipeline->readdebug);
+  return NULL;
+}
+
+static void *msDrawPipelineClassifier(void *arg)
+{
+  drawPipelineObj *pipeline = (drawPipelineObj *)arg;
+  shapeObj shape;
+  int status;
+
+  if(pipeline->debuglevel >= 0)
+    msDebugStartBuffer((debugLevel) pipeline->debuglevel);
+
+  msInitShape(&shape);
+  while((status = msDrawPipelinePop(pipeline, &pipeline->readqueue, &shape)) == MS_SUCCESS) {
+    if(!msDrawShapeFilter(pipeline->map, pipeline->layer, &shape, pipeline->classgroup, pipeline->nclasses, pipeline->minfeaturesize)) {
+      msFreeShape(&shape);
+      continue;
+    }
+
+#ifdef USE_PROJ
+    if(pipeline->project)
+      msProjectShape(&pipeline->layer->projection, &pipeline->map->projection, &shape);
+#endif
+
+    if(!msDrawPipelinePush(pipeline, &pipeline->drawqueue, &shape)) {
+      msFreeShape(&shape);
+      status = MS_DONE;
+      break;
+    }
+  }
+
+  msDrawPipelineFinish(pipeline, &pipeline->drawqueue, status, &pipeline->classifyerrors, &pipeline->classifydebug);
+  return NULL;
+}
+
+static void msDrawPipelineFreeQueue(drawShapeQueueObj *queue)
+{
+  while(queue->count > 0) {
+    msFreeShape(&queue->shapes[queue->head]);
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+  }
+  msFree(queue->shapes);
+}
+
+/*
+** Starts the pipeline threads, returns NULL if the pipeline is not enabled
+** for this layer or could not be started (the serial loop is used then).
+*/
+static drawPipelineObj *msDrawPipelineStart(mapObj *map, layerObj *layer, int *classgroup, int nclasses, double minfeaturesize)
+{
+  drawPipelineObj *pipeline;
+  const char *value;
+  int size = MS_DRAW_PIPELINE_SIZE;
+  int started = MS_FALSE;
+
+  value = msLayerGetProcessingKey(layer, "DRAW_PIPELINE");
+  if(value == NULL || (strcasecmp(value, "ON") != 0 && strcasecmp(value, "TRUE") != 0))
+    return NULL;
+
+  /* STYLEITEM needs the data source while drawing, and circle layers only */
+  /* reproject the circle center */
+  if(layer->styleitem || layer->type == MS_LAYER_CIRCLE)
+    return NULL;
+
+  value = msLayerGetProcessingKey(layer, "DRAW_PIPELINE_SIZE");
+  if(value && atoi(value) > 0)
+    size = atoi(value);
+
+  pipeline = (drawPipelineObj *) msSmallCalloc(1, sizeof(drawPipelineObj));
+  pipeline->map = map;
+  pipeline->layer = layer;
+  pipeline->classgroup = classgroup;
+  pipeline->nclasses = nclasses;
+  pipeline->minfeaturesize = minfeaturesize;
+  pipeline->debuglevel = msGetErrorFile() ? (int) msGetGlobalDebugLevel() : -1;
+#ifdef USE_PROJ
+  pipeline->project = (layer->project && layer->transform == MS_TRUE && msProjectionsDiffer(&(layer->projection), &(map->projection)));
+#endif
+  pipeline->readqueue.size = pipeline->drawqueue.size = size;
+  pipeline->readqueue.shapes = (shapeObj *) msSmallMalloc(size * sizeof(shapeObj));
+  pipeline->drawqueue.shapes = (shapeObj *) msSmallMalloc(size * sizeof(shapeObj));
+
+  pthread_mutex_init(&pipeline->mutex, NULL);
+  pthread_cond_init(&pipeline->cond, NULL);
+
+  /* the classifier only waits on the reader, so it can be stopped without */
+  /* having consumed any shape if the reader thread can't be started */
+  if(pthread_create(&pipeline->classifier, NULL, msDrawPipelineClassifier, pipeline) == 0) {
+    if(pthread_create(&pipeline->reader, NULL, msDrawPipelineReader, pipeline) == 0)
+      started = MS_TRUE;
+    else {
+      pthread_mutex_lock(&pipeline->mutex);
+      pipeline->cancel = MS_TRUE;
+      pthread_cond_broadcast(&pipeline->cond);
+      pthread_mutex_unlock(&pipeline->mutex);
+      pthread_join(pipeline->classifier, NULL);
+    }
+  }
+
+  if(!started) {
+    msDebugWriteBuffer(pipeline->classifydebug); /* a started classifier has ended by now */
+    msFree(pipeline->classifydebug);
+    msAttachErrorList(pipeline->classifyerrors);
+    if(layer->debug)
+      msDebug("msDrawVectorLayer(): failed to start the draw pipeline for layer %s, using the serial loop.\n", layer->name);
+    pthread_mutex_destroy(&pipeline->mutex);
+    pthread_cond_destroy(&pipeline->cond);
+    msFree(pipeline->readqueue.shapes);
+    msFree(pipeline->drawqueue.shapes);
+    msFree(pipeline);
+    return NULL;
+  }
+
+  if(layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msDrawVectorLayer(): using draw pipeline with queue size %d for layer %s.\n", size, layer->name);
+
+  /* shapes come out of the pipeline already reprojected */
+  pipeline->layerproject = layer->project;
+  layer->project = MS_FALSE;
+
+  return pipeline;
+}
+
+static int msDrawPipelineNextShape(drawPipelineObj *pipeline, shapeObj *shape)
+{
+  return msDrawPipelinePop(pipeline, &pipeline->drawqueue, shape);
+}
+
+/*
+** Stops the worker threads (they may still be running if the rendering loop
+** ended early), writes their debug output and sets their errors in the
+** rendering thread, frees the shapes left in the queues and restores the
+** layer.
+*/
+static void msDrawPipelineEnd(drawPipelineObj *pipeline, layerObj *layer)
+{
+  pthread_mutex_lock(&pipeline->mutex);
+  pipeline->cancel = MS_TRUE;
+  pthread_cond_broadcast(&pipeline->cond);
+  pthread_mutex_unlock(&pipeline->mutex);
+
+  pthread_join(pipeline->reader, NULL);
+  pthread_join(pipeline->classifier, NULL);
+
+  msDebugWriteBuffer(pipeline->readdebug);
+  msDebugWriteBuffer(pipeline->classifydebug);
+  msFree(pipeline->readdebug);
+  msFree(pipeline->classifydebug);
+  msAttachErrorList(pipeline->readerrors);
+  msAttachErrorList(pipeline->classifyerrors);
+
+  pthread_mutex_destroy(&pipeline->mutex);
+  pthread_cond_destroy(&pipeline->cond);
+  msDrawPipelineFreeQueue(&pipeline->readqueue);
+  msDrawPipelineFreeQueue(&pipeline->drawqueue);
+
+  layer->project = pipeline->layerproject;
+  msFree(pipeline);
+}
+#endif /* MS_DRAW_PIPELINE */
+
 int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 {
   int         status, retcode=MS_SUCCESS;
-  int         drawmode=MS_DRAWMODE_FEATURES;
+  int         drawmode=MS_DRAW_FEATURES(map->drawmode);
   char        annotate=MS_TRUE;
   shapeObj    shape;
   rectObj     searchrect;
@@ -916,13 +1868,19 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   double minfeaturesize = -1;
   int maxfeatures=-1;
   int featuresdrawn=0;
+  shapeBatchObj batch;
+  drawBudgetObj *budget = &(map->drawbudget);
+  double simplifytolerance;
+#ifdef MS_DRAW_PIPELINE
+  drawPipelineObj *pipeline = NULL;
+#endif
 
   if (image)
     maxfeatures=msLayerGetMaxFeaturesToDraw(layer, image->format);
 
   /* TODO TBT: draw as raster layer in vector renderers */
 
-  annotate = msEvalContext(map, layer, layer->labelrequires);
+  annotate = (MS_DRAW_LABELS(map->drawmode) || (map->striplabels && !layer->styleitem)) && msEvalContext(map, layer, layer->labelrequires);
   if(map->scaledenom > 0) {
     if((layer->labelmaxscaledenom != -1) && (map->scaledenom >= layer->labelmaxscaledenom)) annotate = MS_FALSE;
     if((layer->labelminscaledenom != -1) && (map->scaledenom < layer->labelminscaledenom)) annotate = MS_FALSE;
@@ -979,20 +1937,37 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if(layer->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, layer, layer->minfeaturesize);
 
-  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+  msInitShapeBatch(layer, &batch);
+#ifdef MS_DRAW_PIPELINE
+  pipeline = msDrawPipelineStart(map, layer, classgroup, nclasses, minfeaturesize);
+  if(!pipeline) /* the pipeline threads can't share an arena */
+#endif
+    layer->arena = msCreateShapeArena();
+
+  /* two pixels, in the coordinates of the shapes */
+  simplifytolerance = 2 * MS_MAX(MS_CELLSIZE(searchrect.minx, searchrect.maxx, map->width),
+                                 MS_CELLSIZE(searchrect.miny, searchrect.maxy, map->height));
+#ifdef MS_DRAW_PIPELINE
+  if(pipeline)
+    simplifytolerance = 2 * map->cellsize;
+#endif
 
-    /* Check if the shape size is ok to be drawn */
-    if((shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) && (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE)) {
-      if(layer->debug >= MS_DEBUGLEVEL_V)
-        msDebug("msDrawVectorLayer(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-      msFreeShape(&shape);
-      continue;
-    }
+  for(;;) {
+#ifdef MS_DRAW_PIPELINE
+    if(pipeline) {
+      /* shapes are already filtered, classified and reprojected */
+      if((status = msDrawPipelineNextShape(pipeline, &shape)) != MS_SUCCESS)
+        break;
+    } else
+#endif
+    {
+      if((status = msLayerNextShapeFromBatch(layer, &batch, &shape)) != MS_SUCCESS)
+        break;
 
-    shape.classindex = msShapeGetClass(layer, map, &shape, classgroup, nclasses);
-    if((shape.classindex == -1) || (layer->class[shape.classindex]->status == MS_OFF)) {
-      msFreeShape(&shape);
-      continue;
+      if(!msDrawShapeFilter(map, layer, &shape, classgroup, nclasses, minfeaturesize)) {
+        msShapeArenaFreeShape(layer->arena, &shape);
+        continue;
+      }
     }
 
     if(maxfeatures >=0 && featuresdrawn >= maxfeatures) {
@@ -1001,8 +1976,22 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     }
     featuresdrawn++;
 
+    if(budget->enabled) {
+      int i;
+      if(budget->level >= MS_DRAWBUDGET_STOP) {
+        msShapeArenaFreeShape(layer->arena, &shape);
+        status = MS_DONE;
+        break;
+      }
+      budget->numfeatures++;
+      for(i=0; i<shape.numlines; i++)
+        budget->numvertices += shape.line[i].numpoints;
+      if(budget->level >= MS_DRAWBUDGET_SIMPLIFY && shape.type != MS_SHAPE_POINT)
+        msDrawBudgetSimplifyShape(&shape, simplifytolerance);
+    }
+
     cache = MS_FALSE;
-    if(layer->type == MS_LAYER_LINE && (layer->class[shape.classindex]->numstyles > 1 || (layer->class[shape.classindex]->numstyles == 1 && layer->class[shape.classindex]->styles[0]->outlinewidth > 0))) {
+    if(MS_DRAW_FEATURES(drawmode) && layer->type == MS_LAYER_LINE && (layer->class[shape.classindex]->numstyles > 1 || (layer->class[shape.classindex]->numstyles == 1 && layer->class[shape.classindex]->styles[0]->outlinewidth > 0))) {
       int i;
       cache = MS_TRUE; /* only line layers with multiple styles need be cached (I don't think POLYLINE layers need caching - SDL) */
 
@@ -1033,11 +2022,25 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     }
 
     /* RFC77 TODO: check return value, may need a more sophisticated if-then test. */
-    if(annotate && layer->class[shape.classindex]->numlabels > 0) {
-      msShapeGetAnnotation(layer, &shape);
-      drawmode |= MS_DRAWMODE_LABELS;
-      if (msLayerGetProcessingKey(layer, "LABEL_NO_CLIP")) {
-        drawmode |= MS_DRAWMODE_UNCLIPPEDLABELS;
+    if(annotate && (!budget->enabled || budget->level < MS_DRAWBUDGET_SIMPLIFY) && layer->class[shape.classindex]->numlabels > 0) {
+      if(map->striplabels) { /* labelled once all the strips are drawn, see msDrawMapStrips() */
+        featureListNodeObjPtr node = insertFeatureList(&(map->striplabels[layer->index]), &shape);
+        if(node == NULL) {
+          msShapeArenaFreeShape(layer->arena, &shape);
+          retcode = MS_FAILURE;
+          break;
+        }
+#ifdef USE_PROJ
+        /* kept in map coordinates, as shapes from the pipeline already are */
+        if(layer->project && layer->transform == MS_TRUE && msProjectionsDiffer(&(layer->projection), &(map->projection)))
+          msProjectShape(&layer->projection, &map->projection, &(node->shape));
+#endif
+      } else {
+        msShapeGetAnnotation(layer, &shape);
+        drawmode |= MS_DRAWMODE_LABELS;
+        if (msLayerGetProcessingKey(layer, "LABEL_NO_CLIP")) {
+          drawmode |= MS_DRAWMODE_UNCLIPPEDLABELS;
+        }
       }
     }
 
@@ -1093,13 +2096,19 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     else
       status = msDrawShape(map, layer, &shape, image, -1, drawmode); /* all styles  */
     if(status != MS_SUCCESS) {
-      msFreeShape(&shape);
+      msShapeArenaFreeShape(layer->arena, &shape);
+      retcode = MS_FAILURE;
+      break;
+    }
+
+    if(budget->enabled && msDrawBudgetCheck(map, layer) != MS_SUCCESS) {
+      msShapeArenaFreeShape(layer->arena, &shape);
       retcode = MS_FAILURE;
       break;
     }
 
     if(shape.numlines == 0) { /* once clipped the shape didn't need to be drawn */
-      msFreeShape(&shape);
+      msShapeArenaFreeShape(layer->arena, &shape);
       continue;
     }
 
@@ -1111,9 +2120,17 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     }
 
     maxnumstyles = MS_MAX(maxnumstyles, layer->class[shape.classindex]->numstyles);
-    msFreeShape(&shape);
+    msShapeArenaFreeShape(layer->arena, &shape);
   }
 
+#ifdef MS_DRAW_PIPELINE
+  if(pipeline)
+    msDrawPipelineEnd(pipeline, layer);
+#endif
+  msFreeShapeBatch(&batch);
+  msFreeShapeArena(layer->arena);
+  layer->arena = NULL;
+
   if (classgroup)
     msFree(classgroup);
 
@@ -1484,6 +2501,10 @@ int msDrawRasterLayer(mapObj *map, layerObj *layer, imageObj *image)
   else if( MS_RENDERER_RAWDATA(image->format) )
     rv = msDrawRasterLayerLow(map, layer, image, NULL);
   msLayerRestoreFromScaletokens(layer);
+
+  /* only the time limit applies to rasters */
+  if(rv == MS_SUCCESS && map->drawbudget.enabled)
+    rv = msDrawBudgetCheck(map, layer);
   return rv;
 }
 
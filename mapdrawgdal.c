@@ -1314,6 +1314,133 @@ static int ApplyLUT( int iColorIndex, layerObj *layer,
   return 0;
 }
 
+/************************************************************************/
+/*                         SelectGDALOverview()                         */
+/*                                                                      */
+/*      Pick the overview level to read the source window from for     */
+/*      the requested buffer size.  By default this is the coarsest     */
+/*      overview that is still at least as fine as the buffer.  The     */
+/*      OVERVIEW_LEVEL processing option may force a level, counting    */
+/*      from 1, or be set to AUTO to leave the choice to GDAL's         */
+/*      RasterIO.  Returns -1 for the base bands.                       */
+/************************************************************************/
+
+static int
+SelectGDALOverview( GDALDatasetH hDS, int band_numbers[4], int band_count,
+                    layerObj *layer,
+                    int src_xsize, int src_ysize,
+                    int dst_xsize, int dst_ysize )
+
+{
+  GDALRasterBandH hBand = GDALGetRasterBand( hDS, band_numbers[0] );
+  const char *pszLevel = CSLFetchNameValue( layer->processing, "OVERVIEW_LEVEL" );
+  double dfFactor, dfBestFactor = 1.0;
+  int iOverview, iBand, nBest = -1;
+  int nOverviews = GDALGetOverviewCount( hBand );
+
+  if( nOverviews == 0 || (pszLevel && EQUAL(pszLevel,"AUTO")) )
+    return -1;
+
+  if( pszLevel != NULL ) {
+    nBest = MS_MIN( atoi(pszLevel), nOverviews ) - 1;
+  } else {
+    dfFactor = MS_MIN( src_xsize / (double) dst_xsize,
+                       src_ysize / (double) dst_ysize );
+
+    for( iOverview = 0; iOverview < nOverviews; iOverview++ ) {
+      GDALRasterBandH hOverview = GDALGetOverview( hBand, iOverview );
+      double dfOverviewFactor;
+
+      if( hOverview == NULL || GDALGetRasterBandXSize( hOverview ) <= 0 )
+        continue;
+
+      dfOverviewFactor = GDALGetRasterBandXSize( hBand )
+                         / (double) GDALGetRasterBandXSize( hOverview );
+      if( dfOverviewFactor <= dfFactor && dfOverviewFactor > dfBestFactor ) {
+        dfBestFactor = dfOverviewFactor;
+        nBest = iOverview;
+      }
+    }
+  }
+
+  if( nBest < 0 )
+    return -1;
+
+  /* all the bands must have a matching overview */
+  for( iBand = 1; iBand < band_count; iBand++ ) {
+    GDALRasterBandH hOther = GDALGetRasterBand( hDS, band_numbers[iBand] );
+
+    if( GDALGetOverviewCount( hOther ) <= nBest
+        || GDALGetOverview( hOther, nBest ) == NULL
+        || GDALGetRasterBandXSize( GDALGetOverview( hOther, nBest ) )
+        != GDALGetRasterBandXSize( GDALGetOverview( hBand, nBest ) ) )
+      return -1;
+  }
+
+  if( layer->debug )
+    msDebug( "SelectGDALOverview(): reading %dx%d source pixels to %dx%d from overview %d.\n",
+             src_xsize, src_ysize, dst_xsize, dst_ysize, nBest + 1 );
+
+  return nBest;
+}
+
+/************************************************************************/
+/*                           ReadGDALBands()                            */
+/*                                                                      */
+/*      Read the source window of the bands into a band interleaved     */
+/*      buffer, from the overview chosen by SelectGDALOverview().      */
+/************************************************************************/
+
+static CPLErr
+ReadGDALBands( GDALDatasetH hDS, int band_numbers[4], int band_count,
+               layerObj *layer,
+               int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+               void *pBuffer, int dst_xsize, int dst_ysize,
+               GDALDataType eType )
+
+{
+  int iOverview, iBand;
+  int nPixelSize = GDALGetDataTypeSize( eType ) / 8;
+
+  iOverview = SelectGDALOverview( hDS, band_numbers, band_count, layer,
+                                  src_xsize, src_ysize, dst_xsize, dst_ysize );
+
+  if( iOverview < 0 )
+    return GDALDatasetRasterIO( hDS, GF_Read,
+                                src_xoff, src_yoff, src_xsize, src_ysize,
+                                pBuffer, dst_xsize, dst_ysize, eType,
+                                band_count, band_numbers, 0, 0, 0 );
+
+  for( iBand = 0; iBand < band_count; iBand++ ) {
+    GDALRasterBandH hBand = GDALGetRasterBand( hDS, band_numbers[iBand] );
+    GDALRasterBandH hOverview = GDALGetOverview( hBand, iOverview );
+    int nOvXSize = GDALGetRasterBandXSize( hOverview );
+    int nOvYSize = GDALGetRasterBandYSize( hOverview );
+    double dfXRatio = GDALGetRasterBandXSize( hBand ) / (double) nOvXSize;
+    double dfYRatio = GDALGetRasterBandYSize( hBand ) / (double) nOvYSize;
+    int nXOff, nYOff, nXSize, nYSize;
+    CPLErr eErr;
+
+    /* scale the window to the overview, rounding like GDAL does */
+    nXOff = MS_MIN( (int) (src_xoff / dfXRatio + 0.5), nOvXSize - 1 );
+    nYOff = MS_MIN( (int) (src_yoff / dfYRatio + 0.5), nOvYSize - 1 );
+    nXSize = MS_MAX( 1, (int) (src_xsize / dfXRatio + 0.5) );
+    nYSize = MS_MAX( 1, (int) (src_ysize / dfYRatio + 0.5) );
+    nXSize = MS_MIN( nXSize, nOvXSize - nXOff );
+    nYSize = MS_MIN( nYSize, nOvYSize - nYOff );
+
+    eErr = GDALRasterIO( hOverview, GF_Read,
+                         nXOff, nYOff, nXSize, nYSize,
+                         ((GByte *) pBuffer)
+                         + (size_t) nPixelSize * dst_xsize * dst_ysize * iBand,
+                         dst_xsize, dst_ysize, eType, 0, 0 );
+    if( eErr != CE_None )
+      return eErr;
+  }
+
+  return CE_None;
+}
+
 /************************************************************************/
 /*                           LoadGDALImages()                           */
 /*                                                                      */
@@ -1369,12 +1496,10 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
       && CSLFetchNameValue( layer->processing, "SCALE_2" ) == NULL
       && CSLFetchNameValue( layer->processing, "SCALE_3" ) == NULL
       && CSLFetchNameValue( layer->processing, "SCALE_4" ) == NULL ) {
-    eErr = GDALDatasetRasterIO( hDS, GF_Read,
-                                src_xoff, src_yoff, src_xsize, src_ysize,
-                                pabyWholeBuffer,
-                                dst_xsize, dst_ysize, GDT_Byte,
-                                band_count, band_numbers,
-                                0,0,0);
+    eErr = ReadGDALBands( hDS, band_numbers, band_count, layer,
+                          src_xoff, src_yoff, src_xsize, src_ysize,
+                          pabyWholeBuffer,
+                          dst_xsize, dst_ysize, GDT_Byte );
 
     if( eErr != CE_None ) {
       msSetError( MS_IOERR,
@@ -1424,12 +1549,10 @@ LoadGDALImages( GDALDatasetH hDS, int band_numbers[4], int band_count,
     return -1;
   }
 
-  eErr = GDALDatasetRasterIO(
-           hDS, GF_Read,
-           src_xoff, src_yoff, src_xsize, src_ysize,
-           pafWholeRawData, dst_xsize, dst_ysize, GDT_Float32,
-           band_count, band_numbers,
-           0, 0, 0 );
+  eErr = ReadGDALBands( hDS, band_numbers, band_count, layer,
+                        src_xoff, src_yoff, src_xsize, src_ysize,
+                        pafWholeRawData, dst_xsize, dst_ysize,
+                        GDT_Float32 );
 
   if( eErr != CE_None ) {
     msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
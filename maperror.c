@@ -265,6 +265,55 @@ void msResetErrorList()
 #endif
 }
 
+/* msDetachErrorList()
+**
+** Takes the error list of the calling thread, most recent error first, and
+** releases the error object of the thread. Used by worker threads to hand
+** their errors over to the thread that started them, which sets them again
+** with msAttachErrorList(). Returns NULL if there is no error.
+*/
+errorObj *msDetachErrorList()
+{
+  errorObj *ms_error, *list = NULL;
+  ms_error = msGetErrorObj();
+
+  if (ms_error->code != MS_NOERR) {
+    list = (errorObj *)malloc(sizeof(errorObj));
+    if (list) {
+      *list = *ms_error;
+      ms_error->next = NULL;
+    }
+  }
+
+  msResetErrorList();
+
+  return list;
+}
+
+/* msAttachErrorList()
+**
+** Sets the errors of a list returned by msDetachErrorList() in the calling
+** thread, in the order they were raised, and frees the list. The errors are
+** not logged again.
+*/
+void msAttachErrorList(errorObj *list)
+{
+  errorObj *ms_error;
+
+  if (list == NULL)
+    return;
+
+  msAttachErrorList(list->next);
+
+  ms_error = msInsertErrorObj();
+  ms_error->code = list->code;
+  ms_error->isreported = list->isreported;
+  strlcpy(ms_error->routine, list->routine, sizeof(ms_error->routine));
+  strlcpy(ms_error->message, list->message, sizeof(ms_error->message));
+
+  free(list);
+}
+
 char *msGetErrorCodeString(int code)
 {
 
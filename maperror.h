@@ -119,6 +119,8 @@ extern "C" {
   MS_DLL_EXPORT void msWriteErrorXML(FILE *stream);
   MS_DLL_EXPORT char *msGetErrorCodeString(int code);
   MS_DLL_EXPORT char *msAddErrorDisplayString(char *source, errorObj *error);
+  MS_DLL_EXPORT errorObj *msDetachErrorList(void);
+  MS_DLL_EXPORT void msAttachErrorList(errorObj *list);
 
   struct mapObj;
   MS_DLL_EXPORT void msWriteErrorImage(struct mapObj *map, char *filename, int blank);
@@ -143,7 +145,8 @@ extern "C" {
                  MS_DEBUGMODE_FILE,
                  MS_DEBUGMODE_STDERR,
                  MS_DEBUGMODE_STDOUT,
-                 MS_DEBUGMODE_WINDOWSDEBUG
+                 MS_DEBUGMODE_WINDOWSDEBUG,
+                 MS_DEBUGMODE_BUFFER /* worker thread, see msDebugStartBuffer() */
                } debugMode;
 
   typedef struct debug_info_obj {
@@ -151,6 +154,9 @@ extern "C" {
     debugMode   debug_mode;
     char        *errorfile;
     FILE        *fp;
+    char        *buffer; /* MS_DEBUGMODE_BUFFER output */
+    int         buffer_len;
+    int         buffer_size;
     /* The following 2 members are used only with USE_THREAD (but we won't #ifndef them) */
     int         thread_id;
     struct debug_info_obj *next;
@@ -165,6 +171,9 @@ extern "C" {
   MS_DLL_EXPORT debugLevel msGetGlobalDebugLevel( void );
   MS_DLL_EXPORT int msDebugInitFromEnv( void );
   MS_DLL_EXPORT void msDebugCleanup( void );
+  MS_DLL_EXPORT void msDebugStartBuffer( debugLevel level );
+  MS_DLL_EXPORT char *msDebugEndBuffer( void );
+  MS_DLL_EXPORT void msDebugWriteBuffer( const char *buffer );
 
 #endif /* SWIG */
 
@@ -105,21 +105,21 @@ int msValidateParameter(char *value, char *pattern1, char *pattern2, char *patte
 
 int msEvalRegex(char *e, char *s)
 {
-  ms_regex_t re;
+  ms_regex_t *re;
 
   if(!e || !s) return(MS_FALSE);
 
-  if(ms_regcomp(&re, e, MS_REG_EXTENDED|MS_REG_NOSUB) != 0) {
+  if((re = msRegexCacheAcquire(e, MS_REG_EXTENDED|MS_REG_NOSUB)) == NULL) {
     msSetError(MS_REGEXERR, "Failed to compile expression (%s).", "msEvalRegex()", e);
     return(MS_FALSE);
   }
 
-  if(ms_regexec(&re, s, 0, NULL, 0) != 0) { /* no match */
-    ms_regfree(&re);
+  if(ms_regexec(re, s, 0, NULL, 0) != 0) { /* no match */
+    msRegexCacheRelease(re);
     msSetError(MS_REGEXERR, "String failed expression test.", "msEvalRegex()");
     return(MS_FALSE);
   }
-  ms_regfree(&re);
+  msRegexCacheRelease(re);
 
   return(MS_TRUE);
 }
@@ -3843,6 +3843,7 @@ int initLayer(layerObj *layer, mapObj *map)
 
   layer->layerinfo = NULL;
   layer->wfslayerinfo = NULL;
+  layer->arena = NULL;
 
   layer->items = NULL;
   layer->iteminfo = NULL;
@@ -5843,6 +5844,10 @@ int initMap(mapObj *map)
 
   msInitQuery(&(map->query));
 
+  map->drawmode = MS_DRAWMODE_FEATURES|MS_DRAWMODE_LABELS;
+  map->striplabels = NULL;
+  memset(&(map->drawbudget), 0, sizeof(drawBudgetObj));
+
   return(0);
 }
 
@@ -45,6 +45,117 @@
 
 static int    bGDALInitialized = 0;
 
+/************************************************************************/
+/*                          Raster handle pool                          */
+/*                                                                      */
+/*      Datasets drawn by raster layers are kept open between           */
+/*      requests in a bounded pool keyed by path, so they are not       */
+/*      reopened for every request and tile, and the blocks they        */
+/*      hold in the GDAL block cache (capped by GDAL_CACHEMAX) are      */
+/*      not flushed by a close.  The pool is protected by TLOCK_GDAL    */
+/*      which callers hold.                                             */
+/************************************************************************/
+
+#define MS_GDAL_POOL_DEFAULT_SIZE 64
+
+typedef struct {
+  char *path;
+  GDALDatasetH hDS;
+  int inuse;
+  unsigned long lastused;
+} gdalPoolEntryObj;
+
+static gdalPoolEntryObj *gdalPool = NULL;
+static int gdalPoolCount = 0, gdalPoolMax = 0;
+static unsigned long gdalPoolClock = 0;
+
+static void msGDALPoolRemove( int i )
+
+{
+  GDALClose( gdalPool[i].hDS );
+  msFree( gdalPool[i].path );
+  gdalPool[i] = gdalPool[--gdalPoolCount];
+}
+
+/************************************************************************/
+/*                          msGDALOpenPooled()                          */
+/*                                                                      */
+/*      Returns an idle pooled handle on path, or opens a new one.      */
+/*      The handle is returned with msGDALClosePooled().                */
+/************************************************************************/
+
+void *msGDALOpenPooled( const char *path )
+
+{
+  int i;
+
+  for( i = 0; i < gdalPoolCount; i++ ) {
+    if( !gdalPool[i].inuse && strcmp(gdalPool[i].path, path) == 0 ) {
+      gdalPool[i].inuse = MS_TRUE;
+      return gdalPool[i].hDS;
+    }
+  }
+
+  return GDALOpen( path, GA_ReadOnly );
+}
+
+/************************************************************************/
+/*                         msGDALClosePooled()                          */
+/*                                                                      */
+/*      Puts back a handle from msGDALOpenPooled().  If keep is true    */
+/*      it stays open in the pool, whose size is set by the             */
+/*      MS_GDAL_POOL_SIZE config option, evicting the least recently    */
+/*      used idle handles.  Otherwise it is closed.                     */
+/************************************************************************/
+
+void msGDALClosePooled( mapObj *map, void *hDS, const char *path, int keep )
+
+{
+  const char *value;
+  int i, poolsize = MS_GDAL_POOL_DEFAULT_SIZE;
+
+  if( map && (value = msGetConfigOption( map, "MS_GDAL_POOL_SIZE" )) != NULL )
+    poolsize = MS_MAX( 0, atoi(value) );
+
+  for( i = 0; i < gdalPoolCount; i++ ) {
+    if( gdalPool[i].hDS == (GDALDatasetH) hDS )
+      break;
+  }
+
+  if( !keep || poolsize == 0 ) {
+    if( i < gdalPoolCount )
+      msGDALPoolRemove( i );
+    else
+      GDALClose( (GDALDatasetH) hDS );
+    return;
+  }
+
+  if( i == gdalPoolCount ) {
+    if( gdalPoolCount == gdalPoolMax ) {
+      gdalPoolMax = gdalPoolMax * 2 + 8;
+      gdalPool = (gdalPoolEntryObj *) msSmallRealloc( gdalPool, sizeof(gdalPoolEntryObj) * gdalPoolMax );
+    }
+    gdalPool[i].path = msStrdup( path );
+    gdalPool[i].hDS = (GDALDatasetH) hDS;
+    gdalPoolCount++;
+  }
+  gdalPool[i].inuse = MS_FALSE;
+  gdalPool[i].lastused = ++gdalPoolClock;
+
+  /* trim the idle handles down to the pool size */
+  while( gdalPoolCount > poolsize ) {
+    int lru = -1;
+
+    for( i = 0; i < gdalPoolCount; i++ ) {
+      if( !gdalPool[i].inuse && (lru == -1 || gdalPool[i].lastused < gdalPool[lru].lastused) )
+        lru = i;
+    }
+    if( lru == -1 )
+      break;
+    msGDALPoolRemove( lru );
+  }
+}
+
 /************************************************************************/
 /*                          msGDALInitialize()                          */
 /************************************************************************/
@@ -74,6 +185,13 @@ void msGDALCleanup( void )
     int iRepeat = 5;
     msAcquireLock( TLOCK_GDAL );
 
+    /* close the pooled raster handles */
+    while( gdalPoolCount > 0 )
+      msGDALPoolRemove( gdalPoolCount - 1 );
+    msFree( gdalPool );
+    gdalPool = NULL;
+    gdalPoolMax = 0;
+
 #if GDAL_RELEASE_DATE > 20101207
     {
       /*
@@ -139,6 +257,64 @@ void CleanVSIDir( const char *pszDir )
   CSLDestroy( papszFiles );
 }
 
+/************************************************************************/
+/*                      msGDALSetOutputMetadata()                       */
+/*                                                                      */
+/*      Assign the georeferencing of the map (if any), the nodata       */
+/*      value of the output format and the resolution to a dataset      */
+/*      written in an output format.  Used by msSaveImageGDAL() and     */
+/*      the WCS strip output so they write the same metadata.  The      */
+/*      caller holds the GDAL lock.                                     */
+/************************************************************************/
+
+void msGDALSetOutputMetadata( mapObj *map, outputFormatObj *format,
+                              int nBands, double resolution, void *hDSVoid )
+
+{
+  GDALDatasetH hDS = (GDALDatasetH) hDSVoid;
+
+  /* -------------------------------------------------------------------- */
+  /*      Assign the projection and coordinate system to the dataset.     */
+  /* -------------------------------------------------------------------- */
+  if( map != NULL ) {
+    char *pszWKT;
+
+    GDALSetGeoTransform( hDS, map->gt.geotransform );
+
+    pszWKT = msProjectionObj2OGCWKT( &(map->projection) );
+    if( pszWKT != NULL ) {
+      GDALSetProjection( hDS, pszWKT );
+      msFree( pszWKT );
+    }
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Possibly assign a nodata value.                                 */
+  /* -------------------------------------------------------------------- */
+  if( msGetOutputFormatOption(format,"NULLVALUE",NULL) != NULL ) {
+    int iBand;
+    const char *nullvalue = msGetOutputFormatOption(format,
+                            "NULLVALUE",NULL);
+
+    for( iBand = 0; iBand < nBands; iBand++ ) {
+      GDALRasterBandH hBand = GDALGetRasterBand( hDS, iBand+1 );
+      GDALSetRasterNoDataValue( hBand, atof(nullvalue) );
+    }
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*  Try to save resolution in the output file.                          */
+  /* -------------------------------------------------------------------- */
+  if( resolution > 0 ) {
+    char res[30];
+
+    sprintf( res, "%lf", resolution );
+    GDALSetMetadataItem( hDS, "TIFFTAG_XRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hDS, "TIFFTAG_YRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hDS, "TIFFTAG_RESOLUTIONUNIT", "2", NULL );
+  }
+}
+
 /************************************************************************/
 /*                          msSaveImageGDAL()                           */
 /************************************************************************/
@@ -418,47 +594,9 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
     }
 
   /* -------------------------------------------------------------------- */
-  /*      Assign the projection and coordinate system to the memory       */
-  /*      dataset.                                                        */
-  /* -------------------------------------------------------------------- */
-
-  if( map != NULL ) {
-    char *pszWKT;
-
-    GDALSetGeoTransform( hMemDS, map->gt.geotransform );
-
-    pszWKT = msProjectionObj2OGCWKT( &(map->projection) );
-    if( pszWKT != NULL ) {
-      GDALSetProjection( hMemDS, pszWKT );
-      msFree( pszWKT );
-    }
-  }
-
-  /* -------------------------------------------------------------------- */
-  /*      Possibly assign a nodata value.                                 */
+  /*      Assign the georeferencing, nodata value and resolution.         */
   /* -------------------------------------------------------------------- */
-  if( msGetOutputFormatOption(format,"NULLVALUE",NULL) != NULL ) {
-    int iBand;
-    const char *nullvalue = msGetOutputFormatOption(format,
-                            "NULLVALUE",NULL);
-
-    for( iBand = 0; iBand < nBands; iBand++ ) {
-      GDALRasterBandH hBand = GDALGetRasterBand( hMemDS, iBand+1 );
-      GDALSetRasterNoDataValue( hBand, atof(nullvalue) );
-    }
-  }
-
-  /* -------------------------------------------------------------------- */
-  /*  Try to save resolution in the output file.                          */
-  /* -------------------------------------------------------------------- */
-  if( image->resolution > 0 ) {
-    char res[30];
-
-    sprintf( res, "%lf", image->resolution );
-    GDALSetMetadataItem( hMemDS, "TIFFTAG_XRESOLUTION", res, NULL );
-    GDALSetMetadataItem( hMemDS, "TIFFTAG_YRESOLUTION", res, NULL );
-    GDALSetMetadataItem( hMemDS, "TIFFTAG_RESOLUTIONUNIT", "2", NULL );
-  }
+  msGDALSetOutputMetadata( map, format, nBands, image->resolution, hMemDS );
 
   /* -------------------------------------------------------------------- */
   /*      Create a disk image in the selected output format from the      */
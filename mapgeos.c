@@ -33,6 +33,10 @@
 
 #include <geos_c.h>
 
+#if GEOS_VERSION_MAJOR > 3 || (GEOS_VERSION_MAJOR == 3 && GEOS_VERSION_MINOR >= 3)
+#define USE_GEOS_PREPARED /* all the prepared predicates used here appeared in GEOS 3.3 */
+#endif
+
 /*
 ** Error handling...
 */
@@ -616,8 +620,15 @@ void msGEOSFreeGeometry(shapeObj *shape)
   if(!shape || !shape->geometry)
     return;
 
+#ifdef USE_GEOS_PREPARED
+  if(shape->prepared) /* refers to the geometry, goes first */
+    GEOSPreparedGeom_destroy((const GEOSPreparedGeometry *) shape->prepared);
+  shape->prepared = NULL;
+#endif
+
   g = (GEOSGeom) shape->geometry;
   GEOSGeom_destroy(g);
+  shape->geometry = NULL;
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSFreeGEOSGeom()");
   return;
@@ -955,30 +966,131 @@ shapeObj *msGEOSSymDifference(shapeObj *shape1, shapeObj *shape2)
 ** Binary predicates exposed to MapServer/MapScript
 */
 
+#ifdef USE_GEOS
 /*
-** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+** Returns the geometry of a shape, built on first use. A geometry that is used
+** again, typically the fixed side of a predicate evaluated against many
+** features (a query shape or a WKT literal in an expression), is prepared as
+** well so the following predicates can use its spatial index.
 */
-int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+static GEOSGeom msGEOSGetGeometry(shapeObj *shape)
+{
+  if(!shape->geometry) { /* if no geometry for the shape then build one */
+    shape->geometry = (GEOSGeom) msGEOSShape2Geometry(shape);
+    return (GEOSGeom) shape->geometry;
+  }
+
+#ifdef USE_GEOS_PREPARED
+  if(!shape->prepared)
+    shape->prepared = (void *) GEOSPrepare((GEOSGeom) shape->geometry);
+#endif
+
+  return (GEOSGeom) shape->geometry;
+}
+
+#ifdef USE_GEOS_PREPARED
+/*
+** Evaluates a predicate with the prepared geometry of one of the shapes,
+** returns -2 if that isn't possible. prepared1 tells which shape is prepared,
+** predicates with the operands swapped use the converse predicate.
+*/
+static int msGEOSPreparedPredicate(const GEOSPreparedGeometry *prepared, GEOSGeom g, int prepared1, int op)
+{
+  switch(op) {
+    case MS_GEOS_INTERSECTS:
+      return GEOSPreparedIntersects(prepared, g);
+    case MS_GEOS_DISJOINT:
+      return GEOSPreparedDisjoint(prepared, g);
+    case MS_GEOS_TOUCHES:
+      return GEOSPreparedTouches(prepared, g);
+    case MS_GEOS_OVERLAPS:
+      return GEOSPreparedOverlaps(prepared, g);
+    case MS_GEOS_CROSSES:
+      return GEOSPreparedCrosses(prepared, g);
+    case MS_GEOS_CONTAINS:
+      return prepared1 ? GEOSPreparedContains(prepared, g) : GEOSPreparedWithin(prepared, g);
+    case MS_GEOS_WITHIN:
+      return prepared1 ? GEOSPreparedWithin(prepared, g) : GEOSPreparedContains(prepared, g);
+    default:
+      return -2;
+  }
+}
+#endif
+
+/*
+** Common code of the binary predicates. Shapes with disjoint bounds are
+** answered without building their geometries. The bounds are computed here
+** as those of shapes built by MapScript or expressions are not always set.
+*/
+static int msGEOSPredicate(shapeObj *shape1, shapeObj *shape2, int op)
 {
-#ifdef USE_GEOS
   GEOSGeom g1, g2;
-  int result;
+  int result = -2;
 
   if(!shape1 || !shape2)
     return -1;
 
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
+  if(shape1->numlines > 0 && shape2->numlines > 0) {
+    msComputeBounds(shape1);
+    msComputeBounds(shape2);
+    if(msRectOverlap(&shape1->bounds, &shape2->bounds) == MS_FALSE)
+      return (op == MS_GEOS_DISJOINT) ? MS_TRUE : MS_FALSE;
+  }
 
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
+  g1 = msGEOSGetGeometry(shape1);
+  if(!g1) return -1;
+  g2 = msGEOSGetGeometry(shape2);
   if(!g2) return -1;
 
-  result = GEOSContains(g1, g2);
+#ifdef USE_GEOS_PREPARED
+  if(shape1->prepared)
+    result = msGEOSPreparedPredicate((const GEOSPreparedGeometry *) shape1->prepared, g2, MS_TRUE, op);
+  else if(shape2->prepared)
+    result = msGEOSPreparedPredicate((const GEOSPreparedGeometry *) shape2->prepared, g1, MS_FALSE, op);
+#endif
+
+  if(result == -2) {
+    switch(op) {
+      case MS_GEOS_EQUALS:
+        result = GEOSEquals(g1, g2);
+        break;
+      case MS_GEOS_DISJOINT:
+        result = GEOSDisjoint(g1, g2);
+        break;
+      case MS_GEOS_TOUCHES:
+        result = GEOSTouches(g1, g2);
+        break;
+      case MS_GEOS_OVERLAPS:
+        result = GEOSOverlaps(g1, g2);
+        break;
+      case MS_GEOS_CROSSES:
+        result = GEOSCrosses(g1, g2);
+        break;
+      case MS_GEOS_INTERSECTS:
+        result = GEOSIntersects(g1, g2);
+        break;
+      case MS_GEOS_WITHIN:
+        result = GEOSWithin(g1, g2);
+        break;
+      case MS_GEOS_CONTAINS:
+        result = GEOSContains(g1, g2);
+        break;
+      default:
+        return -1;
+    }
+  }
+
   return ((result==2) ? -1 : result);
+}
+#endif /* USE_GEOS */
+
+/*
+** Does shape1 contain shape2, returns MS_TRUE/MS_FALSE or -1 for an error.
+*/
+int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
+{
+#ifdef USE_GEOS
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_CONTAINS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSContains()");
   return -1;
@@ -991,24 +1103,7 @@ int msGEOSContains(shapeObj *shape1, shapeObj *shape2)
 int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSOverlaps(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_OVERLAPS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSOverlaps()");
   return -1;
@@ -1021,24 +1116,7 @@ int msGEOSOverlaps(shapeObj *shape1, shapeObj *shape2)
 int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSWithin(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_WITHIN);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSWithin()");
   return -1;
@@ -1051,24 +1129,7 @@ int msGEOSWithin(shapeObj *shape1, shapeObj *shape2)
 int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSCrosses(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_CROSSES);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSCrosses()");
   return -1;
@@ -1081,24 +1142,7 @@ int msGEOSCrosses(shapeObj *shape1, shapeObj *shape2)
 int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSIntersects(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_INTERSECTS);
 #else
   if(!shape1 || !shape2)
     return -1;
@@ -1132,24 +1176,7 @@ int msGEOSIntersects(shapeObj *shape1, shapeObj *shape2)
 int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSTouches(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_TOUCHES);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSTouches()");
   return -1;
@@ -1162,24 +1189,7 @@ int msGEOSTouches(shapeObj *shape1, shapeObj *shape2)
 int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSEquals(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_EQUALS);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSEquals()");
   return -1;
@@ -1192,24 +1202,7 @@ int msGEOSEquals(shapeObj *shape1, shapeObj *shape2)
 int msGEOSDisjoint(shapeObj *shape1, shapeObj *shape2)
 {
 #ifdef USE_GEOS
-  GEOSGeom g1, g2;
-  int result;
-
-  if(!shape1 || !shape2)
-    return -1;
-
-  if(!shape1->geometry) /* if no geometry for shape1 then build one */
-    shape1->geometry = (GEOSGeom) msGEOSShape2Geometry(shape1);
-  g1 = (GEOSGeom) shape1->geometry;
-  if(!g1) return -1;
-
-  if(!shape2->geometry) /* if no geometry for shape2 then build one */
-    shape2->geometry = (GEOSGeom) msGEOSShape2Geometry(shape2);
-  g2 = (GEOSGeom) shape2->geometry;
-  if(!g2) return -1;
-
-  result = GEOSDisjoint(g1, g2);
-  return ((result==2) ? -1 : result);
+  return msGEOSPredicate(shape1, shape2, MS_GEOS_DISJOINT);
 #else
   msSetError(MS_GEOSERR, "GEOS support is not available.", "msGEOSDisjoint()");
   return -1;
@@ -40,10 +40,18 @@
 
 
 #include <time.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifndef _WIN32
 #include <sys/time.h>
 #include <unistd.h>
-
+#include <dirent.h>
+#include <utime.h>
+#else
+#include <direct.h>
+#include <sys/utime.h>
+#define mkdir(path, mode) _mkdir(path)
 #endif
 
 /*
@@ -67,6 +75,8 @@
  **********************************************************************/
 static int gbCurlInitialized = MS_FALSE;
 
+static void msHTTPCacheFreeInfo(httpRequestObj *psReq);
+
 int msHTTPInit()
 {
   /* curl_global_init() should only be called once (no matter how
@@ -138,6 +148,8 @@ void msHTTPInitRequestObj(httpRequestObj *pasReqInfo, int numRequests)
     pasReqInfo[i].pszProxyPassword = NULL;
     pasReqInfo[i].pszHttpUsername = NULL;
     pasReqInfo[i].pszHttpPassword = NULL;
+    pasReqInfo[i].pszCacheDir = NULL;
+    pasReqInfo[i].nCacheMaxSize = 0;
 
     pasReqInfo[i].debug = MS_FALSE;
 
@@ -146,6 +158,10 @@ void msHTTPInitRequestObj(httpRequestObj *pasReqInfo, int numRequests)
     pasReqInfo[i].result_data = NULL;
     pasReqInfo[i].result_size = 0;
     pasReqInfo[i].result_buf_size = 0;
+    pasReqInfo[i].done = MS_FALSE;
+    pasReqInfo[i].nBytesWritten = 0;
+    pasReqInfo[i].nWriteError = 0;
+    pasReqInfo[i].cache_info = NULL;
   }
 }
 
@@ -190,6 +206,12 @@ void msHTTPFreeRequestObj(httpRequestObj *pasReqInfo, int numRequests)
       free(pasReqInfo[i].pszHTTPCookieData);
     pasReqInfo[i].pszHTTPCookieData = NULL;
 
+    if (pasReqInfo[i].pszCacheDir)
+      free(pasReqInfo[i].pszCacheDir);
+    pasReqInfo[i].pszCacheDir = NULL;
+
+    msHTTPCacheFreeInfo(&(pasReqInfo[i]));
+
     pasReqInfo[i].curl_handle = NULL;
 
     free( pasReqInfo[i].result_data );
@@ -209,6 +231,10 @@ void msHTTPFreeRequestObj(httpRequestObj *pasReqInfo, int numRequests)
  * it'll signal an error to the library and it will abort the transfer
  * and produce a CURLE_WRITE_ERROR.
  *
+ * May be called from the background download thread so no msSetError()
+ * or msDebug() in here: failures are recorded in the request and
+ * reported by msHTTPFinalizeRequest().
+ *
  **********************************************************************/
 static size_t msHTTPWriteFct(void *buffer, size_t size, size_t nmemb,
                              void *reqInfo)
@@ -217,10 +243,7 @@ static size_t msHTTPWriteFct(void *buffer, size_t size, size_t nmemb,
 
   psReq = (httpRequestObj *)reqInfo;
 
-  if (psReq->debug) {
-    msDebug("msHTTPWriteFct(id=%d, %d bytes)\n",
-            psReq->nLayerId, size*nmemb);
-  }
+  psReq->nBytesWritten += size*nmemb;
 
   /* Case where we are writing to a disk file. */
   if( psReq->fp != NULL ) {
@@ -229,23 +252,18 @@ static size_t msHTTPWriteFct(void *buffer, size_t size, size_t nmemb,
 
   /* Case where we build up the result in memory */
   else {
-    if( psReq->result_data == NULL ) {
-      psReq->result_buf_size = size*nmemb + 10000;
-      psReq->result_data = (char *) msSmallMalloc( psReq->result_buf_size );
-    } else if( psReq->result_size + nmemb * size > psReq->result_buf_size ) {
-      psReq->result_buf_size = psReq->result_size + nmemb*size + 10000;
-      psReq->result_data = (char *) msSmallRealloc( psReq->result_data,
-                           psReq->result_buf_size );
-    }
-
-    if( psReq->result_data == NULL ) {
-      msSetError(MS_HTTPERR,
-                 "Unable to grow HTTP result buffer to size %d.",
-                 "msHTTPWriteFct()",
-                 psReq->result_buf_size );
-      psReq->result_buf_size = 0;
-      psReq->result_size = 0;
-      return -1;
+    if( psReq->result_data == NULL ||
+        psReq->result_size + nmemb * size > psReq->result_buf_size ) {
+      char *pabyData;
+      int nBufSize = psReq->result_size + size*nmemb + 10000;
+
+      pabyData = (char *) realloc( psReq->result_data, nBufSize );
+      if( pabyData == NULL ) {
+        psReq->nWriteError = nBufSize;
+        return -1;
+      }
+      psReq->result_data = pabyData;
+      psReq->result_buf_size = nBufSize;
     }
 
     memcpy( psReq->result_data + psReq->result_size,
@@ -281,302 +299,818 @@ long msGetCURLAuthType(enum MS_HTTP_AUTH_TYPE authType)
 }
 
 /**********************************************************************
- *                          msHTTPExecuteRequests()
+ *                          HTTP response cache
  *
- * Fetch a map slide via HTTP request and save to specified temp file.
+ * When pszCacheDir is set on a GET request, responses are kept in a
+ * local content-addressed cache: one <key>.cache file per response where
+ * <key> is a hash of the request URL and of the request headers that can
+ * change the response (cookie, credentials).  Each file starts with a few
+ * "name: value" lines terminated by an empty line, followed by the body.
  *
- * If bCheckLocalCache==MS_TRUE then if the pszOutputfile already exists
- * then is is not downloaded again, and status 242 is returned.
- *
- * Return value:
- * MS_SUCCESS if all requests completed succesfully.
- * MS_FAILURE if a fatal error happened
- * MS_DONE if some requests failed with 40x status for instance (not fatal)
+ * Freshness follows the Cache-Control (no-store, private, no-cache,
+ * max-age, s-maxage) and Expires response headers.  Stale entries that
+ * have an ETag or Last-Modified validator are revalidated with
+ * If-None-Match/If-Modified-Since, and a 304 response is served from the
+ * cache.  If nCacheMaxSize is set, the least recently used entries are
+ * removed once the cache grows larger than that.
  **********************************************************************/
-int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
-                          int bCheckLocalCache)
+#define MS_HTTP_CACHE_MAGIC "MSHTTPCACHE 1"
+
+typedef struct {
+  char    szPath[MS_MAXPATHLEN];  /* <pszCacheDir>/<key>.cache */
+  int     bRevalidating;    /* a conditional request has been sent */
+  time_t  nExpires;         /* expiry date of the cached entry */
+  char   *pszContentType;   /* content type of the cached entry */
+  char   *pszETag;          /* validators, from the response or entry */
+  char   *pszLastModified;
+  char   *pszCacheControl;  /* from the response */
+  char   *pszExpires;
+  struct curl_slist *headers;
+} httpCacheInfo;
+
+static void msHTTPCacheFreeInfo(httpRequestObj *psReq)
 {
-  int     i, nStatus = MS_SUCCESS, nTimeout, still_running=0, num_msgs=0;
-  CURLM   *multi_handle;
-  CURLMsg *curl_msg;
-  char     debug = MS_FALSE;
-  const char *pszCurlCABundle = NULL;
+  httpCacheInfo *psCache = (httpCacheInfo *)psReq->cache_info;
+
+  if (psCache == NULL)
+    return;
+
+  msFree(psCache->pszContentType);
+  msFree(psCache->pszETag);
+  msFree(psCache->pszLastModified);
+  msFree(psCache->pszCacheControl);
+  msFree(psCache->pszExpires);
+  if (psCache->headers)
+    curl_slist_free_all(psCache->headers);
+  free(psCache);
+  psReq->cache_info = NULL;
+}
 
-  if (numRequests == 0)
-    return MS_SUCCESS;  /* Nothing to do */
+/*
+** Build the cache key of a request: two 64 bits FNV-1a hashes of the
+** URL, the cookie and every authentication and proxy setting, so that
+** a response is only served again with the same credentials.
+*/
+static void msHTTPCacheKey(httpRequestObj *psReq, char *pszKey)
+{
+  const char *apszParts[9];
+  char szAuthTypes[64], szProxy[64];
+  unsigned long long h1 = 14695981039346656037ULL, h2 = 0x9e3779b97f4a7c15ULL;
+  int i;
 
-  if (!gbCurlInitialized)
-    msHTTPInit();
+  snprintf(szAuthTypes, sizeof(szAuthTypes), "%d %d",
+           (int)psReq->eHttpAuthType, (int)psReq->eProxyAuthType);
+  snprintf(szProxy, sizeof(szProxy), "%ld %d",
+           psReq->nProxyPort, (int)psReq->eProxyType);
+
+  apszParts[0] = psReq->pszGetUrl;
+  apszParts[1] = psReq->pszHTTPCookieData;
+  apszParts[2] = psReq->pszHttpUsername;
+  apszParts[3] = psReq->pszHttpPassword;
+  apszParts[4] = szAuthTypes;
+  apszParts[5] = psReq->pszProxyAddress;
+  apszParts[6] = szProxy;
+  apszParts[7] = psReq->pszProxyUsername;
+  apszParts[8] = psReq->pszProxyPassword;
+
+  for (i = 0; i < 9; i++) {
+    const unsigned char *p = (const unsigned char *)apszParts[i];
+    for (; p && *p; p++) {
+      h1 = (h1 ^ *p) * 1099511628211ULL;
+      h2 = (h2 ^ *p) * 1099511628211ULL;
+    }
+    /* separator so that parts cannot be shifted into each other */
+    h1 = (h1 ^ 0xff) * 1099511628211ULL;
+    h2 = (h2 ^ 0xff) * 1099511628211ULL;
+  }
 
-  /* Establish the timeout (seconds) for how long we are going to wait
-   * for a response.
-   * We use the longest timeout value in the array of requests
-   */
-  nTimeout = pasReqInfo[0].nTimeout;
-  for (i=0; i<numRequests; i++) {
-    if (pasReqInfo[i].nTimeout > nTimeout)
-      nTimeout = pasReqInfo[i].nTimeout;
+  sprintf(pszKey, "%016llx%016llx", h1, h2);
+}
 
-    if (pasReqInfo[i].debug)
-      debug = MS_TRUE;  /* For the download loop */
-  }
+/*
+** CURLOPT_HEADERFUNCTION: keep track of the response headers used by the
+** cache.  May be called from the background download thread so no
+** msSetError()/msDebug() in here.
+*/
+static size_t msHTTPHeaderFct(char *buffer, size_t size, size_t nitems,
+                              void *reqInfo)
+{
+  httpRequestObj *psReq = (httpRequestObj *)reqInfo;
+  httpCacheInfo *psCache = (httpCacheInfo *)psReq->cache_info;
+  size_t nLen = size * nitems;
+  const char *apszNames[] = { "ETag:", "Last-Modified:", "Cache-Control:",
+                              "Expires:"
+                            };
+  char **papszValues[4];
+  int i;
 
-  if (nTimeout <= 0)
-    nTimeout = 30;
+  if (psCache == NULL)
+    return nLen;
+
+  papszValues[0] = &psCache->pszETag;
+  papszValues[1] = &psCache->pszLastModified;
+  papszValues[2] = &psCache->pszCacheControl;
+  papszValues[3] = &psCache->pszExpires;
+
+  for (i = 0; i < 4; i++) {
+    size_t nNameLen = strlen(apszNames[i]);
+
+    if (nLen > nNameLen && strncasecmp(buffer, apszNames[i], nNameLen) == 0) {
+      const char *pszStart = buffer + nNameLen;
+      const char *pszEnd = buffer + nLen;
+      char *pszValue;
+
+      /* Strip surrounding whitespace and the CRLF */
+      while (pszStart < pszEnd && isspace((unsigned char)*pszStart))
+        pszStart++;
+      while (pszEnd > pszStart && isspace((unsigned char)pszEnd[-1]))
+        pszEnd--;
+
+      pszValue = (char *)msSmallMalloc(pszEnd - pszStart + 1);
+      memcpy(pszValue, pszStart, pszEnd - pszStart);
+      pszValue[pszEnd - pszStart] = '\0';
+      msFree(*(papszValues[i]));
+      *(papszValues[i]) = pszValue;
+      break;
+    }
+  }
 
-  /* Check if we've got a CURL_CA_BUNDLE env. var.
-   * If set then the value is the full path to the ca-bundle.crt file
-   * e.g. CURL_CA_BUNDLE=/usr/local/share/curl/curl-ca-bundle.crt
-   */
-  pszCurlCABundle = getenv("CURL_CA_BUNDLE");
+  return nLen;
+}
 
-  if (debug) {
-    msDebug("HTTP: Starting to prepare HTTP requests.\n");
-    if (pszCurlCABundle)
-      msDebug("Using CURL_CA_BUNDLE=%s\n", pszCurlCABundle);
+/*
+** Read the header of a cache entry.  Returns the offset of the body or
+** -1 if the file is not a valid cache entry.
+*/
+static long msHTTPCacheReadEntry(FILE *fp, httpCacheInfo *psCache)
+{
+  char szLine[MS_BUFFER_LENGTH];
+
+  if (fgets(szLine, sizeof(szLine), fp) == NULL ||
+      strncmp(szLine, MS_HTTP_CACHE_MAGIC, strlen(MS_HTTP_CACHE_MAGIC)) != 0)
+    return -1;
+
+  while (fgets(szLine, sizeof(szLine), fp) != NULL) {
+    char *pszValue;
+
+    msStringTrimEOL(szLine);
+    if (szLine[0] == '\0')
+      return ftell(fp);
+
+    if ((pszValue = strchr(szLine, ':')) == NULL)
+      continue;
+    *pszValue++ = '\0';
+    while (*pszValue == ' ')
+      pszValue++;
+
+    if (strcasecmp(szLine, "expires") == 0)
+      psCache->nExpires = (time_t)strtol(pszValue, NULL, 10);
+    else if (strcasecmp(szLine, "content-type") == 0 && *pszValue) {
+      msFree(psCache->pszContentType);
+      psCache->pszContentType = msStrdup(pszValue);
+    } else if (strcasecmp(szLine, "etag") == 0 && *pszValue) {
+      msFree(psCache->pszETag);
+      psCache->pszETag = msStrdup(pszValue);
+    } else if (strcasecmp(szLine, "last-modified") == 0 && *pszValue) {
+      msFree(psCache->pszLastModified);
+      psCache->pszLastModified = msStrdup(pszValue);
+    }
   }
 
-  /* Alloc a curl-multi handle, and add a curl-easy handle to it for each
-   * file to download.
-   */
-  multi_handle = curl_multi_init();
-  if (multi_handle == NULL) {
-    msSetError(MS_HTTPERR, "curl_multi_init() failed.",
-               "msHTTPExecuteRequests()");
-    return(MS_FAILURE);
+  return -1;
+}
+
+/*
+** Copy the body of the cache entry to the request output (file or
+** memory buffer).
+*/
+static int msHTTPCacheServe(httpRequestObj *psReq)
+{
+  httpCacheInfo *psCache = (httpCacheInfo *)psReq->cache_info;
+  httpCacheInfo sEntry;
+  FILE *fp, *fpOut = NULL;
+  long nBodyOffset, nEnd;
+  char szBuf[8192];
+  size_t nRead;
+
+  if ((fp = fopen(psCache->szPath, "rb")) == NULL)
+    return MS_FAILURE;
+
+  memset(&sEntry, 0, sizeof(sEntry));
+  nBodyOffset = msHTTPCacheReadEntry(fp, &sEntry);
+  msFree(sEntry.pszContentType);
+  msFree(sEntry.pszETag);
+  msFree(sEntry.pszLastModified);
+
+  if (nBodyOffset < 0 || fseek(fp, 0, SEEK_END) != 0) {
+    fclose(fp);
+    return MS_FAILURE;
   }
+  nEnd = ftell(fp);
+  fseek(fp, nBodyOffset, SEEK_SET);
 
-  for (i=0; i<numRequests; i++) {
-    CURL *http_handle;
-    FILE *fp;
+  if (psReq->pszOutputFile != NULL) {
+    if ((fpOut = fopen(psReq->pszOutputFile, "wb")) == NULL) {
+      fclose(fp);
+      return MS_FAILURE;
+    }
+  } else {
+    free(psReq->result_data);
+    psReq->result_buf_size = nEnd - nBodyOffset + 1;
+    psReq->result_data = (char *)msSmallMalloc(psReq->result_buf_size);
+    psReq->result_size = 0;
+  }
 
-    if (pasReqInfo[i].pszGetUrl == NULL ) {
-      msSetError(MS_HTTPERR, "URL or output file parameter missing.",
-                 "msHTTPExecuteRequests()");
-      return(MS_FAILURE);
+  while ((nRead = fread(szBuf, 1, sizeof(szBuf), fp)) > 0) {
+    if (fpOut)
+      fwrite(szBuf, 1, nRead, fpOut);
+    else if (psReq->result_size + nRead < psReq->result_buf_size) {
+      memcpy(psReq->result_data + psReq->result_size, szBuf, nRead);
+      psReq->result_size += nRead;
     }
+  }
+
+  fclose(fp);
+  if (fpOut)
+    fclose(fpOut);
+
+  /* Keep track of the last use of the entry for the size cap */
+  utime(psCache->szPath, NULL);
+
+  return MS_SUCCESS;
+}
+
+#ifndef _WIN32
+typedef struct {
+  char   *pszName;
+  time_t  nMTime;
+  long    nSize;
+} httpCacheEntry;
+
+static int msHTTPCacheCompareEntries(const void *a, const void *b)
+{
+  const httpCacheEntry *e1 = (const httpCacheEntry *)a;
+  const httpCacheEntry *e2 = (const httpCacheEntry *)b;
 
-    if (pasReqInfo[i].debug) {
-      msDebug("HTTP request: id=%d, %s\n",
-              pasReqInfo[i].nLayerId, pasReqInfo[i].pszGetUrl);
+  return (e1->nMTime < e2->nMTime) ? -1 : (e1->nMTime > e2->nMTime) ? 1 : 0;
+}
+#endif
+
+/*
+** Enforce the size cap of the cache directory by removing the least
+** recently used entries until the cache is back under 90% of the cap.
+*/
+static void msHTTPCachePrune(const char *pszCacheDir, int nMaxSizeMB)
+{
+#ifndef _WIN32
+  DIR *dir;
+  struct dirent *psDirEnt;
+  httpCacheEntry *pasEntries = NULL;
+  int numEntries = 0, maxEntries = 0, i;
+  double dTotalSize = 0, dMaxSize = nMaxSizeMB * 1024.0 * 1024.0;
+  char szPath[MS_MAXPATHLEN];
+
+  if ((dir = opendir(pszCacheDir)) == NULL)
+    return;
+
+  while ((psDirEnt = readdir(dir)) != NULL) {
+    struct stat sStat;
+
+    if (strlen(psDirEnt->d_name) <= 6 ||
+        strcmp(psDirEnt->d_name + strlen(psDirEnt->d_name) - 6, ".cache") != 0)
+      continue;
+
+    snprintf(szPath, sizeof(szPath), "%s/%s", pszCacheDir, psDirEnt->d_name);
+    if (stat(szPath, &sStat) != 0)
+      continue;
+
+    if (numEntries == maxEntries) {
+      maxEntries = maxEntries ? maxEntries * 2 : 256;
+      pasEntries = (httpCacheEntry *)msSmallRealloc(pasEntries,
+                   maxEntries * sizeof(httpCacheEntry));
     }
+    pasEntries[numEntries].pszName = msStrdup(psDirEnt->d_name);
+    pasEntries[numEntries].nMTime = sStat.st_mtime;
+    pasEntries[numEntries].nSize = (long)sStat.st_size;
+    dTotalSize += sStat.st_size;
+    numEntries++;
+  }
+  closedir(dir);
 
-    /* Reset some members */
-    pasReqInfo[i].nStatus = 0;
-    if (pasReqInfo[i].pszContentType)
-      free(pasReqInfo[i].pszContentType);
-    pasReqInfo[i].pszContentType = NULL;
+  if (dTotalSize > dMaxSize) {
+    qsort(pasEntries, numEntries, sizeof(httpCacheEntry),
+          msHTTPCacheCompareEntries);
 
-    /* Check local cache if requested */
-    if (bCheckLocalCache && pasReqInfo[i].pszOutputFile != NULL ) {
-      fp = fopen(pasReqInfo[i].pszOutputFile, "r");
-      if (fp) {
-        /* File already there, don't download again. */
-        if (pasReqInfo[i].debug)
-          msDebug("HTTP request: id=%d, found in cache, skipping.\n",
-                  pasReqInfo[i].nLayerId);
-        fclose(fp);
-        pasReqInfo[i].nStatus = 242;
-        pasReqInfo[i].pszContentType = msStrdup("unknown/cached");
-        continue;
-      }
+    for (i = 0; i < numEntries && dTotalSize > dMaxSize * 0.9; i++) {
+      snprintf(szPath, sizeof(szPath), "%s/%s", pszCacheDir,
+               pasEntries[i].pszName);
+      if (unlink(szPath) == 0)
+        dTotalSize -= pasEntries[i].nSize;
     }
+  }
 
-    /* Alloc curl handle */
-    http_handle = curl_easy_init();
-    if (http_handle == NULL) {
-      msSetError(MS_HTTPERR, "curl_easy_init() failed.",
-                 "msHTTPExecuteRequests()");
-      return(MS_FAILURE);
+  for (i = 0; i < numEntries; i++)
+    free(pasEntries[i].pszName);
+  free(pasEntries);
+#endif /* ndef _WIN32 */
+}
+
+/**********************************************************************
+ *                          msHTTPCacheLookup()
+ *
+ * Called before a request is sent.  If a fresh response is available in
+ * the cache then it is copied to the request output and MS_TRUE is
+ * returned.  Otherwise, if a stale response with validators is available,
+ * conditional request headers are added to the curl handle.
+ **********************************************************************/
+static int msHTTPCacheLookup(httpRequestObj *psReq)
+{
+  httpCacheInfo *psCache;
+  char szKey[33];
+  FILE *fp;
+
+  msHTTPCacheFreeInfo(psReq);
+
+  /* Only GET requests are cached */
+  if (psReq->pszCacheDir == NULL || psReq->pszPostRequest != NULL)
+    return MS_FALSE;
+
+  psReq->cache_info = psCache =
+                        (httpCacheInfo *)msSmallCalloc(1, sizeof(httpCacheInfo));
+
+  msHTTPCacheKey(psReq, szKey);
+  snprintf(psCache->szPath, sizeof(psCache->szPath), "%s/%s.cache",
+           psReq->pszCacheDir, szKey);
+
+  if ((fp = fopen(psCache->szPath, "rb")) == NULL)
+    return MS_FALSE;
+
+  if (msHTTPCacheReadEntry(fp, psCache) < 0) {
+    fclose(fp);
+    return MS_FALSE;
+  }
+  fclose(fp);
+
+  if (psCache->nExpires > time(NULL) &&
+      msHTTPCacheServe(psReq) == MS_SUCCESS) {
+    if (psReq->debug)
+      msDebug("HTTP request: id=%d, fresh response found in HTTP cache.\n",
+              psReq->nLayerId);
+    psReq->nStatus = 242;
+    psReq->pszContentType =
+      msStrdup(psCache->pszContentType ? psCache->pszContentType : "unknown/cached");
+    msHTTPCacheFreeInfo(psReq);
+    return MS_TRUE;
+  }
+
+  /* Stale entry: revalidate it if we can */
+  if (psCache->pszETag || psCache->pszLastModified) {
+    char szHeader[MS_BUFFER_LENGTH];
+
+    if (psCache->pszETag) {
+      snprintf(szHeader, sizeof(szHeader), "If-None-Match: %s",
+               psCache->pszETag);
+      psCache->headers = curl_slist_append(psCache->headers, szHeader);
+    }
+    if (psCache->pszLastModified) {
+      snprintf(szHeader, sizeof(szHeader), "If-Modified-Since: %s",
+               psCache->pszLastModified);
+      psCache->headers = curl_slist_append(psCache->headers, szHeader);
     }
+    psCache->bRevalidating = MS_TRUE;
 
-    pasReqInfo[i].curl_handle = http_handle;
+    if (psReq->debug)
+      msDebug("HTTP request: id=%d, revalidating stale HTTP cache entry.\n",
+              psReq->nLayerId);
+  }
 
-    /* set URL, note that curl keeps only a ref to our string buffer */
-    curl_easy_setopt(http_handle, CURLOPT_URL, pasReqInfo[i].pszGetUrl );
+  return MS_FALSE;
+}
 
-    /* Set User-Agent (auto-generate if not set by caller */
-    if (pasReqInfo[i].pszUserAgent == NULL) {
-      curl_version_info_data *psCurlVInfo;
+/**********************************************************************
+ *                          msHTTPCacheStore()
+ *
+ * Called once a request has completed.  Serves a 304 response from the
+ * cache and stores cacheable 200 responses.
+ **********************************************************************/
+static void msHTTPCacheStore(httpRequestObj *psReq)
+{
+  httpCacheInfo *psCache = (httpCacheInfo *)psReq->cache_info;
+  time_t nNow = time(NULL), nExpires = 0;
+  char szTmpPath[MS_MAXPATHLEN+64];
+  FILE *fp;
+  static int nStoreCount = 0; /* protected by TLOCK_OWS */
+  int bPrune;
+
+  if (psCache == NULL)
+    return;
+
+  if (psReq->nStatus == 304 && psCache->bRevalidating) {
+    if (msHTTPCacheServe(psReq) != MS_SUCCESS) {
+      msHTTPCacheFreeInfo(psReq);
+      return;
+    }
+    if (psReq->debug)
+      msDebug("HTTP request: id=%d, HTTP cache entry revalidated.\n",
+              psReq->nLayerId);
+    psReq->nStatus = 200;
+    if (psReq->pszContentType == NULL && psCache->pszContentType)
+      psReq->pszContentType = msStrdup(psCache->pszContentType);
+  } else if (psReq->nStatus != 200) {
+    return;
+  }
 
-      psCurlVInfo = curl_version_info(CURLVERSION_NOW);
+  /* Work out the freshness lifetime of the response */
+  if (psCache->pszCacheControl) {
+    char *pszCC = msStrdup(psCache->pszCacheControl);
+    const char *pszAge;
+    int bNoStore;
+
+    msStringToLower(pszCC);
+    bNoStore = (strstr(pszCC, "no-store") != NULL ||
+                strstr(pszCC, "private") != NULL);
+
+    if ((pszAge = strstr(pszCC, "s-maxage=")) != NULL)
+      nExpires = nNow + atol(pszAge + 9);
+    else if ((pszAge = strstr(pszCC, "max-age=")) != NULL)
+      nExpires = nNow + atol(pszAge + 8);
+    if (strstr(pszCC, "no-cache") != NULL)
+      nExpires = 0;
+    msFree(pszCC);
+
+    if (bNoStore) {
+      unlink(psCache->szPath);
+      return;
+    }
+  } else if (psCache->pszExpires) {
+    nExpires = curl_getdate(psCache->pszExpires, NULL);
+    if (nExpires < 0)
+      nExpires = 0;
+  }
 
-      pasReqInfo[i].pszUserAgent = (char*)msSmallMalloc(100*sizeof(char));
+  /* Nothing to gain from an entry that can neither be used nor revalidated */
+  if (nExpires <= nNow && !psCache->pszETag && !psCache->pszLastModified)
+    return;
+
+  /* Write the entry to a temporary file and move it in place so that */
+  /* concurrent readers never see a partial entry. */
+  snprintf(szTmpPath, sizeof(szTmpPath), "%s.%ld.%d.tmp", psCache->szPath,
+           (long)getpid(), msGetThreadId());
+
+  if ((fp = fopen(szTmpPath, "wb")) == NULL) {
+    /* Try to create the cache directory */
+    mkdir(psReq->pszCacheDir, 0777);
+    if ((fp = fopen(szTmpPath, "wb")) == NULL) {
+      if (psReq->debug)
+        msDebug("HTTP: unable to write HTTP cache entry %s.\n", szTmpPath);
+      return;
+    }
+  }
 
-      if (pasReqInfo[i].pszUserAgent) {
-        sprintf(pasReqInfo[i].pszUserAgent,
-                "MapServer/%s libcurl/%d.%d.%d",
-                MS_VERSION,
-                psCurlVInfo->version_num/0x10000 & 0xff,
-                psCurlVInfo->version_num/0x100 & 0xff,
-                psCurlVInfo->version_num & 0xff );
-      }
+  fprintf(fp, "%s\n", MS_HTTP_CACHE_MAGIC);
+  fprintf(fp, "expires: %ld\n", (long)nExpires);
+  fprintf(fp, "content-type: %s\n",
+          psReq->pszContentType ? psReq->pszContentType : "");
+  fprintf(fp, "etag: %s\n", psCache->pszETag ? psCache->pszETag : "");
+  fprintf(fp, "last-modified: %s\n",
+          psCache->pszLastModified ? psCache->pszLastModified : "");
+  fprintf(fp, "url: %s\n\n", psReq->pszGetUrl);
+
+  if (psReq->pszOutputFile != NULL) {
+    FILE *fpIn;
+    char szBuf[8192];
+    size_t nRead;
+
+    if ((fpIn = fopen(psReq->pszOutputFile, "rb")) != NULL) {
+      while ((nRead = fread(szBuf, 1, sizeof(szBuf), fpIn)) > 0)
+        fwrite(szBuf, 1, nRead, fp);
+      fclose(fpIn);
     }
-    if (pasReqInfo[i].pszUserAgent) {
-      curl_easy_setopt(http_handle,
-                       CURLOPT_USERAGENT, pasReqInfo[i].pszUserAgent );
+  } else if (psReq->result_data != NULL) {
+    fwrite(psReq->result_data, 1, psReq->result_size, fp);
+  }
+
+  if (fclose(fp) != 0 || rename(szTmpPath, psCache->szPath) != 0) {
+    unlink(szTmpPath);
+    return;
+  }
+
+  if (psReq->nCacheMaxSize > 0) {
+    msAcquireLock(TLOCK_OWS);
+    bPrune = ((nStoreCount++ % 16) == 0);
+    msReleaseLock(TLOCK_OWS);
+    if (bPrune)
+      msHTTPCachePrune(psReq->pszCacheDir, psReq->nCacheMaxSize);
+  }
+}
+
+/**********************************************************************
+ *                          httpRequestBatchObj
+ *
+ * State of a set of requests started with msHTTPStartRequests().  When
+ * thread support is available the curl-multi download loop is run in a
+ * background thread so that the caller can keep working (e.g. drawing
+ * local layers) while the remote responses are coming in.  Otherwise the
+ * transfers are progressed by msHTTPPollRequests() and
+ * msHTTPWaitRequests() from the calling thread.
+ *
+ * Only the thread running the download loop touches the multi handle.
+ * Completed easy handles are removed from the multi handle by that
+ * thread and flagged as done, after which they belong to the caller again
+ * (see msHTTPFinalizeRequest()).
+ **********************************************************************/
+#if defined(USE_THREAD) && !defined(_WIN32)
+#define MS_HTTP_THREADED_REQUESTS
+#include <pthread.h>
+#endif
+
+struct http_request_batch {
+  httpRequestObj *pasReqInfo;
+  int             numRequests;
+  int             nTimeout;
+  int             debug;
+  CURLM          *multi_handle;
+  int             still_running;
+
+  int             bThreaded;
+#ifdef MS_HTTP_THREADED_REQUESTS
+  pthread_t       thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  int             bCancel;
+  int             bThreadDone;
+#endif
+};
+
+/**********************************************************************
+ *                          msHTTPPrepareRequest()
+ *
+ * Alloc and configure the curl easy handle for one request and add it
+ * to the multi handle.
+ *
+ * Returns MS_SUCCESS/MS_FAILURE.
+ **********************************************************************/
+static int msHTTPPrepareRequest(httpRequestObj *psReq, CURLM *multi_handle,
+                                int nTimeout, int bCheckLocalCache,
+                                const char *pszCurlCABundle)
+{
+  CURL *http_handle;
+  FILE *fp;
+
+  if (psReq->pszGetUrl == NULL ) {
+    msSetError(MS_HTTPERR, "URL or output file parameter missing.",
+               "msHTTPExecuteRequests()");
+    return(MS_FAILURE);
+  }
+
+  if (psReq->debug) {
+    msDebug("HTTP request: id=%d, %s\n",
+            psReq->nLayerId, psReq->pszGetUrl);
+  }
+
+  /* Reset some members */
+  psReq->nStatus = 0;
+  psReq->done = MS_FALSE;
+  psReq->nBytesWritten = 0;
+  psReq->nWriteError = 0;
+  if (psReq->pszContentType)
+    free(psReq->pszContentType);
+  psReq->pszContentType = NULL;
+
+  /* Check local cache if requested */
+  if (bCheckLocalCache && psReq->pszOutputFile != NULL ) {
+    fp = fopen(psReq->pszOutputFile, "r");
+    if (fp) {
+      /* File already there, don't download again. */
+      if (psReq->debug)
+        msDebug("HTTP request: id=%d, found in cache, skipping.\n",
+                psReq->nLayerId);
+      fclose(fp);
+      psReq->nStatus = 242;
+      psReq->pszContentType = msStrdup("unknown/cached");
+      psReq->done = MS_TRUE;
+      return MS_SUCCESS;
     }
+  }
 
-    /* Enable following redirections.  Requires libcurl 7.10.1 at least */
-    curl_easy_setopt(http_handle, CURLOPT_FOLLOWLOCATION, 1 );
-    curl_easy_setopt(http_handle, CURLOPT_MAXREDIRS, 10 );
+  /* Check the HTTP response cache if enabled */
+  if (msHTTPCacheLookup(psReq)) {
+    psReq->done = MS_TRUE;
+    return MS_SUCCESS;
+  }
 
-    /* Set timeout.*/
-    curl_easy_setopt(http_handle, CURLOPT_TIMEOUT, nTimeout );
+  /* Alloc curl handle */
+  http_handle = curl_easy_init();
+  if (http_handle == NULL) {
+    msSetError(MS_HTTPERR, "curl_easy_init() failed.",
+               "msHTTPExecuteRequests()");
+    return(MS_FAILURE);
+  }
 
-    /* Pass CURL_CA_BUNDLE if set */
-    if (pszCurlCABundle)
-      curl_easy_setopt(http_handle, CURLOPT_CAINFO, pszCurlCABundle );
+  psReq->curl_handle = http_handle;
 
-    /* Set proxying settings */
-    if (pasReqInfo[i].pszProxyAddress != NULL
-        && strlen(pasReqInfo[i].pszProxyAddress) > 0) {
-      long    nProxyType     = CURLPROXY_HTTP;
+  /* set URL, note that curl keeps only a ref to our string buffer */
+  curl_easy_setopt(http_handle, CURLOPT_URL, psReq->pszGetUrl );
 
-      curl_easy_setopt(http_handle, CURLOPT_PROXY,
-                       pasReqInfo[i].pszProxyAddress);
+  /* Set User-Agent (auto-generate if not set by caller */
+  if (psReq->pszUserAgent == NULL) {
+    curl_version_info_data *psCurlVInfo;
 
-      if (pasReqInfo[i].nProxyPort > 0
-          && pasReqInfo[i].nProxyPort < 65535) {
-        curl_easy_setopt(http_handle, CURLOPT_PROXYPORT,
-                         pasReqInfo[i].nProxyPort);
-      }
+    psCurlVInfo = curl_version_info(CURLVERSION_NOW);
 
-      switch (pasReqInfo[i].eProxyType) {
-        case MS_HTTP:
-          nProxyType = CURLPROXY_HTTP;
-          break;
-        case MS_SOCKS5:
-          nProxyType = CURLPROXY_SOCKS5;
-          break;
-      }
-      curl_easy_setopt(http_handle, CURLOPT_PROXYTYPE, nProxyType);
-
-      /* If there is proxy authentication information, set it */
-      if (pasReqInfo[i].pszProxyUsername != NULL
-          && pasReqInfo[i].pszProxyPassword != NULL
-          && strlen(pasReqInfo[i].pszProxyUsername) > 0
-          && strlen(pasReqInfo[i].pszProxyPassword) > 0) {
-        char    szUsernamePasswd[128];
-#ifdef USE_CURLOPT_PROXYAUTH
-        long    nProxyAuthType = CURLAUTH_BASIC;
-        /* CURLOPT_PROXYAUTH available only in Curl 7.10.7 and up */
-        nProxyAuthType = msGetCURLAuthType(pasReqInfo[i].eProxyAuthType);
-        curl_easy_setopt(http_handle, CURLOPT_PROXYAUTH, nProxyAuthType);
-#else
-        /* We log an error but don't abort processing */
-        msSetError(MS_HTTPERR, "CURLOPT_PROXYAUTH not supported. Requires Curl 7.10.7 and up. *_proxy_auth_type setting ignored.",
-                   "msHTTPExecuteRequests()");
-#endif /* CURLOPT_PROXYAUTH */
+    psReq->pszUserAgent = (char*)msSmallMalloc(100*sizeof(char));
 
-        snprintf(szUsernamePasswd, 127, "%s:%s",
-                 pasReqInfo[i].pszProxyUsername,
-                 pasReqInfo[i].pszProxyPassword);
-        curl_easy_setopt(http_handle, CURLOPT_PROXYUSERPWD,
-                         szUsernamePasswd);
-      }
+    if (psReq->pszUserAgent) {
+      sprintf(psReq->pszUserAgent,
+              "MapServer/%s libcurl/%d.%d.%d",
+              MS_VERSION,
+              psCurlVInfo->version_num/0x10000 & 0xff,
+              psCurlVInfo->version_num/0x100 & 0xff,
+              psCurlVInfo->version_num & 0xff );
+    }
+  }
+  if (psReq->pszUserAgent) {
+    curl_easy_setopt(http_handle,
+                     CURLOPT_USERAGENT, psReq->pszUserAgent );
+  }
+
+  /* Enable following redirections.  Requires libcurl 7.10.1 at least */
+  curl_easy_setopt(http_handle, CURLOPT_FOLLOWLOCATION, 1 );
+  curl_easy_setopt(http_handle, CURLOPT_MAXREDIRS, 10 );
+
+  /* Set timeout.*/
+  curl_easy_setopt(http_handle, CURLOPT_TIMEOUT, nTimeout );
+
+  /* Pass CURL_CA_BUNDLE if set */
+  if (pszCurlCABundle)
+    curl_easy_setopt(http_handle, CURLOPT_CAINFO, pszCurlCABundle );
+
+  /* Set proxying settings */
+  if (psReq->pszProxyAddress != NULL
+      && strlen(psReq->pszProxyAddress) > 0) {
+    long    nProxyType     = CURLPROXY_HTTP;
+
+    curl_easy_setopt(http_handle, CURLOPT_PROXY,
+                     psReq->pszProxyAddress);
+
+    if (psReq->nProxyPort > 0
+        && psReq->nProxyPort < 65535) {
+      curl_easy_setopt(http_handle, CURLOPT_PROXYPORT,
+                       psReq->nProxyPort);
     }
 
-    /* Set HTTP Authentication settings */
-    if (pasReqInfo[i].pszHttpUsername != NULL
-        && pasReqInfo[i].pszHttpPassword != NULL
-        && strlen(pasReqInfo[i].pszHttpUsername) > 0
-        && strlen(pasReqInfo[i].pszHttpPassword) > 0) {
+    switch (psReq->eProxyType) {
+      case MS_HTTP:
+        nProxyType = CURLPROXY_HTTP;
+        break;
+      case MS_SOCKS5:
+        nProxyType = CURLPROXY_SOCKS5;
+        break;
+    }
+    curl_easy_setopt(http_handle, CURLOPT_PROXYTYPE, nProxyType);
+
+    /* If there is proxy authentication information, set it */
+    if (psReq->pszProxyUsername != NULL
+        && psReq->pszProxyPassword != NULL
+        && strlen(psReq->pszProxyUsername) > 0
+        && strlen(psReq->pszProxyPassword) > 0) {
       char    szUsernamePasswd[128];
-      long    nHttpAuthType = CURLAUTH_BASIC;
+#ifdef USE_CURLOPT_PROXYAUTH
+      long    nProxyAuthType = CURLAUTH_BASIC;
+      /* CURLOPT_PROXYAUTH available only in Curl 7.10.7 and up */
+      nProxyAuthType = msGetCURLAuthType(psReq->eProxyAuthType);
+      curl_easy_setopt(http_handle, CURLOPT_PROXYAUTH, nProxyAuthType);
+#else
+      /* We log an error but don't abort processing */
+      msSetError(MS_HTTPERR, "CURLOPT_PROXYAUTH not supported. Requires Curl 7.10.7 and up. *_proxy_auth_type setting ignored.",
+                 "msHTTPExecuteRequests()");
+#endif /* CURLOPT_PROXYAUTH */
 
       snprintf(szUsernamePasswd, 127, "%s:%s",
-               pasReqInfo[i].pszHttpUsername,
-               pasReqInfo[i].pszHttpPassword);
-      curl_easy_setopt(http_handle, CURLOPT_USERPWD,
+               psReq->pszProxyUsername,
+               psReq->pszProxyPassword);
+      curl_easy_setopt(http_handle, CURLOPT_PROXYUSERPWD,
                        szUsernamePasswd);
-
-      nHttpAuthType = msGetCURLAuthType(pasReqInfo[i].eHttpAuthType);
-      curl_easy_setopt(http_handle, CURLOPT_HTTPAUTH, nHttpAuthType);
     }
+  }
 
-    /* NOSIGNAL should be set to true for timeout to work in multithread
-     * environments on Unix, requires libcurl 7.10 or more recent.
-     * (this force avoiding the use of sgnal handlers)
-     */
+  /* Set HTTP Authentication settings */
+  if (psReq->pszHttpUsername != NULL
+      && psReq->pszHttpPassword != NULL
+      && strlen(psReq->pszHttpUsername) > 0
+      && strlen(psReq->pszHttpPassword) > 0) {
+    char    szUsernamePasswd[128];
+    long    nHttpAuthType = CURLAUTH_BASIC;
+
+    snprintf(szUsernamePasswd, 127, "%s:%s",
+             psReq->pszHttpUsername,
+             psReq->pszHttpPassword);
+    curl_easy_setopt(http_handle, CURLOPT_USERPWD,
+                     szUsernamePasswd);
+
+    nHttpAuthType = msGetCURLAuthType(psReq->eHttpAuthType);
+    curl_easy_setopt(http_handle, CURLOPT_HTTPAUTH, nHttpAuthType);
+  }
+
+  /* NOSIGNAL should be set to true for timeout to work in multithread
+   * environments on Unix, requires libcurl 7.10 or more recent.
+   * (this force avoiding the use of sgnal handlers)
+   */
 #ifdef CURLOPT_NOSIGNAL
-    curl_easy_setopt(http_handle, CURLOPT_NOSIGNAL, 1 );
+  curl_easy_setopt(http_handle, CURLOPT_NOSIGNAL, 1 );
 #endif
 
-    /* If we are writing file to disk, open the file now. */
-    if( pasReqInfo[i].pszOutputFile != NULL ) {
-      if ( (fp = fopen(pasReqInfo[i].pszOutputFile, "wb")) == NULL) {
-        msSetError(MS_HTTPERR, "Can't open output file %s.",
-                   "msHTTPExecuteRequests()", pasReqInfo[i].pszOutputFile);
-        return(MS_FAILURE);
-      }
-
-      pasReqInfo[i].fp = fp;
+  /* If we are writing file to disk, open the file now. */
+  if( psReq->pszOutputFile != NULL ) {
+    if ( (fp = fopen(psReq->pszOutputFile, "wb")) == NULL) {
+      msSetError(MS_HTTPERR, "Can't open output file %s.",
+                 "msHTTPExecuteRequests()", psReq->pszOutputFile);
+      return(MS_FAILURE);
     }
 
-    curl_easy_setopt(http_handle, CURLOPT_WRITEDATA, &(pasReqInfo[i]));
-    curl_easy_setopt(http_handle, CURLOPT_WRITEFUNCTION, msHTTPWriteFct);
+    psReq->fp = fp;
+  }
 
-    /* Provide a buffer where libcurl can write human readable error msgs
-     */
-    if (pasReqInfo[i].pszErrBuf == NULL)
-      pasReqInfo[i].pszErrBuf = (char *)msSmallMalloc((CURL_ERROR_SIZE+1)*
-                                sizeof(char));
-    pasReqInfo[i].pszErrBuf[0] = '\0';
-
-    curl_easy_setopt(http_handle, CURLOPT_ERRORBUFFER,
-                     pasReqInfo[i].pszErrBuf);
-
-    if(pasReqInfo[i].pszPostRequest != NULL ) {
-      char szBuf[100];
-
-      struct curl_slist *headers=NULL;
-      snprintf(szBuf, 100,
-               "Content-Type: %s", pasReqInfo[i].pszPostContentType);
-      headers = curl_slist_append(headers, szBuf);
-
-      curl_easy_setopt(http_handle, CURLOPT_POST, 1 );
-      curl_easy_setopt(http_handle, CURLOPT_POSTFIELDS,
-                       pasReqInfo[i].pszPostRequest);
-      curl_easy_setopt(http_handle, CURLOPT_HTTPHEADER, headers);
-      /* curl_slist_free_all(headers); */ /* free the header list */
-    }
-
-    /* Added by RFC-42 HTTP Cookie Forwarding */
-    if(pasReqInfo[i].pszHTTPCookieData != NULL) {
-      /* Check if there's no end of line in the Cookie string */
-      /* This could break the HTTP Header */
-      int nPos;
-
-      for(nPos=0; nPos<strlen(pasReqInfo[i].pszHTTPCookieData); nPos++) {
-        if(pasReqInfo[i].pszHTTPCookieData[nPos] == '\n') {
-          msSetError(MS_HTTPERR, "Can't use cookie containing a newline character.",
-                     "msHTTPExecuteRequests()");
-          return(MS_FAILURE);
-        }
-      }
+  curl_easy_setopt(http_handle, CURLOPT_WRITEDATA, psReq);
+  curl_easy_setopt(http_handle, CURLOPT_WRITEFUNCTION, msHTTPWriteFct);
 
-      /* Set the Curl option to send Cookie */
-      curl_easy_setopt(http_handle, CURLOPT_COOKIE,
-                       pasReqInfo[i].pszHTTPCookieData);
-    }
+  /* Response headers and conditional requests used by the HTTP cache */
+  if (psReq->cache_info != NULL) {
+    httpCacheInfo *psCache = (httpCacheInfo *)psReq->cache_info;
 
-    /* Add to multi handle */
-    curl_multi_add_handle(multi_handle, http_handle);
+    curl_easy_setopt(http_handle, CURLOPT_HEADERDATA, psReq);
+    curl_easy_setopt(http_handle, CURLOPT_HEADERFUNCTION, msHTTPHeaderFct);
+    if (psCache->headers)
+      curl_easy_setopt(http_handle, CURLOPT_HTTPHEADER, psCache->headers);
+  }
 
+  /* Provide a buffer where libcurl can write human readable error msgs
+   */
+  if (psReq->pszErrBuf == NULL)
+    psReq->pszErrBuf = (char *)msSmallMalloc((CURL_ERROR_SIZE+1)*
+                       sizeof(char));
+  psReq->pszErrBuf[0] = '\0';
+
+  curl_easy_setopt(http_handle, CURLOPT_ERRORBUFFER,
+                   psReq->pszErrBuf);
+
+  if(psReq->pszPostRequest != NULL ) {
+    char szBuf[100];
+
+    struct curl_slist *headers=NULL;
+    snprintf(szBuf, 100,
+             "Content-Type: %s", psReq->pszPostContentType);
+    headers = curl_slist_append(headers, szBuf);
+
+    curl_easy_setopt(http_handle, CURLOPT_POST, 1 );
+    curl_easy_setopt(http_handle, CURLOPT_POSTFIELDS,
+                     psReq->pszPostRequest);
+    curl_easy_setopt(http_handle, CURLOPT_HTTPHEADER, headers);
+    /* curl_slist_free_all(headers); */ /* free the header list */
   }
 
-  if (debug) {
-    msDebug("HTTP: Before download loop\n");
+  /* Added by RFC-42 HTTP Cookie Forwarding */
+  if(psReq->pszHTTPCookieData != NULL) {
+    /* Check if there's no end of line in the Cookie string */
+    /* This could break the HTTP Header */
+    int nPos;
+
+    for(nPos=0; nPos<strlen(psReq->pszHTTPCookieData); nPos++) {
+      if(psReq->pszHTTPCookieData[nPos] == '\n') {
+        msSetError(MS_HTTPERR, "Can't use cookie containing a newline character.",
+                   "msHTTPExecuteRequests()");
+        return(MS_FAILURE);
+      }
+    }
+
+    /* Set the Curl option to send Cookie */
+    curl_easy_setopt(http_handle, CURLOPT_COOKIE,
+                     psReq->pszHTTPCookieData);
   }
 
-  /* DOWNLOAD LOOP ... inspired from multi-double.c example */
+  /* Add to multi handle */
+  curl_multi_add_handle(multi_handle, http_handle);
 
-  /* we start some action by calling perform right away */
-  while(CURLM_CALL_MULTI_PERFORM ==
-        curl_multi_perform(multi_handle, &still_running));
+  return MS_SUCCESS;
+}
 
-  while(still_running) {
+/**********************************************************************
+ *                          msHTTPPerform()
+ *
+ * Run one iteration of the download loop.  If bBlock is MS_TRUE then
+ * wait (up to 100ms) for activity on the sockets before performing.
+ *
+ * Completed transfers are removed from the multi handle and flagged as
+ * done.  Must only be called by the thread that owns the download loop,
+ * and must not call msSetError()/msDebug() since this may run in a
+ * background thread.
+ **********************************************************************/
+static void msHTTPPerform(httpRequestBatchObj *psBatch, int bBlock)
+{
+  CURLMsg *curl_msg;
+  int num_msgs = 0;
+
+  if (bBlock) {
     struct timeval timeout;
     int rc; /* select() return code */
 
@@ -594,7 +1128,7 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
     timeout.tv_usec = 100000;
 
     /* get file descriptors from the transfers */
-    curl_multi_fdset(multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
+    curl_multi_fdset(psBatch->multi_handle, &fdread, &fdwrite, &fdexcep, &maxfd);
 
     rc = select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
 
@@ -615,164 +1149,538 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
       case 0:
       default:
         /* timeout or readable/writable sockets */
-        curl_multi_perform(multi_handle, &still_running);
+        while(CURLM_CALL_MULTI_PERFORM ==
+              curl_multi_perform(psBatch->multi_handle, &psBatch->still_running));
         break;
     }
+  } else {
+    while(CURLM_CALL_MULTI_PERFORM ==
+          curl_multi_perform(psBatch->multi_handle, &psBatch->still_running));
   }
 
-  if (debug)
-    msDebug("HTTP: After download loop\n");
-
-  /* Scan message stack from CURL and report fatal errors*/
+  /* Scan message stack from CURL for completed transfers */
+  while((curl_msg = curl_multi_info_read(psBatch->multi_handle, &num_msgs)) != NULL) {
+    int i;
 
-  while((curl_msg = curl_multi_info_read( multi_handle, &num_msgs)) != NULL) {
-    httpRequestObj *psReq = NULL;
+    if (curl_msg->msg != CURLMSG_DONE)
+      continue;
 
-    if (curl_msg->msg == CURLMSG_DONE &&
-        curl_msg->data.result != CURLE_OK) {
-      /* Something went wrong with this transfer... report error */
+    for (i=0; i<psBatch->numRequests; i++) {
+      httpRequestObj *psReq = &(psBatch->pasReqInfo[i]);
 
-      for (i=0; i<numRequests; i++) {
-        if (pasReqInfo[i].curl_handle == curl_msg->easy_handle) {
-          psReq = &(pasReqInfo[i]);
-          break;
-        }
-      }
+      if (psReq->curl_handle != curl_msg->easy_handle)
+        continue;
 
-      if (psReq != NULL) {
-        /* Record error code in nStatus as a negative value */
+      /* Record error code in nStatus as a negative value */
+      if (curl_msg->data.result != CURLE_OK)
         psReq->nStatus = -curl_msg->data.result;
-      }
+
+      /* From now on the easy handle is not used by the download loop */
+      curl_multi_remove_handle(psBatch->multi_handle, psReq->curl_handle);
+
+#ifdef MS_HTTP_THREADED_REQUESTS
+      if (psBatch->bThreaded) {
+        pthread_mutex_lock(&psBatch->mutex);
+        psReq->done = MS_TRUE;
+        pthread_cond_broadcast(&psBatch->cond);
+        pthread_mutex_unlock(&psBatch->mutex);
+      } else
+#endif
+        psReq->done = MS_TRUE;
+      break;
+    }
+  }
+}
+
+#ifdef MS_HTTP_THREADED_REQUESTS
+/**********************************************************************
+ *                          msHTTPRequestThread()
+ *
+ * Background download loop.
+ **********************************************************************/
+static void *msHTTPRequestThread(void *pArg)
+{
+  httpRequestBatchObj *psBatch = (httpRequestBatchObj *)pArg;
+
+  for (;;) {
+    int bCancel;
+
+    pthread_mutex_lock(&psBatch->mutex);
+    bCancel = psBatch->bCancel;
+    pthread_mutex_unlock(&psBatch->mutex);
+
+    if (bCancel || !psBatch->still_running)
+      break;
+
+    msHTTPPerform(psBatch, MS_TRUE);
+  }
+
+  pthread_mutex_lock(&psBatch->mutex);
+  psBatch->bThreadDone = MS_TRUE;
+  pthread_cond_broadcast(&psBatch->cond);
+  pthread_mutex_unlock(&psBatch->mutex);
+
+  return NULL;
+}
+#endif
+
+/**********************************************************************
+ *                          msHTTPFinalizeRequest()
+ *
+ * Called from the caller's thread once a transfer is done (or has been
+ * cancelled): close the output file, fetch the HTTP status and content
+ * type, report errors and cleanup the curl handle.
+ *
+ * Returns MS_SUCCESS if the request succeeded, MS_DONE otherwise.
+ **********************************************************************/
+static int msHTTPFinalizeRequest(httpRequestBatchObj *psBatch,
+                                 httpRequestObj *psReq, int bReportErrors)
+{
+  CURL *http_handle;
+  long lVal=0;
+  int nTimeout = psBatch->nTimeout;
+
+  if (psReq->curl_handle == NULL)
+    /* Nothing to do here, either this file was in cache already or */
+    /* the request has already been finalized. */
+    return MS_HTTP_SUCCESS(psReq->nStatus) ? MS_SUCCESS : MS_DONE;
+
+  if (psReq->fp)
+    fclose(psReq->fp);
+  psReq->fp = NULL;
+
+  http_handle = (CURL*)(psReq->curl_handle);
+
+  if (psReq->nStatus == 0 &&
+      curl_easy_getinfo(http_handle,
+                        CURLINFO_HTTP_CODE, &lVal) == CURLE_OK) {
+    char *pszContentType = NULL;
+
+    psReq->nStatus = lVal;
+
+    /* Fetch content type of response */
+    if (curl_easy_getinfo(http_handle,
+                          CURLINFO_CONTENT_TYPE,
+                          &pszContentType) == CURLE_OK &&
+        pszContentType != NULL) {
+      psReq->pszContentType = msStrdup(pszContentType);
     }
   }
 
+  if (psReq->debug)
+    msDebug("msHTTPWriteFct(id=%d, %d bytes)\n",
+            psReq->nLayerId, psReq->nBytesWritten);
+
+  if (psReq->nWriteError > 0) {
+    msSetError(MS_HTTPERR,
+               "Unable to grow HTTP result buffer to size %d.",
+               "msHTTPWriteFct()",
+               psReq->nWriteError );
+    free( psReq->result_data );
+    psReq->result_data = NULL;
+    psReq->result_buf_size = 0;
+    psReq->result_size = 0;
+  }
+
+  /* Serve 304 responses from the HTTP cache, or add the response to it */
+  if (psReq->cache_info != NULL) {
+    msHTTPCacheStore(psReq);
+    msHTTPCacheFreeInfo(psReq);
+  }
+
+  if (!MS_HTTP_SUCCESS(psReq->nStatus) && bReportErrors) {
+    if (psReq->nStatus == -(CURLE_OPERATION_TIMEOUTED)) {
+      /* Timeout isn't a fatal error */
+      if (psReq->debug)
+        msDebug("HTTP: TIMEOUT of %d seconds exceeded for %s\n",
+                nTimeout, psReq->pszGetUrl );
+
+      msSetError(MS_HTTPERR,
+                 "HTTP: TIMEOUT of %d seconds exceeded for %s\n",
+                 "msHTTPExecuteRequests()",
+                 nTimeout, psReq->pszGetUrl);
+
+      /* Rewrite error message, the curl timeout message isn't
+       * of much use to our users.
+       */
+      sprintf(psReq->pszErrBuf,
+              "TIMEOUT of %d seconds exceeded.", nTimeout);
+    } else if (psReq->nStatus > 0) {
+      /* Got an HTTP Error, e.g. 404, etc. */
+
+      if (psReq->debug)
+        msDebug("HTTP: HTTP GET request failed with status %d (%s)"
+                " for %s\n",
+                psReq->nStatus, psReq->pszErrBuf,
+                psReq->pszGetUrl);
+
+      msSetError(MS_HTTPERR,
+                 "HTTP GET request failed with status %d (%s) "
+                 "for %s",
+                 "msHTTPExecuteRequests()", psReq->nStatus,
+                 psReq->pszErrBuf, psReq->pszGetUrl);
+    } else {
+      /* Got a curl error */
+
+      if (psReq->debug)
+        msDebug("HTTP: request failed with curl error "
+                "code %d (%s) for %s",
+                -psReq->nStatus, psReq->pszErrBuf,
+                psReq->pszGetUrl);
+
+      msSetError(MS_HTTPERR,
+                 "HTTP: request failed with curl error "
+                 "code %d (%s) for %s",
+                 "msHTTPExecuteRequests()",
+                 -psReq->nStatus, psReq->pszErrBuf,
+                 psReq->pszGetUrl);
+    }
+  }
+
+  /* Report download times foreach handle, in debug mode */
+  if (psReq->debug) {
+    double dConnectTime=0.0, dTotalTime=0.0, dStartTfrTime=0.0;
+
+    curl_easy_getinfo(http_handle,
+                      CURLINFO_CONNECT_TIME, &dConnectTime);
+    curl_easy_getinfo(http_handle,
+                      CURLINFO_STARTTRANSFER_TIME, &dStartTfrTime);
+    curl_easy_getinfo(http_handle,
+                      CURLINFO_TOTAL_TIME, &dTotalTime);
+    /* STARTTRANSFER_TIME includes CONNECT_TIME, but TOTAL_TIME
+     * doesn't, so we need to add it.
+     */
+    dTotalTime += dConnectTime;
+
+    msDebug("Layer %d: %.3f + %.3f + %.3f = %.3fs\n", psReq->nLayerId,
+            dConnectTime, dStartTfrTime-dConnectTime,
+            dTotalTime-dStartTfrTime, dTotalTime);
+  }
+
+  /* Cleanup this handle (already removed from the multi handle) */
+  curl_easy_setopt(http_handle, CURLOPT_URL, "" );
+  curl_easy_cleanup(http_handle);
+  psReq->curl_handle = NULL;
+
+  return MS_HTTP_SUCCESS(psReq->nStatus) ? MS_SUCCESS : MS_DONE;
+}
+
+/**********************************************************************
+ *                          msHTTPStartRequests()
+ *
+ * Start downloading a set of requests in parallel and return immediately.
+ * The transfers keep running in the background (or are progressed by
+ * msHTTPPollRequests() when thread support is not available) until
+ * msHTTPWaitRequests() or msHTTPEndRequests() is called.
+ *
+ * If bCheckLocalCache==MS_TRUE then if the pszOutputfile already exists
+ * then is is not downloaded again, and status 242 is returned.
+ *
+ * pasReqInfo must not be freed before msHTTPEndRequests() has been
+ * called on the returned handle.
+ *
+ * Returns NULL if a fatal error happened.
+ **********************************************************************/
+static httpRequestBatchObj *msHTTPStartRequestsEx(httpRequestObj *pasReqInfo,
+    int numRequests,
+    int bCheckLocalCache,
+    int bThreaded)
+{
+  int     i, nTimeout;
+  char     debug = MS_FALSE;
+  const char *pszCurlCABundle = NULL;
+  httpRequestBatchObj *psBatch;
+
+  if (!gbCurlInitialized)
+    msHTTPInit();
+
+  /* Establish the timeout (seconds) for how long we are going to wait
+   * for a response.
+   * We use the longest timeout value in the array of requests
+   */
+  nTimeout = (numRequests > 0) ? pasReqInfo[0].nTimeout : 0;
+  for (i=0; i<numRequests; i++) {
+    if (pasReqInfo[i].nTimeout > nTimeout)
+      nTimeout = pasReqInfo[i].nTimeout;
+
+    if (pasReqInfo[i].debug)
+      debug = MS_TRUE;  /* For the download loop */
+  }
+
+  if (nTimeout <= 0)
+    nTimeout = 30;
+
+  /* Check if we've got a CURL_CA_BUNDLE env. var.
+   * If set then the value is the full path to the ca-bundle.crt file
+   * e.g. CURL_CA_BUNDLE=/usr/local/share/curl/curl-ca-bundle.crt
+   */
+  pszCurlCABundle = getenv("CURL_CA_BUNDLE");
+
   if (debug) {
-    /* Print a msDebug header for timings reported in the loop below */
-    msDebug("msHTTPExecuteRequests() timing summary per layer (connect_time + time_to_first_packet + download_time = total_time in seconds)\n");
+    msDebug("HTTP: Starting to prepare HTTP requests.\n");
+    if (pszCurlCABundle)
+      msDebug("Using CURL_CA_BUNDLE=%s\n", pszCurlCABundle);
   }
 
-  /* Check status of all requests, close files, report errors and cleanup
-   * handles
+  psBatch = (httpRequestBatchObj *)calloc(1, sizeof(httpRequestBatchObj));
+  MS_CHECK_ALLOC(psBatch, sizeof(httpRequestBatchObj), NULL);
+
+  psBatch->pasReqInfo = pasReqInfo;
+  psBatch->numRequests = numRequests;
+  psBatch->nTimeout = nTimeout;
+  psBatch->debug = debug;
+  psBatch->bThreaded = MS_FALSE;
+
+  /* Alloc a curl-multi handle, and add a curl-easy handle to it for each
+   * file to download.
    */
+  psBatch->multi_handle = curl_multi_init();
+  if (psBatch->multi_handle == NULL) {
+    msSetError(MS_HTTPERR, "curl_multi_init() failed.",
+               "msHTTPExecuteRequests()");
+    free(psBatch);
+    return(NULL);
+  }
+
   for (i=0; i<numRequests; i++) {
-    httpRequestObj *psReq;
-    CURL *http_handle;
-    long lVal=0;
+    if (msHTTPPrepareRequest(&(pasReqInfo[i]), psBatch->multi_handle,
+                             nTimeout, bCheckLocalCache,
+                             pszCurlCABundle) != MS_SUCCESS) {
+      msHTTPEndRequests(psBatch, MS_TRUE);
+      return(NULL);
+    }
+  }
 
-    psReq = &(pasReqInfo[i]);
+  if (debug) {
+    msDebug("HTTP: Before download loop\n");
+  }
 
-    if (psReq->nStatus == 242)
-      continue;  /* Nothing to do here, this file was in cache already */
+  /* DOWNLOAD LOOP ... inspired from multi-double.c example */
 
-    if (psReq->fp)
-      fclose(psReq->fp);
-    psReq->fp = NULL;
+  /* we start some action by calling perform right away */
+  msHTTPPerform(psBatch, MS_FALSE);
+
+#ifdef MS_HTTP_THREADED_REQUESTS
+  if (bThreaded && psBatch->still_running) {
+    pthread_mutex_init(&psBatch->mutex, NULL);
+    pthread_cond_init(&psBatch->cond, NULL);
+    psBatch->bThreaded = MS_TRUE;
+
+    if (pthread_create(&psBatch->thread, NULL,
+                       msHTTPRequestThread, psBatch) != 0) {
+      /* Fallback on driving the download loop from this thread */
+      pthread_mutex_destroy(&psBatch->mutex);
+      pthread_cond_destroy(&psBatch->cond);
+      psBatch->bThreaded = MS_FALSE;
+    }
+  }
+#endif
 
-    http_handle = (CURL*)(psReq->curl_handle);
+  return psBatch;
+}
+
+httpRequestBatchObj *msHTTPStartRequests(httpRequestObj *pasReqInfo,
+    int numRequests,
+    int bCheckLocalCache)
+{
+  return msHTTPStartRequestsEx(pasReqInfo, numRequests, bCheckLocalCache,
+                               MS_TRUE);
+}
 
-    if (psReq->nStatus == 0 &&
-        curl_easy_getinfo(http_handle,
-                          CURLINFO_HTTP_CODE, &lVal) == CURLE_OK) {
-      char *pszContentType = NULL;
+/**********************************************************************
+ *                          msHTTPPollRequests()
+ *
+ * Give the transfers a chance to progress without blocking.  This is a
+ * no-op when the download loop is run by a background thread.
+ **********************************************************************/
+void msHTTPPollRequests(httpRequestBatchObj *psBatch)
+{
+  if (psBatch == NULL || psBatch->bThreaded || !psBatch->still_running)
+    return;
 
-      psReq->nStatus = lVal;
+  msHTTPPerform(psBatch, MS_FALSE);
+}
 
-      /* Fetch content type of response */
-      if (curl_easy_getinfo(http_handle,
-                            CURLINFO_CONTENT_TYPE,
-                            &pszContentType) == CURLE_OK &&
-          pszContentType != NULL) {
-        psReq->pszContentType = msStrdup(pszContentType);
+/**********************************************************************
+ *                          msHTTPWaitRequests()
+ *
+ * Block until all the requests of layer nLayerId (or all the requests
+ * if nLayerId is -1) are completed, and finalize them.
+ *
+ * Return value:
+ * MS_SUCCESS if all these requests completed succesfully.
+ * MS_DONE if some requests failed with 40x status for instance (not fatal)
+ **********************************************************************/
+int msHTTPWaitRequests(httpRequestBatchObj *psBatch, int nLayerId)
+{
+  int i, nStatus = MS_SUCCESS;
+
+  for (;;) {
+    int bPending = MS_FALSE;
+
+#ifdef MS_HTTP_THREADED_REQUESTS
+    if (psBatch->bThreaded)
+      pthread_mutex_lock(&psBatch->mutex);
+#endif
+
+    for (i=0; i<psBatch->numRequests; i++) {
+      if ((nLayerId == -1 || psBatch->pasReqInfo[i].nLayerId == nLayerId) &&
+          !psBatch->pasReqInfo[i].done) {
+        bPending = MS_TRUE;
+        break;
       }
     }
 
-    if (!MS_HTTP_SUCCESS(psReq->nStatus)) {
-      /* Set status to MS_DONE to indicate that transfers were  */
-      /* completed but may not be succesfull */
-      nStatus = MS_DONE;
+#ifdef MS_HTTP_THREADED_REQUESTS
+    if (psBatch->bThreaded) {
+      if (bPending && !psBatch->bThreadDone)
+        pthread_cond_wait(&psBatch->cond, &psBatch->mutex);
+      else
+        bPending = MS_FALSE;
+      pthread_mutex_unlock(&psBatch->mutex);
+      if (bPending)
+        continue;
+      break;
+    }
+#endif
 
-      if (psReq->nStatus == -(CURLE_OPERATION_TIMEOUTED)) {
-        /* Timeout isn't a fatal error */
-        if (psReq->debug)
-          msDebug("HTTP: TIMEOUT of %d seconds exceeded for %s\n",
-                  nTimeout, psReq->pszGetUrl );
-
-        msSetError(MS_HTTPERR,
-                   "HTTP: TIMEOUT of %d seconds exceeded for %s\n",
-                   "msHTTPExecuteRequests()",
-                   nTimeout, psReq->pszGetUrl);
-
-        /* Rewrite error message, the curl timeout message isn't
-         * of much use to our users.
-         */
-        sprintf(psReq->pszErrBuf,
-                "TIMEOUT of %d seconds exceeded.", nTimeout);
-      } else if (psReq->nStatus > 0) {
-        /* Got an HTTP Error, e.g. 404, etc. */
-
-        if (psReq->debug)
-          msDebug("HTTP: HTTP GET request failed with status %d (%s)"
-                  " for %s\n",
-                  psReq->nStatus, psReq->pszErrBuf,
-                  psReq->pszGetUrl);
-
-        msSetError(MS_HTTPERR,
-                   "HTTP GET request failed with status %d (%s) "
-                   "for %s",
-                   "msHTTPExecuteRequests()", psReq->nStatus,
-                   psReq->pszErrBuf, psReq->pszGetUrl);
-      } else {
-        /* Got a curl error */
-
-        if (psReq->debug)
-          msDebug("HTTP: request failed with curl error "
-                  "code %d (%s) for %s",
-                  -psReq->nStatus, psReq->pszErrBuf,
-                  psReq->pszGetUrl);
-
-        msSetError(MS_HTTPERR,
-                   "HTTP: request failed with curl error "
-                   "code %d (%s) for %s",
-                   "msHTTPExecuteRequests()",
-                   -psReq->nStatus, psReq->pszErrBuf,
-                   psReq->pszGetUrl);
-      }
+    if (!bPending || !psBatch->still_running)
+      break;
+
+    msHTTPPerform(psBatch, MS_TRUE);
+  }
+
+  for (i=0; i<psBatch->numRequests; i++) {
+    httpRequestObj *psReq = &(psBatch->pasReqInfo[i]);
+    int bDone;
+
+    if (nLayerId != -1 && psReq->nLayerId != nLayerId)
+      continue;
+
+#ifdef MS_HTTP_THREADED_REQUESTS
+    if (psBatch->bThreaded)
+      pthread_mutex_lock(&psBatch->mutex);
+#endif
+    bDone = psReq->done;
+#ifdef MS_HTTP_THREADED_REQUESTS
+    if (psBatch->bThreaded)
+      pthread_mutex_unlock(&psBatch->mutex);
+#endif
+
+    /* Still running: only possible if the download loop was cancelled */
+    if (!bDone) {
+      nStatus = MS_DONE;
+      continue;
     }
 
-    /* Report download times foreach handle, in debug mode */
-    if (psReq->debug) {
-      double dConnectTime=0.0, dTotalTime=0.0, dStartTfrTime=0.0;
+    if (msHTTPFinalizeRequest(psBatch, psReq, MS_TRUE) != MS_SUCCESS)
+      nStatus = MS_DONE;
+  }
+
+  return nStatus;
+}
 
-      curl_easy_getinfo(http_handle,
-                        CURLINFO_CONNECT_TIME, &dConnectTime);
-      curl_easy_getinfo(http_handle,
-                        CURLINFO_STARTTRANSFER_TIME, &dStartTfrTime);
-      curl_easy_getinfo(http_handle,
-                        CURLINFO_TOTAL_TIME, &dTotalTime);
-      /* STARTTRANSFER_TIME includes CONNECT_TIME, but TOTAL_TIME
-       * doesn't, so we need to add it.
-       */
-      dTotalTime += dConnectTime;
+/**********************************************************************
+ *                          msHTTPEndRequests()
+ *
+ * Wait for all the requests to complete (or abort them if bCancel is
+ * MS_TRUE), finalize them and release the handle returned by
+ * msHTTPStartRequests().
+ *
+ * Return value:
+ * MS_SUCCESS if all requests completed succesfully.
+ * MS_DONE if some requests failed with 40x status for instance (not fatal)
+ **********************************************************************/
+int msHTTPEndRequests(httpRequestBatchObj *psBatch, int bCancel)
+{
+  int i, nStatus = MS_SUCCESS;
 
-      msDebug("Layer %d: %.3f + %.3f + %.3f = %.3fs\n", psReq->nLayerId,
-              dConnectTime, dStartTfrTime-dConnectTime,
-              dTotalTime-dStartTfrTime, dTotalTime);
+  if (psBatch == NULL)
+    return MS_SUCCESS;
+
+#ifdef MS_HTTP_THREADED_REQUESTS
+  if (psBatch->bThreaded) {
+    if (bCancel) {
+      pthread_mutex_lock(&psBatch->mutex);
+      psBatch->bCancel = MS_TRUE;
+      pthread_mutex_unlock(&psBatch->mutex);
     }
+    pthread_join(psBatch->thread, NULL);
+    pthread_mutex_destroy(&psBatch->mutex);
+    pthread_cond_destroy(&psBatch->cond);
+    psBatch->bThreaded = MS_FALSE;
+  }
+#endif
 
-    /* Cleanup this handle */
-    curl_easy_setopt(http_handle, CURLOPT_URL, "" );
-    curl_multi_remove_handle(multi_handle, http_handle);
-    curl_easy_cleanup(http_handle);
-    psReq->curl_handle = NULL;
+  if (!bCancel) {
+    while (psBatch->still_running)
+      msHTTPPerform(psBatch, MS_TRUE);
+  }
 
+  if (psBatch->debug)
+    msDebug("HTTP: After download loop\n");
+
+  if (psBatch->debug) {
+    /* Print a msDebug header for timings reported in the loop below */
+    msDebug("msHTTPExecuteRequests() timing summary per layer (connect_time + time_to_first_packet + download_time = total_time in seconds)\n");
+  }
+
+  /* Check status of all requests, close files, report errors and cleanup
+   * handles
+   */
+  for (i=0; i<psBatch->numRequests; i++) {
+    httpRequestObj *psReq = &(psBatch->pasReqInfo[i]);
+
+    if (psReq->curl_handle != NULL && !psReq->done) {
+      /* Transfer aborted before completion */
+      curl_multi_remove_handle(psBatch->multi_handle, psReq->curl_handle);
+      if (psReq->nStatus == 0)
+        psReq->nStatus = -CURLE_ABORTED_BY_CALLBACK;
+      psReq->done = MS_TRUE;
+    }
+
+    if (msHTTPFinalizeRequest(psBatch, psReq, !bCancel) != MS_SUCCESS)
+      /* Set status to MS_DONE to indicate that transfers were  */
+      /* completed but may not be succesfull */
+      nStatus = MS_DONE;
   }
 
   /* Cleanup multi handle, each handle had to be cleaned up individually */
-  curl_multi_cleanup(multi_handle);
+  curl_multi_cleanup(psBatch->multi_handle);
+  free(psBatch);
 
   return nStatus;
 }
 
+/**********************************************************************
+ *                          msHTTPExecuteRequests()
+ *
+ * Fetch a map slide via HTTP request and save to specified temp file.
+ *
+ * If bCheckLocalCache==MS_TRUE then if the pszOutputfile already exists
+ * then is is not downloaded again, and status 242 is returned.
+ *
+ * Return value:
+ * MS_SUCCESS if all requests completed succesfully.
+ * MS_FAILURE if a fatal error happened
+ * MS_DONE if some requests failed with 40x status for instance (not fatal)
+ **********************************************************************/
+int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
+                          int bCheckLocalCache)
+{
+  httpRequestBatchObj *psBatch;
+
+  if (numRequests == 0)
+    return MS_SUCCESS;  /* Nothing to do */
+
+  psBatch = msHTTPStartRequestsEx(pasReqInfo, numRequests, bCheckLocalCache,
+                                  MS_FALSE);
+  if (psBatch == NULL)
+    return MS_FAILURE;
+
+  return msHTTPEndRequests(psBatch, MS_FALSE);
+}
+
 /**********************************************************************
  *                          msHTTPGetFile()
  *
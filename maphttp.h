@@ -82,6 +82,9 @@ extern "C" {
     char    *pszHttpUsername;   /* HTTP Authentication username              */
     char    *pszHttpPassword;   /* HTTP Authentication password              */
 
+    char    *pszCacheDir;       /* HTTP response cache dir, NULL=disabled */
+    int      nCacheMaxSize;     /* Size cap of the cache in MB, 0=no cap  */
+
     /* For debugging/profiling */
     int         debug;         /* Debug mode?  MS_TRUE/MS_FALSE */
 
@@ -93,8 +96,16 @@ extern "C" {
     int       result_size;
     int       result_buf_size;
 
+    int       done;            /* MS_TRUE once the transfer has completed */
+    int       nBytesWritten;   /* bytes received by msHTTPWriteFct() */
+    int       nWriteError;     /* result buffer size that failed to alloc */
+    void      * cache_info;    /* httpCacheInfo * used by the HTTP cache */
+
   } httpRequestObj;
 
+  /* Opaque handle on a set of requests started with msHTTPStartRequests() */
+  typedef struct http_request_batch httpRequestBatchObj;
+
 #ifdef USE_CURL
 
   int msHTTPInit(void);
@@ -104,6 +115,12 @@ extern "C" {
   void msHTTPFreeRequestObj(httpRequestObj *pasReqInfo, int numRequests);
   int  msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
                              int bCheckLocalCache);
+  httpRequestBatchObj *msHTTPStartRequests(httpRequestObj *pasReqInfo,
+      int numRequests,
+      int bCheckLocalCache);
+  void msHTTPPollRequests(httpRequestBatchObj *psBatch);
+  int  msHTTPWaitRequests(httpRequestBatchObj *psBatch, int nLayerId);
+  int  msHTTPEndRequests(httpRequestBatchObj *psBatch, int bCancel);
   int  msHTTPGetFile(const char *pszGetUrl, const char *pszOutputFile,
                      int *pnHTTPStatus, int nTimeout, int bCheckLocalCache,
                      int bDebug);
@@ -28,6 +28,7 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
 #include "png.h"
 #include "setjmp.h"
 #include <assert.h>
@@ -42,13 +43,22 @@
 
 typedef struct _streamInfo {
   FILE *fp;
+  msIOContext *context; /* msIO handler of fp, NULL for plain files */
   bufferObj *buffer;
 } streamInfo;
 
+/* encoded bytes go straight to the msIO handler, looked up once per image */
+static int msStreamWrite(FILE *fp, msIOContext *context, const void *data, size_t length)
+{
+  if(context)
+    return msIO_contextWrite(context, data, length);
+  return fwrite(data, 1, length, fp);
+}
+
 void png_write_data_to_stream(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-  FILE *fp = ((streamInfo*)png_get_io_ptr(png_ptr))->fp;
-  msIO_fwrite(data,length,1,fp);
+  streamInfo *info = (streamInfo*)png_get_io_ptr(png_ptr);
+  msStreamWrite(info->fp, info->context, data, length);
 }
 
 void png_write_data_to_buffer(png_structp png_ptr, png_bytep data, png_size_t length)
@@ -70,6 +80,7 @@ typedef struct {
 typedef struct {
   ms_destination_mgr mgr;
   FILE *stream;
+  msIOContext *context;
 } ms_stream_destination_mgr;
 
 typedef struct {
@@ -77,7 +88,8 @@ typedef struct {
   bufferObj *buffer;
 } ms_buffer_destination_mgr;
 
-#define OUTPUT_BUF_SIZE 4096
+/* large enough for stdio and FastCGI streams to pass the blocks through */
+#define OUTPUT_BUF_SIZE 65536
 
 void
 jpeg_init_destination (j_compress_ptr cinfo)
@@ -96,7 +108,7 @@ jpeg_init_destination (j_compress_ptr cinfo)
 void jpeg_stream_term_destination (j_compress_ptr cinfo)
 {
   ms_stream_destination_mgr *dest = (ms_stream_destination_mgr*) cinfo->dest;
-  msIO_fwrite(dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer, 1, dest->stream);
+  msStreamWrite(dest->stream, dest->context, dest->mgr.data, OUTPUT_BUF_SIZE-dest->mgr.pub.free_in_buffer);
   dest->mgr.pub.next_output_byte = dest->mgr.data;
   dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
 }
@@ -112,7 +124,7 @@ void jpeg_buffer_term_destination (j_compress_ptr cinfo)
 int jpeg_stream_empty_output_buffer (j_compress_ptr cinfo)
 {
   ms_stream_destination_mgr *dest = (ms_stream_destination_mgr*) cinfo->dest;
-  msIO_fwrite(dest->mgr.data, OUTPUT_BUF_SIZE, 1, dest->stream);
+  msStreamWrite(dest->stream, dest->context, dest->mgr.data, OUTPUT_BUF_SIZE);
   dest->mgr.pub.next_output_byte = dest->mgr.data;
   dest->mgr.pub.free_in_buffer = OUTPUT_BUF_SIZE;
   return TRUE;
@@ -148,6 +160,7 @@ int saveAsJPEG(mapObj *map /*not used*/, rasterBufferObj *rb, streamInfo *info,
       ((ms_stream_destination_mgr*)cinfo.dest)->mgr.pub.empty_output_buffer = jpeg_stream_empty_output_buffer;
       ((ms_stream_destination_mgr*)cinfo.dest)->mgr.pub.term_destination = jpeg_stream_term_destination;
       ((ms_stream_destination_mgr*)cinfo.dest)->stream = info->fp;
+      ((ms_stream_destination_mgr*)cinfo.dest)->context = info->context;
     } else {
 
       cinfo.dest = (struct jpeg_destination_mgr *)
@@ -258,12 +271,14 @@ int remapPaletteForPNG(rasterBufferObj *rb, rgbPixel *rgb, unsigned char *a, int
   return MS_SUCCESS;
 }
 
-int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
+/*
+ * write a palette buffer whose entries have already been converted to the
+ * PNG PLTE (rgb) and tRNS (a, num_a) chunks
+ */
+static int writePalettePNG(rasterBufferObj *rb, rgbPixel *rgb, unsigned char *a, int num_a,
+                           streamInfo *info, int compression)
 {
   png_infop info_ptr;
-  rgbPixel rgb[256];
-  unsigned char a[256];
-  int num_a;
   int row,sample_depth;
   png_structp png_ptr = png_create_write_struct(
                           PNG_LIBPNG_VER_STRING, NULL,NULL,NULL);
@@ -307,8 +322,6 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
                0, PNG_COMPRESSION_TYPE_DEFAULT,
                PNG_FILTER_TYPE_DEFAULT);
 
-  remapPaletteForPNG(rb,rgb,a,&num_a);
-
   png_set_PLTE(png_ptr, info_ptr, (png_colorp)(rgb),rb->data.palette.num_entries);
   if(num_a)
     png_set_tRNS(png_ptr, info_ptr, a,num_a, NULL);
@@ -325,6 +338,105 @@ int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
   return MS_SUCCESS;
 }
 
+int savePalettePNG(rasterBufferObj *rb, streamInfo *info, int compression)
+{
+  rgbPixel rgb[256];
+  unsigned char a[256];
+  int num_a;
+
+  assert(rb->type == MS_BUFFER_BYTE_PALETTE);
+
+  if(remapPaletteForPNG(rb,rgb,a,&num_a) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  return writePalettePNG(rb,rgb,a,num_a,info,compression);
+}
+
+/*
+ * scan a RGBA buffer for the ADAPTIVE formatoption. Returns the number of
+ * distinct colors if there are no more than 256 of them, in which case
+ * pixels[] holds an index into colors[] for each pixel, or 0 otherwise.
+ * Colors are stored un-premultiplied, exactly as the RGBA writer would output
+ * them. *opaque is set if no pixel is even partially transparent.
+ */
+static int analyzeRasterBuffer(rasterBufferObj *rb, unsigned char *pixels,
+                               unsigned int *colors, int *opaque)
+{
+  int row, col, i, num_colors = 0;
+  unsigned int hash_key[1024];
+  short hash_idx[1024];
+  unsigned int last_raw = 0, last_idx = 0;
+  int have_last = MS_FALSE;
+
+  assert(rb->type == MS_BUFFER_BYTE_RGBA);
+
+  for(i=0; i<1024; i++)
+    hash_idx[i] = -1;
+  *opaque = MS_TRUE;
+
+  for(row=0; row<rb->height; row++) {
+    unsigned char *r,*g,*b,*a = NULL;
+    unsigned char *pixptr = &(pixels[row*rb->width]);
+    r=rb->data.rgba.r+row*rb->data.rgba.row_step;
+    g=rb->data.rgba.g+row*rb->data.rgba.row_step;
+    b=rb->data.rgba.b+row*rb->data.rgba.row_step;
+    if(rb->data.rgba.a)
+      a=rb->data.rgba.a+row*rb->data.rgba.row_step;
+
+    for(col=0; col<rb->width; col++) {
+      unsigned int raw = *r | (*g<<8) | (*b<<16) | ((a?*a:255)<<24);
+      if(!have_last || raw != last_raw) {
+        unsigned int key, h;
+        if(a && *a != 255) {
+          *opaque = MS_FALSE;
+          if(*a) {
+            double da = *a/255.0;
+            unsigned char ur = *r/da, ug = *g/da, ub = *b/da;
+            key = ur | (ug<<8) | (ub<<16) | (*a<<24);
+          } else {
+            key = 0;
+          }
+        } else {
+          key = raw;
+        }
+        h = ((key * 2654435761U) >> 22) & 1023;
+        while(hash_idx[h] != -1 && hash_key[h] != key)
+          h = (h+1) & 1023;
+        if(hash_idx[h] == -1) {
+          if(num_colors == 256) {
+            /* too many colors, only look for transparent pixels from now on */
+            if(!a || !*opaque)
+              return 0;
+            for(; row<rb->height; row++, col=0) {
+              a=rb->data.rgba.a+row*rb->data.rgba.row_step+col*rb->data.rgba.pixel_step;
+              for(; col<rb->width; col++) {
+                if(*a != 255) {
+                  *opaque = MS_FALSE;
+                  return 0;
+                }
+                a+=rb->data.rgba.pixel_step;
+              }
+            }
+            return 0;
+          }
+          hash_key[h] = key;
+          hash_idx[h] = num_colors;
+          colors[num_colors++] = key;
+        }
+        last_raw = raw;
+        last_idx = hash_idx[h];
+        have_last = MS_TRUE;
+      }
+      *pixptr++ = last_idx;
+      r+=rb->data.rgba.pixel_step;
+      g+=rb->data.rgba.pixel_step;
+      b+=rb->data.rgba.pixel_step;
+      if(a) a+=rb->data.rgba.pixel_step;
+    }
+  }
+  return num_colors;
+}
+
 int readPalette(const char *palette, rgbaPixel *entries, unsigned int *nEntries, int useAlpha)
 {
   FILE *stream = NULL;
@@ -375,6 +487,8 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 {
   int force_pc256 = MS_FALSE;
   int force_palette = MS_FALSE;
+  int adaptive = MS_FALSE;
+  int use_alpha;
 
   int ret = MS_FAILURE;
 
@@ -400,6 +514,57 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
   if( force_string && (strcasecmp(force_string,"on") == 0  || strcasecmp(force_string,"yes") == 0 || strcasecmp(force_string,"true") == 0) )
     force_palette = MS_TRUE;
 
+  force_string = msGetOutputFormatOption( format, "ADAPTIVE", NULL );
+  if( force_string && (strcasecmp(force_string,"on") == 0  || strcasecmp(force_string,"yes") == 0 || strcasecmp(force_string,"true") == 0) )
+    adaptive = MS_TRUE;
+
+  use_alpha = (rb->type == MS_BUFFER_BYTE_RGBA && rb->data.rgba.a);
+
+  if(adaptive && !force_pc256 && !force_palette && rb->type == MS_BUFFER_BYTE_RGBA) {
+    /*
+    ** images with no more than 256 colors (empty or uniform tiles, simple
+    ** vector maps) are written losslessly as palette PNGs, opaque images
+    ** without an alpha channel
+    */
+    rasterBufferObj qrb;
+    unsigned int colors[256];
+    int num_colors, opaque, i, num_a = 0, top_idx;
+    unsigned char remap[256], a[256];
+    rgbPixel rgb[256];
+
+    memset(&qrb,0,sizeof(rasterBufferObj));
+    qrb.type = MS_BUFFER_BYTE_PALETTE;
+    qrb.width = rb->width;
+    qrb.height = rb->height;
+    qrb.data.palette.pixels = (unsigned char*)msSmallMalloc(qrb.width*qrb.height*sizeof(unsigned char));
+    num_colors = analyzeRasterBuffer(rb,qrb.data.palette.pixels,colors,&opaque);
+    if(num_colors > 0) {
+      /* translucent entries first so they can be the only ones in the tRNS chunk */
+      for(i=0; i<num_colors; i++)
+        if((colors[i]>>24) != 255)
+          num_a++;
+      for(i=0, top_idx=num_a, num_a=0; i<num_colors; i++) {
+        int idx = ((colors[i]>>24) != 255) ? num_a++ : top_idx++;
+        remap[i] = idx;
+        rgb[idx].r = colors[i] & 0xff;
+        rgb[idx].g = (colors[i]>>8) & 0xff;
+        rgb[idx].b = (colors[i]>>16) & 0xff;
+        a[idx] = colors[i]>>24;
+      }
+      if(num_a) {
+        for(i=0; i<qrb.width*qrb.height; i++)
+          qrb.data.palette.pixels[i] = remap[qrb.data.palette.pixels[i]];
+      }
+      qrb.data.palette.num_entries = num_colors;
+      ret = writePalettePNG(&qrb,rgb,a,num_a,info,compression);
+      msFree(qrb.data.palette.pixels);
+      return ret;
+    }
+    msFree(qrb.data.palette.pixels);
+    if(opaque)
+      use_alpha = MS_FALSE;
+  }
+
   if(force_pc256 || force_palette) {
     rasterBufferObj qrb;
     rgbaPixel palette[256], paletteGiven[256];
@@ -479,7 +644,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
     else
       png_set_write_fn(png_ptr,info, png_write_data_to_buffer, png_flush_data);
 
-    if(rb->data.rgba.a)
+    if(use_alpha)
       color_type = PNG_COLOR_TYPE_RGB_ALPHA;
     else
       color_type = PNG_COLOR_TYPE_RGB;
@@ -490,7 +655,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
 
     png_write_info(png_ptr, info_ptr);
 
-    if(!rb->data.rgba.a && rb->data.rgba.pixel_step==4)
+    if(!use_alpha && rb->data.rgba.pixel_step==4)
       png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
     rowdata = (unsigned int*)malloc(rb->width*sizeof(unsigned int));
@@ -501,7 +666,7 @@ int saveAsPNG(mapObj *map,rasterBufferObj *rb, streamInfo *info, outputFormatObj
       r=rb->data.rgba.r+row*rb->data.rgba.row_step;
       g=rb->data.rgba.g+row*rb->data.rgba.row_step;
       b=rb->data.rgba.b+row*rb->data.rgba.row_step;
-      if(rb->data.rgba.a) {
+      if(use_alpha) {
         a=rb->data.rgba.a+row*rb->data.rgba.row_step;
         for(col=0; col<rb->width; col++) {
           if(*a) {
@@ -954,12 +1119,14 @@ int msSaveRasterBuffer(mapObj *map, rasterBufferObj *rb, FILE *stream,
   if(strcasestr(format->driver,"/png")) {
     streamInfo info;
     info.fp = stream;
+    info.context = msIO_getHandler(stream);
     info.buffer = NULL;
 
     return saveAsPNG(map, rb,&info,format);
   } else if(strcasestr(format->driver,"/jpeg")) {
     streamInfo info;
     info.fp = stream;
+    info.context = msIO_getHandler(stream);
     info.buffer=NULL;
     return saveAsJPEG(map, rb,&info,format);
   } else {
@@ -968,6 +1135,167 @@ int msSaveRasterBuffer(mapObj *map, rasterBufferObj *rb, FILE *stream,
   }
 }
 
+/*
+** Encoded uniform images, e.g. the background returned by msDrawMap() when no
+** layer intersects the map extent. Entries are keyed on the output format,
+** the image size and the pixel value, most recently used first.
+*/
+typedef struct blankImageCacheObj {
+  char *key;
+  unsigned char *data;
+  int size;
+  struct blankImageCacheObj *next;
+} blankImageCacheObj;
+
+#define MS_BLANK_IMAGE_CACHE_SIZE 16
+
+static blankImageCacheObj *blankImageCache = NULL;
+
+/* MS_TRUE if all pixels of rb have the same value, stored in pixel */
+static int getUniformPixel(rasterBufferObj *rb, unsigned char *pixel)
+{
+  int row, col;
+
+  pixel[0] = *rb->data.rgba.r;
+  pixel[1] = *rb->data.rgba.g;
+  pixel[2] = *rb->data.rgba.b;
+  pixel[3] = rb->data.rgba.a ? *rb->data.rgba.a : 255;
+
+  for(row=0; row<rb->height; row++) {
+    unsigned char *r,*g,*b,*a = NULL;
+    r=rb->data.rgba.r+row*rb->data.rgba.row_step;
+    g=rb->data.rgba.g+row*rb->data.rgba.row_step;
+    b=rb->data.rgba.b+row*rb->data.rgba.row_step;
+    if(rb->data.rgba.a)
+      a=rb->data.rgba.a+row*rb->data.rgba.row_step;
+    for(col=0; col<rb->width; col++) {
+      if(*r != pixel[0] || *g != pixel[1] || *b != pixel[2] || (a && *a != pixel[3]))
+        return MS_FALSE;
+      r+=rb->data.rgba.pixel_step;
+      g+=rb->data.rgba.pixel_step;
+      b+=rb->data.rgba.pixel_step;
+      if(a) a+=rb->data.rgba.pixel_step;
+    }
+  }
+  return MS_TRUE;
+}
+
+/*
+** Same as msSaveRasterBuffer() for an image that is expected to be blank:
+** if all its pixels have the same value, the encoded image is kept in a per
+** process cache and written from there on later requests.
+*/
+int msSaveBlankRasterBuffer(mapObj *map, rasterBufferObj *rb, FILE *stream,
+                            outputFormatObj *format)
+{
+  blankImageCacheObj *entry, **prev;
+  msStringBuffer *sb;
+  unsigned char pixel[4], *data = NULL;
+  char szTmp[128];
+  char *key;
+  int i, size = 0, status = MS_SUCCESS;
+
+  if(rb->type != MS_BUFFER_BYTE_RGBA || rb->width <= 0 || rb->height <= 0 ||
+      !(strcasestr(format->driver,"/png") || strcasestr(format->driver,"/jpeg")) ||
+      !getUniformPixel(rb, pixel))
+    return msSaveRasterBuffer(map, rb, stream, format);
+
+  sb = msStringBufferAlloc();
+  snprintf(szTmp, sizeof(szTmp), "%dx%d:%d,%d,%d,%d:%d:%d:", rb->width, rb->height,
+           pixel[0], pixel[1], pixel[2], pixel[3], format->imagemode, format->transparent);
+  msStringBufferAppend(sb, szTmp);
+  msStringBufferAppend(sb, format->driver);
+  for(i=0; i<format->numformatoptions; i++) {
+    msStringBufferAppend(sb, ":");
+    msStringBufferAppend(sb, format->formatoptions[i]);
+  }
+  /* the PNG palette file is relative to the map */
+  if(map && map->mappath) {
+    msStringBufferAppend(sb, ":");
+    msStringBufferAppend(sb, map->mappath);
+  }
+  key = msStringBufferReleaseStringAndFree(sb);
+
+  msAcquireLock(TLOCK_BLANKIMAGE);
+  for(prev = &blankImageCache; (entry = *prev) != NULL; prev = &(entry->next)) {
+    if(strcmp(entry->key, key) == 0) {
+      *prev = entry->next;
+      entry->next = blankImageCache;
+      blankImageCache = entry;
+      data = (unsigned char *) msSmallMalloc(entry->size);
+      memcpy(data, entry->data, entry->size);
+      size = entry->size;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_BLANKIMAGE);
+
+  if(!data) {
+    bufferObj buffer;
+    streamInfo info;
+
+    msBufferInit(&buffer);
+    info.fp = NULL;
+    info.context = NULL;
+    info.buffer = &buffer;
+    if(strcasestr(format->driver,"/png"))
+      status = saveAsPNG(map, rb, &info, format);
+    else
+      status = saveAsJPEG(map, rb, &info, format);
+    if(status != MS_SUCCESS) {
+      msBufferFree(&buffer);
+      msFree(key);
+      return status;
+    }
+    data = buffer.data;
+    size = buffer.size;
+
+    entry = (blankImageCacheObj *) msSmallMalloc(sizeof(blankImageCacheObj));
+    entry->key = key;
+    entry->data = (unsigned char *) msSmallMalloc(size);
+    memcpy(entry->data, data, size);
+    entry->size = size;
+    key = NULL;
+
+    msAcquireLock(TLOCK_BLANKIMAGE);
+    entry->next = blankImageCache;
+    blankImageCache = entry;
+    /* drop the least recently used entries (and any duplicate that was added meanwhile) */
+    for(i=0, prev = &blankImageCache; (entry = *prev) != NULL; i++) {
+      if(i >= MS_BLANK_IMAGE_CACHE_SIZE || (entry != blankImageCache && strcmp(entry->key, blankImageCache->key) == 0)) {
+        *prev = entry->next;
+        msFree(entry->key);
+        msFree(entry->data);
+        msFree(entry);
+      } else {
+        prev = &(entry->next);
+      }
+    }
+    msReleaseLock(TLOCK_BLANKIMAGE);
+  }
+  msFree(key);
+
+  if(msIO_fwrite(data, 1, size, stream) != size) {
+    msSetError(MS_IOERR, "Failed to write %d bytes.", "msSaveBlankRasterBuffer()", size);
+    status = MS_FAILURE;
+  }
+  msFree(data);
+  return status;
+}
+
+void msBlankImageCacheCleanup(void)
+{
+  msAcquireLock(TLOCK_BLANKIMAGE);
+  while(blankImageCache) {
+    blankImageCacheObj *next = blankImageCache->next;
+    msFree(blankImageCache->key);
+    msFree(blankImageCache->data);
+    msFree(blankImageCache);
+    blankImageCache = next;
+  }
+  msReleaseLock(TLOCK_BLANKIMAGE);
+}
+
 int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer,
                                outputFormatObj *format)
 {
@@ -981,11 +1309,13 @@ int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer,
   if(strcasestr(format->driver,"/png")) {
     streamInfo info;
     info.fp = NULL;
+    info.context = NULL;
     info.buffer = buffer;
     return saveAsPNG(NULL, data,&info,format);
   } else if(strcasestr(format->driver,"/jpeg")) {
     streamInfo info;
     info.fp = NULL;
+    info.context = NULL;
     info.buffer=buffer;
     return saveAsJPEG(NULL, data,&info,format);
   } else {
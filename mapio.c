@@ -163,11 +163,18 @@ msIOContext *msIO_getHandler( FILE * fp )
       return NULL;
   }
 
-  if( fp == stdin || fp == NULL || strcmp((const char *)fp,"stdin") == 0 )
+  /* compare the pointers first, output mostly goes to stdout */
+  if( fp == stdout )
+    return &(group->stdout_context);
+  else if( fp == stdin || fp == NULL )
+    return &(group->stdin_context);
+  else if( fp == stderr )
+    return &(group->stderr_context);
+  else if( strcmp((const char *)fp,"stdin") == 0 )
     return &(group->stdin_context);
-  else if( fp == stdout || strcmp((const char *)fp,"stdout") == 0 )
+  else if( strcmp((const char *)fp,"stdout") == 0 )
     return &(group->stdout_context);
-  else if( fp == stderr || strcmp((const char *)fp,"stderr") == 0 )
+  else if( strcmp((const char *)fp,"stderr") == 0 )
     return &(group->stderr_context);
   else
     return NULL;
@@ -176,6 +183,7 @@ msIOContext *msIO_getHandler( FILE * fp )
 void msIO_setHeader (const char *header, const char* value, ...)
 {
   va_list args;
+  char *format = NULL;
   va_start( args, value );
 #ifdef MOD_WMS_ENABLED
   msIOContext *ioctx = msIO_getHandler (stdout);
@@ -195,9 +203,13 @@ void msIO_setHeader (const char *header, const char* value, ...)
     }
   } else {
 #endif // MOD_WMS_ENABLED
-    msIO_fprintf(stdout,"%s: ",header);
-    msIO_vfprintf(stdout,value,args);
-    msIO_fprintf(stdout,"\r\n");
+    /* one write per header line */
+    format = msStringConcatenate(format, header);
+    format = msStringConcatenate(format, ": ");
+    format = msStringConcatenate(format, value);
+    format = msStringConcatenate(format, "\r\n");
+    msIO_vfprintf(stdout,format,args);
+    msFree(format);
 #ifdef MOD_WMS_ENABLED
   }
 #endif
@@ -209,8 +221,8 @@ void msIO_sendHeaders ()
   msIOContext *ioctx = msIO_getHandler (stdout);
   if(ioctx && !strcmp(ioctx->label,"apache")) return;
 #endif // !MOD_WMS_ENABLED
+  /* not flushed, the headers go out with the start of the content */
   msIO_printf ("\r\n");
-  fflush (stdout);
 }
 
 
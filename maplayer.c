@@ -283,6 +283,113 @@ int msLayerNextShape(layerObj *layer, shapeObj *shape)
   return rv;
 }
 
+/*
+** Batch version of msLayerNextShape(): reads up to maxshapes shapes at once into caller owned
+** storage (an array of initialized shapes, usually reused from one call to the next). Returns
+** MS_SUCCESS if more shapes may follow, MS_DONE once the end of the candidate shapes has been
+** reached (numshapes can still be > 0 in that case) and MS_FAILURE on error. The caller is
+** responsible for freeing the returned shapes.
+*/
+int msLayerNextShapes(layerObj *layer, shapeObj *shapes, int maxshapes, int *numshapes)
+{
+  int rv, i;
+
+  *numshapes = 0;
+
+  if ( ! layer->vtable) {
+    rv =  msInitializeVirtualTable(layer);
+    if (rv != MS_SUCCESS)
+      return rv;
+  }
+
+  rv = layer->vtable->LayerNextShapes(layer, shapes, maxshapes, numshapes);
+
+  /* RFC89 Apply Layer GeomTransform */
+  if(layer->_geomtransform.type != MS_GEOMTRANSFORM_NONE && rv != MS_FAILURE) {
+    for(i=0; i<*numshapes; i++) {
+      if(msGeomTransformShape(layer->map, layer, &shapes[i]) != MS_SUCCESS) {
+        rv = MS_FAILURE;
+        break;
+      }
+    }
+  }
+
+  if(rv == MS_FAILURE) {
+    for(i=0; i<*numshapes; i++)
+      msShapeArenaFreeShape(layer->arena, &shapes[i]);
+    *numshapes = 0;
+  }
+
+  return rv;
+}
+
+/*
+** Shape batches let the drawing and query loops consume shapes one at a time while they are
+** read from the data source through msLayerNextShapes(). The batch size is 1 (i.e. no read
+** ahead) for layers using STYLEITEM since the data source then needs to be positioned on the
+** current shape.
+**
+** If the layer has a shape arena (layer->arena), the attribute values of the shapes come from it
+** and the arena is reset each time the batch is refilled: the shapes handed out have to be
+** released with msShapeArenaFreeShape() before asking for the next one.
+*/
+void msInitShapeBatch(layerObj *layer, shapeBatchObj *batch)
+{
+  batch->shapes = NULL;
+  batch->maxshapes = (layer->styleitem) ? 1 : MS_SHAPE_BATCH_SIZE;
+  batch->numshapes = batch->current = 0;
+  batch->status = MS_SUCCESS;
+  batch->arena = NULL;
+}
+
+void msFreeShapeBatch(shapeBatchObj *batch)
+{
+  int i;
+
+  if(batch->shapes) {
+    for(i=batch->current; i<batch->numshapes; i++)
+      msShapeArenaFreeShape(batch->arena, &batch->shapes[i]);
+    free(batch->shapes);
+  }
+  batch->shapes = NULL;
+  batch->numshapes = batch->current = 0;
+}
+
+/*
+** Drop-in replacement for msLayerNextShape() reading the shapes through a batch. The shape is
+** handed over to the caller, who has to free it as usual (with msShapeArenaFreeShape() if the
+** layer has an arena).
+*/
+int msLayerNextShapeFromBatch(layerObj *layer, shapeBatchObj *batch, shapeObj *shape)
+{
+  int i;
+
+  while(batch->current >= batch->numshapes) {
+    if(batch->status != MS_SUCCESS)
+      return batch->status; /* MS_DONE or MS_FAILURE */
+
+    if(!batch->shapes) {
+      batch->shapes = (shapeObj *) msSmallMalloc(batch->maxshapes * sizeof(shapeObj));
+      for(i=0; i<batch->maxshapes; i++)
+        msInitShape(&batch->shapes[i]);
+    }
+
+    /* all the shapes of the previous batch have been released */
+    batch->arena = layer->arena;
+    if(batch->arena)
+      msResetShapeArena(batch->arena);
+
+    batch->current = 0;
+    batch->status = msLayerNextShapes(layer, batch->shapes, batch->maxshapes, &batch->numshapes);
+  }
+
+  *shape = batch->shapes[batch->current];
+  msInitShape(&batch->shapes[batch->current]);
+  batch->current++;
+
+  return MS_SUCCESS;
+}
+
 /*
 ** Used to retrieve a shape from a result set by index. Result sets are created by the various
 ** msQueryBy...() functions. The index is assigned by the data source.
@@ -440,6 +547,40 @@ int msLayerGetExtent(layerObj *layer, rectObj *extent)
   return(status);
 }
 
+/*
+** Returns in extent the bounds of the layer data when they are known without
+** opening the layer: the LAYER EXTENT, or the header of the shapefile (or
+** shapefile tile index) holding the data. Returns MS_DONE when they are not.
+*/
+int msLayerGetStoredExtent(mapObj *map, layerObj *layer, rectObj *extent)
+{
+  char szPath[MS_MAXPATHLEN];
+  const char *path = NULL;
+
+  if (MS_VALID_EXTENT(layer->extent)) {
+    *extent = layer->extent;
+    return MS_SUCCESS;
+  }
+
+  if(layer->tileindex) {
+    if((layer->type == MS_LAYER_RASTER || layer->connectiontype == MS_TILED_SHAPEFILE) &&
+        msGetLayerIndex(map, layer->tileindex) == -1)
+      path = layer->tileindex;
+  } else if(layer->type != MS_LAYER_RASTER && layer->connectiontype == MS_SHAPEFILE) {
+    path = layer->data;
+  }
+
+  if(!path)
+    return MS_DONE;
+
+  /* resolve the file like the shapefile driver does */
+  if(msSHPReadFileBounds(msBuildPath3(szPath, map->mappath, map->shapepath, path), extent) == MS_SUCCESS ||
+      msSHPReadFileBounds(msBuildPath(szPath, map->mappath, path), extent) == MS_SUCCESS)
+    return MS_SUCCESS;
+
+  return MS_DONE;
+}
+
 int msLayerGetItemIndex(layerObj *layer, char *item)
 {
   int i;
@@ -1289,6 +1430,23 @@ int LayerDefaultNextShape(layerObj *layer, shapeObj *shape)
   return MS_FAILURE;
 }
 
+/*
+** Adapter for data sources not implementing LayerNextShapes: reads the batch one shape at a time.
+*/
+int LayerDefaultNextShapes(layerObj *layer, shapeObj *shapes, int maxshapes, int *numshapes)
+{
+  int rv = MS_SUCCESS;
+
+  while(*numshapes < maxshapes) {
+    rv = layer->vtable->LayerNextShape(layer, &shapes[*numshapes]);
+    if(rv != MS_SUCCESS)
+      break;
+    (*numshapes)++;
+  }
+
+  return rv;
+}
+
 int LayerDefaultGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 {
   return MS_FAILURE;
@@ -1549,6 +1707,8 @@ static int populateVirtualTable(layerVTableObj *vtable)
   vtable->LayerEnablePaging = msLayerDefaultEnablePaging;
   vtable->LayerGetPaging = msLayerDefaultGetPaging;
 
+  vtable->LayerNextShapes = LayerDefaultNextShapes;
+
   return MS_SUCCESS;
 }
 
@@ -144,12 +144,14 @@ int FLTApplyExpressionToLayer(layerObj *lp, char *pszExpression)
 
 char *FLTGetExpressionForValuesRanges(layerObj *lp, char *item, char *value,  int forcecharcter)
 {
-  int bIscharacter, bSqlLayer;
+  int bIscharacter, bSqlLayer, status = MS_SUCCESS;
   char *pszExpression = NULL, *pszEscapedStr=NULL, *pszTmpExpression=NULL;
   char **paszElements = NULL, **papszRangeElements=NULL;
+  msStringBuffer *exprBuffer = NULL;
   int numelements,i,nrangeelements;
   /* double minval, maxval; */
   if (lp && item && value) {
+    exprBuffer = msStringBufferAlloc();
     if (lp->connectiontype == MS_POSTGIS || lp->connectiontype ==  MS_ORACLESPATIAL ||
         lp->connectiontype == MS_SDE || lp->connectiontype == MS_PLUGIN)
       bSqlLayer = MS_TRUE;
@@ -200,15 +202,18 @@ char *FLTGetExpressionForValuesRanges(layerObj *lp, char *item, char *value,  in
           msFree(pszEscapedStr);
           pszEscapedStr=NULL;
 
-          if (pszExpression != NULL)
-            pszExpression = msStringConcatenate(pszExpression, " OR ");
-
-          pszExpression =  msStringConcatenate(pszExpression, pszTmpExpression);
+          if (msStringBufferGetString(exprBuffer) != NULL)
+            status = msStringBufferAppend(exprBuffer, " OR ");
+          if (status == MS_SUCCESS)
+            status = msStringBufferAppend(exprBuffer, pszTmpExpression);
 
           msFree(pszTmpExpression);
           pszTmpExpression = NULL;
+          if (status != MS_SUCCESS)
+            break;
         }
-        pszExpression = msStringConcatenate(pszExpression, ")");
+        if (status == MS_SUCCESS)
+          status = msStringBufferAppend(exprBuffer, ")");
         msFreeCharArray(paszElements, numelements);
       }
     } else {
@@ -278,20 +283,27 @@ char *FLTGetExpressionForValuesRanges(layerObj *lp, char *item, char *value,  in
               pszTmpExpression = msStringConcatenate(pszTmpExpression, ")");
             }
 
-            if (pszExpression != NULL)
-              pszExpression = msStringConcatenate(pszExpression, " OR ");
-
-            pszExpression =  msStringConcatenate(pszExpression, pszTmpExpression);
+            if (msStringBufferGetString(exprBuffer) != NULL)
+              status = msStringBufferAppend(exprBuffer, " OR ");
+            if (status == MS_SUCCESS)
+              status = msStringBufferAppend(exprBuffer, pszTmpExpression);
             msFree(pszTmpExpression);
             pszTmpExpression = NULL;
 
             msFreeCharArray(papszRangeElements, nrangeelements);
+            if (status != MS_SUCCESS)
+              break;
           }
         }
-        pszExpression = msStringConcatenate(pszExpression, ")");
+        if (status == MS_SUCCESS)
+          status = msStringBufferAppend(exprBuffer, ")");
         msFreeCharArray(paszElements, numelements);
       }
     }
+    if (status == MS_SUCCESS)
+      pszExpression = msStringBufferReleaseStringAndFree(exprBuffer);
+    else
+      msStringBufferFree(exprBuffer);
   }
   return pszExpression;
 }
@@ -763,6 +775,364 @@ int FLTLayerApplyCondSQLFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
   return FLTLayerApplyPlainFilterToLayer(psNode, map, iLayerIndex);
 }
 
+/************************************************************************/
+/*                        FLTIsAttributeOnlyFilter                      */
+/*                                                                      */
+/*      Returns MS_TRUE if the node and its children do not contain     */
+/*      any spatial operator.                                           */
+/************************************************************************/
+static int FLTIsAttributeOnlyFilter(FilterEncodingNode *psNode)
+{
+  if (psNode == NULL)
+    return MS_TRUE;
+
+  if (psNode->eType == FILTER_NODE_TYPE_SPATIAL)
+    return MS_FALSE;
+
+  return FLTIsAttributeOnlyFilter(psNode->psLeftNode) &&
+         FLTIsAttributeOnlyFilter(psNode->psRightNode);
+}
+
+/************************************************************************/
+/*                          FLTIsNullSafeFilter                         */
+/*                                                                      */
+/*      Returns MS_TRUE if the SQL translation of the attribute only    */
+/*      node cannot reject a feature with NULL attributes that the      */
+/*      mapserver expression accepts. Drivers return NULL attributes    */
+/*      as empty strings so the expression compares them as "" or 0,   */
+/*      while any SQL comparison with NULL fails. Only equalities       */
+/*      (and likes) to a value that is not empty, combined with AND     */
+/*      and OR, are safe: NOT, inequalities, ranges... are not.         */
+/************************************************************************/
+static int FLTIsNullSafeFilter(FilterEncodingNode *psNode)
+{
+  FEPropertyIsLike *psLike = NULL;
+  const char *pszValue = NULL;
+
+  if (psNode == NULL || psNode->pszValue == NULL)
+    return MS_FALSE;
+
+  if (psNode->eType == FILTER_NODE_TYPE_FEATUREID)
+    return MS_TRUE;
+
+  if (psNode->eType == FILTER_NODE_TYPE_LOGICAL) {
+    if (strcasecmp(psNode->pszValue, "AND") == 0 ||
+        strcasecmp(psNode->pszValue, "OR") == 0)
+      return FLTIsNullSafeFilter(psNode->psLeftNode) &&
+             FLTIsNullSafeFilter(psNode->psRightNode);
+    return MS_FALSE;
+  }
+
+  if (psNode->eType != FILTER_NODE_TYPE_COMPARISON || psNode->psRightNode == NULL)
+    return MS_FALSE;
+
+  pszValue = psNode->psRightNode->pszValue;
+  if (pszValue == NULL || pszValue[0] == '\0')
+    return MS_FALSE;
+
+  if (strcasecmp(psNode->pszValue, "PropertyIsEqualTo") == 0)
+    return MS_TRUE;
+
+  /* a like matches empty strings if its pattern only has wild cards */
+  if (strcasecmp(psNode->pszValue, "PropertyIsLike") == 0) {
+    psLike = (FEPropertyIsLike *)psNode->pOther;
+    if (psLike == NULL || psLike->pszWildCard == NULL)
+      return MS_FALSE;
+    return (strspn(pszValue, psLike->pszWildCard) < strlen(pszValue));
+  }
+
+  return MS_FALSE;
+}
+
+/************************************************************************/
+/*                            FLTAddNullTests                           */
+/*                                                                      */
+/*      Appends "OR <property> IS NULL" to the SQL expression for each  */
+/*      property used by the node, so that features with NULL          */
+/*      attributes reach the evaluation of the mapserver expression.    */
+/************************************************************************/
+static char *FLTAddNullTests(FilterEncodingNode *psNode, layerObj *lp, char *pszExpression)
+{
+  char *pszEscapedStr = NULL, *pszTest = NULL;
+
+  if (psNode == NULL || pszExpression == NULL)
+    return pszExpression;
+
+  if (psNode->eType == FILTER_NODE_TYPE_COMPARISON &&
+      psNode->psLeftNode && psNode->psLeftNode->pszValue) {
+    pszEscapedStr = msLayerEscapePropertyName(lp, psNode->psLeftNode->pszValue);
+    pszTest = msStringConcatenate(pszTest, " OR ");
+    pszTest = msStringConcatenate(pszTest, pszEscapedStr);
+    pszTest = msStringConcatenate(pszTest, " IS NULL");
+    if (strstr(pszExpression, pszTest) == NULL)
+      pszExpression = msStringConcatenate(pszExpression, pszTest);
+    msFree(pszTest);
+    msFree(pszEscapedStr);
+    return pszExpression;
+  }
+
+  pszExpression = FLTAddNullTests(psNode->psLeftNode, lp, pszExpression);
+  return FLTAddNullTests(psNode->psRightNode, lp, pszExpression);
+}
+
+/************************************************************************/
+/*                         FLTIsSQLStringValue                          */
+/*                                                                      */
+/*      Returns MS_TRUE if FLTGetSQLExpression() quotes the value       */
+/*      compared to the property.                                       */
+/************************************************************************/
+static int FLTIsSQLStringValue(layerObj *lp, const char *pszProperty, const char *pszValue)
+{
+  char szTmp[256];
+  const char *pszOFGType;
+
+  if (pszValue == NULL)
+    return MS_TRUE;
+
+  snprintf(szTmp, sizeof(szTmp), "%s_type", pszProperty);
+  pszOFGType = msOWSLookupMetadata(&(lp->metadata), "OFG", szTmp);
+  if (pszOFGType != NULL && strcasecmp(pszOFGType, "Character") == 0)
+    return MS_TRUE;
+
+  return !FLTIsNumeric((char *)pszValue);
+}
+
+/************************************************************************/
+/*                        FLTIsNativeFilterNode                         */
+/*                                                                      */
+/*      Returns MS_TRUE if the SQL translation of the attribute only    */
+/*      node is valid OGR SQL for the opened layer: every property is   */
+/*      a field of a known type, compared to values of the same type    */
+/*      (OGR rejects a string field compared to a number and the        */
+/*      other way round), and no lower() is used for matchCase="false". */
+/************************************************************************/
+static int FLTIsNativeFilterNode(FilterEncodingNode *psNode, layerObj *lp)
+{
+  FEPropertyIsLike *psLike = NULL;
+  const char *pszType = NULL, *pszProperty = NULL;
+  char **tokens = NULL;
+  int nTokens = 0, i, bString, bResult = MS_TRUE;
+
+  if (psNode == NULL || psNode->pszValue == NULL)
+    return MS_FALSE;
+
+  if (psNode->eType == FILTER_NODE_TYPE_LOGICAL) {
+    if (strcasecmp(psNode->pszValue, "NOT") == 0)
+      return FLTIsNativeFilterNode(psNode->psLeftNode, lp);
+    return FLTIsNativeFilterNode(psNode->psLeftNode, lp) &&
+           FLTIsNativeFilterNode(psNode->psRightNode, lp);
+  }
+
+  if (psNode->eType == FILTER_NODE_TYPE_FEATUREID) {
+    pszProperty = msOWSLookupMetadata(&(lp->metadata), "OFG", "featureid");
+    if (pszProperty == NULL ||
+        (pszType = msOGRLayerGetItemType(lp, pszProperty)) == NULL)
+      return MS_FALSE;
+    /* ids are quoted from the first one that is not numeric */
+    bString = MS_FALSE;
+    tokens = msStringSplit(psNode->pszValue, ',', &nTokens);
+    for (i=0; i<nTokens && bResult; i++) {
+      if (strlen(tokens[i]) <= 0)
+        continue;
+      if (FLTIsNumeric(tokens[i]) == MS_FALSE)
+        bString = MS_TRUE;
+      bResult = (bString == (strcasecmp(pszType, "Character") == 0));
+    }
+    msFreeCharArray(tokens, nTokens);
+    return bResult;
+  }
+
+  if (psNode->eType != FILTER_NODE_TYPE_COMPARISON ||
+      psNode->psLeftNode == NULL || psNode->psRightNode == NULL ||
+      (pszType = msOGRLayerGetItemType(lp, psNode->psLeftNode->pszValue)) == NULL)
+    return MS_FALSE;
+
+  pszProperty = psNode->psLeftNode->pszValue;
+
+  if (FLTIsBinaryComparisonFilterType(psNode->pszValue)) {
+    bString = FLTIsSQLStringValue(lp, pszProperty, psNode->psRightNode->pszValue);
+    if (bString && strcasecmp(psNode->pszValue, "PropertyIsEqualTo") == 0 &&
+        psNode->psRightNode->pOther && (*(int *)psNode->psRightNode->pOther) == 1)
+      return MS_FALSE;
+    return (bString == (strcasecmp(pszType, "Character") == 0));
+  }
+
+  if (strcasecmp(psNode->pszValue, "PropertyIsBetween") == 0) {
+    tokens = msStringSplit(psNode->psRightNode->pszValue, ';', &nTokens);
+    if (nTokens == 2) {
+      bString = FLTIsSQLStringValue(lp, pszProperty, tokens[0]) ||
+                FLTIsNumeric(tokens[1]) == MS_FALSE;
+      bResult = (bString == (strcasecmp(pszType, "Character") == 0));
+    } else
+      bResult = MS_FALSE;
+    msFreeCharArray(tokens, nTokens);
+    return bResult;
+  }
+
+  /* OGR likes take no escape clause here and may ignore the case */
+  if (strcasecmp(psNode->pszValue, "PropertyIsLike") == 0) {
+    psLike = (FEPropertyIsLike *)psNode->pOther;
+    return (psLike && !psLike->bCaseInsensitive && psLike->pszEscapeChar &&
+            psNode->psRightNode->pszValue &&
+            strchr(psNode->psRightNode->pszValue, psLike->pszEscapeChar[0]) == NULL &&
+            strcasecmp(pszType, "Character") == 0);
+  }
+
+  return MS_FALSE;
+}
+
+/************************************************************************/
+/*                       FLTGetNativeAttributeFilter                    */
+/*                                                                      */
+/*      Builds an SQL expression from the attribute only operands of    */
+/*      the top level AND nodes of the filter. Features matching the    */
+/*      filter always match this expression, so it can be used by the   */
+/*      driver to discard features before the whole filter is           */
+/*      evaluated. Operands that are not NULL safe also accept the      */
+/*      features whose properties are NULL, operands OGR cannot         */
+/*      evaluate are left out, see FLTIsNativeFilterNode(). Returns     */
+/*      NULL if there is no such operand.                               */
+/************************************************************************/
+static char *FLTGetNativeAttributeFilter(FilterEncodingNode *psNode, layerObj *lp)
+{
+  char *pszLeft = NULL, *pszRight = NULL, *pszExpression = NULL;
+
+  if (psNode == NULL)
+    return NULL;
+
+  if (psNode->eType == FILTER_NODE_TYPE_LOGICAL && psNode->pszValue &&
+      strcasecmp(psNode->pszValue, "AND") == 0 &&
+      !(FLTIsAttributeOnlyFilter(psNode) && FLTIsNativeFilterNode(psNode, lp))) {
+    pszLeft = FLTGetNativeAttributeFilter(psNode->psLeftNode, lp);
+    pszRight = FLTGetNativeAttributeFilter(psNode->psRightNode, lp);
+    if (pszLeft && pszRight) {
+      pszExpression = msStringConcatenate(pszExpression, "(");
+      pszExpression = msStringConcatenate(pszExpression, pszLeft);
+      pszExpression = msStringConcatenate(pszExpression, " AND ");
+      pszExpression = msStringConcatenate(pszExpression, pszRight);
+      pszExpression = msStringConcatenate(pszExpression, ")");
+      msFree(pszLeft);
+      msFree(pszRight);
+      return pszExpression;
+    }
+    return pszLeft ? pszLeft : pszRight;
+  }
+
+  if (FLTIsAttributeOnlyFilter(psNode) && FLTIsNativeFilterNode(psNode, lp)) {
+    pszExpression = FLTGetSQLExpression(psNode, lp);
+    if (pszExpression && !FLTIsNullSafeFilter(psNode)) {
+      pszLeft = msStringConcatenate(pszLeft, "(");
+      pszLeft = msStringConcatenate(pszLeft, pszExpression);
+      pszLeft = FLTAddNullTests(psNode, lp, pszLeft);
+      pszLeft = msStringConcatenate(pszLeft, ")");
+      msFree(pszExpression);
+      pszExpression = pszLeft;
+    }
+    return pszExpression;
+  }
+
+  return NULL;
+}
+
+/************************************************************************/
+/*                            FLTGetQueryRect                           */
+/*                                                                      */
+/*      Computes a rectangle containing every feature the filter can    */
+/*      match, in the coordinates msQueryByFilter() expects for the     */
+/*      search rectangle of the layer. Returns MS_FALSE if the filter   */
+/*      does not restrict the search area (attribute filters, NOT,      */
+/*      Disjoint, Beyond...).                                           */
+/************************************************************************/
+int FLTGetQueryRect(FilterEncodingNode *psNode, layerObj *lp, rectObj *psRect)
+{
+  rectObj sLeftRect, sRightRect;
+  int bLeft = MS_FALSE, bRight = MS_FALSE;
+  char *pszSRS = NULL;
+  shapeObj *psShape = NULL;
+  double dfDistance = -1;
+  int nUnit = -1;
+  projectionObj sProjTmp;
+
+  if (psNode == NULL || lp == NULL || psRect == NULL || psNode->pszValue == NULL)
+    return MS_FALSE;
+
+  if (psNode->eType == FILTER_NODE_TYPE_LOGICAL) {
+    if (strcasecmp(psNode->pszValue, "AND") == 0) {
+      bLeft = FLTGetQueryRect(psNode->psLeftNode, lp, &sLeftRect);
+      bRight = FLTGetQueryRect(psNode->psRightNode, lp, &sRightRect);
+      if (bLeft && bRight) {
+        psRect->minx = MS_MAX(sLeftRect.minx, sRightRect.minx);
+        psRect->miny = MS_MAX(sLeftRect.miny, sRightRect.miny);
+        psRect->maxx = MS_MIN(sLeftRect.maxx, sRightRect.maxx);
+        psRect->maxy = MS_MIN(sLeftRect.maxy, sRightRect.maxy);
+      } else if (bLeft)
+        *psRect = sLeftRect;
+      else if (bRight)
+        *psRect = sRightRect;
+      return (bLeft || bRight);
+    } else if (strcasecmp(psNode->pszValue, "OR") == 0) {
+      /* every operand has to be restricted */
+      if (FLTGetQueryRect(psNode->psLeftNode, lp, &sLeftRect) &&
+          FLTGetQueryRect(psNode->psRightNode, lp, &sRightRect)) {
+        psRect->minx = MS_MIN(sLeftRect.minx, sRightRect.minx);
+        psRect->miny = MS_MIN(sLeftRect.miny, sRightRect.miny);
+        psRect->maxx = MS_MAX(sLeftRect.maxx, sRightRect.maxx);
+        psRect->maxy = MS_MAX(sLeftRect.maxy, sRightRect.maxy);
+        return MS_TRUE;
+      }
+    }
+    return MS_FALSE;
+  }
+
+  if (psNode->eType != FILTER_NODE_TYPE_SPATIAL)
+    return MS_FALSE;
+
+  if (FLTIsBBoxFilter(psNode)) {
+    if (!psNode->psRightNode || !psNode->psRightNode->pOther)
+      return MS_FALSE;
+    pszSRS = FLTGetBBOX(psNode, psRect);
+  } else {
+    if (strcasecmp(psNode->pszValue, "Disjoint") == 0 ||
+        strcasecmp(psNode->pszValue, "Beyond") == 0)
+      return MS_FALSE;
+
+    psShape = FLTGetShape(psNode, &dfDistance, &nUnit);
+    if (psShape == NULL || psShape->numlines == 0)
+      return MS_FALSE;
+    msComputeBounds(psShape);
+    *psRect = psShape->bounds;
+
+    /* same unit handling as FLTGetSpatialComparisonCommonExpression() */
+    if (strcasecmp(psNode->pszValue, "DWithin") == 0 && dfDistance > 0) {
+      if (nUnit >=0 && nUnit != lp->map->units)
+        dfDistance *= msInchesPerUnit(nUnit,0)/msInchesPerUnit(lp->map->units,0);
+      psRect->minx -= dfDistance;
+      psRect->miny -= dfDistance;
+      psRect->maxx += dfDistance;
+      psRect->maxy += dfDistance;
+    }
+    pszSRS = psNode->pszSRS;
+  }
+
+  /* The filter geometry is compared to the shapes in layer coordinates,
+     projected from its srs if the layer has a projection. msQueryByFilter()
+     projects the search rectangle from the map projection to the layer one. */
+  if (pszSRS && lp->projection.numargs > 0) {
+    if (FLTParseEpsgString(pszSRS, &sProjTmp)) {
+      if (lp->map->projection.numargs <= 0) {
+        msFreeProjection(&sProjTmp);
+        return MS_FALSE;
+      }
+#ifdef USE_PROJ
+      msProjectRect(&sProjTmp, &(lp->map->projection), psRect);
+#endif
+      msFreeProjection(&sProjTmp);
+    }
+  }
+
+  return MS_TRUE;
+}
+
 /************************************************************************/
 /*                   FLTLayerApplyPlainFilterToLayer                    */
 /*                                                                      */
@@ -772,12 +1142,46 @@ int FLTLayerApplyPlainFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
                                     int iLayerIndex)
 {
   char *pszExpression  =NULL;
+  char *pszNativeFilter = NULL, *pszTmp = NULL;
+  layerObj *lp = GET_LAYER(map, iLayerIndex);
+  rectObj sQueryRect = map->extent, sFilterRect;
   int status =MS_FALSE;
 
-  pszExpression = FLTGetCommonExpression(psNode,  GET_LAYER(map, iLayerIndex));
+  pszExpression = FLTGetCommonExpression(psNode, lp);
   if (pszExpression) {
-    status = FLTApplyFilterToLayerCommonExpression(map, iLayerIndex, pszExpression);
+    /* the spatial part of the filter narrows the search rectangle so
+       that drivers can use their spatial index (.qix, OGR spatial
+       filter...). The whole expression is still evaluated on the
+       features returned. */
+    if (FLTGetQueryRect(psNode, lp, &sFilterRect) &&
+        sFilterRect.minx <= sFilterRect.maxx && sFilterRect.miny <= sFilterRect.maxy &&
+        msRectOverlap(&sFilterRect, &(map->extent))) {
+      sQueryRect.minx = MS_MAX(sFilterRect.minx, map->extent.minx);
+      sQueryRect.miny = MS_MAX(sFilterRect.miny, map->extent.miny);
+      sQueryRect.maxx = MS_MIN(sFilterRect.maxx, map->extent.maxx);
+      sQueryRect.maxy = MS_MIN(sFilterRect.maxy, map->extent.maxy);
+    }
+
+    /* OGR layers get the attribute only part of the filter as a native
+       attribute filter, the layer is opened to check the field types */
+    if (lp->connectiontype == MS_OGR && msLayerOpen(lp) == MS_SUCCESS) {
+      pszTmp = FLTGetNativeAttributeFilter(psNode, lp);
+      if (pszTmp) {
+        pszNativeFilter = msStringConcatenate(pszNativeFilter, "WHERE ");
+        pszNativeFilter = msStringConcatenate(pszNativeFilter, pszTmp);
+        msFree(pszTmp);
+      }
+    }
+
+    if (map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("FLTLayerApplyPlainFilterToLayer(): layer %s, search rectangle %f %f %f %f, native filter %s\n",
+              lp->name ? lp->name : "(null)", sQueryRect.minx, sQueryRect.miny,
+              sQueryRect.maxx, sQueryRect.maxy, pszNativeFilter ? pszNativeFilter : "none");
+
+    status = FLTApplyFilterToLayerCommonExpressionWithRect(map, iLayerIndex, pszExpression,
+             sQueryRect, pszNativeFilter);
     msFree(pszExpression);
+    msFree(pszNativeFilter);
   }
 
   return status;
@@ -785,6 +1189,7 @@ int FLTLayerApplyPlainFilterToLayer(FilterEncodingNode *psNode, mapObj *map,
 
 
 
+
 /************************************************************************/
 /*            FilterNode *FLTPaserFilterEncoding(char *szXMLString)     */
 /*                                                                      */
@@ -2018,8 +2423,9 @@ char *FLTGetMapserverExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
   const char *pszAttribute = NULL;
   char szTmp[256];
   char **tokens = NULL;
-  int nTokens = 0, i=0,bString=0;
+  int nTokens = 0, i=0,bString=0, status=MS_SUCCESS;
   char *pszTmp;
+  msStringBuffer *idBuffer = NULL;
 
   if (!psFilterNode)
     return NULL;
@@ -2052,6 +2458,7 @@ char *FLTGetMapserverExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
       if (pszAttribute) {
         tokens = msStringSplit(psFilterNode->pszValue,',', &nTokens);
         if (tokens && nTokens > 0) {
+          idBuffer = msStringBufferAlloc();
           for (i=0; i<nTokens; i++) {
             if (i == 0) {
               pszTmp = tokens[0];
@@ -2063,19 +2470,27 @@ char *FLTGetMapserverExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
             else
               snprintf(szTmp, sizeof(szTmp), "([%s] = %s)" , pszAttribute, tokens[i]);
 
-            if (pszExpression != NULL)
-              pszExpression = msStringConcatenate(pszExpression, " OR ");
+            if (msStringBufferGetString(idBuffer) != NULL)
+              status = msStringBufferAppend(idBuffer, " OR ");
             else
-              pszExpression = msStringConcatenate(pszExpression, "(");
-            pszExpression = msStringConcatenate(pszExpression, szTmp);
+              status = msStringBufferAppend(idBuffer, "(");
+            if (status == MS_SUCCESS)
+              status = msStringBufferAppend(idBuffer, szTmp);
+            if (status != MS_SUCCESS)
+              break;
           }
 
+          /*opening and closing brackets are needed for mapserver expressions*/
+          if (status == MS_SUCCESS && msStringBufferGetString(idBuffer) != NULL)
+            status = msStringBufferAppend(idBuffer, ")");
+          if (status == MS_SUCCESS)
+            pszExpression = msStringBufferReleaseStringAndFree(idBuffer);
+          else
+            msStringBufferFree(idBuffer);
+
           msFreeCharArray(tokens, nTokens);
         }
       }
-      /*opening and closing brackets are needed for mapserver expressions*/
-      if (pszExpression)
-        pszExpression = msStringConcatenate(pszExpression, ")");
     }
 #else
     msSetError(MS_MISCERR, "OWS support is not available.",
@@ -2099,7 +2514,8 @@ char *FLTGetSQLExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
   const char *pszAttribute = NULL;
   char szTmp[256];
   char **tokens = NULL;
-  int nTokens = 0, i=0, bString=0;
+  int nTokens = 0, i=0, bString=0, status=MS_SUCCESS;
+  msStringBuffer *idBuffer = NULL;
 
   if (psFilterNode == NULL || lp == NULL)
     return NULL;
@@ -2143,6 +2559,7 @@ char *FLTGetSQLExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
         tokens = msStringSplit(psFilterNode->pszValue,',', &nTokens);
         bString = 0;
         if (tokens && nTokens > 0) {
+          idBuffer = msStringBufferAlloc();
           for (i=0; i<nTokens; i++) {
             char *pszEscapedStr = NULL;
             if (strlen(tokens[i]) <= 0)
@@ -2160,21 +2577,28 @@ char *FLTGetSQLExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
             msFree(pszEscapedStr);
             pszEscapedStr=NULL;
 
-            if (pszExpression != NULL)
-              pszExpression = msStringConcatenate(pszExpression, " OR ");
+            if (msStringBufferGetString(idBuffer) != NULL)
+              status = msStringBufferAppend(idBuffer, " OR ");
             else
               /*opening and closing brackets*/
-              pszExpression = msStringConcatenate(pszExpression, "(");
-
-            pszExpression = msStringConcatenate(pszExpression, szTmp);
+              status = msStringBufferAppend(idBuffer, "(");
+            if (status == MS_SUCCESS)
+              status = msStringBufferAppend(idBuffer, szTmp);
+            if (status != MS_SUCCESS)
+              break;
           }
 
+          /*opening and closing brackets*/
+          if (status == MS_SUCCESS && msStringBufferGetString(idBuffer) != NULL)
+            status = msStringBufferAppend(idBuffer, ")");
+          if (status == MS_SUCCESS)
+            pszExpression = msStringBufferReleaseStringAndFree(idBuffer);
+          else
+            msStringBufferFree(idBuffer);
+
           msFreeCharArray(tokens, nTokens);
         }
       }
-      /*opening and closing brackets*/
-      if (pszExpression)
-        pszExpression = msStringConcatenate(pszExpression, ")");
     }
 #else
     msSetError(MS_MISCERR, "OWS support is not available.",
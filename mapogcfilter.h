@@ -129,6 +129,9 @@ MS_DLL_EXPORT  int FLTParseGMLBox(CPLXMLNode *psBox, rectObj *psBbox, char **pps
 MS_DLL_EXPORT   char *FLTGetBinaryComparisonCommonExpression(FilterEncodingNode *psFilterNode, layerObj *lp);
 MS_DLL_EXPORT  char *FLTGetCommonExpression(FilterEncodingNode *psFilterNode, layerObj *lp);
 MS_DLL_EXPORT int FLTApplyFilterToLayerCommonExpression(mapObj *map, int iLayerIndex, char *pszExpression);
+MS_DLL_EXPORT int FLTApplyFilterToLayerCommonExpressionWithRect(mapObj *map, int iLayerIndex, char *pszExpression,
+    rectObj rect, char *pszNativeFilter);
+MS_DLL_EXPORT int FLTGetQueryRect(FilterEncodingNode *psNode, layerObj *lp, rectObj *psRect);
 
 
 #ifdef USE_LIBXML2
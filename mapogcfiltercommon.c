@@ -597,6 +597,8 @@ char *FLTGetFeatureIdCommonExpression(FilterEncodingNode *psFilterNode, layerObj
   int nTokens = 0, i=0, bString=0;
   char **tokens = NULL;
   const char *pszAttribute=NULL;
+  msStringBuffer *idBuffer = NULL;
+  int status = MS_SUCCESS;
 
 #if defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR)
   if (psFilterNode->pszValue) {
@@ -604,6 +606,7 @@ char *FLTGetFeatureIdCommonExpression(FilterEncodingNode *psFilterNode, layerObj
     if (pszAttribute) {
       tokens = msStringSplit(psFilterNode->pszValue,',', &nTokens);
       if (tokens && nTokens > 0) {
+        idBuffer = msStringBufferAlloc();
         for (i=0; i<nTokens; i++) {
           char *pszTmp = NULL;
           int bufferSize = 0;
@@ -624,20 +627,28 @@ char *FLTGetFeatureIdCommonExpression(FilterEncodingNode *psFilterNode, layerObj
             snprintf(pszTmp, bufferSize, "([%s] == %s)" , pszAttribute, tokens[i]);
           }
 
-          if (pszExpression != NULL)
-            pszExpression = msStringConcatenate(pszExpression, " OR ");
+          if (msStringBufferGetString(idBuffer) != NULL)
+            status = msStringBufferAppend(idBuffer, " OR ");
           else
-            pszExpression = msStringConcatenate(pszExpression, "(");
-          pszExpression = msStringConcatenate(pszExpression, pszTmp);
+            status = msStringBufferAppend(idBuffer, "(");
+          if (status == MS_SUCCESS)
+            status = msStringBufferAppend(idBuffer, pszTmp);
           msFree(pszTmp);
+          if (status != MS_SUCCESS)
+            break;
         }
 
+        /*opening and closing brackets are needed for mapserver expressions*/
+        if (status == MS_SUCCESS && msStringBufferGetString(idBuffer) != NULL)
+          status = msStringBufferAppend(idBuffer, ")");
+        if (status == MS_SUCCESS)
+          pszExpression = msStringBufferReleaseStringAndFree(idBuffer);
+        else
+          msStringBufferFree(idBuffer);
+
         msFreeCharArray(tokens, nTokens);
       }
     }
-    /*opening and closing brackets are needed for mapserver expressions*/
-    if (pszExpression)
-      pszExpression = msStringConcatenate(pszExpression, ")");
   }
 #endif
 
@@ -676,6 +687,19 @@ char *FLTGetCommonExpression(FilterEncodingNode *psFilterNode, layerObj *lp)
 
 
 int FLTApplyFilterToLayerCommonExpression(mapObj *map, int iLayerIndex, char *pszExpression)
+{
+  return FLTApplyFilterToLayerCommonExpressionWithRect(map, iLayerIndex, pszExpression,
+         map->extent, NULL);
+}
+
+/*
+** Same as FLTApplyFilterToLayerCommonExpression() but only searches rect (in
+** map projection) and hands pszNativeFilter (an OGR "WHERE ..." clause) to
+** drivers that can pre-filter features. Both have to be implied by the
+** expression, which is still evaluated on every feature returned.
+*/
+int FLTApplyFilterToLayerCommonExpressionWithRect(mapObj *map, int iLayerIndex, char *pszExpression,
+    rectObj rect, char *pszNativeFilter)
 {
   int retval;
 
@@ -689,8 +713,10 @@ int FLTApplyFilterToLayerCommonExpression(mapObj *map, int iLayerIndex, char *ps
   map->query.filter->type = 2000;
   map->query.layer = iLayerIndex;
 
-  /*TODO: if there is a bbox in the node, get it and set the map extent*/
-  map->query.rect = map->extent;
+  if (pszNativeFilter)
+    map->query.nativefilter = msStrdup(pszNativeFilter);
+
+  map->query.rect = rect;
 
   retval = msQueryByFilter(map);
 
@@ -3081,6 +3081,7 @@ char *msSLDGenerateSLD(mapObj *map, int iLayer, const char *pszVersion)
   int i = 0;
   char *pszTmp = NULL;
   char *pszSLD = NULL;
+  msStringBuffer *sldBuffer = NULL;
   char *schemalocation = NULL;
   int sld_version = OWS_VERSION_NOTSET;
 
@@ -3099,24 +3100,26 @@ char *msSLDGenerateSLD(mapObj *map, int iLayer, const char *pszVersion)
 
     free(schemalocation);
 
-    pszSLD = msStringConcatenate(pszSLD, szTmp);
+    sldBuffer = msStringBufferAlloc();
+    msStringBufferAppend(sldBuffer, szTmp);
     if (iLayer < 0 || iLayer > map->numlayers -1) {
       for (i=0; i<map->numlayers; i++) {
         pszTmp = msSLDGenerateSLDLayer(GET_LAYER(map, i), sld_version);
         if (pszTmp) {
-          pszSLD= msStringConcatenate(pszSLD, pszTmp);
+          msStringBufferAppend(sldBuffer, pszTmp);
           free(pszTmp);
         }
       }
     } else {
       pszTmp = msSLDGenerateSLDLayer(GET_LAYER(map, iLayer), sld_version);
       if (pszTmp) {
-        pszSLD = msStringConcatenate(pszSLD, pszTmp);
+        msStringBufferAppend(sldBuffer, pszTmp);
         free(pszTmp);
       }
     }
     snprintf(szTmp, sizeof(szTmp), "%s", "</StyledLayerDescriptor>\n");
-    pszSLD = msStringConcatenate(pszSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
+    pszSLD = msStringBufferReleaseStringAndFree(sldBuffer);
   }
 
   return pszSLD;
@@ -4012,6 +4015,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
   styleObj *psStyle = NULL;
   char *pszFilter = NULL;
   char *pszFinalSLD = NULL;
+  msStringBuffer *sldBuffer = NULL;
   char *pszSLD = NULL;
   const char *pszTmp = NULL;
   double dfMinScale =-1, dfMaxScale = -1;
@@ -4025,8 +4029,9 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
        psLayer->type == MS_LAYER_LINE ||
        psLayer->type == MS_LAYER_POLYGON ||
        psLayer->type == MS_LAYER_ANNOTATION)) {
+    sldBuffer = msStringBufferAlloc();
     snprintf(szTmp, sizeof(szTmp), "%s\n",  "<NamedLayer>");
-    pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
 
     pszTmp = msOWSLookupMetadata(&(psLayer->metadata), "MO", "name");
     if (pszTmp) {
@@ -4035,7 +4040,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
         snprintf(szTmp, sizeof(szTmp), "<se:Name>%s</se:Name>\n", pszEncoded);
       else
         snprintf(szTmp, sizeof(szTmp), "<Name>%s</Name>\n", pszEncoded);
-      pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+      msStringBufferAppend(sldBuffer, szTmp);
       msFree(pszEncoded);
     } else if (psLayer->name) {
       pszEncoded = msEncodeHTMLEntities(psLayer->name);
@@ -4047,7 +4052,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
 
 
       msFree(pszEncoded);
-      pszFinalSLD = msStringConcatenate(pszFinalSLD, pszTmpName);
+      msStringBufferAppend(sldBuffer, pszTmpName);
       msFree(pszTmpName);
       pszTmpName=NULL;
 
@@ -4056,19 +4061,19 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
         snprintf(szTmp, sizeof(szTmp), "<se:Name>%s</se:Name>\n", "NamedLayer");
       else
         snprintf(szTmp, sizeof(szTmp), "<Name>%s</Name>\n", "NamedLayer");
-      pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+      msStringBufferAppend(sldBuffer, szTmp);
     }
 
 
     snprintf(szTmp,  sizeof(szTmp), "%s\n",  "<UserStyle>");
-    pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
 
     if (nVersion > OWS_1_0_0)
       snprintf(szTmp, sizeof(szTmp), "%s\n",  "<se:FeatureTypeStyle>");
     else
       snprintf(szTmp, sizeof(szTmp), "%s\n",  "<FeatureTypeStyle>");
 
-    pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
 
     pszWfsFilter = msLookupHashTable(&(psLayer->metadata), "wfs_filter");
     if (pszWfsFilter)
@@ -4080,7 +4085,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
         else
           snprintf(szTmp, sizeof(szTmp), "%s\n",  "<Rule>");
 
-        pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+        msStringBufferAppend(sldBuffer, szTmp);
 
         /* if class has a name, use it as the RULE name */
         if (psLayer->class[i]->name) {
@@ -4094,7 +4099,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
 
           msFree(pszEncoded);
 
-          pszFinalSLD = msStringConcatenate(pszFinalSLD, pszTmpName);
+          msStringBufferAppend(sldBuffer, pszTmpName);
           msFree(pszTmpName);
           pszTmpName=NULL;
         }
@@ -4105,7 +4110,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
                                    pszWfsFilter);/* pszWfsFilterEncoded); */
 
         if (pszFilter) {
-          pszFinalSLD = msStringConcatenate(pszFinalSLD, pszFilter);
+          msStringBufferAppend(sldBuffer, pszFilter);
           free(pszFilter);
         }
         /* -------------------------------------------------------------------- */
@@ -4126,7 +4131,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
             snprintf(szTmp, sizeof(szTmp), "<MinScaleDenominator>%f</MinScaleDenominator>\n",
                      dfMinScale);
 
-          pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+          msStringBufferAppend(sldBuffer, szTmp);
         }
 
         dfMaxScale = -1.0;
@@ -4144,7 +4149,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
             snprintf(szTmp, sizeof(szTmp), "<MaxScaleDenominator>%f</MaxScaleDenominator>\n",
                      dfMaxScale);
 
-          pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+          msStringBufferAppend(sldBuffer, szTmp);
         }
 
 
@@ -4161,7 +4166,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
             psStyle = psLayer->class[i]->styles[j];
             pszSLD = msSLDGenerateLineSLD(psStyle, psLayer, nVersion);
             if (pszSLD) {
-              pszFinalSLD = msStringConcatenate(pszFinalSLD, pszSLD);
+              msStringBufferAppend(sldBuffer, pszSLD);
               free(pszSLD);
             }
           }
@@ -4171,7 +4176,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
             psStyle = psLayer->class[i]->styles[j];
             pszSLD = msSLDGeneratePolygonSLD(psStyle, psLayer, nVersion);
             if (pszSLD) {
-              pszFinalSLD = msStringConcatenate(pszFinalSLD, pszSLD);
+              msStringBufferAppend(sldBuffer, pszSLD);
               free(pszSLD);
             }
           }
@@ -4181,7 +4186,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
             psStyle = psLayer->class[i]->styles[j];
             pszSLD = msSLDGeneratePointSLD(psStyle, psLayer, nVersion);
             if (pszSLD) {
-              pszFinalSLD = msStringConcatenate(pszFinalSLD, pszSLD);
+              msStringBufferAppend(sldBuffer, pszSLD);
               free(pszSLD);
             }
           }
@@ -4191,7 +4196,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
             psStyle = psLayer->class[i]->styles[j];
             pszSLD = msSLDGeneratePointSLD(psStyle, psLayer, nVersion);
             if (pszSLD) {
-              pszFinalSLD = msStringConcatenate(pszFinalSLD, pszSLD);
+              msStringBufferAppend(sldBuffer, pszSLD);
               free(pszSLD);
             }
           }
@@ -4200,7 +4205,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
         /* label if it exists */
         pszSLD = msSLDGenerateTextSLD(psLayer->class[i], psLayer, nVersion);
         if (pszSLD) {
-          pszFinalSLD = msStringConcatenate(pszFinalSLD, pszSLD);
+          msStringBufferAppend(sldBuffer, pszSLD);
           free(pszSLD);
         }
         if (nVersion > OWS_1_0_0)
@@ -4208,7 +4213,7 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
         else
           snprintf(szTmp, sizeof(szTmp), "%s\n",  "</Rule>");
 
-        pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+        msStringBufferAppend(sldBuffer, szTmp);
 
 
       }
@@ -4220,13 +4225,14 @@ char *msSLDGenerateSLDLayer(layerObj *psLayer, int nVersion)
     else
       snprintf(szTmp, sizeof(szTmp), "%s\n",  "</FeatureTypeStyle>");
 
-    pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
 
     snprintf(szTmp, sizeof(szTmp), "%s\n",  "</UserStyle>");
-    pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
 
     snprintf(szTmp, sizeof(szTmp), "%s\n",  "</NamedLayer>");
-    pszFinalSLD = msStringConcatenate(pszFinalSLD, szTmp);
+    msStringBufferAppend(sldBuffer, szTmp);
+    pszFinalSLD = msStringBufferReleaseStringAndFree(sldBuffer);
 
   }
   return pszFinalSLD;
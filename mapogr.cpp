@@ -2058,6 +2058,44 @@ int msOGRLayerGetItems(layerObj *layer)
 #endif /* USE_OGR */
 }
 
+/**********************************************************************
+ *                     msOGRLayerGetItemType()
+ *
+ * Returns the type of a field of an opened layer as a gml type name:
+ * "Integer", "Real" or "Character", or NULL if the field does not exist
+ * or has another type. Tiled layers may mix schemas, NULL is returned
+ * for all their fields.
+ **********************************************************************/
+const char *msOGRLayerGetItemType(layerObj *layer, const char *item)
+{
+#ifdef USE_OGR
+  msOGRFileInfo *psInfo =(msOGRFileInfo*)layer->layerinfo;
+  OGRFeatureDefnH hDefn;
+  int iField;
+
+  if (psInfo == NULL || psInfo->hLayer == NULL || layer->tileindex != NULL || item == NULL)
+    return NULL;
+
+  if((hDefn = OGR_L_GetLayerDefn( psInfo->hLayer )) == NULL
+      || (iField = OGR_FD_GetFieldIndex( hDefn, item )) < 0)
+    return NULL;
+
+  switch( OGR_Fld_GetType( OGR_FD_GetFieldDefn( hDefn, iField ) ) ) {
+    case OFTInteger:
+      return "Integer";
+    case OFTReal:
+      return "Real";
+    case OFTString:
+      return "Character";
+    default:
+      return NULL;
+  }
+
+#else
+  return NULL;
+#endif /* USE_OGR */
+}
+
 /**********************************************************************
  *                     msOGRLayerInitItemInfo()
  *
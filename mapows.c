@@ -2259,6 +2259,36 @@ int msOWSGetLayerExtent(mapObj *map, layerObj *lp, const char *namespaces, rectO
 }
 
 
+#if defined(USE_CURL)
+/**********************************************************************
+ *                          msOWSSetHTTPCacheOptions()
+ *
+ * Enable the local HTTP response cache on the requests if the
+ * MS_HTTP_CACHE_DIR config option is set.  MS_HTTP_CACHE_MAXSIZE sets the
+ * size cap of the cache in megabytes.
+ **********************************************************************/
+static void msOWSSetHTTPCacheOptions(httpRequestObj *pasReqInfo,
+                                     int numRequests, mapObj *map)
+{
+  const char *pszCacheDir, *pszMaxSize;
+  char szPath[MS_MAXPATHLEN];
+  int iReq;
+
+  if ((pszCacheDir = msGetConfigOption(map, "MS_HTTP_CACHE_DIR")) == NULL)
+    return;
+  pszMaxSize = msGetConfigOption(map, "MS_HTTP_CACHE_MAXSIZE");
+
+  msBuildPath(szPath, map->mappath, pszCacheDir);
+
+  for(iReq=0; iReq<numRequests; iReq++) {
+    if (pasReqInfo[iReq].pszCacheDir != NULL)
+      continue;
+    pasReqInfo[iReq].pszCacheDir = msStrdup(szPath);
+    pasReqInfo[iReq].nCacheMaxSize = pszMaxSize ? atoi(pszMaxSize) : 0;
+  }
+}
+#endif
+
 /**********************************************************************
  *                          msOWSExecuteRequests()
  *
@@ -2272,6 +2302,7 @@ int msOWSExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
 
   /* Execute requests */
 #if defined(USE_CURL)
+  msOWSSetHTTPCacheOptions(pasReqInfo, numRequests, map);
   nStatus = msHTTPExecuteRequests(pasReqInfo, numRequests, bCheckLocalCache);
 #else
   msSetError(MS_WMSERR, "msOWSExecuteRequests() called apparently without libcurl configured, msHTTPExecuteRequests() not available.",
@@ -2296,6 +2327,119 @@ int msOWSExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
   return nStatus;
 }
 
+/**********************************************************************
+ *                          msOWSStartRequests()
+ *
+ * Start a number of WFS/WMS HTTP requests in parallel and return without
+ * waiting for them to complete.  msOWSWaitRequests() must be called for
+ * a layer before the layer can use the result of its request(s), and
+ * msOWSEndRequests() must be called before pasReqInfo is freed.
+ *
+ * Returns NULL if a fatal error happened.
+ **********************************************************************/
+httpRequestBatchObj *msOWSStartRequests(httpRequestObj *pasReqInfo,
+                                        int numRequests,
+                                        mapObj *map, int bCheckLocalCache)
+{
+#if defined(USE_CURL)
+  msOWSSetHTTPCacheOptions(pasReqInfo, numRequests, map);
+  return msHTTPStartRequests(pasReqInfo, numRequests, bCheckLocalCache);
+#else
+  msSetError(MS_WMSERR, "msOWSStartRequests() called apparently without libcurl configured, msHTTPStartRequests() not available.",
+             "msOWSStartRequests()");
+  return NULL;
+#endif
+}
+
+/**********************************************************************
+ *                          msOWSWaitRequests()
+ *
+ * Wait for the requests of layer nLayerId to complete and update the
+ * layerObj information with their result.  If there is no request for
+ * this layer then this only gives the pending transfers a chance to
+ * progress.
+ **********************************************************************/
+int msOWSWaitRequests(httpRequestBatchObj *psBatch,
+                      httpRequestObj *pasReqInfo, int numRequests,
+                      mapObj *map, int nLayerId)
+{
+#if defined(USE_CURL)
+  int nStatus, iReq;
+
+  if (psBatch == NULL)
+    return MS_SUCCESS;
+
+  for(iReq=0; iReq<numRequests; iReq++) {
+    if (pasReqInfo[iReq].nLayerId == nLayerId)
+      break;
+  }
+
+  if (iReq == numRequests) {
+    msHTTPPollRequests(psBatch);
+    return MS_SUCCESS;
+  }
+
+  nStatus = msHTTPWaitRequests(psBatch, nLayerId);
+
+  if (nLayerId >= 0 && nLayerId < map->numlayers) {
+    layerObj *lp = GET_LAYER(map, nLayerId);
+
+    for(iReq=0; iReq<numRequests; iReq++) {
+      if (pasReqInfo[iReq].nLayerId == nLayerId &&
+          lp->connectiontype == MS_WFS)
+        msWFSUpdateRequestInfo(lp, &(pasReqInfo[iReq]));
+    }
+  }
+
+  return nStatus;
+#else
+  msSetError(MS_WMSERR, "msOWSWaitRequests() called apparently without libcurl configured, msHTTPWaitRequests() not available.",
+             "msOWSWaitRequests()");
+  return MS_FAILURE;
+#endif
+}
+
+/**********************************************************************
+ *                          msOWSEndRequests()
+ *
+ * Complete (or cancel if bCancel is MS_TRUE) the requests started by
+ * msOWSStartRequests() and update layerObj information with the result
+ * of the requests.
+ **********************************************************************/
+int msOWSEndRequests(httpRequestBatchObj *psBatch,
+                     httpRequestObj *pasReqInfo, int numRequests,
+                     mapObj *map, int bCancel)
+{
+#if defined(USE_CURL)
+  int nStatus, iReq;
+
+  if (psBatch == NULL)
+    return MS_SUCCESS;
+
+  nStatus = msHTTPEndRequests(psBatch, bCancel);
+
+  for(iReq=0; !bCancel && iReq<numRequests; iReq++) {
+    if (pasReqInfo[iReq].nLayerId >= 0 &&
+        pasReqInfo[iReq].nLayerId < map->numlayers) {
+      layerObj *lp;
+
+      lp = GET_LAYER(map, pasReqInfo[iReq].nLayerId);
+
+      if (lp->connectiontype == MS_WFS)
+        msWFSUpdateRequestInfo(lp, &(pasReqInfo[iReq]));
+    }
+  }
+
+  return nStatus;
+#else
+  if (psBatch == NULL)
+    return MS_SUCCESS;
+  msSetError(MS_WMSERR, "msOWSEndRequests() called apparently without libcurl configured, msHTTPEndRequests() not available.",
+             "msOWSEndRequests()");
+  return MS_FAILURE;
+#endif
+}
+
 /**********************************************************************
  *                          msOWSProcessException()
  *
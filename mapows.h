@@ -266,6 +266,15 @@ int msOWSGetLayerExtent(mapObj *map, layerObj *lp, const char *namespaces, rectO
 
 int msOWSExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
                          mapObj *map, int bCheckLocalCache);
+httpRequestBatchObj *msOWSStartRequests(httpRequestObj *pasReqInfo,
+                                        int numRequests,
+                                        mapObj *map, int bCheckLocalCache);
+int msOWSWaitRequests(httpRequestBatchObj *psBatch,
+                      httpRequestObj *pasReqInfo, int numRequests,
+                      mapObj *map, int nLayerId);
+int msOWSEndRequests(httpRequestBatchObj *psBatch,
+                     httpRequestObj *pasReqInfo, int numRequests,
+                     mapObj *map, int bCancel);
 
 void msOWSProcessException(layerObj *lp, const char *pszFname,
                            int nErrorCode, const char *pszFuncName);
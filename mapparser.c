@@ -1843,17 +1843,17 @@ yyreduce:
 /* Line 1806 of yacc.c  */
 #line 187 "mapparser.y"
     {
-                                         ms_regex_t re;
+                                         ms_regex_t *re;
 
-                                         if(ms_regcomp(&re, (yyvsp[(3) - (3)].strval), MS_REG_EXTENDED|MS_REG_NOSUB) != 0) 
+                                         if((re = msRegexCacheAcquire((yyvsp[(3) - (3)].strval), MS_REG_EXTENDED|MS_REG_NOSUB)) == NULL)
                                            (yyval.intval) = MS_FALSE;
-
-                                         if(ms_regexec(&re, (yyvsp[(1) - (3)].strval), 0, NULL, 0) == 0)
-                                  	   (yyval.intval) = MS_TRUE;
-			                 else
-			                   (yyval.intval) = MS_FALSE;
-
-                                         ms_regfree(&re);
+                                         else {
+                                           if(ms_regexec(re, (yyvsp[(1) - (3)].strval), 0, NULL, 0) == 0)
+                                             (yyval.intval) = MS_TRUE;
+                                           else
+                                             (yyval.intval) = MS_FALSE;
+                                           msRegexCacheRelease(re);
+                                         }
                                          free((yyvsp[(1) - (3)].strval));
                                          free((yyvsp[(3) - (3)].strval));
                                        }
@@ -1864,17 +1864,17 @@ yyreduce:
 /* Line 1806 of yacc.c  */
 #line 202 "mapparser.y"
     {
-                                         ms_regex_t re;
+                                         ms_regex_t *re;
 
-                                         if(ms_regcomp(&re, (yyvsp[(3) - (3)].strval), MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE) != 0) 
+                                         if((re = msRegexCacheAcquire((yyvsp[(3) - (3)].strval), MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE)) == NULL)
                                            (yyval.intval) = MS_FALSE;
-
-                                         if(ms_regexec(&re, (yyvsp[(1) - (3)].strval), 0, NULL, 0) == 0)
-                                  	   (yyval.intval) = MS_TRUE;
-			                 else
-			                   (yyval.intval) = MS_FALSE;
-
-                                         ms_regfree(&re);
+                                         else {
+                                           if(ms_regexec(re, (yyvsp[(1) - (3)].strval), 0, NULL, 0) == 0)
+                                             (yyval.intval) = MS_TRUE;
+                                           else
+                                             (yyval.intval) = MS_FALSE;
+                                           msRegexCacheRelease(re);
+                                         }
                                          free((yyvsp[(1) - (3)].strval));
                                          free((yyvsp[(3) - (3)].strval));
                                        }
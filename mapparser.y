@@ -185,32 +185,32 @@ logical_exp:
        | NOT logical_exp	       { $$ = !$2; }
        | NOT math_exp	       	       { $$ = !$2; }
        | string_exp RE string_exp     {
-                                         ms_regex_t re;
+                                         ms_regex_t *re;
 
-                                         if(ms_regcomp(&re, $3, MS_REG_EXTENDED|MS_REG_NOSUB) != 0) 
+                                         if((re = msRegexCacheAcquire($3, MS_REG_EXTENDED|MS_REG_NOSUB)) == NULL)
                                            $$ = MS_FALSE;
-
-                                         if(ms_regexec(&re, $1, 0, NULL, 0) == 0)
-                                  	   $$ = MS_TRUE;
-			                 else
-			                   $$ = MS_FALSE;
-
-                                         ms_regfree(&re);
+                                         else {
+                                           if(ms_regexec(re, $1, 0, NULL, 0) == 0)
+                                             $$ = MS_TRUE;
+                                           else
+                                             $$ = MS_FALSE;
+                                           msRegexCacheRelease(re);
+                                         }
                                          free($1);
                                          free($3);
                                        }
        | string_exp IRE string_exp     {
-                                         ms_regex_t re;
+                                         ms_regex_t *re;
 
-                                         if(ms_regcomp(&re, $3, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE) != 0) 
+                                         if((re = msRegexCacheAcquire($3, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE)) == NULL)
                                            $$ = MS_FALSE;
-
-                                         if(ms_regexec(&re, $1, 0, NULL, 0) == 0)
-                                  	   $$ = MS_TRUE;
-			                 else
-			                   $$ = MS_FALSE;
-
-                                         ms_regfree(&re);
+                                         else {
+                                           if(ms_regexec(re, $1, 0, NULL, 0) == 0)
+                                             $$ = MS_TRUE;
+                                           else
+                                             $$ = MS_FALSE;
+                                           msRegexCacheRelease(re);
+                                         }
                                          free($1);
                                          free($3);
                                        }
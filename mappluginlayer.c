@@ -160,6 +160,7 @@ copyVirtualTable(layerVTableObj *dest,
   dest->LayerIsOpen = src->LayerIsOpen ? src->LayerIsOpen : dest->LayerIsOpen;
   dest->LayerWhichShapes = src->LayerWhichShapes ? src->LayerWhichShapes : dest->LayerWhichShapes;
   dest->LayerNextShape = src->LayerNextShape ? src->LayerNextShape : dest->LayerNextShape;
+  dest->LayerNextShapes = src->LayerNextShapes ? src->LayerNextShapes : dest->LayerNextShapes;
   dest->LayerGetShape = src->LayerGetShape ? src->LayerGetShape : dest->LayerGetShape;
   /* dest->LayerResultsGetShape = src->LayerResultsGetShape ? src->LayerResultsGetShape : dest->LayerResultsGetShape; */
   dest->LayerClose = src->LayerClose ? src->LayerClose : dest->LayerClose;
@@ -2154,15 +2154,22 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
     char *tmp;
     /* Found a drawable shape, so now retreive the attributes. */
 
-    shape->values = (char**) msSmallMalloc(sizeof(char*) * layer->numitems);
+    /* Attribute values are taken from the layer arena while drawing */
+    if (layer->arena)
+      shape->values = (char**) msShapeArenaAlloc(layer->arena, sizeof(char*) * layer->numitems);
+    else
+      shape->values = (char**) msSmallMalloc(sizeof(char*) * layer->numitems);
     for ( t = 0; t < layer->numitems; t++) {
       int size = PQgetlength(layerinfo->pgresult, layerinfo->rownum, t);
       char *val = (char*)PQgetvalue(layerinfo->pgresult, layerinfo->rownum, t);
       int isnull = PQgetisnull(layerinfo->pgresult, layerinfo->rownum, t);
       if ( isnull ) {
-        shape->values[t] = msStrdup("");
+        shape->values[t] = (layer->arena) ? msShapeArenaStrdup(layer->arena, "") : msStrdup("");
       } else {
-        shape->values[t] = (char*) msSmallMalloc(size + 1);
+        if (layer->arena)
+          shape->values[t] = (char*) msShapeArenaAlloc(layer->arena, size + 1);
+        else
+          shape->values[t] = (char*) msSmallMalloc(size + 1);
         memcpy(shape->values[t], val, size);
         shape->values[t][size] = '\0'; /* null terminate it */
         msStringTrimBlanks(shape->values[t]);
@@ -46,6 +46,261 @@ typedef enum {CLIP_LEFT, CLIP_MIDDLE, CLIP_RIGHT} CLIP_STATE;
 #endif
 #define NEARZERO (1.0e-30) /* 1/INFINITY */
 
+/*
+** Vector kernels for the map to image transform, the bounds computation and
+** the clipping trivial accept test. They produce the same coordinates as the
+** scalar code (MS_MAP2IMAGE_*_IC macros and MS_NINT()), the SSE2 kernels are
+** used wherever the compiler targets SSE2 and the AVX2 ones when the CPU
+** supports them at runtime.
+*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MS_HAVE_SSE2_KERNELS
+#include <emmintrin.h>
+#endif
+
+/* AVX2 kernels need the target attribute and work on two contiguous x,y pairs */
+#if defined(MS_HAVE_SSE2_KERNELS) && defined(__x86_64__) && !defined(USE_POINT_Z_M) && \
+    ((defined(__clang__) && __clang_major__ >= 8) || \
+     (!defined(__clang__) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define MS_HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+/* largest magnitude converted to int32 by the rounding kernels, anything else goes through MS_NINT() */
+#define MS_KERNEL_INT_LIMIT (2147483647.0)
+
+static int msPrimitiveKernels = -2; /* not detected yet */
+
+static int msDetectPrimitiveKernels(void)
+{
+#ifdef MS_HAVE_AVX2_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return MS_PRIMITIVE_KERNELS_AVX2;
+#endif
+#ifdef MS_HAVE_SSE2_KERNELS
+  return MS_PRIMITIVE_KERNELS_SSE2;
+#else
+  return MS_PRIMITIVE_KERNELS_SCALAR;
+#endif
+}
+
+/*
+** Returns the kernels in use, detecting the best available ones on first call.
+*/
+int msGetPrimitiveKernels(void)
+{
+  if(msPrimitiveKernels < MS_PRIMITIVE_KERNELS_REFERENCE)
+    msPrimitiveKernels = msDetectPrimitiveKernels();
+  return msPrimitiveKernels;
+}
+
+/*
+** Forces the kernels used by the primitive code, e.g. to compare them. Requests
+** for kernels unavailable on this build or CPU fall back to the best available
+** ones. MS_PRIMITIVE_KERNELS_REFERENCE also turns off the shortcuts of the
+** clipping code. Returns the kernels actually selected.
+*/
+int msSetPrimitiveKernels(int kernels)
+{
+  int best = msDetectPrimitiveKernels();
+  if(kernels < MS_PRIMITIVE_KERNELS_REFERENCE || kernels > best)
+    kernels = best;
+  msPrimitiveKernels = kernels;
+  return kernels;
+}
+
+static void transformPointsScalar(pointObj *point, int numpoints, double minx, double maxy, double inv_cs, int round)
+{
+  int i;
+  if(round) {
+    for(i=0; i<numpoints; i++) {
+      point[i].x = MS_MAP2IMAGE_X_IC(point[i].x, minx, inv_cs);
+      point[i].y = MS_MAP2IMAGE_Y_IC(point[i].y, maxy, inv_cs);
+    }
+  } else {
+    for(i=0; i<numpoints; i++) {
+      point[i].x = MS_MAP2IMAGE_X_IC_DBL(point[i].x, minx, inv_cs);
+      point[i].y = MS_MAP2IMAGE_Y_IC_DBL(point[i].y, maxy, inv_cs);
+    }
+  }
+}
+
+static void boundsPointsScalar(const pointObj *point, int numpoints, rectObj *bounds)
+{
+  int i;
+  for(i=0; i<numpoints; i++) {
+    bounds->minx = MS_MIN(bounds->minx, point[i].x);
+    bounds->maxx = MS_MAX(bounds->maxx, point[i].x);
+    bounds->miny = MS_MIN(bounds->miny, point[i].y);
+    bounds->maxy = MS_MAX(bounds->maxy, point[i].y);
+  }
+}
+
+#ifdef MS_HAVE_SSE2_KERNELS
+/*
+** One point per register. (x-minx, maxy-y) is computed from (x, maxy) and
+** (minx, y) so that both the values and the sign of zeros match the macros.
+*/
+static void transformPointsSSE2(pointObj *point, int numpoints, double minx, double maxy, double inv_cs, int round)
+{
+  int i;
+  const __m128d origin = _mm_set_pd(0.0, minx); /* (minx, 0) */
+  const __m128d top = _mm_set_pd(maxy, 0.0); /* (0, maxy) */
+  const __m128d scale = _mm_set1_pd(inv_cs);
+#if defined(MS_NINT_IS_GENERIC) || defined(MS_NINT_IS_LRINT)
+  const __m128d limit = _mm_set1_pd(MS_KERNEL_INT_LIMIT);
+  const __m128d absmask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+#endif
+#ifdef MS_NINT_IS_GENERIC
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d signmask = _mm_castsi128_pd(_mm_set1_epi64x((long long)0x8000000000000000ULL));
+#endif
+
+  for(i=0; i<numpoints; i++) {
+    __m128d p = _mm_loadu_pd(&point[i].x);
+    __m128d v = _mm_mul_pd(_mm_sub_pd(_mm_move_sd(top, p), _mm_move_sd(p, origin)), scale);
+    if(round) {
+#if defined(MS_NINT_IS_GENERIC)
+      /* MS_NINT_GENERIC(): add 0.5 away from zero then truncate */
+      __m128d t = _mm_add_pd(v, _mm_or_pd(_mm_and_pd(v, signmask), half));
+      if(_mm_movemask_pd(_mm_cmplt_pd(_mm_and_pd(t, absmask), limit)) == 3) {
+        _mm_storeu_pd(&point[i].x, _mm_cvtepi32_pd(_mm_cvttpd_epi32(t)));
+        continue;
+      }
+#elif defined(MS_NINT_IS_LRINT)
+      /* lrint(): round with the current rounding mode */
+      if(_mm_movemask_pd(_mm_cmplt_pd(_mm_and_pd(v, absmask), limit)) == 3) {
+        _mm_storeu_pd(&point[i].x, _mm_cvtepi32_pd(_mm_cvtpd_epi32(v)));
+        continue;
+      }
+#endif
+      _mm_storeu_pd(&point[i].x, v);
+      point[i].x = MS_NINT(point[i].x);
+      point[i].y = MS_NINT(point[i].y);
+    } else {
+      _mm_storeu_pd(&point[i].x, v);
+    }
+  }
+}
+
+/* keeps the MS_MIN/MS_MAX operand order, the result doesn't depend on the kernel */
+static void boundsPointsSSE2(const pointObj *point, int numpoints, rectObj *bounds)
+{
+  int i;
+  __m128d mins = _mm_set_pd(bounds->miny, bounds->minx);
+  __m128d maxs = _mm_set_pd(bounds->maxy, bounds->maxx);
+
+  for(i=0; i<numpoints; i++) {
+    __m128d p = _mm_loadu_pd(&point[i].x);
+    mins = _mm_min_pd(mins, p);
+    maxs = _mm_max_pd(maxs, p);
+  }
+
+  _mm_storel_pd(&bounds->minx, mins);
+  _mm_storeh_pd(&bounds->miny, mins);
+  _mm_storel_pd(&bounds->maxx, maxs);
+  _mm_storeh_pd(&bounds->maxy, maxs);
+}
+#endif /* MS_HAVE_SSE2_KERNELS */
+
+#ifdef MS_HAVE_AVX2_KERNELS
+/* two points per register */
+__attribute__((target("avx2")))
+static void transformPointsAVX2(pointObj *point, int numpoints, double minx, double maxy, double inv_cs, int round)
+{
+  int i;
+  const __m256d origin = _mm256_set_pd(0.0, minx, 0.0, minx);
+  const __m256d top = _mm256_set_pd(maxy, 0.0, maxy, 0.0);
+  const __m256d scale = _mm256_set1_pd(inv_cs);
+#if defined(MS_NINT_IS_GENERIC) || defined(MS_NINT_IS_LRINT)
+  const __m256d limit = _mm256_set1_pd(MS_KERNEL_INT_LIMIT);
+  const __m256d absmask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+#endif
+#ifdef MS_NINT_IS_GENERIC
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d signmask = _mm256_castsi256_pd(_mm256_set1_epi64x((long long)0x8000000000000000ULL));
+#endif
+
+  for(i=0; i+1<numpoints; i+=2) {
+    __m256d p = _mm256_loadu_pd(&point[i].x);
+    __m256d v = _mm256_mul_pd(_mm256_sub_pd(_mm256_blend_pd(p, top, 0xA), _mm256_blend_pd(p, origin, 0x5)), scale);
+    if(round) {
+#if defined(MS_NINT_IS_GENERIC)
+      __m256d t = _mm256_add_pd(v, _mm256_or_pd(_mm256_and_pd(v, signmask), half));
+      if(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(t, absmask), limit, _CMP_LT_OQ)) == 0xF) {
+        _mm256_storeu_pd(&point[i].x, _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(t)));
+        continue;
+      }
+#elif defined(MS_NINT_IS_LRINT)
+      if(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(v, absmask), limit, _CMP_LT_OQ)) == 0xF) {
+        _mm256_storeu_pd(&point[i].x, _mm256_cvtepi32_pd(_mm256_cvtpd_epi32(v)));
+        continue;
+      }
+#endif
+      _mm256_storeu_pd(&point[i].x, v);
+      point[i].x = MS_NINT(point[i].x);
+      point[i].y = MS_NINT(point[i].y);
+      point[i+1].x = MS_NINT(point[i+1].x);
+      point[i+1].y = MS_NINT(point[i+1].y);
+    } else {
+      _mm256_storeu_pd(&point[i].x, v);
+    }
+  }
+
+  if(i < numpoints) {
+    /* odd point, with VEX encoded 128 bit operations to avoid AVX/SSE transitions */
+    __m128d p = _mm_loadu_pd(&point[i].x);
+    __m128d v = _mm_mul_pd(_mm_sub_pd(_mm_move_sd(_mm256_castpd256_pd128(top), p),
+                                      _mm_move_sd(p, _mm256_castpd256_pd128(origin))), _mm256_castpd256_pd128(scale));
+    _mm_storeu_pd(&point[i].x, v);
+    if(round) {
+      point[i].x = MS_NINT(point[i].x);
+      point[i].y = MS_NINT(point[i].y);
+    }
+  }
+}
+#endif /* MS_HAVE_AVX2_KERNELS */
+
+/*
+** Transforms points in place from map to image coordinates, rounded to the
+** nearest integer like MS_MAP2IMAGE_X_IC() or kept in double precision like
+** MS_MAP2IMAGE_X_IC_DBL().
+*/
+static void transformPoints(pointObj *point, int numpoints, double minx, double maxy, double inv_cs, int round)
+{
+  switch(msGetPrimitiveKernels()) {
+#ifdef MS_HAVE_AVX2_KERNELS
+    case MS_PRIMITIVE_KERNELS_AVX2:
+      transformPointsAVX2(point, numpoints, minx, maxy, inv_cs, round);
+      break;
+#endif
+#ifdef MS_HAVE_SSE2_KERNELS
+    case MS_PRIMITIVE_KERNELS_SSE2:
+      transformPointsSSE2(point, numpoints, minx, maxy, inv_cs, round);
+      break;
+#endif
+    default:
+      transformPointsScalar(point, numpoints, minx, maxy, inv_cs, round);
+  }
+}
+
+/*
+** Grows bounds to the given points. The min/max reduction is a dependency
+** chain in point order (which matters for signed zeros), so the AVX2 level
+** shares the SSE2 kernel rather than folding two points at a time.
+*/
+static void boundsPoints(const pointObj *point, int numpoints, rectObj *bounds)
+{
+#ifdef MS_HAVE_SSE2_KERNELS
+  if(msGetPrimitiveKernels() > MS_PRIMITIVE_KERNELS_SCALAR) {
+    boundsPointsSSE2(point, numpoints, bounds);
+    return;
+  }
+#endif
+  boundsPointsScalar(point, numpoints, bounds);
+}
+
 void msPrintShape(shapeObj *p)
 {
   int i,j;
@@ -102,6 +357,7 @@ void msInitShape(shapeObj *shape)
   shape->numvalues = 0;
 
   shape->geometry = NULL;
+  shape->prepared = NULL;
   shape->renderer_cache = NULL;
 
   /* annotation component */
@@ -145,6 +401,7 @@ int msCopyShape(shapeObj *from, shapeObj *to)
   }
 
   to->geometry = NULL; /* GEOS code will build automatically if necessary */
+  to->prepared = NULL;
   to->scratch = from->scratch;
 
   return(0);
@@ -170,6 +427,98 @@ void msFreeShape(shapeObj *shape)
   msInitShape(shape); /* now reset */
 }
 
+/*
+** Shape arenas: the attribute values of the shapes read while drawing a layer are carved out of a
+** few large blocks instead of one malloc per value, and the whole arena is reset between batches
+** of shapes (see msLayerNextShapeFromBatch()). Only the values array and the value strings are
+** taken from the arena: the geometry is reallocated in place by many functions (clipping,
+** reprojection, geomtransforms) and stays on the heap.
+*/
+#define MS_SHAPE_ARENA_BLOCKSIZE 65536
+
+shapeArenaObj *msCreateShapeArena()
+{
+  return (shapeArenaObj *) msSmallCalloc(1, sizeof(shapeArenaObj));
+}
+
+void msFreeShapeArena(shapeArenaObj *arena)
+{
+  int i;
+
+  if(!arena) return;
+
+  for(i=0; i<arena->numblocks; i++)
+    free(arena->blocks[i]);
+  free(arena->blocks);
+  free(arena->blocksizes);
+  free(arena);
+}
+
+/*
+** Makes all the memory of the arena available again. Shapes using it must have been released.
+*/
+void msResetShapeArena(shapeArenaObj *arena)
+{
+  arena->current = 0;
+  arena->used = 0;
+}
+
+void *msShapeArenaAlloc(shapeArenaObj *arena, size_t size)
+{
+  size_t blocksize;
+
+  size = (size + 7) & ~((size_t)7); /* keep 8 byte alignment */
+
+  while(arena->current < arena->numblocks) {
+    if(arena->used + size <= arena->blocksizes[arena->current]) {
+      void *p = arena->blocks[arena->current] + arena->used;
+      arena->used += size;
+      return p;
+    }
+    arena->current++;
+    arena->used = 0;
+  }
+
+  blocksize = MS_MAX(size, MS_SHAPE_ARENA_BLOCKSIZE);
+  arena->blocks = (char **) msSmallRealloc(arena->blocks, sizeof(char *)*(arena->numblocks+1));
+  arena->blocksizes = (size_t *) msSmallRealloc(arena->blocksizes, sizeof(size_t)*(arena->numblocks+1));
+  arena->blocks[arena->numblocks] = (char *) msSmallMalloc(blocksize);
+  arena->blocksizes[arena->numblocks] = blocksize;
+  arena->current = arena->numblocks++;
+  arena->used = size;
+
+  return arena->blocks[arena->current];
+}
+
+char *msShapeArenaStrdup(shapeArenaObj *arena, const char *string)
+{
+  size_t len = strlen(string) + 1;
+  char *p = (char *) msShapeArenaAlloc(arena, len);
+
+  memcpy(p, string, len);
+  return p;
+}
+
+/*
+** msFreeShape() for shapes whose values may come from the arena. The arena can be NULL.
+*/
+void msShapeArenaFreeShape(shapeArenaObj *arena, shapeObj *shape)
+{
+  int i;
+
+  if(arena && shape->values) {
+    for(i=0; i<arena->numblocks; i++) {
+      if((char *)shape->values >= arena->blocks[i] && (char *)shape->values < arena->blocks[i] + arena->blocksizes[i]) {
+        shape->values = NULL; /* owned by the arena */
+        shape->numvalues = 0;
+        break;
+      }
+    }
+  }
+
+  msFreeShape(shape);
+}
+
 void msFreeLabelPathObj(labelPathObj *path)
 {
   msFreeShape(&(path->bounds));
@@ -196,7 +545,7 @@ void msShapeDeleteLine( shapeObj *shape, int line )
 
 void msComputeBounds(shapeObj *shape)
 {
-  int i, j;
+  int i;
   if(shape->numlines <= 0) return;
   for(i=0; i<shape->numlines; i++) {
     if(shape->line[i].numpoints > 0) {
@@ -207,14 +556,8 @@ void msComputeBounds(shapeObj *shape)
   }
   if(i == shape->numlines) return;
 
-  for( i=0; i<shape->numlines; i++ ) {
-    for( j=0; j<shape->line[i].numpoints; j++ ) {
-      shape->bounds.minx = MS_MIN(shape->bounds.minx, shape->line[i].point[j].x);
-      shape->bounds.maxx = MS_MAX(shape->bounds.maxx, shape->line[i].point[j].x);
-      shape->bounds.miny = MS_MIN(shape->bounds.miny, shape->line[i].point[j].y);
-      shape->bounds.maxy = MS_MAX(shape->bounds.maxy, shape->line[i].point[j].y);
-    }
-  }
+  for( i=0; i<shape->numlines; i++ )
+    boundsPoints(shape->line[i].point, shape->line[i].numpoints, &(shape->bounds));
 }
 
 /* checks to see if ring r is an outer ring of shape */
@@ -494,6 +837,20 @@ void msClipPolylineRect(shapeObj *shape, rectObj rect)
 
   for(i=0; i<shape->numlines; i++) {
 
+    /* a part entirely within the rectangle comes out of clipLine() unchanged, move it over as is */
+    if(shape->line[i].numpoints >= 2 && msGetPrimitiveKernels() != MS_PRIMITIVE_KERNELS_REFERENCE) {
+      rectObj bounds;
+      bounds.minx = bounds.maxx = shape->line[i].point[0].x;
+      bounds.miny = bounds.maxy = shape->line[i].point[0].y;
+      boundsPoints(shape->line[i].point, shape->line[i].numpoints, &bounds);
+      if(bounds.minx >= rect.minx && bounds.maxx <= rect.maxx &&
+          bounds.miny >= rect.miny && bounds.maxy <= rect.maxy) {
+        msAddLineDirectly(&tmp, &(shape->line[i]));
+        shape->line[i].point = NULL;
+        continue;
+      }
+    }
+
     line.point = (pointObj *)msSmallMalloc(sizeof(pointObj)*shape->line[i].numpoints);
     line.numpoints = 0;
 
@@ -576,6 +933,28 @@ void msClipPolygonRect(shapeObj *shape, rectObj rect)
 
   for(j=0; j<shape->numlines; j++) {
 
+    /*
+    ** A ring strictly within the rectangle, and at least NEARZERO away from the
+    ** edges the vertical and horizontal bumps below point to, comes out as its
+    ** points 1..n-1 followed by point 1 again. Produce that in place.
+    */
+    if(shape->line[j].numpoints >= 2 && msGetPrimitiveKernels() != MS_PRIMITIVE_KERNELS_REFERENCE) {
+      rectObj bounds;
+      pointObj *point = shape->line[j].point;
+      bounds.minx = bounds.maxx = point[0].x;
+      bounds.miny = bounds.maxy = point[0].y;
+      boundsPoints(point, shape->line[j].numpoints, &bounds);
+      if(bounds.minx > rect.minx && bounds.maxx < rect.maxx &&
+          bounds.miny > rect.miny && bounds.maxy < rect.maxy &&
+          bounds.minx - rect.minx >= NEARZERO && bounds.miny - rect.miny >= NEARZERO) {
+        memmove(point, point+1, sizeof(pointObj)*(shape->line[j].numpoints-1));
+        point[shape->line[j].numpoints-1] = point[0];
+        msAddLineDirectly(&tmp, &(shape->line[j]));
+        shape->line[j].point = NULL;
+        continue;
+      }
+    }
+
     line.point = (pointObj *)msSmallMalloc(sizeof(pointObj)*2*shape->line[j].numpoints+1); /* worst case scenario, +1 allows us to duplicate the 1st and last point */
     line.numpoints = 0;
 
@@ -1038,37 +1417,28 @@ void msTransformShapeToPixelRound(shapeObj *shape, rectObj extent, double cellsi
   inv_cs = 1.0 / cellsize; /* invert and multiply much faster */
   if(shape->type == MS_SHAPE_LINE || shape->type == MS_SHAPE_POLYGON) { /* remove duplicate vertices */
     for(i=0; i<shape->numlines; i++) { /* for each part */
-      shape->line[i].point[0].x = MS_MAP2IMAGE_X_IC(shape->line[i].point[0].x, extent.minx, inv_cs);;
-      shape->line[i].point[0].y = MS_MAP2IMAGE_Y_IC(shape->line[i].point[0].y, extent.maxy, inv_cs);
+      pointObj *point = shape->line[i].point;
+      if(shape->line[i].numpoints <= 0) continue;
+      transformPoints(point, shape->line[i].numpoints, extent.minx, extent.maxy, inv_cs, MS_TRUE);
       for(j=1, k=1; j < shape->line[i].numpoints; j++ ) {
-        shape->line[i].point[k].x = MS_MAP2IMAGE_X_IC(shape->line[i].point[j].x, extent.minx, inv_cs);
-        shape->line[i].point[k].y = MS_MAP2IMAGE_Y_IC(shape->line[i].point[j].y, extent.maxy, inv_cs);
-        if(shape->line[i].point[k].x!=shape->line[i].point[k-1].x || shape->line[i].point[k].y!=shape->line[i].point[k-1].y)
-          k++;
+        if(point[j].x!=point[k-1].x || point[j].y!=point[k-1].y)
+          point[k++] = point[j];
       }
       shape->line[i].numpoints=k;
     }
   } else { /* points or untyped shapes */
-    for(i=0; i<shape->numlines; i++) { /* for each part */
-      for(j=0; j < shape->line[i].numpoints; j++ ) {
-        shape->line[i].point[j].x = MS_MAP2IMAGE_X_IC(shape->line[i].point[j].x, extent.minx, inv_cs);
-        shape->line[i].point[j].y = MS_MAP2IMAGE_Y_IC(shape->line[i].point[j].y, extent.maxy, inv_cs);
-      }
-    }
+    for(i=0; i<shape->numlines; i++) /* for each part */
+      transformPoints(shape->line[i].point, shape->line[i].numpoints, extent.minx, extent.maxy, inv_cs, MS_TRUE);
   }
 
 }
 
 void msTransformShapeToPixelDoublePrecision(shapeObj *shape, rectObj extent, double cellsize)
 {
-  int i,j; /* loop counters */
+  int i; /* loop counters */
   double inv_cs = 1.0 / cellsize; /* invert and multiply much faster */
-  for(i=0; i<shape->numlines; i++) {
-    for(j=0; j<shape->line[i].numpoints; j++) {
-      shape->line[i].point[j].x = MS_MAP2IMAGE_X_IC_DBL(shape->line[i].point[j].x, extent.minx, inv_cs);
-      shape->line[i].point[j].y = MS_MAP2IMAGE_Y_IC_DBL(shape->line[i].point[j].y, extent.maxy, inv_cs);
-    }
-  }
+  for(i=0; i<shape->numlines; i++)
+    transformPoints(shape->line[i].point, shape->line[i].numpoints, extent.minx, extent.maxy, inv_cs, MS_FALSE);
 }
 
 
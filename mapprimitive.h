@@ -74,6 +74,7 @@ typedef struct {
   lineObj *line;
   char **values;
   void *geometry;
+  void *prepared; /* GEOS prepared version of geometry, see mapgeos.c */
   void *renderer_cache;
 #endif
 
@@ -94,6 +95,18 @@ typedef struct {
 
 typedef lineObj multipointObj;
 
+#ifndef SWIG
+/* bump allocator for the attribute values of the shapes read by a layer */
+/* loop, memory is handed back in bulk with msResetShapeArena() */
+typedef struct {
+  char **blocks;
+  size_t *blocksizes;
+  int numblocks;
+  int current; /* block being carved */
+  size_t used; /* bytes used in the current block */
+} shapeArenaObj;
+#endif
+
 #ifndef SWIG
 /* attribute primatives */
 typedef struct {
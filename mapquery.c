@@ -57,6 +57,7 @@ int msInitQuery(queryObj *query)
   
   query->item = query->str = NULL;
   query->filter = NULL;
+  query->nativefilter = NULL;
 
   return MS_SUCCESS;
 }
@@ -74,6 +75,7 @@ void msFreeQuery(queryObj *query)
     freeExpression(query->filter);
     free(query->filter);
   }
+  if(query->nativefilter) free(query->nativefilter);
 }
 
 /*
@@ -604,6 +606,7 @@ int msQueryByAttributes(mapObj *map)
   rectObj searchrect;
 
   shapeObj shape;
+  shapeBatchObj batch;
   int paging;
 
   int nclasses = 0;
@@ -714,7 +717,8 @@ int msQueryByAttributes(mapObj *map)
   if (lp->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-  while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+  msInitShapeBatch(lp, &batch);
+  while((status = msLayerNextShapeFromBatch(lp, &batch, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
     /* Check if the shape size is ok to be drawn */
     if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
@@ -765,6 +769,7 @@ int msQueryByAttributes(mapObj *map)
       break;
     }
   }
+  msFreeShapeBatch(&batch);
 
   if (classgroup)
     msFree(classgroup);
@@ -802,6 +807,7 @@ int msQueryByFilter(mapObj *map)
   rectObj search_rect;
 
   shapeObj shape;
+  shapeBatchObj batch;
 
   int nclasses = 0;
   int *classgroup = NULL;
@@ -877,6 +883,8 @@ int msQueryByFilter(mapObj *map)
 
     if(!msLayerSupportsCommonFilters(lp)) {
       freeExpression(&lp->filter); /* clear existing filter */
+      if(map->query.nativefilter && lp->connectiontype == MS_OGR) /* let the driver discard features early, map->query.filter is still applied below */
+        msLoadExpressionString(&lp->filter, map->query.nativefilter);
       status = msTokenizeExpression(map->query.filter, lp->items, &(lp->numitems));
       if(status != MS_SUCCESS) goto query_error;
     }
@@ -890,6 +898,14 @@ int msQueryByFilter(mapObj *map)
 #endif
 
     status = msLayerWhichShapes(lp, search_rect, MS_TRUE);
+    if(status == MS_FAILURE && map->query.nativefilter && lp->filter.string) {
+      /* the driver rejected the pre-filter, map->query.filter alone gives the same results */
+      if(lp->debug || map->debug)
+        msDebug("msQueryByFilter(): layer %s rejected the native filter %s, ignoring it.\n", lp->name?lp->name:"(null)", map->query.nativefilter);
+      msResetErrorList();
+      freeExpression(&lp->filter);
+      status = msLayerWhichShapes(lp, search_rect, MS_TRUE);
+    }
     if(status == MS_DONE) { /* no overlap */
       msLayerClose(lp);
       continue;
@@ -907,7 +923,8 @@ int msQueryByFilter(mapObj *map)
     if (lp->minfeaturesize > 0)
       minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+    msInitShapeBatch(lp, &batch);
+    while((status = msLayerNextShapeFromBatch(lp, &batch, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
       if(!msLayerSupportsCommonFilters(lp)) { /* we have to apply the filter here instead of within the driver */
         if(msEvalExpression(lp, &shape, map->query.filter, -1) != MS_TRUE) { /* next shape */
@@ -960,6 +977,7 @@ int msQueryByFilter(mapObj *map)
         break;
       }
     } /* next shape */
+    msFreeShapeBatch(&batch);
 
     if(classgroup) msFree(classgroup);
 
@@ -987,35 +1005,186 @@ query_error:
   return MS_FAILURE;
 }
 
-int msQueryByRect(mapObj *map)
+/*
+** Parallel layer queries, enabled with CONFIG "MS_QUERY_THREADS" set to the
+** number of threads. Each queryable layer is queried on its own by one of the
+** threads, filling its own result cache, and the results are then looked at in
+** layer order as the serial loop would. Connections are taken from the pool per
+** thread, the errors and debug output of a thread are handed over to the
+** calling thread and set/written there in layer order. The layers are queried
+** with a private copy of map->query, map->query itself is left alone.
+*/
+#if defined(USE_THREAD) && !defined(_WIN32)
+
+#include <pthread.h>
+
+typedef struct {
+  mapObj *map;
+  int (*queryLayer)(mapObj *map, layerObj *lp, queryObj *query);
+  int *layers; /* layer indexes in query order */
+  int *status; /* query status of each layer */
+  errorObj **errors; /* errors raised while querying each layer */
+  char **debug; /* debug output of each layer */
+  int numlayers;
+  int next; /* next layer to pick up */
+  int last; /* last layer the serial loop would query so far */
+  int stoponresult;
+  int threaded; /* MS_FALSE if the work is done in the calling thread */
+  int debuglevel; /* global debug level of the calling thread, -1 if it doesn't log */
+  pthread_mutex_t mutex;
+} queryPoolObj;
+
+static void *msQueryPoolWorker(void *arg)
 {
-  int l; /* counters */
-  int start, stop=0;
+  queryPoolObj *pool = (queryPoolObj *) arg;
+  queryObj query;
+  layerObj *lp;
+  int i, skip;
+
+  while(1) {
+    pthread_mutex_lock(&pool->mutex);
+    i = pool->next++;
+    skip = (i > pool->last); /* an earlier layer failed or returned results */
+    pthread_mutex_unlock(&pool->mutex);
+    if(i >= pool->numlayers || skip) break;
+
+    lp = GET_LAYER(pool->map, pool->layers[i]);
+    if(pool->threaded && pool->debuglevel >= 0)
+      msDebugStartBuffer((debugLevel) pool->debuglevel);
+
+    query = pool->map->query; /* the counters of map->query are not touched here */
+    pool->status[i] = pool->queryLayer(pool->map, lp, &query);
+
+    if(pool->status[i] != MS_SUCCESS ||
+        (pool->stoponresult && lp->type != MS_LAYER_RASTER && lp->resultcache && lp->resultcache->numresults > 0)) {
+      pthread_mutex_lock(&pool->mutex);
+      pool->last = MS_MIN(pool->last, i);
+      pthread_mutex_unlock(&pool->mutex);
+    }
 
+    if(pool->threaded) { /* also releases the error and debug objects of this thread */
+      pool->errors[i] = msDetachErrorList();
+      pool->debug[i] = msDebugEndBuffer();
+    }
+  }
+
+  return NULL;
+}
+
+/*
+** Returns MS_DONE if the query can't run in parallel: there is a single layer
+** to query, a feature count or start index is shared between the layers, or a
+** layer reads another layer of the map (union layers and tile indexes).
+*/
+static int msQueryLayersParallel(mapObj *map, int start, int stop, int (*queryLayer)(mapObj *map, layerObj *lp, queryObj *query), int stoponresult)
+{
+  queryPoolObj pool;
+  pthread_t *threads;
+  const char *value;
   layerObj *lp;
+  errorObj *error;
+  int numthreads, i, l, status = MS_SUCCESS;
 
-  char status;
-  shapeObj shape, searchshape;
-  rectObj searchrect;
-  double layer_tolerance = 0, tolerance = 0;
+  value = msGetConfigOption(map, "MS_QUERY_THREADS");
+  if(value == NULL || (numthreads = atoi(value)) < 2 || start == stop)
+    return MS_DONE;
 
-  int paging;
-  int nclasses = 0;
-  int *classgroup = NULL;
-  double minfeaturesize = -1;
+  if(map->query.maxfeatures >= 0 || map->query.startindex > 1)
+    return MS_DONE;
 
-  if(map->query.type != MS_QUERY_BY_RECT) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByRect()");
-    return(MS_FAILURE);
+  for(l=start; l>=stop; l--) {
+    lp = GET_LAYER(map, l);
+    if(lp->startindex > 1 || lp->connectiontype == MS_UNION)
+      return MS_DONE;
+    if(lp->tileindex && msGetLayerIndex(map, lp->tileindex) != -1)
+      return MS_DONE;
   }
 
-  msInitShape(&shape);
-  msInitShape(&searchshape);
+  pool.map = map;
+  pool.queryLayer = queryLayer;
+  pool.numlayers = start - stop + 1;
+  pool.next = 0;
+  pool.last = pool.numlayers - 1;
+  pool.stoponresult = stoponresult;
+  pool.threaded = MS_TRUE;
+  pool.debuglevel = msGetErrorFile() ? (int) msGetGlobalDebugLevel() : -1;
+  pool.layers = (int *) msSmallMalloc(sizeof(int) * pool.numlayers);
+  pool.status = (int *) msSmallMalloc(sizeof(int) * pool.numlayers);
+  pool.errors = (errorObj **) msSmallCalloc(pool.numlayers, sizeof(errorObj *));
+  pool.debug = (char **) msSmallCalloc(pool.numlayers, sizeof(char *));
+  for(i=0, l=start; l>=stop; l--, i++)
+    pool.layers[i] = l;
+
+  numthreads = MS_MIN(numthreads, pool.numlayers);
+  threads = (pthread_t *) msSmallMalloc(sizeof(pthread_t) * numthreads);
+  pthread_mutex_init(&pool.mutex, NULL);
+
+  for(i=0; i<numthreads; i++) {
+    if(pthread_create(&threads[i], NULL, msQueryPoolWorker, &pool) != 0)
+      break;
+  }
+  if(i == 0) { /* no thread at all, do the work here */
+    pool.threaded = MS_FALSE;
+    msQueryPoolWorker(&pool);
+  }
+  numthreads = i;
+  for(i=0; i<numthreads; i++)
+    pthread_join(threads[i], NULL);
 
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
+  pthread_mutex_destroy(&pool.mutex);
+  free(threads);
+
+  /* merge in layer order, as far as the serial loop would have gone */
+  for(i=0; i<pool.numlayers; i++) {
+    lp = GET_LAYER(map, pool.layers[i]);
+
+    msDebugWriteBuffer(pool.debug[i]);
+    msFree(pool.debug[i]);
+
+    if(i > pool.last) { /* the serial loop stops before this layer */
+      while(pool.errors[i]) {
+        error = pool.errors[i]->next;
+        free(pool.errors[i]);
+        pool.errors[i] = error;
+      }
+      if(lp->resultcache) {
+        if(lp->resultcache->results) free(lp->resultcache->results);
+        free(lp->resultcache);
+        lp->resultcache = NULL;
+      }
+      msLayerClose(lp);
+      continue;
+    }
+
+    msAttachErrorList(pool.errors[i]);
+    if(pool.status[i] != MS_SUCCESS)
+      status = MS_FAILURE;
+  }
+
+  free(pool.layers);
+  free(pool.status);
+  free(pool.errors);
+  free(pool.debug);
+
+  return status;
+}
+#endif /* USE_THREAD && !_WIN32 */
+
+/*
+** Queries layers start down to stop with queryLayer(). With stoponresult the
+** search ends at the first vector layer returning results. In the serial loop
+** the start index and feature count of map->query carry over to the next layer.
+*/
+static int msQueryLayers(mapObj *map, int start, int stop, int (*queryLayer)(mapObj *map, layerObj *lp, queryObj *query), int stoponresult)
+{
+  int l, status;
+  layerObj *lp;
+
+#if defined(USE_THREAD) && !defined(_WIN32)
+  status = msQueryLayersParallel(map, start, stop, queryLayer, stoponresult);
+  if(status != MS_DONE)
+    return status;
+#endif
 
   for(l=start; l>=stop; l--) {
     lp = (GET_LAYER(map, l));
@@ -1028,171 +1197,223 @@ int msQueryByRect(mapObj *map)
     /* using mapscript, the map->query.startindex will be unset... */
     if (lp->startindex > 1 && map->query.startindex < 0)
       map->query.startindex = lp->startindex;
-    
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
-    }
+    status = queryLayer(map, lp, &(map->query));
+    if(status != MS_SUCCESS)
+      return MS_FAILURE;
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
+    if(stoponresult && lp->type != MS_LAYER_RASTER && lp->resultcache && lp->resultcache->numresults > 0)
+      break; /* no need to search any further */
+  }
 
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+  return MS_SUCCESS;
+}
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+/*
+** Rectangle query of a single layer, the results go to lp->resultcache.
+*/
+static int msQueryLayerByRect(mapObj *map, layerObj *lp, queryObj *query)
+{
+  char status;
+  shapeObj shape, searchshape;
+  shapeBatchObj batch;
+  rectObj searchrect, queryrect;
+  double layer_tolerance = 0, tolerance = 0;
 
-    searchrect = map->query.rect;
-    if(lp->tolerance > 0) {
-      layer_tolerance = lp->tolerance;
+  int paging;
+  int nclasses = 0;
+  int *classgroup = NULL;
+  double minfeaturesize = -1;
 
-      if(lp->toleranceunits == MS_PIXELS)
-        tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
-      else
-        tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+  /* conditions may have changed since this layer last drawn, so set
+     layer->project true to recheck projection needs (Bug #673) */
+  lp->project = MS_TRUE;
 
-      searchrect.minx -= tolerance;
-      searchrect.maxx += tolerance;
-      searchrect.miny -= tolerance;
-      searchrect.maxy += tolerance;
-    }
+  /* free any previous search results, do it now in case one of the next few tests fail */
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
+  }
 
-    msRectToPolygon(searchrect, &searchshape);
+  if(!msIsLayerQueryable(lp)) return MS_SUCCESS;
+  if(lp->status == MS_OFF) return MS_SUCCESS;
 
-    /* Raster layers are handled specially. */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByRect( map, lp, searchrect ) == MS_FAILURE)
-        return MS_FAILURE;
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return MS_SUCCESS;
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return MS_SUCCESS;
+  }
 
-      continue;
-    }
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return MS_SUCCESS;
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return MS_SUCCESS;
+  }
 
-    /* Paging could have been disabled before */
-    paging = msLayerGetPaging(lp);
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    msLayerEnablePaging(lp, paging);
+  searchrect = map->query.rect;
+  if(lp->tolerance > 0) {
+    layer_tolerance = lp->tolerance;
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
+    if(lp->toleranceunits == MS_PIXELS)
+      tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
+    else
+      tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+
+    searchrect.minx -= tolerance;
+    searchrect.maxx += tolerance;
+    searchrect.miny -= tolerance;
+    searchrect.maxy += tolerance;
+  }
+
+  queryrect = searchrect; /* searchrect gets reprojected to the layer coordinates below */
+
+  /* Raster layers are handled specially. */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByRect( map, lp, searchrect ) == MS_FAILURE)
+      return MS_FAILURE;
+
+    return MS_SUCCESS;
+  }
+
+  /* Paging could have been disabled before */
+  paging = msLayerGetPaging(lp);
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  msLayerEnablePaging(lp, paging);
+
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
 
 #ifdef USE_PROJ
-    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
-    else
-      lp->project = MS_FALSE;
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+  else
+    lp->project = MS_FALSE;
 #endif
-    status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
-      continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
-    }
+  status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(lp);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
 
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
+  lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+  initResultCache( lp->resultcache);
 
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
+  nclasses = 0;
+  classgroup = NULL;
+  if (lp->classgroup && lp->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(lp, &nclasses);
 
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
+  if (lp->minfeaturesize > 0)
+    minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+  msInitShape(&shape);
+  msInitShape(&searchshape);
+  msRectToPolygon(queryrect, &searchshape);
 
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByRect(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
-        }
-      }
+  msInitShapeBatch(lp, &batch);
+  while((status = msLayerNextShapeFromBatch(lp, &batch, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByRect(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
         msFreeShape(&shape);
         continue;
       }
+    }
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
-        msFreeShape(&shape);
-        continue;
-      }
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+      msFreeShape(&shape);
+      continue;
+    }
 
 #ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
+    if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
+    else
+      lp->project = MS_FALSE;
 #endif
 
-      if(msRectContained(&shape.bounds, &searchrect) == MS_TRUE) { /* if the whole shape is in, don't intersect */
-        status = MS_TRUE;
-      } else {
-        switch(shape.type) { /* make sure shape actually intersects the qrect (ADD FUNCTIONS SPECIFIC TO RECTOBJ) */
-          case MS_SHAPE_POINT:
-            status = msIntersectMultipointPolygon(&shape, &searchshape);
-            break;
-          case MS_SHAPE_LINE:
-            status = msIntersectPolylinePolygon(&shape, &searchshape);
-            break;
-          case MS_SHAPE_POLYGON:
-            status = msIntersectPolygons(&shape, &searchshape);
-            break;
-          default:
-            break;
-        }
+    if(msRectContained(&shape.bounds, &searchrect) == MS_TRUE) { /* if the whole shape is in, don't intersect */
+      status = MS_TRUE;
+    } else {
+      switch(shape.type) { /* make sure shape actually intersects the qrect (ADD FUNCTIONS SPECIFIC TO RECTOBJ) */
+        case MS_SHAPE_POINT:
+          status = msIntersectMultipointPolygon(&shape, &searchshape);
+          break;
+        case MS_SHAPE_LINE:
+          status = msIntersectPolylinePolygon(&shape, &searchshape);
+          break;
+        case MS_SHAPE_POLYGON:
+          status = msIntersectPolygons(&shape, &searchshape);
+          break;
+        default:
+          break;
       }
+    }
 
-      if(status == MS_TRUE) {
-        /* Should we skip this feature? */
-        if (!paging && map->query.startindex > 1) {
-          --map->query.startindex;
-          msFreeShape(&shape);
-          continue;
-        }
-        addResult(lp->resultcache, &shape);
-        --map->query.maxfeatures;
+    if(status == MS_TRUE) {
+      /* Should we skip this feature? */
+      if (!paging && query->startindex > 1) {
+        --query->startindex;
+        msFreeShape(&shape);
+        continue;
       }
-      msFreeShape(&shape);
+      addResult(lp->resultcache, &shape);
+      --query->maxfeatures;
+    }
+    msFreeShape(&shape);
 
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-      
-    } /* next shape */
+    /* check shape count */
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      status = MS_DONE;
+      break;
+    }
+    
+  } /* next shape */
+  msFreeShapeBatch(&batch);
+  msFreeShape(&searchshape);
 
-    if (classgroup)
-      msFree(classgroup);
+  if (classgroup)
+    msFree(classgroup);
 
-    if(status != MS_DONE) return(MS_FAILURE);
+  if(status != MS_DONE) return(MS_FAILURE);
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
-  } /* next layer */
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
 
-  msFreeShape(&searchshape);
+  return MS_SUCCESS;
+}
+
+int msQueryByRect(mapObj *map)
+{
+  int l; /* counters */
+  int start, stop=0;
+
+  if(map->query.type != MS_QUERY_BY_RECT) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByRect()");
+    return(MS_FAILURE);
+  }
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  if(msQueryLayers(map, start, stop, msQueryLayerByRect, MS_FALSE) != MS_SUCCESS)
+    return(MS_FAILURE);
 
   /* was anything found? */
   for(l=start; l>=stop; l--) {
@@ -1225,6 +1446,7 @@ int msQueryByFeatures(mapObj *map)
 
   rectObj searchrect;
   shapeObj shape, selectshape;
+  shapeBatchObj batch;
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
@@ -1383,7 +1605,8 @@ int msQueryByFeatures(mapObj *map)
       if (lp->minfeaturesize > 0)
         minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-      while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
+      msInitShapeBatch(lp, &batch);
+      while((status = msLayerNextShapeFromBatch(lp, &batch, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
         /* check for dups when there are multiple selection shapes */
         if(i > 0 && is_duplicate(lp->resultcache, shape.index, shape.tileindex)) continue;
@@ -1502,6 +1725,7 @@ int msQueryByFeatures(mapObj *map)
           break;
         }
       } /* next shape */
+      msFreeShapeBatch(&batch);
 
       if (classgroup)
         msFree(classgroup);
@@ -1538,214 +1762,212 @@ int msQueryByFeatures(mapObj *map)
  *     returned are the first ones found in each layer and are not necessarily
  *     the closest ones).
  */
-int msQueryByPoint(mapObj *map)
+/*
+** Point query of a single layer, the results go to lp->resultcache.
+*/
+static int msQueryLayerByPoint(mapObj *map, layerObj *lp, queryObj *query)
 {
-  int l;
-  int start, stop=0;
-
   double d, t;
   double layer_tolerance;
 
-  layerObj *lp;
-
   int paging;
   char status;
   rectObj rect, searchrect;
   shapeObj shape;
+  shapeBatchObj batch;
   int nclasses = 0;
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
-  if(map->query.type != MS_QUERY_BY_POINT) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByPoint()");
-    return(MS_FAILURE);
+  /* conditions may have changed since this layer last drawn, so set
+     layer->project true to recheck projection needs (Bug #673) */
+  lp->project = MS_TRUE;
+
+  /* free any previous search results, do it now in case one of the next few tests fail */
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
   }
 
-  msInitShape(&shape);
+  if(!msIsLayerQueryable(lp)) return MS_SUCCESS;
+  if(lp->status == MS_OFF) return MS_SUCCESS;
 
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return MS_SUCCESS;
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return MS_SUCCESS;
+  }
 
-  for(l=start; l>=stop; l--) {
-    lp = (GET_LAYER(map, l));
-    if (map->query.maxfeatures == 0)
-      break; /* nothing else to do */
-    else if (map->query.maxfeatures > 0)
-      lp->maxfeatures = map->query.maxfeatures;
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return MS_SUCCESS;
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return MS_SUCCESS;
+  }
 
-    /* using mapscript, the map->query.startindex will be unset... */
-    if (lp->startindex > 1 && map->query.startindex < 0)
-      map->query.startindex = lp->startindex;
-    
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
+  /* Raster layers are handled specially.  */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByPoint( map, lp, map->query.mode, map->query.point, map->query.buffer, map->query.maxresults ) == MS_FAILURE )
+      return MS_FAILURE;
+    return MS_SUCCESS;
+  }
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
-    }
+  /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
+  if(lp->tolerance == -1) {
+    if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
+      layer_tolerance = 3;
+    else
+      layer_tolerance = 0;
+  } else
+    layer_tolerance = lp->tolerance;
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
+  if(map->query.buffer <= 0) { /* use layer tolerance */
+    if(lp->toleranceunits == MS_PIXELS)
+      t = layer_tolerance * MS_MAX(MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width),
+                                   MS_CELLSIZE(map->extent.miny, map->extent.maxy, map->height));
+    else
+      t = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+  } else /* use buffer distance */
+    t = map->query.buffer;
 
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+  rect.minx = map->query.point.x - t;
+  rect.maxx = map->query.point.x + t;
+  rect.miny = map->query.point.y - t;
+  rect.maxy = map->query.point.y + t;
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+  /* Paging could have been disabled before */
+  paging = msLayerGetPaging(lp);
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  msLayerEnablePaging(lp, paging);
 
-    /* Raster layers are handled specially.  */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByPoint( map, lp, map->query.mode, map->query.point, map->query.buffer, map->query.maxresults ) == MS_FAILURE )
-        return MS_FAILURE;
-      continue;
-    }
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
 
-    /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
-    if(lp->tolerance == -1) {
-      if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
-        layer_tolerance = 3;
-      else
-        layer_tolerance = 0;
-    } else
-      layer_tolerance = lp->tolerance;
+  /* identify target shapes */
+  searchrect = rect;
+#ifdef USE_PROJ
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+  else
+    lp->project = MS_FALSE;
+#endif
+  status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(lp);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
 
-    if(map->query.buffer <= 0) { /* use layer tolerance */
-      if(lp->toleranceunits == MS_PIXELS)
-        t = layer_tolerance * MS_MAX(MS_CELLSIZE(map->extent.minx, map->extent.maxx, map->width),
-                                     MS_CELLSIZE(map->extent.miny, map->extent.maxy, map->height));
-      else
-        t = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
-    } else /* use buffer distance */
-      t = map->query.buffer;
+  lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+  initResultCache( lp->resultcache);
 
-    rect.minx = map->query.point.x - t;
-    rect.maxx = map->query.point.x + t;
-    rect.miny = map->query.point.y - t;
-    rect.maxy = map->query.point.y + t;
+  nclasses = 0;
+  classgroup = NULL;
+  if (lp->classgroup && lp->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(lp, &nclasses);
 
-    /* Paging could have been disabled before */
-    paging = msLayerGetPaging(lp);
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    msLayerEnablePaging(lp, paging);
+  if (lp->minfeaturesize > 0)
+    minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
+  msInitShape(&shape);
+  msInitShapeBatch(lp, &batch);
+  while((status = msLayerNextShapeFromBatch(lp, &batch, &shape)) == MS_SUCCESS) { /* step through the shapes */
+
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByPoint(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
+        msFreeShape(&shape);
+        continue;
+      }
+    }
+
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      msFreeShape(&shape);
+      continue;
+    }
+
+    if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+      msFreeShape(&shape);
+      continue;
+    }
 
-    /* identify target shapes */
-    searchrect = rect;
 #ifdef USE_PROJ
     if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
     else
       lp->project = MS_FALSE;
 #endif
-    status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
-      continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
-    }
-
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
-
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
-
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
-
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByPoint(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
-        }
-      }
+    d = msDistancePointToShape(&(map->query.point), &shape);
+    if( d <= t ) { /* found one */
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      /* Should we skip this feature? */
+      if (!paging && query->startindex > 1) {
+        --query->startindex;
         msFreeShape(&shape);
         continue;
       }
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
-        msFreeShape(&shape);
-        continue;
+      if(map->query.mode == MS_QUERY_SINGLE) {
+        lp->resultcache->numresults = 0;
+        addResult(lp->resultcache, &shape);
+        t = d; /* next one must be closer */
+      } else {
+        addResult(lp->resultcache, &shape);
       }
+    }
 
-#ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
-#endif
+    msFreeShape(&shape);
 
-      d = msDistancePointToShape(&(map->query.point), &shape);
-      if( d <= t ) { /* found one */
+    if(map->query.mode == MS_QUERY_MULTIPLE && map->query.maxresults > 0 && lp->resultcache->numresults == map->query.maxresults) {
+      status = MS_DONE;   /* got enough results for this layer */
+      break;
+    }
 
-        /* Should we skip this feature? */
-        if (!paging && map->query.startindex > 1) {
-          --map->query.startindex;
-          msFreeShape(&shape);
-          continue;
-        }
+    /* check shape count */
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      status = MS_DONE;
+      break;
+    }
+  } /* next shape */
+  msFreeShapeBatch(&batch);
 
-        if(map->query.mode == MS_QUERY_SINGLE) {
-          lp->resultcache->numresults = 0;
-          addResult(lp->resultcache, &shape);
-          t = d; /* next one must be closer */
-        } else {
-          addResult(lp->resultcache, &shape);
-        }
-      }
+  if (classgroup)
+    msFree(classgroup);
 
-      msFreeShape(&shape);
+  if(status != MS_DONE) return(MS_FAILURE);
 
-      if(map->query.mode == MS_QUERY_MULTIPLE && map->query.maxresults > 0 && lp->resultcache->numresults == map->query.maxresults) {
-        status = MS_DONE;   /* got enough results for this layer */
-        break;
-      }
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
 
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-    } /* next shape */
+  return MS_SUCCESS;
+}
 
-    if (classgroup)
-      msFree(classgroup);
+int msQueryByPoint(mapObj *map)
+{
+  int l;
+  int start, stop=0;
 
-    if(status != MS_DONE) return(MS_FAILURE);
+  if(map->query.type != MS_QUERY_BY_POINT) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByPoint()");
+    return(MS_FAILURE);
+  }
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
 
-    if((lp->resultcache->numresults > 0) && (map->query.mode == MS_QUERY_SINGLE) && (map->query.maxresults == 0))
-      break;   /* no need to search any further */
-  } /* next layer */
+  /* in single mode without a result count the first layer with a result ends the search */
+  if(msQueryLayers(map, start, stop, msQueryLayerByPoint,
+                   (map->query.mode == MS_QUERY_SINGLE && map->query.maxresults == 0)) != MS_SUCCESS)
+    return(MS_FAILURE);
 
   /* was anything found? */
   for(l=start; l>=stop; l--) {
@@ -1757,11 +1979,13 @@ int msQueryByPoint(mapObj *map)
   return(MS_FAILURE);
 }
 
-int msQueryByShape(mapObj *map)
+/*
+** Shape query of a single layer, the results go to lp->resultcache.
+*/
+static int msQueryLayerByShape(mapObj *map, layerObj *lp, queryObj *query)
 {
-  int start, stop=0, l;
-  shapeObj shape, *qshape=NULL;
-  layerObj *lp;
+  shapeObj shape, *qshape = map->query.shape;
+  shapeBatchObj batch;
   char status;
   double distance, tolerance, layer_tolerance;
   rectObj searchrect;
@@ -1770,257 +1994,255 @@ int msQueryByShape(mapObj *map)
   int *classgroup = NULL;
   double minfeaturesize = -1;
 
-  if(map->query.type != MS_QUERY_BY_SHAPE) {
-    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByShape()");
-    return(MS_FAILURE);
-  }
+  /* conditions may have changed since this layer last drawn, so set
+     layer->project true to recheck projection needs (Bug #673) */
+  lp->project = MS_TRUE;
 
-  if(!(map->query.shape)) {
-    msSetError(MS_QUERYERR, "Query shape is not defined.", "msQueryByShape()");
-    return(MS_FAILURE);
+  /* free any previous search results, do it now in case one of the next few tests fail */
+  if(lp->resultcache) {
+    if(lp->resultcache->results) free(lp->resultcache->results);
+    free(lp->resultcache);
+    lp->resultcache = NULL;
   }
-  if(map->query.shape->type != MS_SHAPE_POLYGON && map->query.shape->type != MS_SHAPE_LINE && map->query.shape->type != MS_SHAPE_POINT) {
-    msSetError(MS_QUERYERR, "Query shape MUST be a polygon, line or point.", "msQueryByShape()");
-    return(MS_FAILURE);
+
+  if(!msIsLayerQueryable(lp)) return MS_SUCCESS;
+  if(lp->status == MS_OFF) return MS_SUCCESS;
+
+  if(map->scaledenom > 0) {
+    if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) return MS_SUCCESS;
+    if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) return MS_SUCCESS;
   }
 
-  msInitShape(&shape);
-  qshape = map->query.shape; /* for brevity */
+  if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
+    if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) return MS_SUCCESS;
+    if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) return MS_SUCCESS;
+  }
 
-  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
-    start = map->numlayers-1;
-  else
-    start = stop = map->query.layer;
+  /* Raster layers are handled specially. */
+  if( lp->type == MS_LAYER_RASTER ) {
+    if( msRasterQueryByShape(map, lp, qshape) == MS_FAILURE )
+      return MS_FAILURE;
+    return MS_SUCCESS;
+  }
 
-  msComputeBounds(qshape); /* make sure an accurate extent exists */
+  /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
+  if(lp->tolerance == -1) {
+    if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
+      layer_tolerance = 3;
+    else
+      layer_tolerance = 0;
+  } else
+    layer_tolerance = lp->tolerance;
 
-  for(l=start; l>=stop; l--) { /* each layer */
-    lp = (GET_LAYER(map, l));
-    if (map->query.maxfeatures == 0)
-      break; /* nothing else to do */
-    else if (map->query.maxfeatures > 0)
-      lp->maxfeatures = map->query.maxfeatures;
+  if(lp->toleranceunits == MS_PIXELS)
+    tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
+  else
+    tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
 
-    /* using mapscript, the map->query.startindex will be unset... */
-    if (lp->startindex > 1 && map->query.startindex < 0)
-      map->query.startindex = lp->startindex;
+  msLayerClose(lp); /* reset */
+  status = msLayerOpen(lp);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
+  /* disable driver paging */
+  msLayerEnablePaging(lp, MS_FALSE);
 
-    /* conditions may have changed since this layer last drawn, so set
-       layer->project true to recheck projection needs (Bug #673) */
-    lp->project = MS_TRUE;
+  /* build item list, we want *all* items */
+  status = msLayerWhichItems(lp, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) return(MS_FAILURE);
 
-    /* free any previous search results, do it now in case one of the next few tests fail */
-    if(lp->resultcache) {
-      if(lp->resultcache->results) free(lp->resultcache->results);
-      free(lp->resultcache);
-      lp->resultcache = NULL;
-    }
+  /* identify target shapes */
+  searchrect = qshape->bounds;
 
-    if(!msIsLayerQueryable(lp)) continue;
-    if(lp->status == MS_OFF) continue;
+  searchrect.minx -= tolerance; /* expand the search box to account for layer tolerances (e.g. buffered searches) */
+  searchrect.maxx += tolerance;
+  searchrect.miny -= tolerance;
+  searchrect.maxy += tolerance;
 
-    if(map->scaledenom > 0) {
-      if((lp->maxscaledenom > 0) && (map->scaledenom > lp->maxscaledenom)) continue;
-      if((lp->minscaledenom > 0) && (map->scaledenom <= lp->minscaledenom)) continue;
-    }
+#ifdef USE_PROJ
+  if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
+    msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+  else
+    lp->project = MS_FALSE;
+#endif
 
-    if (lp->maxscaledenom <= 0 && lp->minscaledenom <= 0) {
-      if((lp->maxgeowidth > 0) && ((map->extent.maxx - map->extent.minx) > lp->maxgeowidth)) continue;
-      if((lp->mingeowidth > 0) && ((map->extent.maxx - map->extent.minx) < lp->mingeowidth)) continue;
-    }
+  status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
+  if(status == MS_DONE) { /* no overlap */
+    msLayerClose(lp);
+    return MS_SUCCESS;
+  } else if(status != MS_SUCCESS) {
+    msLayerClose(lp);
+    return(MS_FAILURE);
+  }
 
-    /* Raster layers are handled specially. */
-    if( lp->type == MS_LAYER_RASTER ) {
-      if( msRasterQueryByShape(map, lp, qshape) == MS_FAILURE )
-        return MS_FAILURE;
-      continue;
-    }
+  lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
+  MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
+  initResultCache( lp->resultcache);
 
-    /* Get the layer tolerance default is 3 for point and line layers, 0 for others */
-    if(lp->tolerance == -1) {
-      if(lp->type == MS_LAYER_POINT || lp->type == MS_LAYER_LINE)
-        layer_tolerance = 3;
-      else
-        layer_tolerance = 0;
-    } else
-      layer_tolerance = lp->tolerance;
+  nclasses = 0;
+  classgroup = NULL;
+  if (lp->classgroup && lp->numclasses > 0)
+    classgroup = msAllocateValidClassGroups(lp, &nclasses);
 
-    if(lp->toleranceunits == MS_PIXELS)
-      tolerance = layer_tolerance * msAdjustExtent(&(map->extent), map->width, map->height);
-    else
-      tolerance = layer_tolerance * (msInchesPerUnit(lp->toleranceunits,0)/msInchesPerUnit(map->units,0));
+  if (lp->minfeaturesize > 0)
+    minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
 
-    msLayerClose(lp); /* reset */
-    status = msLayerOpen(lp);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
-    /* disable driver paging */
-    msLayerEnablePaging(lp, MS_FALSE);
+  msInitShape(&shape);
+  msInitShapeBatch(lp, &batch);
+  while((status = msLayerNextShapeFromBatch(lp, &batch, &shape)) == MS_SUCCESS) { /* step through the shapes */
 
-    /* build item list, we want *all* items */
-    status = msLayerWhichItems(lp, MS_TRUE, NULL);
-    if(status != MS_SUCCESS) return(MS_FAILURE);
+    /* Check if the shape size is ok to be drawn */
+    if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
+      if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
+        if( lp->debug >= MS_DEBUGLEVEL_V )
+          msDebug("msQueryByShape(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
+        msFreeShape(&shape);
+        continue;
+      }
+    }
 
-    /* identify target shapes */
-    searchrect = qshape->bounds;
+    shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
+    if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+      msFreeShape(&shape);
+      continue;
+    }
 
-    searchrect.minx -= tolerance; /* expand the search box to account for layer tolerances (e.g. buffered searches) */
-    searchrect.maxx += tolerance;
-    searchrect.miny -= tolerance;
-    searchrect.maxy += tolerance;
+    if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
+      msFreeShape(&shape);
+      continue;
+    }
 
 #ifdef USE_PROJ
     if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-      msProjectRect(&(map->projection), &(lp->projection), &searchrect); /* project the searchrect to source coords */
+      msProjectShape(&(lp->projection), &(map->projection), &shape);
     else
       lp->project = MS_FALSE;
 #endif
 
-    status = msLayerWhichShapes(lp, searchrect, MS_TRUE);
-    if(status == MS_DONE) { /* no overlap */
-      msLayerClose(lp);
-      continue;
-    } else if(status != MS_SUCCESS) {
-      msLayerClose(lp);
-      return(MS_FAILURE);
-    }
-
-    lp->resultcache = (resultCacheObj *)malloc(sizeof(resultCacheObj)); /* allocate and initialize the result cache */
-    MS_CHECK_ALLOC(lp->resultcache, sizeof(resultCacheObj), MS_FAILURE);
-    initResultCache( lp->resultcache);
-
-    nclasses = 0;
-    classgroup = NULL;
-    if (lp->classgroup && lp->numclasses > 0)
-      classgroup = msAllocateValidClassGroups(lp, &nclasses);
-
-    if (lp->minfeaturesize > 0)
-      minfeaturesize = Pix2LayerGeoref(map, lp, lp->minfeaturesize);
-
-    while((status = msLayerNextShape(lp, &shape)) == MS_SUCCESS) { /* step through the shapes */
-
-      /* Check if the shape size is ok to be drawn */
-      if ( (shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) ) {
-        if (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE) {
-          if( lp->debug >= MS_DEBUGLEVEL_V )
-            msDebug("msQueryByShape(): Skipping shape (%d) because LAYER::MINFEATURESIZE is bigger than shape size\n", shape.index);
-          msFreeShape(&shape);
-          continue;
+    switch(qshape->type) { /* may eventually support types other than polygon or line */
+      case MS_SHAPE_POLYGON:
+        switch(shape.type) { /* make sure shape actually intersects the shape */
+          case MS_SHAPE_POINT:
+            if(tolerance == 0) /* just test for intersection */
+              status = msIntersectMultipointPolygon(&shape, qshape);
+            else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_LINE:
+            if(tolerance == 0) { /* just test for intersection */
+              status = msIntersectPolylinePolygon(&shape, qshape);
+            } else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_POLYGON:
+            if(tolerance == 0) /* just test for intersection */
+              status = msIntersectPolygons(&shape, qshape);
+            else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          default:
+            break;
         }
-      }
+        break;
+      case MS_SHAPE_LINE:
+        switch(shape.type) { /* make sure shape actually intersects the selectshape */
+          case MS_SHAPE_POINT:
+            if(tolerance == 0) { /* just test for intersection */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance == 0) status = MS_TRUE;
+            } else {
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_LINE:
+            if(tolerance == 0) { /* just test for intersection */
+              status = msIntersectPolylines(&shape, qshape);
+            } else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          case MS_SHAPE_POLYGON:
+            if(tolerance == 0) /* just test for intersection */
+              status = msIntersectPolylinePolygon(qshape, &shape);
+            else { /* check distance, distance=0 means they intersect */
+              distance = msDistanceShapeToShape(qshape, &shape);
+              if(distance < tolerance) status = MS_TRUE;
+            }
+            break;
+          default:
+            status = MS_FALSE;
+            break;
+        }
+        break;
+      case MS_SHAPE_POINT:
+        distance = msDistanceShapeToShape(qshape, &shape);
+        status = MS_FALSE;
+        if(tolerance == 0 && distance == 0) status = MS_TRUE; /* shapes intersect */
+        else if(distance < tolerance) status = MS_TRUE; /* shapes are close enough */
+        break;
+      default:
+        break; /* should never get here as we test for selection shape type explicitly earlier */
+    }
 
-      shape.classindex = msShapeGetClass(lp, map, &shape, classgroup, nclasses);
-      if(!(lp->template) && ((shape.classindex == -1) || (lp->class[shape.classindex]->status == MS_OFF))) { /* not a valid shape */
+    if(status == MS_TRUE) {
+      /* Should we skip this feature? */
+      if (!msLayerGetPaging(lp) && query->startindex > 1) {
+        --query->startindex;
         msFreeShape(&shape);
         continue;
       }
+      addResult(lp->resultcache, &shape);
+    }
+    msFreeShape(&shape);
 
-      if(!(lp->template) && !(lp->class[shape.classindex]->template)) { /* no valid template */
-        msFreeShape(&shape);
-        continue;
-      }
+    /* check shape count */
+    if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
+      status = MS_DONE;
+      break;
+    }
+  } /* next shape */
+  msFreeShapeBatch(&batch);
 
-#ifdef USE_PROJ
-      if(lp->project && msProjectionsDiffer(&(lp->projection), &(map->projection)))
-        msProjectShape(&(lp->projection), &(map->projection), &shape);
-      else
-        lp->project = MS_FALSE;
-#endif
+  if(status != MS_DONE) return(MS_FAILURE);
 
-      switch(qshape->type) { /* may eventually support types other than polygon or line */
-        case MS_SHAPE_POLYGON:
-          switch(shape.type) { /* make sure shape actually intersects the shape */
-            case MS_SHAPE_POINT:
-              if(tolerance == 0) /* just test for intersection */
-                status = msIntersectMultipointPolygon(&shape, qshape);
-              else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_LINE:
-              if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylinePolygon(&shape, qshape);
-              } else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_POLYGON:
-              if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolygons(&shape, qshape);
-              else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            default:
-              break;
-          }
-          break;
-        case MS_SHAPE_LINE:
-          switch(shape.type) { /* make sure shape actually intersects the selectshape */
-            case MS_SHAPE_POINT:
-              if(tolerance == 0) { /* just test for intersection */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance == 0) status = MS_TRUE;
-              } else {
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_LINE:
-              if(tolerance == 0) { /* just test for intersection */
-                status = msIntersectPolylines(&shape, qshape);
-              } else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            case MS_SHAPE_POLYGON:
-              if(tolerance == 0) /* just test for intersection */
-                status = msIntersectPolylinePolygon(qshape, &shape);
-              else { /* check distance, distance=0 means they intersect */
-                distance = msDistanceShapeToShape(qshape, &shape);
-                if(distance < tolerance) status = MS_TRUE;
-              }
-              break;
-            default:
-              status = MS_FALSE;
-              break;
-          }
-          break;
-        case MS_SHAPE_POINT:
-          distance = msDistanceShapeToShape(qshape, &shape);
-          status = MS_FALSE;
-          if(tolerance == 0 && distance == 0) status = MS_TRUE; /* shapes intersect */
-          else if(distance < tolerance) status = MS_TRUE; /* shapes are close enough */
-          break;
-        default:
-          break; /* should never get here as we test for selection shape type explicitly earlier */
-      }
+  if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
 
-      if(status == MS_TRUE) {
-        /* Should we skip this feature? */
-        if (!msLayerGetPaging(lp) && map->query.startindex > 1) {
-          --map->query.startindex;
-          msFreeShape(&shape);
-          continue;
-        }
-        addResult(lp->resultcache, &shape);
-      }
-      msFreeShape(&shape);
+  return MS_SUCCESS;
+}
 
-      /* check shape count */
-      if(lp->maxfeatures > 0 && lp->maxfeatures == lp->resultcache->numresults) {
-        status = MS_DONE;
-        break;
-      }
-    } /* next shape */
+int msQueryByShape(mapObj *map)
+{
+  int start, stop=0, l;
 
-    if(status != MS_DONE) return(MS_FAILURE);
+  if(map->query.type != MS_QUERY_BY_SHAPE) {
+    msSetError(MS_QUERYERR, "The query is not properly defined.", "msQueryByShape()");
+    return(MS_FAILURE);
+  }
 
-    if(lp->resultcache->numresults == 0) msLayerClose(lp); /* no need to keep the layer open */
-  } /* next layer */
+  if(!(map->query.shape)) {
+    msSetError(MS_QUERYERR, "Query shape is not defined.", "msQueryByShape()");
+    return(MS_FAILURE);
+  }
+  if(map->query.shape->type != MS_SHAPE_POLYGON && map->query.shape->type != MS_SHAPE_LINE && map->query.shape->type != MS_SHAPE_POINT) {
+    msSetError(MS_QUERYERR, "Query shape MUST be a polygon, line or point.", "msQueryByShape()");
+    return(MS_FAILURE);
+  }
+
+  if(map->query.layer < 0 || map->query.layer >= map->numlayers)
+    start = map->numlayers-1;
+  else
+    start = stop = map->query.layer;
+
+  msComputeBounds(map->query.shape); /* make sure an accurate extent exists */
+
+  if(msQueryLayers(map, start, stop, msQueryLayerByShape, MS_FALSE) != MS_SUCCESS)
+    return(MS_FAILURE);
 
   /* was anything found? */
   for(l=start; l>=stop; l--) {
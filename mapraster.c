@@ -30,6 +30,7 @@
  ****************************************************************************/
 
 #include <assert.h>
+#include <sys/stat.h>
 #include "mapserver.h"
 #include "mapfile.h"
 #include "mapresample.h"
@@ -311,6 +312,269 @@ int msAddColorGD(mapObj *map, gdImagePtr img, int cmt, int r, int g, int b)
 
 #endif
 
+#ifdef USE_GDAL
+/************************************************************************/
+/*                        Raster tile catalogue                         */
+/*                                                                      */
+/*      Shapefile tile indexes referenced by raster layers are read     */
+/*      once per process into a catalogue holding the bounds and        */
+/*      location of every tile under a quadtree, rebuilt when the       */
+/*      index file is modified.  The footprint of each tile file is     */
+/*      recorded the first time it is drawn so that tiles whose         */
+/*      index bounds are looser than the imagery are not reopened.      */
+/*      Footprints depend on the georeferencing settings of the layer   */
+/*      (worldfile, EXTENT...), which are part of the catalogue key.    */
+/*      The catalogues are protected by TLOCK_RASTERCAT.                */
+/************************************************************************/
+
+typedef struct {
+  rectObj bounds; /* from the tile index */
+  char *location; /* value of the tile item, NULL for null shapes */
+  int havefootprint;
+  rectObj footprint; /* from the geotransform used to draw the tile, in the layer projection */
+} rasterTileObj;
+
+typedef struct rasterTileCatalogObj {
+  char *path; /* tile index shapefile */
+  char *tileitem;
+  char *data; /* layer DATA appended to the locations */
+  char *georef; /* layer settings used by msGetGDALGeoTransform(), see msRasterTileGeorefKey() */
+  time_t mtime;
+  int numtiles;
+  rasterTileObj *tiles;
+  treeObj *tree;
+  int refcount;
+  int stale; /* freed once released by its last user */
+  struct rasterTileCatalogObj *next;
+} rasterTileCatalogObj;
+
+static rasterTileCatalogObj *rasterTileCatalogs = NULL;
+
+static void msRasterTileCatalogFree(rasterTileCatalogObj *catalog)
+{
+  int i;
+
+  for(i=0; i<catalog->numtiles; i++)
+    msFree(catalog->tiles[i].location);
+  msFree(catalog->tiles);
+  if(catalog->tree)
+    msDestroyTree(catalog->tree);
+  msFree(catalog->path);
+  msFree(catalog->tileitem);
+  msFree(catalog->data);
+  msFree(catalog->georef);
+  free(catalog);
+}
+
+static rasterTileCatalogObj *msRasterTileCatalogBuild(char *path, const char *tileitem, const char *data,
+    char *georef, int debug)
+{
+  rasterTileCatalogObj *catalog;
+  shapefileObj shpfile;
+  int i, itemindex;
+
+  if(msShapefileOpen(&shpfile, "rb", path, MS_FALSE) == -1) {
+    msFree(georef);
+    return NULL;
+  }
+
+  itemindex = msDBFGetItemIndex(shpfile.hDBF, (char *) tileitem);
+  if(itemindex == -1) {
+    msShapefileClose(&shpfile);
+    msFree(georef);
+    return NULL;
+  }
+
+  catalog = (rasterTileCatalogObj *) msSmallCalloc(1, sizeof(rasterTileCatalogObj));
+  catalog->path = msStrdup(path);
+  catalog->tileitem = msStrdup(tileitem);
+  catalog->data = msStrdup(data ? data : "");
+  catalog->georef = georef;
+  catalog->numtiles = shpfile.numshapes;
+  catalog->tiles = (rasterTileObj *) msSmallCalloc(MS_MAX(1, shpfile.numshapes), sizeof(rasterTileObj));
+
+  for(i=0; i<shpfile.numshapes; i++) {
+    if(msSHPReadBounds(shpfile.hSHP, i, &(catalog->tiles[i].bounds)) == MS_SUCCESS)
+      catalog->tiles[i].location = msStrdup(msDBFReadStringAttribute(shpfile.hDBF, i, itemindex));
+  }
+
+  catalog->tree = msCreateTree(&shpfile, 0);
+  msShapefileClose(&shpfile);
+
+  if(debug)
+    msDebug("msRasterTileCatalogBuild(): read %d tiles from %s.\n", catalog->numtiles, path);
+
+  return catalog;
+}
+
+/*
+** Returns the layer settings msGetGDALGeoTransform() reads besides the tile
+** file: the EXTENT_PRIORITY and WORLDFILE processing options, the layer
+** EXTENT and the OWS extent metadata. Layers sharing an index only share
+** its footprints if they georeference the tiles the same way.
+*/
+static char *msRasterTileGeorefKey(mapObj *map, layerObj *layer)
+{
+  char szPath[MS_MAXPATHLEN], szExtent[256];
+  const char *value;
+  char *key = NULL;
+
+  if((value = CSLFetchNameValue(layer->processing, "EXTENT_PRIORITY")) != NULL)
+    key = msStringConcatenate(key, value);
+  key = msStringConcatenate(key, "|");
+  if((value = CSLFetchNameValue(layer->processing, "WORLDFILE")) != NULL)
+    key = msStringConcatenate(key, msBuildPath(szPath, map->mappath, value));
+  key = msStringConcatenate(key, "|");
+  if(MS_VALID_EXTENT(layer->extent)) {
+    snprintf(szExtent, sizeof(szExtent), "%.15g %.15g %.15g %.15g",
+             layer->extent.minx, layer->extent.miny, layer->extent.maxx, layer->extent.maxy);
+    key = msStringConcatenate(key, szExtent);
+  }
+  key = msStringConcatenate(key, "|");
+#if defined(USE_WMS_SVR) || defined (USE_WFS_SVR)
+  if((value = msOWSLookupMetadata(&(layer->metadata), "MFCO", "extent")) != NULL)
+    key = msStringConcatenate(key, value);
+#endif
+
+  return key;
+}
+
+/*
+** Returns the catalogue of the layer tile index, or NULL when the layer
+** has to go through the tile index layer: an index that is a map layer,
+** not a shapefile, or a layer filter on the index.
+*/
+static rasterTileCatalogObj *msRasterTileCatalogAcquire(mapObj *map, layerObj *layer)
+{
+  rasterTileCatalogObj *catalog, **prev;
+  char szPath[MS_MAXPATHLEN], szShpPath[MS_MAXPATHLEN];
+  char *georef;
+  struct stat sStat;
+
+  if(layer->filter.string || layer->filteritem || !layer->tileitem)
+    return NULL;
+
+  /* resolve the index like a shapefile layer would */
+  msBuildPath3(szPath, map->mappath, map->shapepath, layer->tileindex);
+  strlcpy(szShpPath, szPath, sizeof(szShpPath));
+  strlcat(szShpPath, ".shp", sizeof(szShpPath));
+  if(stat(szPath, &sStat) != 0 && stat(szShpPath, &sStat) != 0) {
+    msBuildPath(szPath, map->mappath, layer->tileindex);
+    strlcpy(szShpPath, szPath, sizeof(szShpPath));
+    strlcat(szShpPath, ".shp", sizeof(szShpPath));
+    if(stat(szPath, &sStat) != 0 && stat(szShpPath, &sStat) != 0)
+      return NULL;
+  }
+
+  georef = msRasterTileGeorefKey(map, layer);
+
+  msAcquireLock(TLOCK_RASTERCAT);
+
+  for(prev = &rasterTileCatalogs; (catalog = *prev) != NULL; prev = &(catalog->next)) {
+    if(strcmp(catalog->path, szPath) == 0 && strcasecmp(catalog->tileitem, layer->tileitem) == 0 &&
+        strcmp(catalog->data, layer->data ? layer->data : "") == 0 && strcmp(catalog->georef, georef) == 0)
+      break;
+  }
+
+  if(catalog && catalog->mtime != sStat.st_mtime) {
+    /* the index was modified, drop the catalogue once its users are done */
+    *prev = catalog->next;
+    if(catalog->refcount == 0)
+      msRasterTileCatalogFree(catalog);
+    else
+      catalog->stale = MS_TRUE;
+    catalog = NULL;
+  }
+
+  if(!catalog) {
+    catalog = msRasterTileCatalogBuild(szPath, layer->tileitem, layer->data, georef, layer->debug || map->debug);
+    georef = NULL; /* owned by the catalogue */
+    if(catalog) {
+      catalog->mtime = sStat.st_mtime;
+      catalog->next = rasterTileCatalogs;
+      rasterTileCatalogs = catalog;
+    }
+  }
+
+  if(catalog)
+    catalog->refcount++;
+
+  msReleaseLock(TLOCK_RASTERCAT);
+
+  msFree(georef);
+
+  return catalog;
+}
+
+static void msRasterTileCatalogRelease(rasterTileCatalogObj *catalog)
+{
+  msAcquireLock(TLOCK_RASTERCAT);
+  if(--catalog->refcount == 0 && catalog->stale)
+    msRasterTileCatalogFree(catalog);
+  msReleaseLock(TLOCK_RASTERCAT);
+}
+
+/* MS_FALSE if the tile imagery is known to miss rect */
+static int msRasterTileOverlaps(rasterTileObj *tile, rectObj *rect)
+{
+  int overlaps = MS_TRUE;
+
+  msAcquireLock(TLOCK_RASTERCAT);
+  if(tile->havefootprint)
+    overlaps = msRectOverlap(&(tile->footprint), rect);
+  msReleaseLock(TLOCK_RASTERCAT);
+
+  return overlaps;
+}
+
+/* gt is the geotransform msGetGDALGeoTransform() found for the tile */
+static void msRasterTileSetFootprint(rasterTileObj *tile, GDALDatasetH hDS, const double *gt)
+{
+  int nXSize = GDALGetRasterXSize(hDS), nYSize = GDALGetRasterYSize(hDS);
+  double x[4], y[4];
+  int i;
+
+  x[0] = gt[0];
+  y[0] = gt[3];
+  x[1] = gt[0] + nXSize * gt[1];
+  y[1] = gt[3] + nXSize * gt[4];
+  x[2] = gt[0] + nYSize * gt[2];
+  y[2] = gt[3] + nYSize * gt[5];
+  x[3] = gt[0] + nXSize * gt[1] + nYSize * gt[2];
+  y[3] = gt[3] + nXSize * gt[4] + nYSize * gt[5];
+
+  msAcquireLock(TLOCK_RASTERCAT);
+  tile->footprint.minx = tile->footprint.maxx = x[0];
+  tile->footprint.miny = tile->footprint.maxy = y[0];
+  for(i=1; i<4; i++) {
+    tile->footprint.minx = MS_MIN(tile->footprint.minx, x[i]);
+    tile->footprint.maxx = MS_MAX(tile->footprint.maxx, x[i]);
+    tile->footprint.miny = MS_MIN(tile->footprint.miny, y[i]);
+    tile->footprint.maxy = MS_MAX(tile->footprint.maxy, y[i]);
+  }
+  tile->havefootprint = MS_TRUE;
+  msReleaseLock(TLOCK_RASTERCAT);
+}
+#endif /* def USE_GDAL */
+
+/************************************************************************/
+/*                    msRasterTileCatalogCleanup()                      */
+/************************************************************************/
+
+void msRasterTileCatalogCleanup(void)
+{
+#ifdef USE_GDAL
+  rasterTileCatalogObj *catalog;
+
+  msAcquireLock(TLOCK_RASTERCAT);
+  while((catalog = rasterTileCatalogs) != NULL) {
+    rasterTileCatalogs = catalog->next;
+    msRasterTileCatalogFree(catalog);
+  }
+  msReleaseLock(TLOCK_RASTERCAT);
+#endif
+}
+
 /************************************************************************/
 /*                        msDrawRasterLayerLow()                        */
 /*                                                                      */
@@ -351,6 +615,12 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
   GDALDatasetH  hDS;
   double  adfGeoTransform[6];
   const char *close_connection;
+  const char *location;
+
+  rasterTileCatalogObj *catalog=NULL;
+  rasterTileObj *tile=NULL;
+  ms_bitarray tilestatus=NULL;
+  int tileindex=-1;
 
   msGDALInitialize();
 
@@ -403,8 +673,31 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
     msInitShape(&tshp);
 
+    searchrect = map->extent;
+#ifdef USE_PROJ
+    /* if necessary, project the searchrect to source coords */
+    if((map->projection.numargs > 0) && (layer->projection.numargs > 0)) {
+      if( msProjectRect(&map->projection, &layer->projection, &searchrect)
+          != MS_SUCCESS ) {
+        msDebug( "msDrawRasterLayerLow(%s): unable to reproject map request rectangle into layer projection, canceling.\n", layer->name );
+        return MS_FAILURE;
+      }
+    }
+#endif
+
     tilelayerindex = msGetLayerIndex(layer->map, layer->tileindex);
-    if(tilelayerindex == -1) { /* the tileindex references a file, not a layer */
+
+    /* use the cached catalogue of a shapefile index when possible */
+    if(tilelayerindex == -1)
+      catalog = msRasterTileCatalogAcquire(map, layer);
+
+    if(catalog) {
+      tilestatus = msSearchTree(catalog->tree, searchrect);
+      if(!tilestatus) {
+        msRasterTileCatalogRelease(catalog);
+        return MS_FAILURE;
+      }
+    } else if(tilelayerindex == -1) { /* the tileindex references a file, not a layer */
 
       /* so we create a temporary layer */
       tlp = (layerObj *) malloc(sizeof(layerObj));
@@ -443,6 +736,9 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
         return MS_FAILURE;
       tlp = (GET_LAYER(layer->map, tilelayerindex));
     }
+  }
+
+  if(tlp) { /* search the tile index layer */
     status = msLayerOpen(tlp);
     if(status != MS_SUCCESS) {
       final_status = status;
@@ -471,18 +767,6 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       goto cleanup;
     }
 
-    searchrect = map->extent;
-#ifdef USE_PROJ
-    /* if necessary, project the searchrect to source coords */
-    if((map->projection.numargs > 0) && (layer->projection.numargs > 0)) {
-      if( msProjectRect(&map->projection, &layer->projection, &searchrect)
-          != MS_SUCCESS ) {
-        msDebug( "msDrawRasterLayerLow(%s): unable to reproject map request rectangle into layer projection, canceling.\n", layer->name );
-        final_status = MS_FAILURE;
-        goto cleanup;
-      }
-    }
-#endif
     status = msLayerWhichShapes(tlp, searchrect, MS_FALSE);
     if (status != MS_SUCCESS) {
       /* Can be either MS_DONE or MS_FAILURE */
@@ -495,7 +779,16 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
   done = MS_FALSE;
   while(done != MS_TRUE) {
-    if(layer->tileindex) {
+    if(catalog) {
+      tileindex = msGetNextBit(tilestatus, tileindex+1, catalog->numtiles);
+      if(tileindex < 0) break; /* no more tiles/images */
+
+      tile = &(catalog->tiles[tileindex]);
+      if(!tile->location || !msRectOverlap(&(tile->bounds), &searchrect)
+          || !msRasterTileOverlaps(tile, &searchrect))
+        continue;
+      location = tile->location;
+    } else if(layer->tileindex) {
       status = msLayerNextShape(tlp, &tshp);
       if( status == MS_FAILURE) {
         final_status = MS_FAILURE;
@@ -504,16 +797,21 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
       if(status == MS_DONE) break; /* no more tiles/images */
 
+      location = tshp.values[tileitemindex];
+    } else {
+      location = NULL;
+      filename = layer->data;
+      done = MS_TRUE; /* only one image so we're done after this */
+    }
+
+    if(location) {
       if(layer->data == NULL || strlen(layer->data) == 0 ) { /* assume whole filename is in attribute field */
-        strlcpy( tilename, tshp.values[tileitemindex], sizeof(tilename));
+        strlcpy( tilename, location, sizeof(tilename));
       } else
-        snprintf(tilename, sizeof(tilename), "%s/%s", tshp.values[tileitemindex], layer->data);
+        snprintf(tilename, sizeof(tilename), "%s/%s", location, layer->data);
       filename = tilename;
 
       msFreeShape(&tshp); /* done with the shape */
-    } else {
-      filename = layer->data;
-      done = MS_TRUE; /* only one image so we're done after this */
     }
 
     if(strlen(filename) == 0) continue;
@@ -543,11 +841,13 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
     ** oracle georaster do not use real paths.
     */
     decrypted_path = msDecryptStringTokens( map, szPath );
-    if( decrypted_path == NULL )
-      return MS_FAILURE;
+    if( decrypted_path == NULL ) {
+      final_status = MS_FAILURE;
+      break;
+    }
 
     msAcquireLock( TLOCK_GDAL );
-    hDS = GDALOpenShared( decrypted_path, GA_ReadOnly );
+    hDS = (GDALDatasetH) msGDALOpenPooled( decrypted_path );
 
     /*
     ** If GDAL doesn't recognise it, and it wasn't successfully opened
@@ -579,7 +879,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
       if(ignore_missing == MS_MISSING_DATA_FAIL) {
         msSetError(MS_IOERR, "Corrupt, empty or missing file '%s' for layer '%s'. %s", "msDrawRasterLayerLow()", szPath, layer->name, cpl_error_msg );
-        return(MS_FAILURE);
+        final_status = MS_FAILURE;
+        break;
       } else if( ignore_missing == MS_MISSING_DATA_LOG ) {
         if( layer->debug || layer->map->debug ) {
           msDebug( "Corrupt, empty or missing file '%s' for layer '%s' ... ignoring this missing data.  %s\n", szPath, layer->name, cpl_error_msg );
@@ -590,13 +891,11 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       } else {
         /* never get here */
         msSetError(MS_IOERR, "msIgnoreMissingData returned unexpected value.", "msDrawRasterLayerLow()");
-        return(MS_FAILURE);
+        final_status = MS_FAILURE;
+        break;
       }
     }
 
-    msFree( decrypted_path );
-    decrypted_path = NULL;
-
     /*
     ** Generate the projection information if using AUTO.
     */
@@ -622,6 +921,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
           msSetError(MS_OGRERR, "%s","msDrawRasterLayer()",
                      szLongMsg);
 
+          msGDALClosePooled( map, hDS, decrypted_path, MS_FALSE );
+          msFree( decrypted_path );
           msReleaseLock( TLOCK_GDAL );
           final_status = MS_FAILURE;
           break;
@@ -629,7 +930,10 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
       }
     }
 
-    msGetGDALGeoTransform( hDS, map, layer, adfGeoTransform );
+    /* tiles without any georeferencing get a default transform, no footprint */
+    if( msGetGDALGeoTransform( hDS, map, layer, adfGeoTransform ) == MS_SUCCESS
+        && tile && !tile->havefootprint )
+      msRasterTileSetFootprint( tile, hDS, adfGeoTransform );
 
     /*
     ** We want to resample if the source image is rotated, if
@@ -660,7 +964,8 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
     }
 
     if( status == -1 ) {
-      GDALClose( hDS );
+      msGDALClosePooled( map, hDS, decrypted_path, MS_FALSE );
+      msFree( decrypted_path );
       msReleaseLock( TLOCK_GDAL );
       final_status = MS_FAILURE;
       break;
@@ -668,33 +973,35 @@ int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image,
 
     /*
     ** Should we keep this file open for future use?
-    ** default to keeping open for single data files, and
-    ** to closing for tile indexes
+    ** default to keeping open, the handle pool is bounded so
+    ** this holds for the files of tile indexes too
     */
 
     close_connection = msLayerGetProcessingKey( layer,
                        "CLOSE_CONNECTION" );
 
-    if( close_connection == NULL && layer->tileindex == NULL )
+    if( close_connection == NULL )
       close_connection = "DEFER";
 
-    if( close_connection != NULL
-        && strcasecmp(close_connection,"DEFER") == 0 ) {
-      GDALDereferenceDataset( hDS );
-    } else {
-      GDALClose( hDS );
-    }
+    msGDALClosePooled( map, hDS, decrypted_path,
+                       strcasecmp(close_connection,"DEFER") == 0 );
+    msFree( decrypted_path );
+    decrypted_path = NULL;
     msReleaseLock( TLOCK_GDAL );
   } /* next tile */
 
 cleanup:
-  if(layer->tileindex) { /* tiling clean-up */
+  if(tlp) { /* tiling clean-up */
     msLayerClose(tlp);
     if(tilelayerindex == -1) {
       freeLayer(tlp);
       free(tlp);
     }
   }
+  if(catalog) {
+    msFree(tilestatus);
+    msRasterTileCatalogRelease(catalog);
+  }
 
   return final_status;
 
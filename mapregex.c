@@ -51,6 +51,7 @@
 
 #include "mapserver.h"
 #include "mapregex.h"
+#include "mapthread.h"
 #include <regex.h>
 
 MS_API_EXPORT(int) ms_regcomp(ms_regex_t *regex, const char *expr, int cflags)
@@ -81,3 +82,112 @@ MS_API_EXPORT(void) ms_regfree(ms_regex_t *regex)
   free(regex->sys_regex);
   return;
 }
+
+/************************************************************************/
+/*                         Compiled regex cache                         */
+/*                                                                      */
+/*      Patterns matched over and over (parameter validation, the       */
+/*      map file patterns, ~ and ~* in logical expressions) are         */
+/*      compiled once per process and kept in a list, most recently     */
+/*      used first, of at most MS_REGEX_CACHE_SIZE entries.  An         */
+/*      entry pushed out while in use is freed once released by its     */
+/*      last user.  The list is protected by TLOCK_REGEX, matching      */
+/*      itself happens outside of the lock since regexec() does not     */
+/*      modify the compiled pattern.                                    */
+/************************************************************************/
+
+#define MS_REGEX_CACHE_SIZE 64
+
+typedef struct regexCacheEntryObj {
+  ms_regex_t regex; /* first, see msRegexCacheRelease() */
+  char *pattern;
+  int cflags;
+  int refcount;
+  int stale; /* freed once released by its last user */
+  struct regexCacheEntryObj *next;
+} regexCacheEntryObj;
+
+static regexCacheEntryObj *regexCache = NULL;
+static int regexCacheSize = 0;
+
+static void msRegexCacheEntryFree(regexCacheEntryObj *entry)
+{
+  ms_regfree(&(entry->regex));
+  msFree(entry->pattern);
+  free(entry);
+}
+
+/*
+** Returns pattern compiled with cflags, or NULL if it doesn't compile.
+** The regex has to be given back with msRegexCacheRelease().
+*/
+ms_regex_t *msRegexCacheAcquire(const char *pattern, int cflags)
+{
+  regexCacheEntryObj *entry, **prev;
+
+  msAcquireLock(TLOCK_REGEX);
+
+  for(prev = &regexCache; (entry = *prev) != NULL; prev = &(entry->next)) {
+    if(entry->cflags == cflags && strcmp(entry->pattern, pattern) == 0)
+      break;
+  }
+
+  if(entry) {
+    *prev = entry->next; /* moved to the front below */
+  } else {
+    entry = (regexCacheEntryObj *) msSmallCalloc(1, sizeof(regexCacheEntryObj));
+    if(ms_regcomp(&(entry->regex), pattern, cflags) != 0) {
+      msReleaseLock(TLOCK_REGEX);
+      free(entry->regex.sys_regex);
+      free(entry);
+      return NULL;
+    }
+    entry->pattern = msStrdup(pattern);
+    entry->cflags = cflags;
+    regexCacheSize++;
+  }
+
+  entry->next = regexCache;
+  regexCache = entry;
+  entry->refcount++;
+
+  while(regexCacheSize > MS_REGEX_CACHE_SIZE) { /* drop the least recently used */
+    regexCacheEntryObj *last;
+
+    for(prev = &regexCache; (*prev)->next != NULL; prev = &((*prev)->next));
+    last = *prev;
+    *prev = NULL;
+    regexCacheSize--;
+    if(last->refcount == 0)
+      msRegexCacheEntryFree(last);
+    else
+      last->stale = MS_TRUE;
+  }
+
+  msReleaseLock(TLOCK_REGEX);
+
+  return &(entry->regex);
+}
+
+void msRegexCacheRelease(ms_regex_t *regex)
+{
+  regexCacheEntryObj *entry = (regexCacheEntryObj *) regex;
+
+  msAcquireLock(TLOCK_REGEX);
+  if(--entry->refcount == 0 && entry->stale)
+    msRegexCacheEntryFree(entry);
+  msReleaseLock(TLOCK_REGEX);
+}
+
+void msRegexCacheCleanup(void)
+{
+  regexCacheEntryObj *entry;
+
+  msAcquireLock(TLOCK_REGEX);
+  while((entry = regexCache) != NULL) {
+    regexCache = entry->next;
+    msRegexCacheEntryFree(entry);
+  }
+  regexCacheSize = 0;
+  msReleaseLock(TLOCK_REGEX);
+}
@@ -2750,6 +2750,34 @@ PHP_METHOD(mapObj, getNumSymbols)
 }
 /* }}} */
 
+/* {{{ proto array map.getDrawBudget()
+   Returns the limits and counters of the draw budget of the last draw() call. */
+PHP_METHOD(mapObj, getDrawBudget)
+{
+  zval *zobj = getThis();
+  php_map_object *php_map;
+  drawBudgetObj *budget;
+
+  PHP_MAPSCRIPT_ERROR_HANDLING(TRUE);
+  if (zend_parse_parameters_none() == FAILURE) {
+    PHP_MAPSCRIPT_RESTORE_ERRORS(TRUE);
+    return;
+  }
+  PHP_MAPSCRIPT_RESTORE_ERRORS(TRUE);
+
+  php_map = (php_map_object *) zend_object_store_get_object(zobj TSRMLS_CC);
+  budget = &(php_map->map->drawbudget);
+
+  array_init(return_value);
+  add_assoc_long(return_value, "maxfeatures", budget->maxfeatures);
+  add_assoc_long(return_value, "maxvertices", budget->maxvertices);
+  add_assoc_long(return_value, "maxtime", budget->maxtime);
+  add_assoc_long(return_value, "numfeatures", budget->numfeatures);
+  add_assoc_long(return_value, "numvertices", budget->numvertices);
+  add_assoc_long(return_value, "level", budget->level);
+}
+/* }}} */
+
 /* {{{ proto int map.setFontName(fileName)*/
 PHP_METHOD(mapObj, setFontSet)
 {
@@ -3457,6 +3485,7 @@ zend_function_entry map_functions[] = {
   PHP_ME(mapObj, processLegendTemplate, map_processLegendTemplate_args, ZEND_ACC_PUBLIC)
   PHP_ME(mapObj, setSymbolSet, map_setSymbolSet_args, ZEND_ACC_PUBLIC)
   PHP_ME(mapObj, getNumSymbols, NULL, ZEND_ACC_PUBLIC)
+  PHP_ME(mapObj, getDrawBudget, NULL, ZEND_ACC_PUBLIC)
   PHP_ME(mapObj, setFontSet, map_setFontSet_args, ZEND_ACC_PUBLIC)
   PHP_ME(mapObj, selectOutputFormat, map_selectOutputFormat_args, ZEND_ACC_PUBLIC)
   PHP_ME(mapObj, appendOutputFormat, map_appendOutputFormat_args, ZEND_ACC_PUBLIC)
@@ -1008,6 +1008,11 @@ PHP_MINIT_FUNCTION(mapscript)
   //#define MS_GD_ALPHA 1000
   REGISTER_LONG_CONSTANT("MS_GD_ALPHA",     MS_GD_ALPHA,       const_flag);
 
+  /* draw budget degradation levels, see map.getDrawBudget() */
+  REGISTER_LONG_CONSTANT("MS_DRAWBUDGET_NONE",     MS_DRAWBUDGET_NONE,     const_flag);
+  REGISTER_LONG_CONSTANT("MS_DRAWBUDGET_SIMPLIFY", MS_DRAWBUDGET_SIMPLIFY, const_flag);
+  REGISTER_LONG_CONSTANT("MS_DRAWBUDGET_STOP",     MS_DRAWBUDGET_STOP,     const_flag);
+
   /* font type constants*/
   REGISTER_LONG_CONSTANT("MS_TRUETYPE",   MS_TRUETYPE,    const_flag);
   REGISTER_LONG_CONSTANT("MS_BITMAP",     MS_BITMAP,      const_flag);
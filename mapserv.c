@@ -129,6 +129,224 @@ static int msIO_installFastCGIRedirect()
   return MS_TRUE;
 }
 
+
+#ifndef WIN32
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/************************************************************************/
+/*                        Pre-forked server mode.                       */
+/*                                                                      */
+/*      With -listen the process opens the FastCGI socket itself, does  */
+/*      the costly set-up once (mapfiles given with -preload, GDAL      */
+/*      drivers) and forks -workers processes that share that state     */
+/*      copy-on-write and accept the requests on the socket, so a       */
+/*      request always goes to an idle worker. The parent restarts the  */
+/*      workers that die, waiting longer and longer before restarting   */
+/*      the ones that keep dying at start-up, and, in debug mode,       */
+/*      reports their load.                                             */
+/************************************************************************/
+
+#define MS_SERVER_MIN_UPTIME 10 /* seconds, a worker dying sooner is restarted with a delay */
+#define MS_SERVER_MAX_RESTART_DELAY 60 /* seconds */
+
+typedef struct {
+  pid_t pid; /* 0 while the worker waits to be restarted */
+  int busy; /* MS_TRUE while the worker processes a request */
+  long requests;
+  double time; /* total processing time */
+  double maxtime;
+  time_t started;
+  time_t restart; /* when to restart the worker */
+  int failures; /* number of times in a row the worker died young */
+} serverWorkerObj;
+
+static serverWorkerObj *serverWorkers = NULL; /* shared between the processes */
+static serverWorkerObj *serverWorker = NULL; /* slot of this worker */
+static volatile sig_atomic_t serverStop = 0;
+
+static void msServerOnSignal( int nInData )
+{
+  serverStop = 1;
+}
+
+static pid_t msServerStartWorker( int slot )
+{
+  pid_t pid = fork();
+
+  if( pid == 0 ) {
+    serverWorker = &(serverWorkers[slot]);
+    serverWorker->busy = MS_FALSE;
+    signal( SIGTERM, msCleanupOnSignal );
+    signal( SIGINT, SIG_DFL );
+  } else if( pid > 0 ) {
+    serverWorkers[slot].pid = pid;
+    serverWorkers[slot].started = time( NULL );
+  }
+
+  return pid;
+}
+
+/*
+** Logs the exit of a worker and sets when to restart it: at once, or after a
+** delay doubling each time it dies again before MS_SERVER_MIN_UPTIME, so that
+** a worker crashing at start-up does not make the server fork in a loop.
+*/
+static void msServerWorkerExited( int slot, int status )
+{
+  serverWorkerObj *worker = &(serverWorkers[slot]);
+  time_t now = time( NULL );
+  int delay = 0;
+
+  if( WIFSIGNALED( status ) )
+    msDebug( "mapserv: worker %d killed by signal %d\n", (int) worker->pid, WTERMSIG( status ) );
+  else
+    msDebug( "mapserv: worker %d exited with status %d\n", (int) worker->pid, WEXITSTATUS( status ) );
+
+  if( now - worker->started < MS_SERVER_MIN_UPTIME ) {
+    worker->failures++;
+    delay = MS_MIN( 1 << MS_MIN( worker->failures, 6 ), MS_SERVER_MAX_RESTART_DELAY );
+    msDebug( "mapserv: worker %d died after %ds, restarting it in %ds\n",
+             (int) worker->pid, (int) (now - worker->started), delay );
+  } else
+    worker->failures = 0;
+
+  worker->pid = 0;
+  worker->busy = MS_FALSE;
+  worker->restart = now + delay;
+}
+
+static void msServerReport( int numworkers )
+{
+  int i, busy = 0;
+  long requests = 0;
+  double time = 0, maxtime = 0;
+
+  for( i = 0; i < numworkers; i++ ) {
+    busy += serverWorkers[i].busy ? 1 : 0;
+    requests += serverWorkers[i].requests;
+    time += serverWorkers[i].time;
+    maxtime = MS_MAX(maxtime, serverWorkers[i].maxtime);
+  }
+
+  /* requests queue in the socket backlog while all the workers are busy */
+  msDebug( "mapserv: %d of %d workers busy%s, %ld requests, mean time %.3fs, max time %.3fs\n",
+           busy, numworkers, (busy == numworkers) ? " (requests queued)" : "",
+           requests, requests ? time/requests : 0.0, maxtime );
+}
+
+static struct mstimeval serverRequestStart;
+
+static void msServerRequestStart( void )
+{
+  if( !serverWorker ) return;
+  serverWorker->busy = MS_TRUE;
+  msGettimeofday( &serverRequestStart, NULL );
+}
+
+static void msServerRequestEnd( void )
+{
+  struct mstimeval endtime;
+  double time;
+
+  if( !serverWorker ) return;
+  msGettimeofday( &endtime, NULL );
+  time = (endtime.tv_sec+endtime.tv_usec/1.0e6)-
+         (serverRequestStart.tv_sec+serverRequestStart.tv_usec/1.0e6);
+  serverWorker->requests++;
+  serverWorker->time += time;
+  serverWorker->maxtime = MS_MAX(serverWorker->maxtime, time);
+  serverWorker->busy = MS_FALSE;
+}
+
+/*
+** Runs the server, only returns in the worker processes. Returns MS_FAILURE
+** if the socket can't be opened.
+*/
+static int msServerRun( const char *address, int numworkers )
+{
+  int i, sock, status, debuglevel, elapsed = 0;
+  pid_t pid;
+  time_t now;
+
+  sock = FCGX_OpenSocket( address, 128 );
+  if( sock < 0 ) {
+    msSetError( MS_IOERR, "Unable to listen on %s.", "msServerRun()", address );
+    return MS_FAILURE;
+  }
+  /* FCGI_Accept() listens on the standard input */
+  if( sock != 0 ) {
+    dup2( sock, 0 );
+    close( sock );
+  }
+
+#ifdef USE_GDAL
+  msGDALInitialize();
+#endif
+
+  serverWorkers = (serverWorkerObj *) mmap( NULL, sizeof(serverWorkerObj) * numworkers, PROT_READ|PROT_WRITE,
+                  MAP_SHARED|MAP_ANONYMOUS, -1, 0 );
+  if( serverWorkers == MAP_FAILED ) {
+    msSetError( MS_MEMERR, "Unable to allocate the worker table.", "msServerRun()" );
+    return MS_FAILURE;
+  }
+  memset( serverWorkers, 0, sizeof(serverWorkerObj) * numworkers );
+
+  signal( SIGTERM, msServerOnSignal );
+  signal( SIGINT, msServerOnSignal );
+
+  for( i = 0; i < numworkers; i++ ) {
+    if( msServerStartWorker( i ) == 0 )
+      return MS_SUCCESS;
+  }
+
+  debuglevel = msGetGlobalDebugLevel();
+  if( debuglevel >= MS_DEBUGLEVEL_DEBUG )
+    msDebug( "mapserv: %d workers listening on %s\n", numworkers, address );
+
+  while( !serverStop ) {
+    pid = waitpid( -1, &status, WNOHANG );
+    if( pid > 0 ) {
+      for( i = 0; i < numworkers; i++ ) {
+        if( serverWorkers[i].pid == pid )
+          msServerWorkerExited( i, status );
+      }
+      continue;
+    }
+
+    /* also retries the workers that could not be forked */
+    now = time( NULL );
+    for( i = 0; i < numworkers; i++ ) {
+      if( serverWorkers[i].pid == 0 && now >= serverWorkers[i].restart ) {
+        if( debuglevel >= MS_DEBUGLEVEL_DEBUG )
+          msDebug( "mapserv: starting a new worker\n" );
+        if( msServerStartWorker( i ) == 0 )
+          return MS_SUCCESS;
+      }
+    }
+
+    sleep( 1 );
+    if( debuglevel >= MS_DEBUGLEVEL_TUNING && ++elapsed % 60 == 0 )
+      msServerReport( numworkers );
+  }
+
+  for( i = 0; i < numworkers; i++ ) {
+    if( serverWorkers[i].pid > 0 )
+      kill( serverWorkers[i].pid, SIGTERM );
+  }
+  while( wait( NULL ) > 0 );
+
+  if( debuglevel >= MS_DEBUGLEVEL_TUNING )
+    msServerReport( numworkers );
+
+  msCGIFreePreloadedMaps();
+  msCleanup(0);
+  exit( 0 );
+}
+
+#endif /* ndef WIN32 */
+
 #endif
 /************************************************************************/
 /*                                main()                                */
@@ -137,6 +355,10 @@ int main(int argc, char *argv[])
 {
   int iArg;
   int sendheaders = MS_TRUE;
+#if defined(USE_FASTCGI) && !defined(WIN32)
+  const char *listen_address = NULL;
+  int numworkers = 4;
+#endif
   struct mstimeval execstarttime, execendtime;
   struct mstimeval requeststarttime, requestendtime;
   mapservObj* mapserv = NULL;
@@ -175,6 +397,23 @@ int main(int argc, char *argv[])
       putenv( "REQUEST_METHOD=GET" );
       putenv( argv[iArg] );
     }
+    /* Server switches, ignored when run as a CGI as arguments then come */
+    /* from the request. */
+    else if( iArg < argc-1 && strcmp(argv[iArg], "-preload") == 0 && !getenv("GATEWAY_INTERFACE") ) {
+      if( msCGIPreloadMap( argv[++iArg] ) != MS_SUCCESS ) {
+        msWriteError( stderr );
+        exit( 1 );
+      }
+    }
+#if defined(USE_FASTCGI) && !defined(WIN32)
+    else if( iArg < argc-1 && strcmp(argv[iArg], "-listen") == 0 && !getenv("GATEWAY_INTERFACE") ) {
+      listen_address = argv[++iArg];
+    } else if( iArg < argc-1 && strcmp(argv[iArg], "-workers") == 0 && !getenv("GATEWAY_INTERFACE") ) {
+      numworkers = atoi(argv[++iArg]);
+      if( numworkers < 1 )
+        numworkers = 1;
+    }
+#endif
 #ifdef MS_ENABLE_CGI_CL_DEBUG_ARGS
     else if( iArg < argc-1 && strcmp(argv[iArg], "-tmpbase") == 0) {
       msForceTmpFileBase( argv[++iArg] );
@@ -212,6 +451,13 @@ int main(int argc, char *argv[])
 #endif
 
 #ifdef USE_FASTCGI
+#ifndef WIN32
+  if( listen_address && msServerRun( listen_address, numworkers ) != MS_SUCCESS ) {
+    msWriteError( stderr );
+    exit( 1 );
+  }
+#endif
+
   msIO_installFastCGIRedirect();
 
 #ifdef WIN32
@@ -221,6 +467,9 @@ int main(int argc, char *argv[])
   /* In FastCGI case we loop accepting multiple requests.  In normal CGI */
   /* use we only accept and process one request.  */
   while( FCGI_Accept() >= 0 ) {
+#ifndef WIN32
+    msServerRequestStart();
+#endif
 #endif /* def USE_FASTCGI */
 
     /* -------------------------------------------------------------------- */
@@ -276,6 +525,9 @@ end_request:
 #ifdef USE_FASTCGI
     /* FCGI_ --- return to top of loop */
     msResetErrorList();
+#ifndef WIN32
+    msServerRequestEnd();
+#endif
     continue;
   } /* end fastcgi loop */
 #endif
@@ -287,6 +539,7 @@ end_request:
             (execendtime.tv_sec+execendtime.tv_usec/1.0e6)-
             (execstarttime.tv_sec+execstarttime.tv_usec/1.0e6) );
   }
+  msCGIFreePreloadedMaps();
   msCleanup(0);
 
 #ifdef _WIN32
@@ -55,6 +55,8 @@
 MS_DLL_EXPORT int msCGIWriteLog(mapservObj *mapserv, int show_error);
 MS_DLL_EXPORT void msCGIWriteError(mapservObj *mapserv);
 MS_DLL_EXPORT mapObj *msCGILoadMap(mapservObj *mapserv);
+MS_DLL_EXPORT int msCGIPreloadMap(char *filename);
+MS_DLL_EXPORT void msCGIFreePreloadedMaps(void);
 int msCGISetMode(mapservObj *mapserv);
 int msCGILoadForm(mapservObj *mapserv);
 int msCGIDispatchBrowseRequest(mapservObj *mapserv);
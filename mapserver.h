@@ -236,6 +236,8 @@ extern "C" {
 #define MS_TEMPLATE_EXPR "\\.(xml|wml|html|htm|svg|kml|gml|js|tmpl)$"
 
 #define MS_INDEX_EXTENSION ".qix"
+#define MS_GENERALIZE_EXTENSION ".gen"
+#define MS_ATTRINDEX_EXTENSION ".aix"
 
 #define MS_QUERY_RESULTS_MAGIC_STRING "MapServer Query Results"
 #define MS_QUERY_PARAMS_MAGIC_STRING "MapServer Query Params"
@@ -328,6 +330,7 @@ extern "C" {
 
 #if defined(WE_HAVE_THE_C99_LRINT) && !defined(USE_GENERIC_MS_NINT)
 #   define MS_NINT(x) lrint(x)
+#   define MS_NINT_IS_LRINT /* the vector kernels of mapprimitive.c round the same way */
   /*#   define MS_NINT(x) lround(x) */
 #elif defined(_MSC_VER) && defined(_WIN32) && !defined(USE_GENERIC_MS_NINT)
   static __inline long int MS_NINT (double flt)
@@ -352,6 +355,7 @@ extern "C" {
   }
 #else
 #  define MS_NINT(x)      MS_NINT_GENERIC(x)
+#  define MS_NINT_IS_GENERIC
 #endif
 
 
@@ -521,6 +525,10 @@ extern "C" {
     MS_TRANSFORM_SIMPLIFY /* keep full resolution */
   };
 
+  /* vector kernels used by the primitive transform, bounds and clipping code, see msSetPrimitiveKernels() */
+  /* (REFERENCE is the scalar code without the clipping shortcuts, to check them against) */
+  enum MS_PRIMITIVE_KERNELS {MS_PRIMITIVE_KERNELS_REFERENCE = -1, MS_PRIMITIVE_KERNELS_SCALAR, MS_PRIMITIVE_KERNELS_SSE2, MS_PRIMITIVE_KERNELS_AVX2};
+
 #ifndef SWIG
   /* Filter object */
   typedef enum {
@@ -813,6 +821,7 @@ extern "C" {
     char *str;
 
     expressionObj *filter; /* by filter */
+    char *nativefilter; /* by filter, optional driver side pre-filter (OGR "WHERE ..." clause) implied by filter */
 
     int slayer; /* selection layer, used for msQueryByFeatures() (note this is not a query mode per se) */
   } queryObj;
@@ -1432,6 +1441,7 @@ extern "C" {
 #endif
 #ifndef SWIG
     int size;
+    int blank; /* set by msDrawMap() when no layer was drawn */
 #endif
 
 #ifndef SWIG
@@ -1577,6 +1587,7 @@ extern "C" {
     /* SDL has converted OracleSpatial, SDE, Graticules */
     void *layerinfo; /* all connection types should use this generic pointer to a vendor specific structure */
     void *wfslayerinfo; /* For WFS layers, will contain a msWFSLayerInfo struct */
+    shapeArenaObj *arena; /* attribute values storage while drawing, see msDrawVectorLayer() */
 #endif /* not SWIG */
 
     /* attribute/classification handling components */
@@ -1647,6 +1658,36 @@ extern "C" {
 #endif    
   } layerObj;
 
+  /* degradation of a map that exceeds its draw budget */
+#define MS_DRAWBUDGET_NONE     0
+#define MS_DRAWBUDGET_SIMPLIFY 1 /* no more labels, simplified geometry */
+#define MS_DRAWBUDGET_STOP     2 /* nothing more is drawn */
+
+  /************************************************************************/
+  /*                             drawBudgetObj                            */
+  /*                                                                      */
+  /*      Limits on the work done by one msDrawMap() call and the         */
+  /*      counters checked against them, see msDrawBudgetCheck().         */
+  /*      Only enabled while msDrawMap() runs, the counters are those     */
+  /*      of the last map drawn.                                          */
+  /************************************************************************/
+  typedef struct {
+#ifdef SWIG
+    %immutable;
+#endif /* SWIG */
+    int enabled;
+    int maxfeatures, maxvertices, maxtime; /* 0 when not limited, maxtime in milliseconds */
+    int abort; /* fail instead of degrading the map */
+    int numfeatures, numvertices; /* drawn so far */
+    int level; /* MS_DRAWBUDGET_NONE, MS_DRAWBUDGET_SIMPLIFY or MS_DRAWBUDGET_STOP */
+#ifdef SWIG
+    %mutable;
+#endif /* SWIG */
+#ifndef SWIG
+    double starttime; /* in seconds */
+#endif /* SWIG */
+  } drawBudgetObj;
+
   /************************************************************************/
   /*                                mapObj                                */
   /*                                                                      */
@@ -1750,6 +1791,7 @@ extern "C" {
     %immutable;
 #endif /* SWIG */
     hashTableObj configoptions;
+    drawBudgetObj drawbudget; /* limits and counters of the last msDrawMap() call */
 #ifdef SWIG
     %mutable;
 #endif /* SWIG */
@@ -1760,6 +1802,9 @@ extern "C" {
     unsigned char encryption_key[MS_ENCRYPTION_KEY_SIZE]; /* 128bits encryption key */
 
     queryObj query;
+
+    int drawmode; /* MS_DRAWMODE_FEATURES and/or MS_DRAWMODE_LABELS, see msDrawMapStrips() */
+    featureListNodeObjPtr *striplabels; /* per layer, features a strip keeps for their labels, see msDrawMapStrips() */
 #endif
   } mapObj;
 
@@ -1794,7 +1839,25 @@ extern "C" {
     char* (*LayerEscapePropertyName)(layerObj *layer, const char* pszString);
     void (*LayerEnablePaging)(layerObj *layer, int value);
     int (*LayerGetPaging)(layerObj *layer);
+    int (*LayerNextShapes)(layerObj *layer, shapeObj *shapes, int maxshapes, int *numshapes);
   };
+
+  /************************************************************************/
+  /*                             shapeBatchObj                            */
+  /*                                                                      */
+  /*      reusable storage to read the shapes of a layer by batches       */
+  /*      (see msLayerNextShapeFromBatch() in maplayer.c)                 */
+  /************************************************************************/
+  typedef struct {
+    shapeObj *shapes;
+    int maxshapes;
+    int numshapes; /* number of shapes read by the last batch */
+    int current; /* next shape to hand out */
+    int status; /* return code of the last batch */
+    shapeArenaObj *arena; /* arena of the layer the shapes were read from */
+  } shapeBatchObj;
+
+#define MS_SHAPE_BATCH_SIZE 64
 #endif /*SWIG*/
 
   /* Function prototypes, wrapable */
@@ -1938,6 +2001,12 @@ extern "C" {
   MS_DLL_EXPORT char *msWriteLegendToString(legendObj *legend);
   MS_DLL_EXPORT char *msWriteClusterToString(clusterObj *cluster);
   MS_DLL_EXPORT int msEvalRegex(char *e, char *s);
+
+  /* in mapregex.c */
+  MS_DLL_EXPORT ms_regex_t *msRegexCacheAcquire(const char *pattern, int cflags);
+  MS_DLL_EXPORT void msRegexCacheRelease(ms_regex_t *regex);
+  MS_DLL_EXPORT void msRegexCacheCleanup(void);
+
 #ifdef USE_MSFREE
   MS_DLL_EXPORT void msFree(void *p);
 #else
@@ -1953,6 +2022,8 @@ extern "C" {
   MS_DLL_EXPORT void msOGRCleanup(void);
   MS_DLL_EXPORT void msGDALCleanup(void);
   MS_DLL_EXPORT void msGDALInitialize(void);
+  MS_DLL_EXPORT void *msGDALOpenPooled(const char *path);
+  MS_DLL_EXPORT void msGDALClosePooled(mapObj *map, void *hDS, const char *path, int keep);
 
   MS_DLL_EXPORT imageObj *msDrawScalebar(mapObj *map); /* in mapscale.c */
   MS_DLL_EXPORT int msCalculateScale(rectObj extent, int units, int width, int height, double resolution, double *scaledenom);
@@ -2043,6 +2114,16 @@ extern "C" {
   MS_DLL_EXPORT void msDecodeHTMLEntities(const char *string);
   MS_DLL_EXPORT int msIsXMLTagValid(const char *string);
   MS_DLL_EXPORT char *msStringConcatenate(char *pszDest, const char *pszSrc);
+
+  /* growable string buffer (mapstring.c), use it instead of msStringConcatenate() in loops */
+  typedef struct msStringBuffer msStringBuffer;
+  MS_DLL_EXPORT msStringBuffer *msStringBufferAlloc(void);
+  MS_DLL_EXPORT void msStringBufferFree(msStringBuffer *sb);
+  MS_DLL_EXPORT const char *msStringBufferGetString(msStringBuffer *sb);
+  MS_DLL_EXPORT size_t msStringBufferGetLength(msStringBuffer *sb);
+  MS_DLL_EXPORT char *msStringBufferReleaseStringAndFree(msStringBuffer *sb);
+  MS_DLL_EXPORT int msStringBufferAppend(msStringBuffer *sb, const char *pszAppendedString);
+
   MS_DLL_EXPORT char *msJoinStrings(char **array, int arrayLength, const char *delimeter);
   MS_DLL_EXPORT char *msHashString(const char *pszStr);
   MS_DLL_EXPORT char *msCommifyString(char *str);
@@ -2137,6 +2218,12 @@ extern "C" {
   MS_DLL_EXPORT labelCacheMemberObj *msGetLabelCacheMember(labelCacheObj *labelcache, int i);
 
   MS_DLL_EXPORT void msFreeShape(shapeObj *shape); /* in mapprimitive.c */
+  MS_DLL_EXPORT shapeArenaObj *msCreateShapeArena(void);
+  MS_DLL_EXPORT void msFreeShapeArena(shapeArenaObj *arena);
+  MS_DLL_EXPORT void msResetShapeArena(shapeArenaObj *arena);
+  MS_DLL_EXPORT void *msShapeArenaAlloc(shapeArenaObj *arena, size_t size);
+  MS_DLL_EXPORT char *msShapeArenaStrdup(shapeArenaObj *arena, const char *string);
+  MS_DLL_EXPORT void msShapeArenaFreeShape(shapeArenaObj *arena, shapeObj *shape);
   MS_DLL_EXPORT void msFreeLabelPathObj(labelPathObj *path);
   MS_DLL_EXPORT shapeObj *msShapeFromWKT(const char *string);
   MS_DLL_EXPORT char *msShapeToWKT(shapeObj *shape);
@@ -2161,6 +2248,8 @@ extern "C" {
   MS_DLL_EXPORT void msTransformShapeToPixelDoublePrecision(shapeObj *shape, rectObj extent, double cellsize);
 
   MS_DLL_EXPORT void msTransformPixelToShape(shapeObj *shape, rectObj extent, double cellsize);
+  MS_DLL_EXPORT int msGetPrimitiveKernels(void);
+  MS_DLL_EXPORT int msSetPrimitiveKernels(int kernels);
   MS_DLL_EXPORT void msPolylineComputeLineSegments(shapeObj *shape, double ***segment_lengths, double **line_lengths, int *max_line_index, double *max_line_length, int *segment_index, double *total_length);
   MS_DLL_EXPORT pointObj** msPolylineLabelPoint(shapeObj *p, int min_length, int repeat_distance, double ***angles, double ***lengths, int *numpoints, int center_on_longest_segment);
   MS_DLL_EXPORT pointObj** msPolylineLabelPointExtended(shapeObj *p, int min_length, int repeat_distance, double ***angles, double ***lengths, int *numpoints, int *regularLines, int numlines, int center_on_longest_segment);
@@ -2212,10 +2301,16 @@ extern "C" {
   MS_DLL_EXPORT int msLayerGetItemIndex(layerObj *layer, char *item);
   MS_DLL_EXPORT int msLayerWhichItems(layerObj *layer, int get_all, char *metadata);
   MS_DLL_EXPORT int msLayerNextShape(layerObj *layer, shapeObj *shape);
+  MS_DLL_EXPORT int msLayerNextShapes(layerObj *layer, shapeObj *shapes, int maxshapes, int *numshapes);
+  MS_DLL_EXPORT void msInitShapeBatch(layerObj *layer, shapeBatchObj *batch);
+  MS_DLL_EXPORT void msFreeShapeBatch(shapeBatchObj *batch);
+  MS_DLL_EXPORT int msLayerNextShapeFromBatch(layerObj *layer, shapeBatchObj *batch, shapeObj *shape);
+  MS_DLL_EXPORT int LayerDefaultNextShapes(layerObj *layer, shapeObj *shapes, int maxshapes, int *numshapes);
   MS_DLL_EXPORT int msLayerGetItems(layerObj *layer);
   MS_DLL_EXPORT int msLayerSetItems(layerObj *layer, char **items, int numitems);
   MS_DLL_EXPORT int msLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record);
   MS_DLL_EXPORT int msLayerGetExtent(layerObj *layer, rectObj *extent);
+  MS_DLL_EXPORT int msLayerGetStoredExtent(mapObj *map, layerObj *layer, rectObj *extent);
   MS_DLL_EXPORT int msLayerSetExtent( layerObj *layer, double minx, double miny, double maxx, double maxy);
   MS_DLL_EXPORT int msLayerGetAutoStyle(mapObj *map, layerObj *layer, classObj *c, shapeObj* shape);
   MS_DLL_EXPORT int msLayerGetFeatureStyle(mapObj *map, layerObj *layer, classObj *c, shapeObj* shape);
@@ -2392,6 +2487,7 @@ extern "C" {
 
   /*in mapraster.c */
   MS_DLL_EXPORT int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image, rasterBufferObj *rb );
+  MS_DLL_EXPORT void msRasterTileCatalogCleanup(void);
 #ifdef USE_GD
   MS_DLL_EXPORT int msAddColorGD(mapObj *map, gdImagePtr img, int cmt, int r, int g, int b);
 #endif
@@ -2541,6 +2637,7 @@ extern "C" {
   /* ==================================================================== */
   MS_DLL_EXPORT int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename );
   MS_DLL_EXPORT int msInitDefaultGDALOutputFormat( outputFormatObj *format );
+  MS_DLL_EXPORT void msGDALSetOutputMetadata( mapObj *map, outputFormatObj *format, int nBands, double resolution, void *hDSVoid );
 
   /* ==================================================================== */
   /*      prototypes for functions in mapogroutput.c                      */
@@ -2555,6 +2652,7 @@ extern "C" {
   int MS_DLL_EXPORT msOGRLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery);
   int MS_DLL_EXPORT msOGRLayerOpen(layerObj *layer, const char *pszOverrideConnection); /* in mapogr.cpp */
   int MS_DLL_EXPORT msOGRLayerClose(layerObj *layer);
+  MS_DLL_EXPORT const char *msOGRLayerGetItemType(layerObj *layer, const char *item);
 
   char MS_DLL_EXPORT *msOGRShapeToWKT(shapeObj *shape);
   shapeObj MS_DLL_EXPORT *msOGRShapeFromWKT(const char *string);
@@ -2813,6 +2911,8 @@ extern "C" {
   int msClassifyRasterBuffer(rasterBufferObj *rb, rasterBufferObj *qrb);
   int msSaveRasterBuffer(mapObj *map, rasterBufferObj *data, FILE *stream, outputFormatObj *format);
   int msSaveRasterBufferToBuffer(rasterBufferObj *data, bufferObj *buffer, outputFormatObj *format);
+  int msSaveBlankRasterBuffer(mapObj *map, rasterBufferObj *data, FILE *stream, outputFormatObj *format);
+  void msBlankImageCacheCleanup(void);
   int msLoadMSRasterBufferFromFile(char *path, rasterBufferObj *rb);
 #ifdef USE_GD
   int msLoadGDRasterBufferFromFile(char *path, rasterBufferObj *rb);
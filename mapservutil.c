@@ -31,6 +31,9 @@
 #include "mapserver.h"
 #include "mapserv.h"
 #include "maptime.h"
+#include "mapcopy.h"
+
+#include <sys/stat.h>
 
 /*
 ** Enumerated types, keep the query modes in sequence and at the end of the enumeration (mode enumeration is in maptemplate.h).
@@ -181,6 +184,89 @@ static void setClassGroup(layerObj *layer, char *classgroup)
   }
 }
 
+/*
+** Mapfiles preloaded once by a long running mapserv (see the -preload switch),
+** requests for one of them get a copy of the parsed map instead of parsing it
+** again. A mapfile modified since it was loaded is parsed again.
+*/
+typedef struct {
+  char *filename;
+  time_t mtime;
+  mapObj *map;
+} preloadedMapObj;
+
+static preloadedMapObj *preloadedMaps = NULL;
+static int numPreloadedMaps = 0;
+
+static time_t msCGIMapfileTime(const char *filename)
+{
+  struct stat stat_buf;
+
+  if(stat(filename, &stat_buf) != 0)
+    return 0;
+  return stat_buf.st_mtime;
+}
+
+int msCGIPreloadMap(char *filename)
+{
+  mapObj *map;
+
+  map = msLoadMap(filename, NULL);
+  if(!map) return MS_FAILURE;
+
+  preloadedMaps = (preloadedMapObj *) msSmallRealloc(preloadedMaps, sizeof(preloadedMapObj) * (numPreloadedMaps+1));
+  preloadedMaps[numPreloadedMaps].filename = msStrdup(filename);
+  preloadedMaps[numPreloadedMaps].mtime = msCGIMapfileTime(filename);
+  preloadedMaps[numPreloadedMaps].map = map;
+  numPreloadedMaps++;
+
+  return MS_SUCCESS;
+}
+
+void msCGIFreePreloadedMaps()
+{
+  int i;
+
+  for(i=0; i<numPreloadedMaps; i++) {
+    msFree(preloadedMaps[i].filename);
+    msFreeMap(preloadedMaps[i].map);
+  }
+  msFree(preloadedMaps);
+  preloadedMaps = NULL;
+  numPreloadedMaps = 0;
+}
+
+static mapObj *msCGILoadMapFile(char *filename)
+{
+  mapObj *map;
+  time_t mtime;
+  int i;
+
+  for(i=0; i<numPreloadedMaps; i++) {
+    if(strcmp(preloadedMaps[i].filename, filename) == 0) break;
+  }
+  if(i == numPreloadedMaps)
+    return msLoadMap(filename, NULL);
+
+  mtime = msCGIMapfileTime(filename);
+  if(mtime != preloadedMaps[i].mtime) { /* edited since, parse it again */
+    map = msLoadMap(filename, NULL);
+    if(!map) return NULL;
+    msFreeMap(preloadedMaps[i].map);
+    preloadedMaps[i].map = map;
+    preloadedMaps[i].mtime = mtime;
+  }
+
+  map = msNewMapObj();
+  if(!map) return NULL;
+  if(msCopyMap(map, preloadedMaps[i].map) != MS_SUCCESS) {
+    msFreeMap(map);
+    return NULL;
+  }
+
+  return map;
+}
+
 /*
 ** Extract Map File name from params and load it.
 ** Returns map object or NULL on error.
@@ -196,14 +282,14 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
   if(i == mapserv->request->NumParams) {
     char *ms_mapfile = getenv("MS_MAPFILE");
     if(ms_mapfile) {
-      map = msLoadMap(ms_mapfile,NULL);
+      map = msCGILoadMapFile(ms_mapfile);
     } else {
       msSetError(MS_WEBERR, "CGI variable \"map\" is not set.", "msCGILoadMap()"); /* no default, outta here */
       return NULL;
     }
   } else {
     if(getenv(mapserv->request->ParamValues[i])) /* an environment variable references the actual file to use */
-      map = msLoadMap(getenv(mapserv->request->ParamValues[i]), NULL);
+      map = msCGILoadMapFile(getenv(mapserv->request->ParamValues[i]));
     else {
       /* by here we know the request isn't for something in an environment variable */
       if(getenv("MS_MAP_NO_PATH")) {
@@ -217,7 +303,7 @@ mapObj *msCGILoadMap(mapservObj *mapserv)
       }
 
       /* ok to try to load now */
-      map = msLoadMap(mapserv->request->ParamValues[i], NULL);
+      map = msCGILoadMapFile(mapserv->request->ParamValues[i]);
     }
   }
   
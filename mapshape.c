@@ -36,6 +36,8 @@
 
 #include <limits.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "mapserver.h"
 
 
@@ -229,6 +231,9 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
   psSHP->panParts = NULL;
   psSHP->nBufSize = psSHP->nPartMax = 0;
 
+  psSHP->pabyReadAhead = NULL;
+  psSHP->nReadAheadBufSize = psSHP->nReadAheadOffset = psSHP->nReadAheadSize = 0;
+
   /* -------------------------------------------------------------------- */
   /*  Compute the base (layer) name.  If there is any extension     */
   /*  on the passed in filename we will strip it off.         */
@@ -373,6 +378,60 @@ SHPHandle msSHPOpen( const char * pszLayer, const char * pszAccess )
   return( psSHP );
 }
 
+/************************************************************************/
+/*                         msSHPReadFileBounds()                        */
+/*                                                                      */
+/*  Read the bounds of a shapefile from the .shp header alone, without  */
+/*  opening the .shx and .dbf files or allocating a handle.             */
+/************************************************************************/
+int msSHPReadFileBounds( const char * pszLayer, rectObj *padBounds )
+{
+  char *pszFullname;
+  FILE *fp;
+  uchar abyBuf[100];
+  double adValue[4];
+  int i, nRead, bSwap;
+
+  if( pszLayer == NULL )
+    return MS_FAILURE;
+
+  pszFullname = (char *) msSmallMalloc(strlen(pszLayer) + 5);
+  strcpy( pszFullname, pszLayer );
+  for( i = strlen(pszFullname)-1;
+       i > 0 && pszFullname[i] != '.' && pszFullname[i] != '/' && pszFullname[i] != '\\';
+       i-- ) {}
+
+  if( pszFullname[i] == '.' )
+    pszFullname[i] = '\0';
+  strcat( pszFullname, ".shp" );
+
+  fp = fopen( pszFullname, "rb" );
+  free( pszFullname );
+  if( fp == NULL )
+    return MS_FAILURE;
+
+  nRead = fread( abyBuf, 100, 1, fp );
+  fclose( fp );
+
+  if( nRead != 1 || abyBuf[0] != 0 || abyBuf[1] != 0 || abyBuf[2] != 0x27  || (abyBuf[3] != 0x0a && abyBuf[3] != 0x0d) )
+    return MS_FAILURE;
+
+  /* the header bounds are little endian */
+  i = 1;
+  bSwap = ( *((uchar *) &i) != 1 );
+  for( i = 0; i < 4; i++ ) {
+    if( bSwap ) SwapWord( 8, abyBuf+36+i*8 );
+    memcpy( &(adValue[i]), abyBuf+36+i*8, 8 );
+  }
+
+  padBounds->minx = adValue[0];
+  padBounds->miny = adValue[1];
+  padBounds->maxx = adValue[2];
+  padBounds->maxy = adValue[3];
+
+  return MS_SUCCESS;
+}
+
 /************************************************************************/
 /*                              msSHPClose()                            */
 /*                        */
@@ -396,6 +455,7 @@ void msSHPClose(SHPHandle psSHP )
 
   if(psSHP->pabyRec) free(psSHP->pabyRec);
   if(psSHP->panParts) free(psSHP->panParts);
+  if(psSHP->pabyReadAhead) free(psSHP->pabyReadAhead);
 
   fclose( psSHP->fpSHX );
   fclose( psSHP->fpSHP );
@@ -585,6 +645,7 @@ int msSHPWritePoint(SHPHandle psSHP, pointObj *point )
   if( psSHP->nShapeType != SHP_POINT) return(-1);
 
   psSHP->bUpdated = MS_TRUE;
+  psSHP->nReadAheadSize = 0;
 
   /* Fill the SHX buffer if it is not already full. */
   if( ! psSHP->panRecAllLoaded ) msSHXLoadAll( psSHP );
@@ -679,6 +740,7 @@ int msSHPWriteShape(SHPHandle psSHP, shapeObj *shape )
   double dfMMin, dfMMax = 0;
 #endif
   psSHP->bUpdated = MS_TRUE;
+  psSHP->nReadAheadSize = 0;
 
   /* Fill the SHX buffer if it is not already full. */
   if( ! psSHP->panRecAllLoaded ) msSHXLoadAll( psSHP );
@@ -945,7 +1007,7 @@ int msSHPWriteShape(SHPHandle psSHP, shapeObj *shape )
   /* -------------------------------------------------------------------- */
   /*  Expand file wide bounds based on this shape.        */
   /* -------------------------------------------------------------------- */
-  if( psSHP->nRecords == 1 ) {
+  if( psSHP->nRecords == 1 && shape->numlines > 0 && shape->line[0].numpoints > 0 ) {
     psSHP->adBoundsMin[0] = psSHP->adBoundsMax[0] = shape->line[0].point[0].x;
     psSHP->adBoundsMin[1] = psSHP->adBoundsMax[1] = shape->line[0].point[0].y;
 #ifdef USE_POINT_Z_M
@@ -1177,6 +1239,53 @@ int msSHXReadSize( SHPHandle psSHP, int hEntity )
 
 }
 
+/*
+** msSHPReadAhead() - Reads the records of several shapes with a single read, msSHPReadShape()
+** then takes them from memory instead of seeking to and reading each record. The list is
+** trimmed from its end so the span read does not exceed SHP_READAHEAD_MAX bytes. Returns the
+** number of entities read ahead, 0 if the records are to be read one at a time.
+*/
+int msSHPReadAhead( SHPHandle psSHP, int *panEntities, int nEntities )
+{
+  int i, nStart=0, nEnd=0, nRecordOffset, nRecordEnd;
+
+  psSHP->nReadAheadSize = 0;
+
+  for( i = 0; i < nEntities; i++ ) {
+    if( panEntities[i] < 0 || panEntities[i] >= psSHP->nRecords )
+      break;
+
+    nRecordOffset = msSHXReadOffset(psSHP, panEntities[i]);
+    nRecordEnd = nRecordOffset + msSHXReadSize(psSHP, panEntities[i]) + 8;
+
+    if( i > 0 && (MS_MAX(nEnd, nRecordEnd) - MS_MIN(nStart, nRecordOffset)) > SHP_READAHEAD_MAX )
+      break;
+
+    nStart = (i == 0) ? nRecordOffset : MS_MIN(nStart, nRecordOffset);
+    nEnd = (i == 0) ? nRecordEnd : MS_MAX(nEnd, nRecordEnd);
+  }
+
+  if( i < 2 || nEnd <= nStart ) /* nothing to gain */
+    return(0);
+
+  if( nEnd - nStart > psSHP->nReadAheadBufSize ) {
+    uchar *pabyBuf = (uchar *) realloc(psSHP->pabyReadAhead, nEnd - nStart);
+    if( pabyBuf == NULL )
+      return(0);
+    psSHP->pabyReadAhead = pabyBuf;
+    psSHP->nReadAheadBufSize = nEnd - nStart;
+  }
+
+  if( fseek( psSHP->fpSHP, nStart, 0 ) != 0 ||
+      fread( psSHP->pabyReadAhead, nEnd - nStart, 1, psSHP->fpSHP ) != 1 )
+    return(0);
+
+  psSHP->nReadAheadOffset = nStart;
+  psSHP->nReadAheadSize = nEnd - nStart;
+
+  return(i);
+}
+
 /*
 ** msSHPReadShape() - Reads the vertices for one shape from a shape file.
 */
@@ -1186,7 +1295,7 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
 #ifdef USE_POINT_Z_M
   int nOffset = 0;
 #endif
-  int nEntitySize, nRequiredSize;
+  int nEntitySize, nRequiredSize, nRecordOffset;
 
   msInitShape(shape); /* initialize the shape */
 
@@ -1210,8 +1319,14 @@ void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape )
   /* -------------------------------------------------------------------- */
   /*      Read the record.                                                */
   /* -------------------------------------------------------------------- */
-  fseek( psSHP->fpSHP, msSHXReadOffset(psSHP, hEntity), 0 );
-  fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP );
+  nRecordOffset = msSHXReadOffset(psSHP, hEntity);
+  if( psSHP->nReadAheadSize > 0 && nRecordOffset >= psSHP->nReadAheadOffset &&
+      nRecordOffset + nEntitySize <= psSHP->nReadAheadOffset + psSHP->nReadAheadSize ) {
+    memcpy( psSHP->pabyRec, psSHP->pabyReadAhead + nRecordOffset - psSHP->nReadAheadOffset, nEntitySize );
+  } else {
+    fseek( psSHP->fpSHP, nRecordOffset, 0 );
+    fread( psSHP->pabyRec, nEntitySize, 1, psSHP->fpSHP );
+  }
 
   /* -------------------------------------------------------------------- */
   /*  Extract vertices for a Polygon or Arc.            */
@@ -1631,6 +1746,9 @@ int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_f
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_FALSE;
+  shpfile->hSHPGen = NULL;
+  shpfile->genlevel = 0;
+  shpfile->numgenlevels = -1;
 
   /* open the shapefile file (appending ok) and get basic info */
   if(!mode)
@@ -1707,6 +1825,9 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_TRUE;
+  shpfile->hSHPGen = NULL;
+  shpfile->genlevel = 0;
+  shpfile->numgenlevels = -1;
 
   shpfile->hDBF = NULL; /* XBase file is NOT created here... */
   return(0);
@@ -1716,12 +1837,132 @@ void msShapefileClose(shapefileObj *shpfile)
 {
   if (shpfile && shpfile->isopen == MS_TRUE) { /* Silently return if called with NULL shpfile by freeLayer() */
     if(shpfile->hSHP) msSHPClose(shpfile->hSHP);
+    if(shpfile->hSHPGen) msSHPClose(shpfile->hSHPGen);
     if(shpfile->hDBF) msDBFClose(shpfile->hDBF);
     if(shpfile->status) free(shpfile->status);
     shpfile->isopen = MS_FALSE;
   }
 }
 
+/*
+** Generalized geometry written by shpgen: <base>.gen lists the tolerance of each
+** level, and level n is stored in <base>.gen<n>.shp/.shx with the same records as the
+** original shapefile, so the spatial index and the attributes of the original apply.
+** Level 0 returns the name of the .gen file.
+*/
+char *msShapefileGetGenFilename(char *pszReturnPath, const char *pszShapefile, int level)
+{
+  int i;
+
+  strlcpy(pszReturnPath, pszShapefile, MS_MAXPATHLEN);
+
+  /* clean off any extention the filename might have, like msSHPOpen() does */
+  for (i = strlen(pszReturnPath) - 1;
+       i > 0 && pszReturnPath[i] != '.' && pszReturnPath[i] != '/' && pszReturnPath[i] != '\\';
+       i-- ) {}
+
+  if( pszReturnPath[i] == '.' )
+    pszReturnPath[i] = '\0';
+
+  strlcat(pszReturnPath, MS_GENERALIZE_EXTENSION, MS_MAXPATHLEN);
+  if(level > 0) {
+    char szLevel[32];
+    snprintf(szLevel, sizeof(szLevel), "%d.shp", level);
+    strlcat(pszReturnPath, szLevel, MS_MAXPATHLEN);
+  }
+
+  return pszReturnPath;
+}
+
+/* read the level tolerances from the .gen file, if any */
+static void msShapefileLoadGenLevels(shapefileObj *shpfile, int debug)
+{
+  char szPath[MS_MAXPATHLEN], szLine[256];
+  FILE *fp;
+  int level;
+  double tolerance;
+
+  shpfile->numgenlevels = 0;
+
+  if((fp = fopen(msShapefileGetGenFilename(szPath, shpfile->source, 0), "r")) == NULL)
+    return;
+
+  while(fgets(szLine, sizeof(szLine), fp) != NULL) {
+    if(szLine[0] == '#')
+      continue;
+    if(sscanf(szLine, "%d %lf", &level, &tolerance) != 2 ||
+        level != shpfile->numgenlevels + 1 || level > MS_SHP_MAXGENLEVELS || tolerance <= 0) {
+      if(debug)
+        msDebug("msShapefileLoadGenLevels(): ignoring invalid line in %s: %s", szPath, szLine);
+      break;
+    }
+    shpfile->gentolerance[shpfile->numgenlevels++] = tolerance;
+  }
+
+  fclose(fp);
+
+  if(debug >= MS_DEBUGLEVEL_V && shpfile->numgenlevels > 0)
+    msDebug("msShapefileLoadGenLevels(): %d generalized levels found for %s.\n", shpfile->numgenlevels, shpfile->source);
+}
+
+/*
+** Select the coarsest generalized level whose tolerance does not exceed the cellsize (a
+** cellsize of 0 restores the full resolution geometry). Subsequent shapes read by
+** msSHPLayerNextShape come from that level.
+*/
+int msShapefileSetGenLevel(shapefileObj *shpfile, double cellsize, int debug)
+{
+  int level = 0, numrecords, type;
+  char szPath[MS_MAXPATHLEN];
+
+  if(shpfile->numgenlevels < 0)
+    msShapefileLoadGenLevels(shpfile, debug);
+
+  if(cellsize > 0) {
+    for(level = shpfile->numgenlevels; level > 0; level--) {
+      if(shpfile->gentolerance[level - 1] <= cellsize)
+        break;
+    }
+  }
+
+  if(level == shpfile->genlevel)
+    return MS_SUCCESS;
+
+  if(shpfile->hSHPGen) {
+    msSHPClose(shpfile->hSHPGen);
+    shpfile->hSHPGen = NULL;
+  }
+  shpfile->genlevel = 0;
+
+  if(level == 0)
+    return MS_SUCCESS;
+
+  shpfile->hSHPGen = msSHPOpen(msShapefileGetGenFilename(szPath, shpfile->source, level), "rb");
+  if(!shpfile->hSHPGen) {
+    if(debug)
+      msDebug("msShapefileSetGenLevel(): unable to open %s, using the full resolution geometry.\n", szPath);
+    shpfile->numgenlevels = level - 1; /* don't try the missing levels again */
+    return MS_SUCCESS;
+  }
+
+  /* the records must match the original shapefile one to one */
+  msSHPGetInfo(shpfile->hSHPGen, &numrecords, &type);
+  if(numrecords != shpfile->numshapes) {
+    if(debug)
+      msDebug("msShapefileSetGenLevel(): %s doesn't match %s, using the full resolution geometry.\n", szPath, shpfile->source);
+    msSHPClose(shpfile->hSHPGen);
+    shpfile->hSHPGen = NULL;
+    shpfile->numgenlevels = 0;
+    return MS_SUCCESS;
+  }
+
+  if(debug >= MS_DEBUGLEVEL_VV)
+    msDebug("msShapefileSetGenLevel(): reading %s (tolerance %g, cellsize %g).\n", szPath, shpfile->gentolerance[level - 1], cellsize);
+
+  shpfile->genlevel = level;
+  return MS_SUCCESS;
+}
+
 /* status array lives in the shpfile, can return MS_SUCCESS/MS_FAILURE/MS_DONE */
 int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
 {
@@ -2512,10 +2753,134 @@ int msSHPLayerIsOpen(layerObj *layer)
     return MS_FALSE;
 }
 
+/*
+** Narrows the candidate shapes with the attribute index (.aix) of a field compared to
+** a literal by the layer filter. Numeric fields handle =, <, <=, > and >=, character
+** fields handle = only.
+*/
+static void msSHPLayerApplyAttrIndex(layerObj *layer, shapefileObj *shpfile, char *item, int comparison,
+                                     double dfValue, const char *pszValue)
+{
+  char szField[12], szPath[MS_MAXPATHLEN];
+  double dfMin = -HUGE_VAL, dfMax = HUGE_VAL;
+  int iField, bMinIncluded = MS_TRUE, bMaxIncluded = MS_TRUE;
+  DBFFieldType type = FTInvalid;
+  struct stat sIndexStat, sDBFStat;
+
+  if(!shpfile->hDBF)
+    return;
+
+  /* like msDBFGetItemIndex() but without raising an error for unknown items */
+  for(iField=0; iField<msDBFGetFieldCount(shpfile->hDBF); iField++) {
+    type = msDBFGetFieldInfo(shpfile->hDBF, iField, szField, NULL, NULL);
+    if(strcasecmp(item, szField) == 0)
+      break;
+  }
+  if(iField == msDBFGetFieldCount(shpfile->hDBF))
+    return;
+
+  msShapefileGetAttrIndexFilename(szPath, shpfile->source, szField);
+
+  /* the DBF file was modified after the index was built, the record count check
+     of the index does not catch updated values */
+  if(stat(szPath, &sIndexStat) != 0)
+    return;
+  if(fstat(fileno(shpfile->hDBF->fp), &sDBFStat) == 0 && sIndexStat.st_mtime < sDBFStat.st_mtime) {
+    if(layer->debug)
+      msDebug("msSHPLayerApplyAttrIndex(): %s is older than the DBF file, ignoring it.\n", szPath);
+    return;
+  }
+
+  if(pszValue) {
+    if(type == FTString && comparison == MS_TOKEN_COMPARISON_EQ)
+      msSearchAttrIndexString(szPath, shpfile->numshapes, pszValue, shpfile->status, layer->debug);
+    return;
+  }
+
+  if(type != FTInteger && type != FTDouble)
+    return;
+
+  switch(comparison) {
+    case MS_TOKEN_COMPARISON_EQ:
+      dfMin = dfMax = dfValue;
+      break;
+    case MS_TOKEN_COMPARISON_GT:
+      bMinIncluded = MS_FALSE; /* fall through */
+    case MS_TOKEN_COMPARISON_GE:
+      dfMin = dfValue;
+      break;
+    case MS_TOKEN_COMPARISON_LT:
+      bMaxIncluded = MS_FALSE; /* fall through */
+    case MS_TOKEN_COMPARISON_LE:
+      dfMax = dfValue;
+      break;
+    default:
+      return;
+  }
+  msSearchAttrIndexRange(szPath, shpfile->numshapes, dfMin, bMinIncluded, dfMax, bMaxIncluded, shpfile->status, layer->debug);
+}
+
+/*
+** Uses the attribute indexes for the comparisons of the layer filter. The filter must be
+** a FILTERITEM string match or an expression made of "<binding> <comparison> <literal>"
+** terms joined by AND, anything else could accept shapes the terms reject. The filter is
+** still evaluated on every shape read, so an index is only a shortcut.
+*/
+static void msSHPLayerApplyAttrIndexes(layerObj *layer, shapefileObj *shpfile)
+{
+  tokenListNodeObjPtr node, binding, literal;
+  int comparison;
+
+  if(!layer->filter.string || !shpfile->status)
+    return;
+
+  if(layer->filter.type == MS_STRING) {
+    if(layer->filteritem && !(layer->filter.flags & MS_EXP_INSENSITIVE))
+      msSHPLayerApplyAttrIndex(layer, shpfile, layer->filteritem, MS_TOKEN_COMPARISON_EQ, 0, layer->filter.string);
+    return;
+  }
+
+  if(layer->filter.type != MS_EXPRESSION || !layer->filter.tokens)
+    return;
+
+  for(node = layer->filter.tokens; node; node = node->next) {
+    if(node->token == '(' || node->token == ')' || node->token == MS_TOKEN_LOGICAL_AND)
+      continue;
+    if(!node->next || !node->next->next ||
+        node->next->token < MS_TOKEN_COMPARISON_EQ || node->next->token > MS_TOKEN_COMPARISON_IEQ)
+      return;
+    node = node->next->next;
+  }
+
+  for(node = layer->filter.tokens; node; node = node->next) {
+    if(node->token == '(' || node->token == ')' || node->token == MS_TOKEN_LOGICAL_AND)
+      continue;
+
+    comparison = node->next->token;
+    binding = node;
+    literal = node->next->next;
+    if(literal->token == MS_TOKEN_BINDING_DOUBLE || literal->token == MS_TOKEN_BINDING_STRING) {
+      binding = literal; /* <literal> <comparison> <binding> */
+      literal = node;
+      if(comparison == MS_TOKEN_COMPARISON_GT) comparison = MS_TOKEN_COMPARISON_LT;
+      else if(comparison == MS_TOKEN_COMPARISON_LT) comparison = MS_TOKEN_COMPARISON_GT;
+      else if(comparison == MS_TOKEN_COMPARISON_GE) comparison = MS_TOKEN_COMPARISON_LE;
+      else if(comparison == MS_TOKEN_COMPARISON_LE) comparison = MS_TOKEN_COMPARISON_GE;
+    }
+    node = node->next->next;
+
+    if(binding->token == MS_TOKEN_BINDING_DOUBLE && literal->token == MS_TOKEN_LITERAL_NUMBER)
+      msSHPLayerApplyAttrIndex(layer, shpfile, binding->tokenval.bindval.item, comparison, literal->tokenval.dblval, NULL);
+    else if(binding->token == MS_TOKEN_BINDING_STRING && literal->token == MS_TOKEN_LITERAL_STRING)
+      msSHPLayerApplyAttrIndex(layer, shpfile, binding->tokenval.bindval.item, comparison, 0, literal->tokenval.strval);
+  }
+}
+
 int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 {
   int status;
   shapefileObj *shpfile;
+  const char *value;
 
   shpfile = layer->layerinfo;
 
@@ -2529,33 +2894,78 @@ int msSHPLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return status;
   }
 
-  return MS_SUCCESS;
+  msSHPLayerApplyAttrIndexes(layer, shpfile);
+
+  /* pick the generalized geometry matching the drawing resolution, queries and layers */
+  /* opened without a map use the full geometry */
+  value = msLayerGetProcessingKey(layer, "GENERALIZE");
+  if(!isQuery && layer->map && layer->map->width > 0 && !(value && (EQUAL(value, "OFF") || EQUAL(value, "FALSE")))) {
+    double cellsize = layer->map->cellsize;
+#ifdef USE_PROJ
+    if(layer->project && msProjectionsDiffer(&(layer->projection), &(layer->map->projection)))
+      cellsize = MS_MIN(MS_CELLSIZE(rect.minx, rect.maxx, layer->map->width),
+                        MS_CELLSIZE(rect.miny, rect.maxy, layer->map->height));
+#endif
+    /* a map over its draw budget simplifies shapes to two pixels, see */
+    /* msDrawVectorLayer(), coarser levels can be read as well */
+    if(layer->map->drawbudget.enabled && layer->map->drawbudget.level >= MS_DRAWBUDGET_SIMPLIFY)
+      cellsize *= 2;
+    return msShapefileSetGenLevel(shpfile, cellsize, layer->debug);
+  }
+
+  return msShapefileSetGenLevel(shpfile, 0, layer->debug);
 }
 
-int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
+/*
+** Reads the next candidate shapes, registered as vtable->LayerNextShapes. The records of the
+** candidates of a batch are read from the .shp file in one pass (see msSHPReadAhead()). Stops
+** at the end of the candidates, returning MS_DONE with the shapes read so far.
+*/
+static int msSHPLayerNextShapes(layerObj *layer, shapeObj *shapes, int maxshapes, int *numshapes)
 {
-  int i, filter_passed=MS_FALSE;
+  int i, n, filter_passed;
+  int candidates[MS_SHAPE_BATCH_SIZE], lastcandidate = -1;
   shapefileObj *shpfile;
+  SHPHandle hSHP;
+  shapeObj *shape;
 
   shpfile = layer->layerinfo;
 
   if(!shpfile) {
-    msSetError(MS_SHPERR, "Shapefile layer has not been opened.", "msSHPLayerNextShape()");
+    msSetError(MS_SHPERR, "Shapefile layer has not been opened.", "msSHPLayerNextShapes()");
     return MS_FAILURE;
   }
 
-  do {
+  hSHP = shpfile->hSHPGen ? shpfile->hSHPGen : shpfile->hSHP;
+
+  while(*numshapes < maxshapes) {
     i = msGetNextBit(shpfile->status, shpfile->lastshape + 1, shpfile->numshapes);
     shpfile->lastshape = i;
     if(i == -1) return(MS_DONE); /* nothing else to read */
 
-    msSHPReadShape(shpfile->hSHP, i, shape);
-    if(shape->type == MS_SHAPE_NULL) {
+    /* read the records of this and the following candidates at once */
+    if(i > lastcandidate && maxshapes - *numshapes > 1) {
+      n = 0;
+      lastcandidate = i;
+      while(lastcandidate != -1 && n < maxshapes - *numshapes && n < MS_SHAPE_BATCH_SIZE) {
+        candidates[n++] = lastcandidate;
+        lastcandidate = msGetNextBit(shpfile->status, lastcandidate + 1, shpfile->numshapes);
+      }
+      n = MS_MAX(msSHPReadAhead(hSHP, candidates, n), 1);
+      lastcandidate = candidates[n-1];
+    }
+
+    shape = &shapes[*numshapes];
+    msSHPReadShape(hSHP, i, shape);
+    if(shape->type == MS_SHAPE_NULL || (shpfile->hSHPGen && shape->numlines == 0)) {
       msFreeShape(shape);
-      continue; /* skip NULL shapes */
+      continue; /* skip NULL shapes and shapes removed by the generalization */
     }
     shape->numvalues = layer->numitems;
-    shape->values = msDBFGetValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems);
+    if(layer->arena)
+      shape->values = msDBFGetArenaValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems, layer->arena);
+    else
+      shape->values = msDBFGetValueList(shpfile->hDBF, i, layer->iteminfo, layer->numitems);
     if(!shape->values) {
       shape->numvalues = 0;
     }
@@ -2565,12 +2975,24 @@ int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
       filter_passed = msEvalExpression(layer, shape, &(layer->filter), layer->filteritemindex);
     }
 
-    if(!filter_passed) msFreeShape(shape);
-  } while(!filter_passed);  /* Loop until both spatial and attribute filters match */
+    if(!filter_passed) {
+      msShapeArenaFreeShape(layer->arena, shape);
+      continue; /* Loop until both spatial and attribute filters match */
+    }
+
+    (*numshapes)++;
+  }
 
   return MS_SUCCESS;
 }
 
+int msSHPLayerNextShape(layerObj *layer, shapeObj *shape)
+{
+  int numshapes = 0;
+
+  return msSHPLayerNextShapes(layer, shape, 1, &numshapes);
+}
+
 int msSHPLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 {
   shapefileObj *shpfile;
@@ -2666,6 +3088,7 @@ int msSHPLayerInitializeVirtualTable(layerObj *layer)
   layer->vtable->LayerIsOpen = msSHPLayerIsOpen;
   layer->vtable->LayerWhichShapes = msSHPLayerWhichShapes;
   layer->vtable->LayerNextShape = msSHPLayerNextShape;
+  layer->vtable->LayerNextShapes = msSHPLayerNextShapes;
   layer->vtable->LayerGetShape = msSHPLayerGetShape;
   layer->vtable->LayerClose = msSHPLayerClose;
   layer->vtable->LayerGetItems = msSHPLayerGetItems;
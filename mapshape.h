@@ -38,9 +38,11 @@ extern "C" {
 #endif
 
 #define SHX_BUFFER_PAGE 1024
+#define SHP_READAHEAD_MAX (256*1024) /* largest span read by msSHPReadAhead() */
 
 #ifndef SWIG
 #define MS_PATH_LENGTH 1024
+#define MS_SHP_MAXGENLEVELS 16 /* generalized geometry levels, see shpgen */
 
   /* Shapefile types */
 #define SHP_POINT 1
@@ -102,6 +104,11 @@ extern "C" {
     int   nPartMax;
     int   *panParts;
 
+    uchar *pabyReadAhead; /* records read in one pass by msSHPReadAhead() */
+    int   nReadAheadBufSize;
+    int   nReadAheadOffset; /* .shp file offset of pabyReadAhead[0] */
+    int   nReadAheadSize; /* bytes held in pabyReadAhead, 0 if none */
+
   } SHPInfo;
   typedef SHPInfo * SHPHandle;
 #endif
@@ -135,6 +142,11 @@ extern "C" {
 
     char  *pszStringField;
     int   nStringFieldLen;
+
+#ifndef SWIG
+    uchar *pabyMap; /* read only files are memory mapped when possible, NULL otherwise, so they must not be rewritten in place while open */
+    size_t nMapSize;
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -160,6 +172,11 @@ extern "C" {
 
 #ifndef SWIG
     DBFHandle hDBF; /* DBF file pointer */
+
+    SHPHandle hSHPGen; /* generalized geometry read instead of hSHP, NULL if not used */
+    int genlevel;
+    int numgenlevels; /* -1 until the .gen file has been looked for */
+    double gentolerance[MS_SHP_MAXGENLEVELS];
 #endif
 
     int lastshape;
@@ -186,6 +203,16 @@ extern "C" {
   MS_DLL_EXPORT int msShapefileCreate(shapefileObj *shpfile, char *filename, int type);
   MS_DLL_EXPORT void msShapefileClose(shapefileObj *shpfile);
   MS_DLL_EXPORT int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug);
+  MS_DLL_EXPORT char *msShapefileGetGenFilename(char *pszReturnPath, const char *pszShapefile, int level);
+  MS_DLL_EXPORT int msShapefileSetGenLevel(shapefileObj *shpfile, double cellsize, int debug);
+
+  /* attribute index (.aix) function prototypes, see mapattrindex.c */
+  MS_DLL_EXPORT char *msShapefileGetAttrIndexFilename(char *pszReturnPath, const char *pszShapefile, const char *pszField);
+  MS_DLL_EXPORT int msWriteAttrIndex(DBFHandle hDBF, int iField, const char *pszFilename);
+  MS_DLL_EXPORT int msSearchAttrIndexRange(const char *pszFilename, int numrecords, double dfMin, int bMinIncluded,
+      double dfMax, int bMaxIncluded, ms_bitarray status, int debug);
+  MS_DLL_EXPORT int msSearchAttrIndexString(const char *pszFilename, int numrecords, const char *pszValue,
+      ms_bitarray status, int debug);
 
   /* SHP/SHX function prototypes */
   MS_DLL_EXPORT SHPHandle msSHPOpen( const char * pszShapeFile, const char * pszAccess );
@@ -193,7 +220,9 @@ extern "C" {
   MS_DLL_EXPORT void msSHPClose( SHPHandle hSHP );
   MS_DLL_EXPORT void msSHPGetInfo( SHPHandle hSHP, int * pnEntities, int * pnShapeType );
   MS_DLL_EXPORT int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds );
+  MS_DLL_EXPORT int msSHPReadFileBounds( const char * pszLayer, rectObj *padBounds );
   MS_DLL_EXPORT void msSHPReadShape( SHPHandle psSHP, int hEntity, shapeObj *shape );
+  MS_DLL_EXPORT int msSHPReadAhead( SHPHandle psSHP, int *panEntities, int nEntities );
   MS_DLL_EXPORT int msSHPReadPoint(SHPHandle psSHP, int hEntity, pointObj *point );
   MS_DLL_EXPORT int msSHPWriteShape( SHPHandle psSHP, shapeObj *shape );
   MS_DLL_EXPORT int msSHPWritePoint(SHPHandle psSHP, pointObj *point );
@@ -228,6 +257,7 @@ extern "C" {
   MS_DLL_EXPORT char **msDBFGetItems(DBFHandle dbffile);
   MS_DLL_EXPORT char **msDBFGetValues(DBFHandle dbffile, int record);
   MS_DLL_EXPORT char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes, int numitems);
+  MS_DLL_EXPORT char **msDBFGetArenaValueList(DBFHandle dbffile, int record, int *itemindexes, int numitems, shapeArenaObj *arena);
   MS_DLL_EXPORT int *msDBFGetItemIndexes(DBFHandle dbffile, char **items, int numitems);
   MS_DLL_EXPORT int msDBFGetItemIndex(DBFHandle dbffile, char *name);
 
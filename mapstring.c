@@ -1301,6 +1301,79 @@ char *msStringConcatenate(char *pszDest, const char *pszSrc)
   return pszDest;
 }
 
+/*
+ * Growable string buffer. Keeps track of its length and doubles its
+ * allocation when full, so building a string out of n pieces is linear
+ * rather than quadratic like repeated calls to msStringConcatenate().
+*/
+struct msStringBuffer {
+  size_t alloc_size;
+  size_t length;
+  char *str;
+};
+
+msStringBuffer *msStringBufferAlloc(void)
+{
+  return (msStringBuffer *) msSmallCalloc(1, sizeof(msStringBuffer));
+}
+
+void msStringBufferFree(msStringBuffer *sb)
+{
+  if(sb) msFree(sb->str);
+  msFree(sb);
+}
+
+/* NULL until something has been appended */
+const char *msStringBufferGetString(msStringBuffer *sb)
+{
+  return sb->str;
+}
+
+size_t msStringBufferGetLength(msStringBuffer *sb)
+{
+  return sb->length;
+}
+
+/* returns the string (to be freed by the caller) and frees the buffer */
+char *msStringBufferReleaseStringAndFree(msStringBuffer *sb)
+{
+  char *str = sb->str;
+
+  sb->str = NULL;
+  msStringBufferFree(sb);
+  return str;
+}
+
+int msStringBufferAppend(msStringBuffer *sb, const char *pszAppendedString)
+{
+  size_t nAppendLen;
+
+  if(pszAppendedString == NULL)
+    return MS_SUCCESS;
+
+  nAppendLen = strlen(pszAppendedString);
+  if(sb->length + nAppendLen + 1 > sb->alloc_size) {
+    size_t nNewSize = (sb->alloc_size < 64) ? 64 : sb->alloc_size * 2;
+    char *pszNewStr;
+
+    if(nNewSize < sb->length + nAppendLen + 1)
+      nNewSize = sb->length + nAppendLen + 1;
+
+    pszNewStr = (char *) realloc(sb->str, nNewSize);
+    if(pszNewStr == NULL) {
+      msSetError(MS_MEMERR, "Error while reallocating memory.", "msStringBufferAppend()");
+      return MS_FAILURE;
+    }
+    sb->str = pszNewStr;
+    sb->alloc_size = nNewSize;
+  }
+
+  memcpy(sb->str + sb->length, pszAppendedString, nAppendLen + 1);
+  sb->length += nAppendLen;
+
+  return MS_SUCCESS;
+}
+
 char *msJoinStrings(char **array, int arrayLength, const char *delimeter)
 {
   char *string;
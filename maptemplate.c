@@ -74,7 +74,16 @@ static char *olLayerWMSTag = \
                              "                                   width: [mapwidth], height: [mapheight], version: '[VERSION]', format:'[openlayers_format]'},"
                              "                                   {singleTile: \"true\", ratio:1, projection: '[openlayers_projection]'});\n";
 
-static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mode);
+/*
+** Position within a templateFileObj, multi-line tags ([resultset]) read
+** ahead through it.
+*/
+typedef struct {
+  templateFileObj *file;
+  int nextline;
+} templateReaderObj;
+
+static char *processLine(mapservObj *mapserv, char *instr, templateReaderObj *reader, int mode);
 
 static int isValidTemplate(FILE *stream, const char *filename)
 {
@@ -850,6 +859,7 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   char *argValue;
   char *tag, *tagInstance, *tagStart;
   hashTableObj *tagArgs=NULL;
+  msStringBuffer *lineBuffer;
 
   int limit=-1;
   char *trimLast=NULL;
@@ -891,7 +901,10 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
 
   /* start rebuilding **line */
   free(*line);
-  *line = preTag;
+  *line = NULL;
+  lineBuffer = msStringBufferAlloc();
+  msStringBufferAppend(lineBuffer, preTag);
+  free(preTag);
 
   /* we know the layer has query results or we wouldn't be in this code */
 
@@ -907,6 +920,7 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
       status = msJoinConnect(layer, &(layer->joins[j]));
       if(status != MS_SUCCESS) {
         msFreeHashTable(tagArgs);
+        *line = msStringBufferReleaseStringAndFree(lineBuffer);
         return status;
       }
     }
@@ -925,6 +939,7 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
     status = msLayerGetShape(layer, &(mapserv->resultshape), &(layer->resultcache->results[i]));
     if(status != MS_SUCCESS) {
       msFreeHashTable(tagArgs);
+      *line = msStringBufferReleaseStringAndFree(lineBuffer);
       return status;
     }
 
@@ -955,7 +970,7 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
 
     /* process the tag */
     tagInstance = processLine(mapserv, tag, NULL, QUERY); /* do substitutions */
-    *line = msStringConcatenate(*line, tagInstance); /* grow the line */
+    msStringBufferAppend(lineBuffer, tagInstance); /* grow the line */
 
     free(tagInstance);
     msFreeShape(&(mapserv->resultshape)); /* init too */
@@ -967,7 +982,8 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   /* msLayerClose(layer); */
   mapserv->resultlayer = NULL; /* necessary? */
 
-  *line = msStringConcatenate(*line, postTag);
+  msStringBufferAppend(lineBuffer, postTag);
+  *line = msStringBufferReleaseStringAndFree(lineBuffer);
 
   /*
   ** clean up
@@ -982,9 +998,8 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
 /*
 ** Function to process a [resultset ...] tag.
 */
-static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
+static int processResultSetTag(mapservObj *mapserv, char **line, templateReaderObj *reader)
 {
-  char lineBuffer[MS_BUFFER_LENGTH];
   int foundTagEnd;
 
   char *preTag, *postTag; /* text before and after the tag */
@@ -1033,7 +1048,7 @@ static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
     lp = GET_LAYER(mapserv->map, layerIndex);
 
     if(strstr(*line, "[/resultset]") == NULL) { /* read ahead */
-      if(!stream) {
+      if(!reader) {
         msSetError(MS_WEBERR, "Invalid file pointer.", "processResultSetTag()");
         msFreeHashTable(tagArgs);
         return(MS_FAILURE);
@@ -1041,8 +1056,8 @@ static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
 
       foundTagEnd = MS_FALSE;
       while(!foundTagEnd) {
-        if(fgets(lineBuffer, MS_BUFFER_LENGTH, stream) != NULL) {
-          *line = msStringConcatenate(*line, lineBuffer);
+        if(reader->nextline < reader->file->numlines) {
+          *line = msStringConcatenate(*line, reader->file->lines[reader->nextline++]);
           if(strstr(*line, "[/resultset]") != NULL)
             foundTagEnd = MS_TRUE;
         } else
@@ -1098,7 +1113,7 @@ static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
 ** TODO's:
 **   - allow URLs
 */
-static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int mode)
+static int processIncludeTag(mapservObj *mapserv, char **line, templateReaderObj *reader, int mode)
 {
   char *tag, *tagStart, *tagEnd;
   hashTableObj *tagArgs=NULL;
@@ -1156,7 +1171,7 @@ static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int
     strlcpy(tag, tagStart, tagLength+1);
 
     /* process any other tags in the content */
-    processedContent = processLine(mapserv, content, stream, mode);
+    processedContent = processLine(mapserv, content, reader, mode);
 
     /* do the replacement */
     *line = msReplaceSubstring(*line, tag, processedContent);
@@ -1949,6 +1964,7 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
 
   shapeObj tShape;
   char *coords=NULL, point[128];
+  msStringBuffer *coordsBuffer=NULL;
 
 
   if(!*line) {
@@ -2156,7 +2172,8 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     ** build the coordinate string
     */
 
-    if(strlen(sh) > 0) coords = msStringConcatenate(coords, sh);
+    coordsBuffer = msStringBufferAlloc();
+    if(strlen(sh) > 0) msStringBufferAppend(coordsBuffer, sh);
 
     /* do we need to handle inner/outer rings */
     if(tShape.type == MS_SHAPE_POLYGON && strlen(orh) > 0 && strlen(irh) > 0) {
@@ -2169,34 +2186,34 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
         int *inners;
         if( outers[i] ) {
           /* this is an outer ring */
-          if((!firstPart) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+          if((!firstPart) && (strlen(ps) > 0)) msStringBufferAppend(coordsBuffer, ps);
           firstPart = 0;
-          if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
-          coords = msStringConcatenate(coords, orh);
+          if(strlen(ph) > 0) msStringBufferAppend(coordsBuffer, ph);
+          msStringBufferAppend(coordsBuffer, orh);
           for(p=0; p<tShape.line[i].numpoints-1; p++) {
             snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-            coords = msStringConcatenate(coords, point);
+            msStringBufferAppend(coordsBuffer, point);
           }
           snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
-          coords = msStringConcatenate(coords, orf);
+          msStringBufferAppend(coordsBuffer, point);
+          msStringBufferAppend(coordsBuffer, orf);
 
           inners = msGetInnerList(&tShape, i, outers);
           /* loop over rings looking for inners to this outer */
           for(j=0; j<tShape.numlines; j++) {
             if( inners[j] ) {
               /* j is an inner ring of i */
-              coords = msStringConcatenate(coords, irh);
+              msStringBufferAppend(coordsBuffer, irh);
               for(p=0; p<tShape.line[j].numpoints-1; p++) {
                 snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-                coords = msStringConcatenate(coords, point);
+                msStringBufferAppend(coordsBuffer, point);
               }
               snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-              coords = msStringConcatenate(coords, irf);
+              msStringBufferAppend(coordsBuffer, irf);
             }
           }
           free( inners );
-          if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+          if(strlen(pf) > 0) msStringBufferAppend(coordsBuffer, pf);
         }
       } /* end of loop over outer rings */
       free( outers );
@@ -2209,21 +2226,23 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
             (tShape.type == MS_SHAPE_POLYGON && tShape.line[i].numpoints < 3))
           continue;
 
-        if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
+        if(strlen(ph) > 0) msStringBufferAppend(coordsBuffer, ph);
 
         for(p=0; p<tShape.line[i].numpoints-1; p++) {
           snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
+          msStringBufferAppend(coordsBuffer, point);
         }
         snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-        coords = msStringConcatenate(coords, point);
+        msStringBufferAppend(coordsBuffer, point);
 
-        if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+        if(strlen(pf) > 0) msStringBufferAppend(coordsBuffer, pf);
 
-        if((i < tShape.numlines-1) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+        if((i < tShape.numlines-1) && (strlen(ps) > 0)) msStringBufferAppend(coordsBuffer, ps);
       }
     }
-    if(strlen(sf) > 0) coords = msStringConcatenate(coords, sf);
+    if(strlen(sf) > 0) msStringBufferAppend(coordsBuffer, sf);
+    coords = msStringBufferReleaseStringAndFree(coordsBuffer);
+    coordsBuffer = NULL;
 
     msFreeShape(&tShape);
 
@@ -2867,39 +2886,45 @@ int generateClassTemplate(char* pszClassTemplate, mapObj *map, int nIdxLayer, in
   *pszTemp = msReplaceSubstring(*pszTemp, "[leg_class_maxscaledenom]", szTmpstr);
 
   /*
-   * Create a hash table that contain info
-   * on current layer
+   * The [if] tags are the only users of the layer info, skip building it
+   * (msIsLayerQueryable() walks all the classes) when there are none.
    */
-  myHashTable = msCreateHashTable();
-
-  /*
-   * for now, only status, type, name and group are  required by template
-   */
-  snprintf(szStatus, sizeof(szStatus), "%d", GET_LAYER(map, nIdxLayer)->status);
-  msInsertHashTable(myHashTable, "layer_status", szStatus);
-
-  snprintf(szType, sizeof(szType), "%d", GET_LAYER(map, nIdxLayer)->type);
-  msInsertHashTable(myHashTable, "layer_type", szType);
-
-  msInsertHashTable(myHashTable, "layer_name",
-                    (GET_LAYER(map, nIdxLayer)->name)? GET_LAYER(map, nIdxLayer)->name : "");
-  msInsertHashTable(myHashTable, "layer_group",
-                    (GET_LAYER(map, nIdxLayer)->group)? GET_LAYER(map, nIdxLayer)->group : "");
-  msInsertHashTable(myHashTable, "layer_visible", msLayerIsVisible(map, GET_LAYER(map, nIdxLayer))?"1":"0" );
-  msInsertHashTable(myHashTable, "layer_queryable", msIsLayerQueryable(GET_LAYER(map, nIdxLayer))?"1":"0" );
-  msInsertHashTable(myHashTable, "class_name",
-                    (GET_LAYER(map, nIdxLayer)->class[nIdxClass]->name)? GET_LAYER(map, nIdxLayer)->class[nIdxClass]->name : "");
+  if(strstr(*pszTemp, "[if") != NULL) {
+    /*
+     * Create a hash table that contain info
+     * on current layer
+     */
+    myHashTable = msCreateHashTable();
 
-  if(processIfTag(pszTemp, myHashTable, MS_FALSE) != MS_SUCCESS)
-    return MS_FAILURE;
+    /*
+     * for now, only status, type, name and group are  required by template
+     */
+    snprintf(szStatus, sizeof(szStatus), "%d", GET_LAYER(map, nIdxLayer)->status);
+    msInsertHashTable(myHashTable, "layer_status", szStatus);
+
+    snprintf(szType, sizeof(szType), "%d", GET_LAYER(map, nIdxLayer)->type);
+    msInsertHashTable(myHashTable, "layer_type", szType);
+
+    msInsertHashTable(myHashTable, "layer_name",
+                      (GET_LAYER(map, nIdxLayer)->name)? GET_LAYER(map, nIdxLayer)->name : "");
+    msInsertHashTable(myHashTable, "layer_group",
+                      (GET_LAYER(map, nIdxLayer)->group)? GET_LAYER(map, nIdxLayer)->group : "");
+    msInsertHashTable(myHashTable, "layer_visible", msLayerIsVisible(map, GET_LAYER(map, nIdxLayer))?"1":"0" );
+    msInsertHashTable(myHashTable, "layer_queryable", msIsLayerQueryable(GET_LAYER(map, nIdxLayer))?"1":"0" );
+    msInsertHashTable(myHashTable, "class_name",
+                      (GET_LAYER(map, nIdxLayer)->class[nIdxClass]->name)? GET_LAYER(map, nIdxLayer)->class[nIdxClass]->name : "");
+
+    if(processIfTag(pszTemp, myHashTable, MS_FALSE) != MS_SUCCESS)
+      return MS_FAILURE;
 
-  if(processIfTag(pszTemp, &(GET_LAYER(map, nIdxLayer)->metadata), MS_FALSE) != MS_SUCCESS)
-    return MS_FAILURE;
+    if(processIfTag(pszTemp, &(GET_LAYER(map, nIdxLayer)->metadata), MS_FALSE) != MS_SUCCESS)
+      return MS_FAILURE;
 
-  if(processIfTag(pszTemp, &(map->web.metadata), MS_TRUE) != MS_SUCCESS)
-    return MS_FAILURE;
+    if(processIfTag(pszTemp, &(map->web.metadata), MS_TRUE) != MS_SUCCESS)
+      return MS_FAILURE;
 
-  msFreeHashTable(myHashTable);
+    msFreeHashTable(myHashTable);
+  }
 
   /*
    * Check if leg_icon tag exist
@@ -2928,6 +2953,7 @@ char *generateLegendTemplate(mapservObj *mapserv)
   char *file = NULL;
   int length;
   char *pszResult = NULL;
+  msStringBuffer *legendBuffer = NULL;
   char *legGroupHtml = NULL;
   char *legLayerHtml = NULL;
   char *legClassHtml = NULL;
@@ -2957,22 +2983,22 @@ char *generateLegendTemplate(mapservObj *mapserv)
   hashTableObj *layerArgs = NULL;
   hashTableObj *classArgs = NULL;
 
-  ms_regex_t re; /* compiled regular expression to be matched */
+  ms_regex_t *re; /* compiled regular expression to be matched */
 
   int  *panCurrentDrawingOrder = NULL;
   char szPath[MS_MAXPATHLEN];
 
-  if(ms_regcomp(&re, MS_TEMPLATE_EXPR, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE) != 0) {
+  if((re = msRegexCacheAcquire(MS_TEMPLATE_EXPR, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE)) == NULL) {
     msSetError(MS_IOERR, "Error regcomp.", "generateLegendTemplate()");
     return NULL;
   }
 
-  if(ms_regexec(&re, mapserv->map->legend.template, 0, NULL, 0) != 0) { /* no match */
+  if(ms_regexec(re, mapserv->map->legend.template, 0, NULL, 0) != 0) { /* no match */
     msSetError(MS_IOERR, "Invalid template file name.", "generateLegendTemplate()");
-    ms_regfree(&re);
+    msRegexCacheRelease(re);
     return NULL;
   }
-  ms_regfree(&re);
+  msRegexCacheRelease(re);
 
   /* -------------------------------------------------------------------- */
   /*      Save the current drawing order. The drawing order is reset      */
@@ -3101,7 +3127,8 @@ char *generateLegendTemplate(mapservObj *mapserv)
     return(NULL);
 
   /* start with the header if present */
-  if(legHeaderHtml) pszResult = msStringConcatenate(pszResult, legHeaderHtml);
+  legendBuffer = msStringBufferAlloc();
+  if(legHeaderHtml) msStringBufferAppend(legendBuffer, legHeaderHtml);
 
   /********************************************************************/
 
@@ -3132,14 +3159,11 @@ char *generateLegendTemplate(mapservObj *mapserv)
     for (i=0; i<nGroupNames; i++) {
       /* process group tags */
       if(generateGroupTemplate(legGroupHtml, mapserv->map, papszGroups[i], groupArgs, &legGroupHtmlCopy, pszPrefix) != MS_SUCCESS) {
-        if(pszResult)
-          free(pszResult);
-        pszResult=NULL;
         goto error;
       }
 
       /* concatenate it to final result */
-      pszResult = msStringConcatenate(pszResult, legGroupHtmlCopy);
+      msStringBufferAppend(legendBuffer, legGroupHtmlCopy);
 
       /*
                if(!pszResult)
@@ -3176,15 +3200,12 @@ char *generateLegendTemplate(mapservObj *mapserv)
           if(GET_LAYER(mapserv->map, mapserv->map->layerorder[j])->group && strcmp(GET_LAYER(mapserv->map, mapserv->map->layerorder[j])->group, papszGroups[i]) == 0) {
             /* process all layer tags */
             if(generateLayerTemplate(legLayerHtml, mapserv->map, mapserv->map->layerorder[j], layerArgs, &legLayerHtmlCopy, pszPrefix) != MS_SUCCESS) {
-              if(pszResult)
-                free(pszResult);
-              pszResult=NULL;
               goto error;
             }
 
 
             /* concatenate to final result */
-            pszResult = msStringConcatenate(pszResult, legLayerHtmlCopy);
+            msStringBufferAppend(legendBuffer, legLayerHtmlCopy);
 
             if(legLayerHtmlCopy) {
               free(legLayerHtmlCopy);
@@ -3200,15 +3221,12 @@ char *generateLegendTemplate(mapservObj *mapserv)
                   continue;
 
                 if(generateClassTemplate(legClassHtml, mapserv->map, mapserv->map->layerorder[j], k, classArgs, &legClassHtmlCopy, pszPrefix) != MS_SUCCESS) {
-                  if(pszResult)
-                    free(pszResult);
-                  pszResult=NULL;
                   goto error;
                 }
 
 
                 /* concatenate to final result */
-                pszResult = msStringConcatenate(pszResult, legClassHtmlCopy);
+                msStringBufferAppend(legendBuffer, legClassHtmlCopy);
 
                 if(legClassHtmlCopy) {
                   free(legClassHtmlCopy);
@@ -3243,15 +3261,12 @@ char *generateLegendTemplate(mapservObj *mapserv)
                   continue;
 
                 if(generateClassTemplate(legClassHtml, mapserv->map, mapserv->map->layerorder[j], k, classArgs, &legClassHtmlCopy, pszPrefix) != MS_SUCCESS) {
-                  if(pszResult)
-                    free(pszResult);
-                  pszResult=NULL;
                   goto error;
                 }
 
 
                 /* concatenate to final result */
-                pszResult = msStringConcatenate(pszResult, legClassHtmlCopy);
+                msStringBufferAppend(legendBuffer, legClassHtmlCopy);
 
                 if(legClassHtmlCopy) {
                   free(legClassHtmlCopy);
@@ -3284,14 +3299,11 @@ char *generateLegendTemplate(mapservObj *mapserv)
 
         /* process a layer tags */
         if(generateLayerTemplate(legLayerHtml, mapserv->map, mapserv->map->layerorder[j], layerArgs, &legLayerHtmlCopy, pszPrefix) != MS_SUCCESS) {
-          if(pszResult)
-            free(pszResult);
-          pszResult=NULL;
           goto error;
         }
 
         /* concatenate to final result */
-        pszResult = msStringConcatenate(pszResult, legLayerHtmlCopy);
+        msStringBufferAppend(legendBuffer, legLayerHtmlCopy);
 
         if(legLayerHtmlCopy) {
           free(legLayerHtmlCopy);
@@ -3306,15 +3318,12 @@ char *generateLegendTemplate(mapservObj *mapserv)
               continue;
 
             if(generateClassTemplate(legClassHtml, mapserv->map, mapserv->map->layerorder[j], k, classArgs, &legClassHtmlCopy, pszPrefix) != MS_SUCCESS) {
-              if(pszResult)
-                free(pszResult);
-              pszResult=NULL;
               goto error;
             }
 
 
             /* concatenate to final result */
-            pszResult = msStringConcatenate(pszResult, legClassHtmlCopy);
+            msStringBufferAppend(legendBuffer, legClassHtmlCopy);
 
             if(legClassHtmlCopy) {
               free(legClassHtmlCopy);
@@ -3345,14 +3354,11 @@ char *generateLegendTemplate(mapservObj *mapserv)
               continue;
 
             if(generateClassTemplate(legClassHtml, mapserv->map, mapserv->map->layerorder[j], k, classArgs, &legClassHtmlCopy, pszPrefix) != MS_SUCCESS) {
-              if(pszResult)
-                free(pszResult);
-              pszResult=NULL;
               goto error;
             }
 
 
-            pszResult = msStringConcatenate(pszResult, legClassHtmlCopy);
+            msStringBufferAppend(legendBuffer, legClassHtmlCopy);
 
             if(legClassHtmlCopy) {
               free(legClassHtmlCopy);
@@ -3365,15 +3371,16 @@ char *generateLegendTemplate(mapservObj *mapserv)
   }
 
   /* finish with the footer if present */
-  if(legFooterHtml) pszResult = msStringConcatenate(pszResult, legFooterHtml);
+  if(legFooterHtml) msStringBufferAppend(legendBuffer, legFooterHtml);
 
   /*
    * if we reach this point, that mean no error was generated.
    * So check if template is null and initialize it to <space>.
    */
-  if(pszResult == NULL) {
-    pszResult = msStringConcatenate(pszResult, " ");
-  }
+  if(msStringBufferGetString(legendBuffer) == NULL)
+    msStringBufferAppend(legendBuffer, " ");
+  pszResult = msStringBufferReleaseStringAndFree(legendBuffer);
+  legendBuffer = NULL;
 
 
   /********************************************************************/
@@ -3387,6 +3394,8 @@ error:
     msFree(papszGroups);
   }
 
+  msStringBufferFree(legendBuffer);
+
   msFreeHashTable(groupArgs);
   msFreeHashTable(layerArgs);
   msFreeHashTable(classArgs);
@@ -3424,11 +3433,12 @@ char *processOneToManyJoin(mapservObj* mapserv, joinObj *join)
 {
   int records=MS_FALSE;
   FILE *stream=NULL;
-  char *outbuf;
+  msStringBuffer *outbuf;
   char line[MS_BUFFER_LENGTH], *tmpline;
   char szPath[MS_MAXPATHLEN];
 
-  if((outbuf = msStrdup("")) == NULL) return(NULL); /* empty at first */
+  outbuf = msStringBufferAlloc();
+  msStringBufferAppend(outbuf, ""); /* empty at first */
 
   msJoinPrepare(join, &(mapserv->resultshape)); /* execute the join */
   while(msJoinNext(join) == MS_SUCCESS) {
@@ -3438,27 +3448,31 @@ char *processOneToManyJoin(mapservObj* mapserv, joinObj *join)
       if(join->header != NULL) {
         if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, join->header), "r")) == NULL) {
           msSetError(MS_IOERR, "Error while opening join header file %s.", "processOneToManyJoin()", join->header);
+          msStringBufferFree(outbuf);
           return(NULL);
         }
 
         if(isValidTemplate(stream, join->header) != MS_TRUE) {
           fclose(stream);
+          msStringBufferFree(outbuf);
           return NULL;
         }
 
         /* echo file to the output buffer, no substitutions */
-        while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) outbuf = msStringConcatenate(outbuf, line);
+        while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) msStringBufferAppend(outbuf, line);
 
         fclose(stream);
       }
 
       if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, join->template), "r")) == NULL) {
         msSetError(MS_IOERR, "Error while opening join template file %s.", "processOneToManyJoin()", join->template);
+        msStringBufferFree(outbuf);
         return(NULL);
       }
 
       if(isValidTemplate(stream, join->template) != MS_TRUE) {
         fclose(stream);
+        msStringBufferFree(outbuf);
         return NULL;
       }
 
@@ -3468,11 +3482,14 @@ char *processOneToManyJoin(mapservObj* mapserv, joinObj *join)
     while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) { /* now on to the end of the template */
       if(strchr(line, '[') != NULL) {
         tmpline = processLine(mapserv, line, NULL, QUERY); /* no multiline tags are allowed in a join */
-        if(!tmpline) return NULL;
-        outbuf = msStringConcatenate(outbuf, tmpline);
+        if(!tmpline) {
+          msStringBufferFree(outbuf);
+          return NULL;
+        }
+        msStringBufferAppend(outbuf, tmpline);
         free(tmpline);
       } else /* no subs, just echo */
-        outbuf = msStringConcatenate(outbuf, line);
+        msStringBufferAppend(outbuf, line);
     }
 
     rewind(stream);
@@ -3482,16 +3499,18 @@ char *processOneToManyJoin(mapservObj* mapserv, joinObj *join)
   if(records==MS_TRUE && join->footer) {
     if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, join->footer), "r")) == NULL) {
       msSetError(MS_IOERR, "Error while opening join footer file %s.", "processOneToManyJoin()", join->footer);
+      msStringBufferFree(outbuf);
       return(NULL);
     }
 
     if(isValidTemplate(stream, join->footer) != MS_TRUE) {
       fclose(stream);
+      msStringBufferFree(outbuf);
       return NULL;
     }
 
     /* echo file to the output buffer, no substitutions */
-    while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) outbuf = msStringConcatenate(outbuf, line);
+    while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) msStringBufferAppend(outbuf, line);
 
     fclose(stream);
   }
@@ -3500,14 +3519,14 @@ char *processOneToManyJoin(mapservObj* mapserv, joinObj *join)
   msFreeCharArray(join->values, join->numitems);
   join->values = NULL;
 
-  return(outbuf);
+  return msStringBufferReleaseStringAndFree(outbuf);
 }
 
 /*
 ** Process a single line in the template. A few tags (e.g. [resultset]...[/resultset]) can be multi-line so
 ** we pass the filehandle to look ahead if necessary.
 */
-static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mode)
+static char *processLine(mapservObj *mapserv, char *instr, templateReaderObj *reader, int mode)
 {
   int i, j;
 #define PROCESSLINE_BUFLEN 5120
@@ -3524,10 +3543,14 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
 
   if(strstr(outstr, "[version]")) outstr = msReplaceSubstring(outstr, "[version]",  msGetVersion());
 
-  snprintf(repstr, PROCESSLINE_BUFLEN, "%s%s%s.%s", mapserv->map->web.imageurl, mapserv->map->name, mapserv->Id, MS_IMAGE_EXTENSION(mapserv->map->outputformat));
-  outstr = msReplaceSubstring(outstr, "[img]", repstr);
-  snprintf(repstr, PROCESSLINE_BUFLEN, "%s%sref%s.%s", mapserv->map->web.imageurl, mapserv->map->name, mapserv->Id, MS_IMAGE_EXTENSION(mapserv->map->outputformat));
-  outstr = msReplaceSubstring(outstr, "[ref]", repstr);
+  if(strstr(outstr, "[img]")) {
+    snprintf(repstr, PROCESSLINE_BUFLEN, "%s%s%s.%s", mapserv->map->web.imageurl, mapserv->map->name, mapserv->Id, MS_IMAGE_EXTENSION(mapserv->map->outputformat));
+    outstr = msReplaceSubstring(outstr, "[img]", repstr);
+  }
+  if(strstr(outstr, "[ref]")) {
+    snprintf(repstr, PROCESSLINE_BUFLEN, "%s%sref%s.%s", mapserv->map->web.imageurl, mapserv->map->name, mapserv->Id, MS_IMAGE_EXTENSION(mapserv->map->outputformat));
+    outstr = msReplaceSubstring(outstr, "[ref]", repstr);
+  }
 
   if(strstr(outstr, "[errmsg")) {
     char *errmsg = msGetErrorString(";");
@@ -3557,17 +3580,23 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
     }
   }
 
-  snprintf(repstr, PROCESSLINE_BUFLEN, "%s%ssb%s.%s", mapserv->map->web.imageurl, mapserv->map->name, mapserv->Id, MS_IMAGE_EXTENSION(mapserv->map->outputformat));
-  outstr = msReplaceSubstring(outstr, "[scalebar]", repstr);
+  if(strstr(outstr, "[scalebar]")) {
+    snprintf(repstr, PROCESSLINE_BUFLEN, "%s%ssb%s.%s", mapserv->map->web.imageurl, mapserv->map->name, mapserv->Id, MS_IMAGE_EXTENSION(mapserv->map->outputformat));
+    outstr = msReplaceSubstring(outstr, "[scalebar]", repstr);
+  }
 
   if(mapserv->savequery) {
-    snprintf(repstr, PROCESSLINE_BUFLEN, "%s%s%s%s", mapserv->map->web.imagepath, mapserv->map->name, mapserv->Id, MS_QUERY_EXTENSION);
-    outstr = msReplaceSubstring(outstr, "[queryfile]", repstr);
+    if(strstr(outstr, "[queryfile]")) {
+      snprintf(repstr, PROCESSLINE_BUFLEN, "%s%s%s%s", mapserv->map->web.imagepath, mapserv->map->name, mapserv->Id, MS_QUERY_EXTENSION);
+      outstr = msReplaceSubstring(outstr, "[queryfile]", repstr);
+    }
   }
 
   if(mapserv->savemap) {
-    snprintf(repstr, PROCESSLINE_BUFLEN, "%s%s%s.map", mapserv->map->web.imagepath, mapserv->map->name, mapserv->Id);
-    outstr = msReplaceSubstring(outstr, "[map]", repstr);
+    if(strstr(outstr, "[map]")) {
+      snprintf(repstr, PROCESSLINE_BUFLEN, "%s%s%s.map", mapserv->map->web.imagepath, mapserv->map->name, mapserv->Id);
+      outstr = msReplaceSubstring(outstr, "[map]", repstr);
+    }
   }
 
   if(strstr(outstr,"[mapserv_onlineresource]")) {
@@ -3582,102 +3611,114 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
   }
 
   if(getenv("HTTP_HOST")) {
-    snprintf(repstr, PROCESSLINE_BUFLEN, "%s", getenv("HTTP_HOST"));
-    outstr = msReplaceSubstring(outstr, "[host]", repstr);
+    if(strstr(outstr, "[host]")) {
+      snprintf(repstr, PROCESSLINE_BUFLEN, "%s", getenv("HTTP_HOST"));
+      outstr = msReplaceSubstring(outstr, "[host]", repstr);
+    }
   }
   if(getenv("SERVER_PORT")) {
-    snprintf(repstr, PROCESSLINE_BUFLEN, "%s", getenv("SERVER_PORT"));
-    outstr = msReplaceSubstring(outstr, "[port]", repstr);
+    if(strstr(outstr, "[port]")) {
+      snprintf(repstr, PROCESSLINE_BUFLEN, "%s", getenv("SERVER_PORT"));
+      outstr = msReplaceSubstring(outstr, "[port]", repstr);
+    }
   }
 
-  snprintf(repstr, PROCESSLINE_BUFLEN, "%s", mapserv->Id);
-  outstr = msReplaceSubstring(outstr, "[id]", repstr);
-
-  repstr[0] = '\0'; /* Layer list for a "POST" request */
-  for(i=0; i<mapserv->NumLayers; i++) {
-    strlcat(repstr, mapserv->Layers[i], sizeof(repstr));
-    strlcat(repstr, " ", sizeof(repstr));
+  if(strstr(outstr, "[id]")) {
+    snprintf(repstr, PROCESSLINE_BUFLEN, "%s", mapserv->Id);
+    outstr = msReplaceSubstring(outstr, "[id]", repstr);
   }
-  msStringTrimBlanks(repstr);
-  outstr = msReplaceSubstring(outstr, "[layers]", repstr);
 
-  encodedstr = msEncodeUrl(repstr);
-  outstr = msReplaceSubstring(outstr, "[layers_esc]", encodedstr);
-  free(encodedstr);
-
-  strcpy(repstr, ""); /* list of ALL layers that can be toggled */
-  repstr[0] = '\0';
-  for(i=0; i<mapserv->map->numlayers; i++) {
-    if(GET_LAYER(mapserv->map, i)->status != MS_DEFAULT && GET_LAYER(mapserv->map, i)->name != NULL) {
-      strlcat(repstr, GET_LAYER(mapserv->map, i)->name, sizeof(repstr));
+  if(strstr(outstr, "[layers")) {
+    repstr[0] = '\0'; /* Layer list for a "POST" request */
+    for(i=0; i<mapserv->NumLayers; i++) {
+      strlcat(repstr, mapserv->Layers[i], sizeof(repstr));
       strlcat(repstr, " ", sizeof(repstr));
     }
+    msStringTrimBlanks(repstr);
+    outstr = msReplaceSubstring(outstr, "[layers]", repstr);
+
+    encodedstr = msEncodeUrl(repstr);
+    outstr = msReplaceSubstring(outstr, "[layers_esc]", encodedstr);
+    free(encodedstr);
   }
-  msStringTrimBlanks(repstr);
-  outstr = msReplaceSubstring(outstr, "[toggle_layers]", repstr);
 
-  encodedstr = msEncodeUrl(repstr);
-  outstr = msReplaceSubstring(outstr, "[toggle_layers_esc]", encodedstr);
-  free(encodedstr);
+  if(strstr(outstr, "[toggle_layers")) {
+    strcpy(repstr, ""); /* list of ALL layers that can be toggled */
+    repstr[0] = '\0';
+    for(i=0; i<mapserv->map->numlayers; i++) {
+      if(GET_LAYER(mapserv->map, i)->status != MS_DEFAULT && GET_LAYER(mapserv->map, i)->name != NULL) {
+        strlcat(repstr, GET_LAYER(mapserv->map, i)->name, sizeof(repstr));
+        strlcat(repstr, " ", sizeof(repstr));
+      }
+    }
+    msStringTrimBlanks(repstr);
+    outstr = msReplaceSubstring(outstr, "[toggle_layers]", repstr);
 
-  for(i=0; i<mapserv->map->numlayers; i++) { /* Set form widgets (i.e. checkboxes, radio and select lists), note that default layers don't show up here */
-    if(isOn(mapserv, GET_LAYER(mapserv->map, i)->name, GET_LAYER(mapserv->map, i)->group) == MS_TRUE) {
-      if(GET_LAYER(mapserv->map, i)->group) {
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->group);
-        outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->group);
-        outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
+    encodedstr = msEncodeUrl(repstr);
+    outstr = msReplaceSubstring(outstr, "[toggle_layers_esc]", encodedstr);
+    free(encodedstr);
+  }
+
+  if(strstr(outstr, "_select]") || strstr(outstr, "_check]")) { /* only lines with form widgets */
+    for(i=0; i<mapserv->map->numlayers; i++) { /* Set form widgets (i.e. checkboxes, radio and select lists), note that default layers don't show up here */
+      if(isOn(mapserv, GET_LAYER(mapserv->map, i)->name, GET_LAYER(mapserv->map, i)->group) == MS_TRUE) {
+        if(GET_LAYER(mapserv->map, i)->group) {
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->group);
+          outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->group);
+          outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
+        }
+        if(GET_LAYER(mapserv->map, i)->name) {
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->name);
+          outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->name);
+          outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
+        }
+      } else {
+        if(GET_LAYER(mapserv->map, i)->group) {
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->group);
+          outstr = msReplaceSubstring(outstr, substr, "");
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->group);
+          outstr = msReplaceSubstring(outstr, substr, "");
+        }
+        if(GET_LAYER(mapserv->map, i)->name) {
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->name);
+          outstr = msReplaceSubstring(outstr, substr, "");
+          snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->name);
+          outstr = msReplaceSubstring(outstr, substr, "");
+        }
       }
-      if(GET_LAYER(mapserv->map, i)->name) {
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->name);
+    }
+
+    for(i=-1; i<=1; i++) { /* make zoom direction persistant */
+      if(mapserv->ZoomDirection == i) {
+        snprintf(substr, sizeof(substr), "[zoomdir_%d_select]", i);
         outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->name);
+        snprintf(substr, sizeof(substr), "[zoomdir_%d_check]", i);
         outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
-      }
-    } else {
-      if(GET_LAYER(mapserv->map, i)->group) {
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->group);
+      } else {
+        snprintf(substr, sizeof(substr), "[zoomdir_%d_select]", i);
         outstr = msReplaceSubstring(outstr, substr, "");
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->group);
+        snprintf(substr, sizeof(substr), "[zoomdir_%d_check]", i);
         outstr = msReplaceSubstring(outstr, substr, "");
       }
-      if(GET_LAYER(mapserv->map, i)->name) {
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_select]", GET_LAYER(mapserv->map, i)->name);
+    }
+
+    for(i=MINZOOM; i<=MAXZOOM; i++) { /* make zoom persistant */
+      if(mapserv->Zoom == i) {
+        snprintf(substr, sizeof(substr), "[zoom_%d_select]", i);
+        outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
+        snprintf(substr, sizeof(substr), "[zoom_%d_check]", i);
+        outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
+      } else {
+        snprintf(substr, sizeof(substr), "[zoom_%d_select]", i);
         outstr = msReplaceSubstring(outstr, substr, "");
-        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_check]", GET_LAYER(mapserv->map, i)->name);
+        snprintf(substr, sizeof(substr), "[zoom_%d_check]", i);
         outstr = msReplaceSubstring(outstr, substr, "");
       }
     }
   }
 
-  for(i=-1; i<=1; i++) { /* make zoom direction persistant */
-    if(mapserv->ZoomDirection == i) {
-      snprintf(substr, sizeof(substr), "[zoomdir_%d_select]", i);
-      outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
-      snprintf(substr, sizeof(substr), "[zoomdir_%d_check]", i);
-      outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
-    } else {
-      snprintf(substr, sizeof(substr), "[zoomdir_%d_select]", i);
-      outstr = msReplaceSubstring(outstr, substr, "");
-      snprintf(substr, sizeof(substr), "[zoomdir_%d_check]", i);
-      outstr = msReplaceSubstring(outstr, substr, "");
-    }
-  }
-
-  for(i=MINZOOM; i<=MAXZOOM; i++) { /* make zoom persistant */
-    if(mapserv->Zoom == i) {
-      snprintf(substr, sizeof(substr), "[zoom_%d_select]", i);
-      outstr = msReplaceSubstring(outstr, substr, "selected=\"selected\"");
-      snprintf(substr, sizeof(substr), "[zoom_%d_check]", i);
-      outstr = msReplaceSubstring(outstr, substr, "checked=\"checked\"");
-    } else {
-      snprintf(substr, sizeof(substr), "[zoom_%d_select]", i);
-      outstr = msReplaceSubstring(outstr, substr, "");
-      snprintf(substr, sizeof(substr), "[zoom_%d_check]", i);
-      outstr = msReplaceSubstring(outstr, substr, "");
-    }
-  }
-
   /* allow web object metadata access in template */
 
   /*
@@ -3724,19 +3765,31 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
     }
   }
 
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->mappnt.x);
-  outstr = msReplaceSubstring(outstr, "[mapx]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->mappnt.y);
-  outstr = msReplaceSubstring(outstr, "[mapy]", repstr);
+  if(strstr(outstr, "[mapx]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->mappnt.x);
+    outstr = msReplaceSubstring(outstr, "[mapx]", repstr);
+  }
+  if(strstr(outstr, "[mapy]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->mappnt.y);
+    outstr = msReplaceSubstring(outstr, "[mapy]", repstr);
+  }
 
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.minx); /* Individual mapextent elements for spatial query building, deprecated. */
-  outstr = msReplaceSubstring(outstr, "[minx]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.maxx);
-  outstr = msReplaceSubstring(outstr, "[maxx]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.miny);
-  outstr = msReplaceSubstring(outstr, "[miny]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.maxy);
-  outstr = msReplaceSubstring(outstr, "[maxy]", repstr);
+  if(strstr(outstr, "[minx]")) { /* Individual mapextent elements for spatial query building, deprecated. */
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.minx);
+    outstr = msReplaceSubstring(outstr, "[minx]", repstr);
+  }
+  if(strstr(outstr, "[maxx]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.maxx);
+    outstr = msReplaceSubstring(outstr, "[maxx]", repstr);
+  }
+  if(strstr(outstr, "[miny]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.miny);
+    outstr = msReplaceSubstring(outstr, "[miny]", repstr);
+  }
+  if(strstr(outstr, "[maxy]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->extent.maxy);
+    outstr = msReplaceSubstring(outstr, "[maxy]", repstr);
+  }
 
   if(processDateTag( &outstr ) != MS_SUCCESS)
     return(NULL);
@@ -3746,19 +3799,31 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
   if(processExtentTag(mapserv, &outstr, "mapext_esc", &(mapserv->map->extent), &(mapserv->map->projection)) != MS_SUCCESS) /* depricated */
     return(NULL);
 
-  snprintf(repstr, sizeof(repstr), "%f", (mapserv->map->extent.maxx-mapserv->map->extent.minx)); /* useful for creating cachable extents (i.e. 0 0 dx dy) with legends and scalebars */
-  outstr = msReplaceSubstring(outstr, "[dx]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", (mapserv->map->extent.maxy-mapserv->map->extent.miny));
-  outstr = msReplaceSubstring(outstr, "[dy]", repstr);
+  if(strstr(outstr, "[dx]")) { /* useful for creating cachable extents (i.e. 0 0 dx dy) with legends and scalebars */
+    snprintf(repstr, sizeof(repstr), "%f", (mapserv->map->extent.maxx-mapserv->map->extent.minx));
+    outstr = msReplaceSubstring(outstr, "[dx]", repstr);
+  }
+  if(strstr(outstr, "[dy]")) {
+    snprintf(repstr, sizeof(repstr), "%f", (mapserv->map->extent.maxy-mapserv->map->extent.miny));
+    outstr = msReplaceSubstring(outstr, "[dy]", repstr);
+  }
 
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.minx); /* Individual raw extent elements for spatial query building, deprecated. */
-  outstr = msReplaceSubstring(outstr, "[rawminx]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.maxx);
-  outstr = msReplaceSubstring(outstr, "[rawmaxx]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.miny);
-  outstr = msReplaceSubstring(outstr, "[rawminy]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.maxy);
-  outstr = msReplaceSubstring(outstr, "[rawmaxy]", repstr);
+  if(strstr(outstr, "[rawminx]")) { /* Individual raw extent elements for spatial query building, deprecated. */
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.minx);
+    outstr = msReplaceSubstring(outstr, "[rawminx]", repstr);
+  }
+  if(strstr(outstr, "[rawmaxx]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.maxx);
+    outstr = msReplaceSubstring(outstr, "[rawmaxx]", repstr);
+  }
+  if(strstr(outstr, "[rawminy]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.miny);
+    outstr = msReplaceSubstring(outstr, "[rawminy]", repstr);
+  }
+  if(strstr(outstr, "[rawmaxy]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->RawExt.maxy);
+    outstr = msReplaceSubstring(outstr, "[rawmaxy]", repstr);
+  }
 
   if(processExtentTag(mapserv, &outstr, "rawext", &(mapserv->RawExt), &(mapserv->map->projection)) != MS_SUCCESS)
     return(NULL);
@@ -3774,19 +3839,31 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
     msProjectRect(&(mapserv->map->projection), &(mapserv->map->latlon), &llextent);
     msProjectPoint(&(mapserv->map->projection), &(mapserv->map->latlon), &llpoint);
 
-    snprintf(repstr, sizeof(repstr), "%f", llpoint.x);
-    outstr = msReplaceSubstring(outstr, "[maplon]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", llpoint.y);
-    outstr = msReplaceSubstring(outstr, "[maplat]", repstr);
+    if(strstr(outstr, "[maplon]")) {
+      snprintf(repstr, sizeof(repstr), "%f", llpoint.x);
+      outstr = msReplaceSubstring(outstr, "[maplon]", repstr);
+    }
+    if(strstr(outstr, "[maplat]")) {
+      snprintf(repstr, sizeof(repstr), "%f", llpoint.y);
+      outstr = msReplaceSubstring(outstr, "[maplat]", repstr);
+    }
 
-    snprintf(repstr, sizeof(repstr), "%f", llextent.minx); /* map extent as lat/lon */
-    outstr = msReplaceSubstring(outstr, "[minlon]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", llextent.maxx);
-    outstr = msReplaceSubstring(outstr, "[maxlon]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", llextent.miny);
-    outstr = msReplaceSubstring(outstr, "[minlat]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", llextent.maxy);
-    outstr = msReplaceSubstring(outstr, "[maxlat]", repstr);
+    if(strstr(outstr, "[minlon]")) { /* map extent as lat/lon */
+      snprintf(repstr, sizeof(repstr), "%f", llextent.minx);
+      outstr = msReplaceSubstring(outstr, "[minlon]", repstr);
+    }
+    if(strstr(outstr, "[maxlon]")) {
+      snprintf(repstr, sizeof(repstr), "%f", llextent.maxx);
+      outstr = msReplaceSubstring(outstr, "[maxlon]", repstr);
+    }
+    if(strstr(outstr, "[minlat]")) {
+      snprintf(repstr, sizeof(repstr), "%f", llextent.miny);
+      outstr = msReplaceSubstring(outstr, "[minlat]", repstr);
+    }
+    if(strstr(outstr, "[maxlat]")) {
+      snprintf(repstr, sizeof(repstr), "%f", llextent.maxy);
+      outstr = msReplaceSubstring(outstr, "[maxlat]", repstr);
+    }
 
     if(processExtentTag(mapserv, &outstr, "mapext_latlon", &(llextent), NULL) != MS_SUCCESS)
       return(NULL);
@@ -3797,14 +3874,22 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
 
   /* submitted by J.F (bug 1102) */
   if(mapserv->map->reference.status == MS_ON) {
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.minx); /* Individual reference map extent elements for spatial query building, depricated. */
-    outstr = msReplaceSubstring(outstr, "[refminx]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.maxx);
-    outstr = msReplaceSubstring(outstr, "[refmaxx]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.miny);
-    outstr = msReplaceSubstring(outstr, "[refminy]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.maxy);
-    outstr = msReplaceSubstring(outstr, "[refmaxy]", repstr);
+    if(strstr(outstr, "[refminx]")) { /* Individual reference map extent elements for spatial query building, depricated. */
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.minx);
+      outstr = msReplaceSubstring(outstr, "[refminx]", repstr);
+    }
+    if(strstr(outstr, "[refmaxx]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.maxx);
+      outstr = msReplaceSubstring(outstr, "[refmaxx]", repstr);
+    }
+    if(strstr(outstr, "[refminy]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.miny);
+      outstr = msReplaceSubstring(outstr, "[refminy]", repstr);
+    }
+    if(strstr(outstr, "[refmaxy]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->map->reference.extent.maxy);
+      outstr = msReplaceSubstring(outstr, "[refmaxy]", repstr);
+    }
 
     if(processExtentTag(mapserv, &outstr, "refext", &(mapserv->map->reference.extent), &(mapserv->map->projection)) != MS_SUCCESS)
       return(NULL);
@@ -3812,36 +3897,56 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
       return(NULL);
   }
 
-  snprintf(repstr, sizeof(repstr), "%d %d", mapserv->map->width, mapserv->map->height);
-  outstr = msReplaceSubstring(outstr, "[mapsize]", repstr);
+  if(strstr(outstr, "[mapsize")) {
+    snprintf(repstr, sizeof(repstr), "%d %d", mapserv->map->width, mapserv->map->height);
+    outstr = msReplaceSubstring(outstr, "[mapsize]", repstr);
 
-  encodedstr = msEncodeUrl(repstr);
-  outstr = msReplaceSubstring(outstr, "[mapsize_esc]", encodedstr);
-  free(encodedstr);
+    encodedstr = msEncodeUrl(repstr);
+    outstr = msReplaceSubstring(outstr, "[mapsize_esc]", encodedstr);
+    free(encodedstr);
+  }
 
-  snprintf(repstr, sizeof(repstr), "%d", mapserv->map->width);
-  outstr = msReplaceSubstring(outstr, "[mapwidth]", repstr);
-  snprintf(repstr, sizeof(repstr), "%d", mapserv->map->height);
-  outstr = msReplaceSubstring(outstr, "[mapheight]", repstr);
+  if(strstr(outstr, "[mapwidth]")) {
+    snprintf(repstr, sizeof(repstr), "%d", mapserv->map->width);
+    outstr = msReplaceSubstring(outstr, "[mapwidth]", repstr);
+  }
+  if(strstr(outstr, "[mapheight]")) {
+    snprintf(repstr, sizeof(repstr), "%d", mapserv->map->height);
+    outstr = msReplaceSubstring(outstr, "[mapheight]", repstr);
+  }
 
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->map->scaledenom);
-  outstr = msReplaceSubstring(outstr, "[scale]", repstr);
-  outstr = msReplaceSubstring(outstr, "[scaledenom]", repstr);
-  snprintf(repstr, sizeof(repstr), "%f", mapserv->map->cellsize);
-  outstr = msReplaceSubstring(outstr, "[cellsize]", repstr);
+  if(strstr(outstr, "[scale")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->scaledenom);
+    outstr = msReplaceSubstring(outstr, "[scale]", repstr);
+    outstr = msReplaceSubstring(outstr, "[scaledenom]", repstr);
+  }
+  if(strstr(outstr, "[cellsize]")) {
+    snprintf(repstr, sizeof(repstr), "%f", mapserv->map->cellsize);
+    outstr = msReplaceSubstring(outstr, "[cellsize]", repstr);
+  }
 
-  snprintf(repstr, sizeof(repstr), "%.1f %.1f", (mapserv->map->width)/2.0, (mapserv->map->height)/2.0); /* not subtracting 1 from image dimensions (see bug 633) */
-  outstr = msReplaceSubstring(outstr, "[center]", repstr);
-  snprintf(repstr, sizeof(repstr), "%.1f", (mapserv->map->width)/2.0);
-  outstr = msReplaceSubstring(outstr, "[center_x]", repstr);
-  snprintf(repstr, sizeof(repstr), "%.1f", (mapserv->map->height)/2.0);
-  outstr = msReplaceSubstring(outstr, "[center_y]", repstr);
+  if(strstr(outstr, "[center]")) { /* not subtracting 1 from image dimensions (see bug 633) */
+    snprintf(repstr, sizeof(repstr), "%.1f %.1f", (mapserv->map->width)/2.0, (mapserv->map->height)/2.0);
+    outstr = msReplaceSubstring(outstr, "[center]", repstr);
+  }
+  if(strstr(outstr, "[center_x]")) {
+    snprintf(repstr, sizeof(repstr), "%.1f", (mapserv->map->width)/2.0);
+    outstr = msReplaceSubstring(outstr, "[center_x]", repstr);
+  }
+  if(strstr(outstr, "[center_y]")) {
+    snprintf(repstr, sizeof(repstr), "%.1f", (mapserv->map->height)/2.0);
+    outstr = msReplaceSubstring(outstr, "[center_y]", repstr);
+  }
 
   /* These are really for situations with multiple result sets only, but often used in header/footer   */
-  snprintf(repstr, sizeof(repstr), "%d", mapserv->NR); /* total number of results */
-  outstr = msReplaceSubstring(outstr, "[nr]", repstr);
-  snprintf(repstr, sizeof(repstr), "%d", mapserv->NL); /* total number of layers with results */
-  outstr = msReplaceSubstring(outstr, "[nl]", repstr);
+  if(strstr(outstr, "[nr]")) { /* total number of results */
+    snprintf(repstr, sizeof(repstr), "%d", mapserv->NR);
+    outstr = msReplaceSubstring(outstr, "[nr]", repstr);
+  }
+  if(strstr(outstr, "[nl]")) { /* total number of layers with results */
+    snprintf(repstr, sizeof(repstr), "%d", mapserv->NL);
+    outstr = msReplaceSubstring(outstr, "[nl]", repstr);
+  }
 
   if(mapserv->resultlayer) {
     if(strstr(outstr, "[items]") != NULL) {
@@ -3852,18 +3957,24 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
       free(itemstr);
     }
 
-    snprintf(repstr, sizeof(repstr), "%d", mapserv->NLR); /* total number of results within this layer */
-    outstr = msReplaceSubstring(outstr, "[nlr]", repstr);
-    snprintf(repstr, sizeof(repstr), "%d", mapserv->RN); /* sequential (eg. 1..n) result number within all layers */
-    outstr = msReplaceSubstring(outstr, "[rn]", repstr);
-    snprintf(repstr, sizeof(repstr), "%d", mapserv->LRN); /* sequential (eg. 1..n) result number within this layer */
-    outstr = msReplaceSubstring(outstr, "[lrn]", repstr);
+    if(strstr(outstr, "[nlr]")) { /* total number of results within this layer */
+      snprintf(repstr, sizeof(repstr), "%d", mapserv->NLR);
+      outstr = msReplaceSubstring(outstr, "[nlr]", repstr);
+    }
+    if(strstr(outstr, "[rn]")) { /* sequential (eg. 1..n) result number within all layers */
+      snprintf(repstr, sizeof(repstr), "%d", mapserv->RN);
+      outstr = msReplaceSubstring(outstr, "[rn]", repstr);
+    }
+    if(strstr(outstr, "[lrn]")) { /* sequential (eg. 1..n) result number within this layer */
+      snprintf(repstr, sizeof(repstr), "%d", mapserv->LRN);
+      outstr = msReplaceSubstring(outstr, "[lrn]", repstr);
+    }
     outstr = msReplaceSubstring(outstr, "[cl]", mapserv->resultlayer->name); /* current layer name */
     /* if(resultlayer->description) outstr = msReplaceSubstring(outstr, "[cd]", resultlayer->description); */ /* current layer description */
   }
 
   if(mode != QUERY) {
-    if(processResultSetTag(mapserv, &outstr, stream) != MS_SUCCESS) return(NULL);
+    if(processResultSetTag(mapserv, &outstr, reader) != MS_SUCCESS) return(NULL);
   }
 
   if(mode == QUERY) { /* return shape and/or values  */
@@ -3885,20 +3996,28 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
       }
     }
 
-    snprintf(repstr, sizeof(repstr), "%f %f", (mapserv->resultshape.bounds.maxx + mapserv->resultshape.bounds.minx)/2, (mapserv->resultshape.bounds.maxy + mapserv->resultshape.bounds.miny)/2);
-    outstr = msReplaceSubstring(outstr, "[shpmid]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", (mapserv->resultshape.bounds.maxx + mapserv->resultshape.bounds.minx)/2);
-    outstr = msReplaceSubstring(outstr, "[shpmidx]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", (mapserv->resultshape.bounds.maxy + mapserv->resultshape.bounds.miny)/2);
-    outstr = msReplaceSubstring(outstr, "[shpmidy]", repstr);
+    if(strstr(outstr, "[shpmid]")) {
+      snprintf(repstr, sizeof(repstr), "%f %f", (mapserv->resultshape.bounds.maxx + mapserv->resultshape.bounds.minx)/2, (mapserv->resultshape.bounds.maxy + mapserv->resultshape.bounds.miny)/2);
+      outstr = msReplaceSubstring(outstr, "[shpmid]", repstr);
+    }
+    if(strstr(outstr, "[shpmidx]")) {
+      snprintf(repstr, sizeof(repstr), "%f", (mapserv->resultshape.bounds.maxx + mapserv->resultshape.bounds.minx)/2);
+      outstr = msReplaceSubstring(outstr, "[shpmidx]", repstr);
+    }
+    if(strstr(outstr, "[shpmidy]")) {
+      snprintf(repstr, sizeof(repstr), "%f", (mapserv->resultshape.bounds.maxy + mapserv->resultshape.bounds.miny)/2);
+      outstr = msReplaceSubstring(outstr, "[shpmidy]", repstr);
+    }
 
     if(processExtentTag(mapserv, &outstr, "shpext", &(mapserv->resultshape.bounds), &(mapserv->resultlayer->projection)) != MS_SUCCESS)
       return(NULL);
     if(processExtentTag(mapserv, &outstr, "shpext_esc", &(mapserv->resultshape.bounds), &(mapserv->resultlayer->projection)) != MS_SUCCESS) /* depricated */
       return(NULL);
 
-    snprintf(repstr, sizeof(repstr), "%d", mapserv->resultshape.classindex);
-    outstr = msReplaceSubstring(outstr, "[shpclass]", repstr);
+    if(strstr(outstr, "[shpclass]")) {
+      snprintf(repstr, sizeof(repstr), "%d", mapserv->resultshape.classindex);
+      outstr = msReplaceSubstring(outstr, "[shpclass]", repstr);
+    }
 
     if(processShpxyTag(mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
       return(NULL);
@@ -3906,19 +4025,31 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
     if(processShplabelTag(mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
       return(NULL);
 
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.minx);
-    outstr = msReplaceSubstring(outstr, "[shpminx]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.miny);
-    outstr = msReplaceSubstring(outstr, "[shpminy]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.maxx);
-    outstr = msReplaceSubstring(outstr, "[shpmaxx]", repstr);
-    snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.maxy);
-    outstr = msReplaceSubstring(outstr, "[shpmaxy]", repstr);
+    if(strstr(outstr, "[shpminx]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.minx);
+      outstr = msReplaceSubstring(outstr, "[shpminx]", repstr);
+    }
+    if(strstr(outstr, "[shpminy]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.miny);
+      outstr = msReplaceSubstring(outstr, "[shpminy]", repstr);
+    }
+    if(strstr(outstr, "[shpmaxx]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.maxx);
+      outstr = msReplaceSubstring(outstr, "[shpmaxx]", repstr);
+    }
+    if(strstr(outstr, "[shpmaxy]")) {
+      snprintf(repstr, sizeof(repstr), "%f", mapserv->resultshape.bounds.maxy);
+      outstr = msReplaceSubstring(outstr, "[shpmaxy]", repstr);
+    }
 
-    snprintf(repstr, sizeof(repstr), "%ld", mapserv->resultshape.index);
-    outstr = msReplaceSubstring(outstr, "[shpidx]", repstr);
-    snprintf(repstr, sizeof(repstr), "%d", mapserv->resultshape.tileindex);
-    outstr = msReplaceSubstring(outstr, "[tileidx]", repstr);
+    if(strstr(outstr, "[shpidx]")) {
+      snprintf(repstr, sizeof(repstr), "%ld", mapserv->resultshape.index);
+      outstr = msReplaceSubstring(outstr, "[shpidx]", repstr);
+    }
+    if(strstr(outstr, "[tileidx]")) {
+      snprintf(repstr, sizeof(repstr), "%d", mapserv->resultshape.tileindex);
+      outstr = msReplaceSubstring(outstr, "[tileidx]", repstr);
+    }
 
     /* return ALL attributes in one delimeted list */
     if(strstr(outstr, "[values]") != NULL) {
@@ -3997,7 +4128,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
 
   } /* end query mode specific substitutions */
 
-  if(processIncludeTag(mapserv, &outstr, stream, mode) != MS_SUCCESS)
+  if(processIncludeTag(mapserv, &outstr, reader, mode) != MS_SUCCESS)
     return(NULL);
 
   for(i=0; i<mapserv->request->NumParams; i++) {
@@ -4007,113 +4138,152 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
      * Replacement is case-insensitive. (#4511)
      */
     snprintf(substr, PROCESSLINE_BUFLEN, "[%s]", mapserv->request->ParamNames[i]);
-    encodedstr = msEncodeHTMLEntities(mapserv->request->ParamValues[i]);
-    outstr = msCaseReplaceSubstring(outstr, substr, encodedstr);
-    free(encodedstr);
+    if(strcasestr(outstr, substr) != NULL) {
+      encodedstr = msEncodeHTMLEntities(mapserv->request->ParamValues[i]);
+      outstr = msCaseReplaceSubstring(outstr, substr, encodedstr);
+      free(encodedstr);
+    }
 
     snprintf(substr, PROCESSLINE_BUFLEN, "[%s_esc]", mapserv->request->ParamNames[i]);
-    encodedstr = msEncodeUrl(mapserv->request->ParamValues[i]);
-    outstr = msCaseReplaceSubstring(outstr, substr, encodedstr);
-    free(encodedstr);
+    if(strcasestr(outstr, substr) != NULL) {
+      encodedstr = msEncodeUrl(mapserv->request->ParamValues[i]);
+      outstr = msCaseReplaceSubstring(outstr, substr, encodedstr);
+      free(encodedstr);
+    }
   }
 
   return(outstr);
 }
 
-#define MS_TEMPLATE_BUFFER 1024 /* 1k */
-
-int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
+/*
+** Returns the template file html, reading it on first use.
+*/
+static templateFileObj *getTemplateFile(mapservObj *mapserv, char *html)
 {
   FILE *stream;
-  char line[MS_BUFFER_LENGTH], *tmpline;
-  int   nBufferSize = 0;
-  int   nCurrentSize = 0;
-  int   nExpandBuffer = 0;
+  char line[MS_BUFFER_LENGTH];
+  int i, maxlines=0;
+  templateFileObj *template;
 
-  ms_regex_t re; /* compiled regular expression to be matched */
+  ms_regex_t *re; /* compiled regular expression to be matched */
   char szPath[MS_MAXPATHLEN];
 
-  if(!html) {
-    msSetError(MS_WEBERR, "No template specified", "msReturnPage()");
-    return MS_FAILURE;
+  for(i=0; i<mapserv->numtemplates; i++) {
+    if(strcmp(mapserv->templates[i]->name, html) == 0)
+      return mapserv->templates[i];
   }
 
-  if(ms_regcomp(&re, MS_TEMPLATE_EXPR, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE) != 0) {
+  if((re = msRegexCacheAcquire(MS_TEMPLATE_EXPR, MS_REG_EXTENDED|MS_REG_NOSUB|MS_REG_ICASE)) == NULL) {
     msSetError(MS_REGEXERR, NULL, "msReturnPage()");
-    return MS_FAILURE;
+    return NULL;
   }
 
-  if(ms_regexec(&re, html, 0, NULL, 0) != 0) { /* no match */
-    ms_regfree(&re);
+  if(ms_regexec(re, html, 0, NULL, 0) != 0) { /* no match */
+    msRegexCacheRelease(re);
     msSetError(MS_WEBERR, "Malformed template name (%s).", "msReturnPage()", html);
-    return MS_FAILURE;
+    return NULL;
   }
-  ms_regfree(&re);
+  msRegexCacheRelease(re);
 
   if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, html), "r")) == NULL) {
     msSetError(MS_IOERR, html, "msReturnPage()");
-    return MS_FAILURE;
+    return NULL;
   }
 
   if(isValidTemplate(stream, html) != MS_TRUE) {
     fclose(stream);
-    return MS_FAILURE;
+    return NULL;
   }
 
-  if(papszBuffer) {
-    if((*papszBuffer) == NULL) {
-      (*papszBuffer) = (char *)msSmallMalloc(MS_TEMPLATE_BUFFER);
-      (*papszBuffer)[0] = '\0';
-      nBufferSize = MS_TEMPLATE_BUFFER;
-      nCurrentSize = 0;
-      nExpandBuffer = 1;
-    } else {
-      nCurrentSize = strlen((*papszBuffer));
-      nBufferSize = nCurrentSize;
-      nExpandBuffer = (nCurrentSize/MS_TEMPLATE_BUFFER) + 1;
+  template = (templateFileObj *) msSmallMalloc(sizeof(templateFileObj));
+  template->name = msStrdup(html);
+  template->lines = NULL;
+  template->numlines = 0;
+
+  while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) {
+    if(template->numlines == maxlines) {
+      maxlines = MS_MAX(16, 2*maxlines);
+      template->lines = (char **) msSmallRealloc(template->lines, sizeof(char *)*maxlines);
     }
+    template->lines[template->numlines++] = msStrdup(line);
   }
 
-  while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) { /* now on to the end of the file */
+  fclose(stream);
+
+  mapserv->templates = (templateFileObj **) msSmallRealloc(mapserv->templates, sizeof(templateFileObj *)*(mapserv->numtemplates+1));
+  mapserv->templates[mapserv->numtemplates++] = template;
+
+  return template;
+}
+
+/*
+** Processes the template html, output goes to buffer if there is one and
+** to stdout otherwise.
+*/
+static int returnPage(mapservObj *mapserv, char *html, int mode, msStringBuffer *buffer)
+{
+  char *line, *tmpline;
+  templateFileObj *template;
+  templateReaderObj reader;
+
+  if(!html) {
+    msSetError(MS_WEBERR, "No template specified", "msReturnPage()");
+    return MS_FAILURE;
+  }
+
+  if((template = getTemplateFile(mapserv, html)) == NULL)
+    return MS_FAILURE;
+
+  reader.file = template;
+  reader.nextline = 0;
+
+  while(reader.nextline < template->numlines) { /* now on to the end of the file */
+    line = template->lines[reader.nextline++];
 
     if(strchr(line, '[') != NULL) {
-      tmpline = processLine(mapserv, line, stream, mode);
+      tmpline = processLine(mapserv, line, &reader, mode);
       if(!tmpline)
         return MS_FAILURE;
 
-      if(papszBuffer) {
-        if(nBufferSize <= (int)(nCurrentSize + strlen(tmpline) + 1)) {
-          nExpandBuffer = (strlen(tmpline) /  MS_TEMPLATE_BUFFER) + 1;
-          nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer + strlen((*papszBuffer));
-          (*papszBuffer) = (char *) msSmallRealloc((*papszBuffer),sizeof(char)*nBufferSize);
-        }
-        strcat((*papszBuffer), tmpline);
-        nCurrentSize += strlen(tmpline);
-      } else
+      if(buffer)
+        msStringBufferAppend(buffer, tmpline);
+      else
         msIO_fwrite(tmpline, strlen(tmpline), 1, stdout);
 
       free(tmpline);
     } else {
-      if(papszBuffer) {
-        if(nBufferSize <= (int)(nCurrentSize + strlen(line))) {
-          nExpandBuffer = (strlen(line) /  MS_TEMPLATE_BUFFER) + 1;
-          nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer + strlen((*papszBuffer));
-          (*papszBuffer) = (char *)msSmallRealloc((*papszBuffer),sizeof(char)*nBufferSize);
-        }
-        strcat((*papszBuffer), line);
-        nCurrentSize += strlen(line);
-      } else
+      if(buffer)
+        msStringBufferAppend(buffer, line);
+      else
         msIO_fwrite(line, strlen(line), 1, stdout);
     }
-    if(!papszBuffer)
-      fflush(stdout);
   } /* next line */
 
-  fclose(stream);
+  /* query templates are returned once per result, leave those to the footer */
+  if(!buffer && mode != QUERY)
+    fflush(stdout);
 
   return MS_SUCCESS;
 }
 
+int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
+{
+  int status;
+  msStringBuffer *buffer;
+
+  if(!papszBuffer)
+    return returnPage(mapserv, html, mode, NULL);
+
+  buffer = msStringBufferAlloc();
+  msStringBufferAppend(buffer, (*papszBuffer) ? (*papszBuffer) : "");
+  status = returnPage(mapserv, html, mode, buffer);
+
+  msFree(*papszBuffer);
+  *papszBuffer = msStringBufferReleaseStringAndFree(buffer);
+
+  return status;
+}
+
 int msReturnURL(mapservObj* ms, char* url, int mode)
 {
   char *tmpurl;
@@ -4137,27 +4307,16 @@ int msReturnURL(mapservObj* ms, char* url, int mode)
 /*
 ** Legacy query template parsing where you use headers, footers and such...
 */
-int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **papszBuffer)
+static int returnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, msStringBuffer *buffer)
 {
   int status;
   int i,j,k;
-  char buffer[1024];
-  int nBufferSize =0;
-  int nCurrentSize = 0;
-  int nExpandBuffer = 0;
+  char szContentType[1024];
 
   char *template;
 
   layerObj *lp=NULL;
 
-  if(papszBuffer) {
-    (*papszBuffer) = (char *)msSmallMalloc(MS_TEMPLATE_BUFFER);
-    (*papszBuffer)[0] = '\0';
-    nBufferSize = MS_TEMPLATE_BUFFER;
-    nCurrentSize = 0;
-    nExpandBuffer = 1;
-  }
-
   msInitShape(&(mapserv->resultshape));
 
   if((mapserv->Mode == ITEMQUERY) || (mapserv->Mode == QUERY)) { /* may need to handle a URL result set since these modes return exactly 1 result */
@@ -4205,7 +4364,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
           }
         }
 
-        if(papszBuffer == NULL) {
+        if(buffer == NULL) {
           if(msReturnURL(mapserv, template, QUERY) != MS_SUCCESS) return MS_FAILURE;
         }
 
@@ -4237,22 +4396,16 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
   ** Is this step really necessary for buffered output? Legend and browse templates don't deal with mime-types
   ** so why should this. Note that new-style templates don't buffer the mime-type either.
   */
-  if(papszBuffer && mapserv->sendheaders) {
-    snprintf(buffer, sizeof(buffer), "Content-Type: %s%c%c", pszMimeType, 10, 10);
-    if(nBufferSize <= (int)(nCurrentSize + strlen(buffer) + 1)) {
-      nExpandBuffer++;
-      (*papszBuffer) = (char *)msSmallRealloc((*papszBuffer), MS_TEMPLATE_BUFFER*nExpandBuffer);
-      nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer;
-    }
-    strcat((*papszBuffer), buffer);
-    nCurrentSize += strlen(buffer);
+  if(buffer && mapserv->sendheaders) {
+    snprintf(szContentType, sizeof(szContentType), "Content-Type: %s%c%c", pszMimeType, 10, 10);
+    msStringBufferAppend(buffer, szContentType);
   } else if(mapserv->sendheaders) {
     msIO_setHeader("Content-Type",pszMimeType);
     msIO_sendHeaders();
   }
 
   if(mapserv->map->web.header) {
-    if(msReturnPage(mapserv, mapserv->map->web.header, BROWSE, papszBuffer) != MS_SUCCESS) return MS_FAILURE;
+    if(returnPage(mapserv, mapserv->map->web.header, BROWSE, buffer) != MS_SUCCESS) return MS_FAILURE;
   }
 
   mapserv->RN = 1; /* overall result number */
@@ -4280,7 +4433,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
     }
 
     if(lp->header) {
-      if(msReturnPage(mapserv, lp->header, BROWSE, papszBuffer) != MS_SUCCESS) return MS_FAILURE;
+      if(returnPage(mapserv, lp->header, BROWSE, buffer) != MS_SUCCESS) return MS_FAILURE;
     }
 
     mapserv->LRN = 1; /* layer result number */
@@ -4303,7 +4456,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
       else
         template = lp->template;
 
-      if(msReturnPage(mapserv, template, QUERY, papszBuffer) != MS_SUCCESS) {
+      if(returnPage(mapserv, template, QUERY, buffer) != MS_SUCCESS) {
         msFreeShape(&(mapserv->resultshape));
         return MS_FAILURE;
       }
@@ -4315,7 +4468,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
     }
 
     if(lp->footer) {
-      if(msReturnPage(mapserv, lp->footer, BROWSE, papszBuffer) != MS_SUCCESS) return MS_FAILURE;
+      if(returnPage(mapserv, lp->footer, BROWSE, buffer) != MS_SUCCESS) return MS_FAILURE;
     }
 
     /* msLayerClose(lp); */
@@ -4323,11 +4476,27 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
   }
 
   if(mapserv->map->web.footer)
-    return msReturnPage(mapserv, mapserv->map->web.footer, BROWSE, papszBuffer);
+    return returnPage(mapserv, mapserv->map->web.footer, BROWSE, buffer);
 
   return MS_SUCCESS;
 }
 
+int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **papszBuffer)
+{
+  int status;
+  msStringBuffer *buffer;
+
+  if(!papszBuffer)
+    return returnNestedTemplateQuery(mapserv, pszMimeType, NULL);
+
+  buffer = msStringBufferAlloc();
+  msStringBufferAppend(buffer, ""); /* empty at first */
+  status = returnNestedTemplateQuery(mapserv, pszMimeType, buffer);
+  *papszBuffer = msStringBufferReleaseStringAndFree(buffer);
+
+  return status;
+}
+
 int msReturnOpenLayersPage(mapservObj *mapserv)
 {
   int i;
@@ -4473,6 +4642,9 @@ mapservObj *msAllocMapServObj()
   mapserv->QueryCoordSource=NONE;
   mapserv->ZoomSize=0; /* zoom absolute magnitude (i.e. > 0) */
 
+  mapserv->templates=NULL;
+  mapserv->numtemplates=0;
+
   return mapserv;
 }
 
@@ -4503,6 +4675,13 @@ void msFreeMapServObj(mapservObj* mapserv)
     msFree(mapserv->SelectLayer);
     msFree(mapserv->QueryFile);
 
+    for(i=0; i<mapserv->numtemplates; i++) {
+      msFreeCharArray(mapserv->templates[i]->lines, mapserv->templates[i]->numlines);
+      msFree(mapserv->templates[i]->name);
+      msFree(mapserv->templates[i]);
+    }
+    msFree(mapserv->templates);
+
     msFree(mapserv);
   }
 }
@@ -49,6 +49,17 @@ enum modes {BROWSE, ZOOMIN, ZOOMOUT, MAP, LEGEND, LEGENDICON, REFERENCE, SCALEBA
            };
 
 
+/* struct templateFileObj
+ * A template file read once and kept by the mapservObj, query templates
+ * are run once per result and would otherwise be re-opened, re-validated
+ * and re-read for each of them.
+*/
+typedef struct {
+  char *name; /* as given in the mapfile, e.g. layer TEMPLATE */
+  char **lines; /* as read by fgets(), magic string line excluded */
+  int numlines;
+} templateFileObj;
+
 /* struct mapservObj
  * Global structure used by templates and mapserver CGI interface.
  *
@@ -132,6 +143,9 @@ typedef struct {
   int NL; /* total number of layers with results */
   int NR; /* total number or results */
   int NLR; /* number of results in a layer */
+
+  templateFileObj **templates; /* template files read so far, see msReturnPage() */
+  int numtemplates;
 } mapservObj;
 
 
@@ -144,7 +144,8 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR",
+  "TIME", "FRIBIDI", "RASTERCAT", "REGEX", "BLANKIMAGE", NULL
 };
 #endif
 
@@ -67,6 +67,9 @@ extern "C" {
 #define TLOCK_OGR       14
 #define TLOCK_TIME      15
 #define TLOCK_FRIBIDI   16
+#define TLOCK_RASTERCAT 17
+#define TLOCK_REGEX     18
+#define TLOCK_BLANKIMAGE 19
 
 #define TLOCK_STATIC_MAX 20
 #define TLOCK_MAX       100
@@ -77,6 +77,7 @@ int msTimeSetup() {
         ms_timeFormats[i].regex = msSmallMalloc(sizeof(ms_regex_t));
         if(0!=ms_regcomp(ms_timeFormats[i].regex, ms_timeFormats[i].pattern, MS_REG_EXTENDED|MS_REG_NOSUB)) {
           msSetError(MS_REGEXERR, "Failed to compile expression (%s).", "msTimeSetup()", ms_timeFormats[i].pattern);
+          msReleaseLock(TLOCK_TIME);
           return MS_FAILURE;
           /* TODO: free already inited regexes */
         }
@@ -304,23 +305,15 @@ int msTimeGetResolution(const char *timestring)
   if (!timestring)
     return -1;
 
+  if(msTimeSetup() != MS_SUCCESS)
+    return -1;
+
   for(i=0; i<MS_NUMTIMEFORMATS; i++) {
-    ms_regex_t *regex = (ms_regex_t *) msSmallMalloc(sizeof(ms_regex_t));
-    if(ms_regcomp(regex, ms_timeFormats[i].pattern,
-                  MS_REG_EXTENDED|MS_REG_NOSUB) != 0) {
-      msSetError(MS_REGEXERR, "Failed to compile expression (%s).", "msParseTime()", ms_timeFormats[i].pattern);
-      msFree(regex);
-      return -1;
-    }
     /* test the expression against the string */
-    if(ms_regexec(regex, timestring, 0, NULL, 0) == 0) {
+    if(ms_regexec(ms_timeFormats[i].regex, timestring, 0, NULL, 0) == 0) {
       /* match    */
-      ms_regfree(regex);
-      msFree(regex);
       return ms_timeFormats[i].resolution;
     }
-    ms_regfree(regex);
-    msFree(regex);
   }
 
   return -1;
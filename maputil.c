@@ -850,7 +850,10 @@ int msSaveImage(mapObj *map, imageObj *img, char *filename)
           if(renderer->getRasterBufferHandle(img,&data) != MS_SUCCESS)
             return MS_FAILURE;
 
-          nReturnVal = msSaveRasterBuffer(map,&data,stream,img->format );
+          if(img->blank)
+            nReturnVal = msSaveBlankRasterBuffer(map,&data,stream,img->format );
+          else
+            nReturnVal = msSaveRasterBuffer(map,&data,stream,img->format );
         } else {
           nReturnVal = renderer->saveImage(img, map, stream, img->format);
         }
@@ -1876,11 +1879,14 @@ void msCleanup(int signal)
     msyystring_buffer = NULL;
   }
   msyylex_destroy();
+  msRegexCacheCleanup();
+  msBlankImageCacheCleanup();
 
 #ifdef USE_OGR
   msOGRCleanup();
 #endif
 #ifdef USE_GDAL
+  msRasterTileCatalogCleanup();
   msGDALCleanup();
 #endif
 #ifdef USE_PROJ
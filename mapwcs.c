@@ -1546,6 +1546,222 @@ static int msWCSGetCoverage_ImageCRSSetup(
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                        msWCSGetStripHeight()                         */
+/*                                                                      */
+/*      Number of lines to render at a time so a raw data coverage      */
+/*      stays within the MS_WCS_STRIP_MEMORY config option (MB,         */
+/*      default 64, 0 to disable), or 0 if it fits in one image or      */
+/*      the output driver can't be written incrementally.               */
+/************************************************************************/
+
+int msWCSGetStripHeight(mapObj *map)
+{
+  outputFormatObj *format = map->outputformat;
+  const char *value;
+  double limit = 64;
+  int pixelsize, stripheight;
+  GDALDriverH hDriver;
+
+  if((value = msGetConfigOption(map, "MS_WCS_STRIP_MEMORY")) != NULL)
+    limit = atof(value);
+  if(limit <= 0 || !format || !MS_RENDERER_RAWDATA(format) || !MS_DRIVER_GDAL(format))
+    return 0;
+
+  if(format->imagemode == MS_IMAGEMODE_INT16)
+    pixelsize = 2;
+  else if(format->imagemode == MS_IMAGEMODE_FLOAT32)
+    pixelsize = 4;
+  else if(format->imagemode == MS_IMAGEMODE_BYTE)
+    pixelsize = 1;
+  else
+    return 0;
+
+  stripheight = (int) MS_MIN(INT_MAX, limit * 1024 * 1024 / ((double) map->width * format->bands * pixelsize));
+  if(stripheight >= map->height)
+    return 0;
+
+  msGDALInitialize();
+  msAcquireLock(TLOCK_GDAL);
+  hDriver = GDALGetDriverByName(format->driver+5);
+  if(hDriver == NULL || GDALGetMetadataItem(hDriver, GDAL_DCAP_CREATE, NULL) == NULL)
+    stripheight = 0;
+  msReleaseLock(TLOCK_GDAL);
+
+  return (stripheight == 0) ? 0 : MS_MAX(2, stripheight);
+}
+
+/************************************************************************/
+/*                      msWCSDrawCoverageStrips()                       */
+/*                                                                      */
+/*      Render the coverage of a layer stripheight lines at a time      */
+/*      straight into a temporary file of the map output format, so     */
+/*      only one strip is held in memory.  Returns the file name, to    */
+/*      pass on to msWCSSendCoverageFile(), or NULL on failure.         */
+/************************************************************************/
+
+char *msWCSDrawCoverageStrips(mapObj *map, layerObj *lp, int stripheight)
+{
+  outputFormatObj *format = map->outputformat;
+  rectObj extent = map->extent, saved_extent = map->saved_extent;
+  geotransformObj gt = map->gt;
+  GDALDriverH hDriver;
+  GDALDatasetH hOutputDS;
+  GDALDataType eDataType = GDT_Byte;
+  char **papszOptions, *filename, *close_connection = NULL;
+  double cellsize_y;
+  int height = map->height, y0 = 0, h, status = MS_SUCCESS;
+
+  if(format->imagemode == MS_IMAGEMODE_INT16)
+    eDataType = GDT_Int16;
+  else if(format->imagemode == MS_IMAGEMODE_FLOAT32)
+    eDataType = GDT_Float32;
+
+  filename = msTmpFile(map, map->mappath, NULL, format->extension ? format->extension : "img.tmp");
+  if(!filename)
+    return NULL;
+
+  /* -------------------------------------------------------------------- */
+  /*      Create the output file with the full coverage size.             */
+  /* -------------------------------------------------------------------- */
+  msAcquireLock(TLOCK_GDAL);
+  hDriver = GDALGetDriverByName(format->driver+5);
+
+  papszOptions = (char **) msSmallCalloc(sizeof(char *), format->numformatoptions+1);
+  memcpy(papszOptions, format->formatoptions, sizeof(char *) * format->numformatoptions);
+  hOutputDS = GDALCreate(hDriver, filename, map->width, map->height, format->bands, eDataType, papszOptions);
+  free(papszOptions);
+
+  if(hOutputDS == NULL) {
+    msReleaseLock(TLOCK_GDAL);
+    msSetError(MS_WCSERR, "Failed to create output %s file.\n%s", "msWCSDrawCoverageStrips()",
+               format->driver+5, CPLGetLastErrorMsg());
+    free(filename);
+    return NULL;
+  }
+
+  /* same georeferencing, nodata value and resolution as msSaveImageGDAL() */
+  msGDALSetOutputMetadata(map, format, format->bands, map->resolution, hOutputDS);
+  msReleaseLock(TLOCK_GDAL);
+
+  /* keep the source files open between strips, closing them as asked after the last one */
+  if(msLayerGetProcessingKey(lp, "CLOSE_CONNECTION") != NULL)
+    close_connection = msStrdup(msLayerGetProcessingKey(lp, "CLOSE_CONNECTION"));
+
+  /* -------------------------------------------------------------------- */
+  /*      Render and write each strip, the map extent refers to the       */
+  /*      centers of the edge pixels.                                     */
+  /* -------------------------------------------------------------------- */
+  cellsize_y = (extent.maxy - extent.miny) / (height - 1);
+
+  while(y0 < height && status == MS_SUCCESS) {
+    imageObj *image;
+
+    h = MS_MIN(stripheight, height - y0);
+    if(height - y0 - h == 1)
+      h++; /* a single line strip would have an empty extent */
+
+    map->height = h;
+    map->extent.maxy = extent.maxy - y0 * cellsize_y;
+    map->extent.miny = extent.maxy - (y0 + h - 1) * cellsize_y;
+    msMapComputeGeotransform(map);
+
+    if(close_connection)
+      msLayerSetProcessingKey(lp, "CLOSE_CONNECTION", (y0 + h < height) ? "DEFER" : close_connection);
+
+    image = msImageCreate(map->width, h, format, map->web.imagepath, map->web.imageurl,
+                          map->resolution, map->defresolution, NULL);
+    if(image == NULL) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    status = msDrawRasterLayerLow(map, lp, image, NULL);
+
+    if(status == MS_SUCCESS) {
+      void *pData = image->img.raw_byte;
+
+      if(format->imagemode == MS_IMAGEMODE_INT16)
+        pData = image->img.raw_16bit;
+      else if(format->imagemode == MS_IMAGEMODE_FLOAT32)
+        pData = image->img.raw_float;
+
+      msAcquireLock(TLOCK_GDAL);
+      if(GDALDatasetRasterIO(hOutputDS, GF_Write, 0, y0, map->width, h, pData, map->width, h,
+                             eDataType, format->bands, NULL, 0, 0, 0) != CE_None) {
+        msSetError(MS_WCSERR, "Failed to write lines %d to %d of the coverage.\n%s", "msWCSDrawCoverageStrips()",
+                   y0, y0 + h - 1, CPLGetLastErrorMsg());
+        status = MS_FAILURE;
+      }
+      msReleaseLock(TLOCK_GDAL);
+    }
+
+    msFreeImage(image);
+    y0 += h;
+  }
+
+  map->extent = extent;
+  map->saved_extent = saved_extent;
+  map->height = height;
+  map->gt = gt;
+  if(close_connection) {
+    msLayerSetProcessingKey(lp, "CLOSE_CONNECTION", close_connection);
+    free(close_connection);
+  }
+
+  msAcquireLock(TLOCK_GDAL);
+  GDALClose(hOutputDS);
+  if(status != MS_SUCCESS)
+    VSIUnlink(filename);
+  msReleaseLock(TLOCK_GDAL);
+
+#ifdef USE_EXEMPI
+  /* license info, as msSaveImageGDAL() adds it */
+  if(status == MS_SUCCESS && msXmpPresent(map) && msXmpWrite(map, filename) == MS_FAILURE) {
+    msSetError(MS_WCSERR, "XMP write to %s failed.", "msWCSDrawCoverageStrips()", filename);
+    VSIUnlink(filename);
+    status = MS_FAILURE;
+  }
+#endif
+
+  if(status != MS_SUCCESS) {
+    free(filename);
+    return NULL;
+  }
+
+  return filename;
+}
+
+/************************************************************************/
+/*                       msWCSSendCoverageFile()                        */
+/*                                                                      */
+/*      Stream a file from msWCSDrawCoverageStrips() to the client      */
+/*      and remove it.  The headers must have been sent.                */
+/************************************************************************/
+
+int msWCSSendCoverageFile(char *filename)
+{
+  VSILFILE *fp;
+  unsigned char block[16384];
+  int bytes_read, status = MS_SUCCESS;
+
+  if(msIO_needBinaryStdout() == MS_FAILURE)
+    status = MS_FAILURE;
+  else if((fp = VSIFOpenL(filename, "rb")) == NULL) {
+    msSetError(MS_WCSERR, "Failed to open %s for streaming to stdout.", "msWCSSendCoverageFile()", filename);
+    status = MS_FAILURE;
+  } else {
+    while((bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0)
+      msIO_fwrite(block, 1, bytes_read, stdout);
+    VSIFCloseL(fp);
+  }
+
+  VSIUnlink(filename);
+  free(filename);
+
+  return status;
+}
+
 /************************************************************************/
 /*                          msWCSGetCoverage()                          */
 /************************************************************************/
@@ -1555,7 +1771,7 @@ static int msWCSGetCoverage(mapObj *map, cgiRequestObj *request,
 {
   imageObj   *image;
   layerObj   *lp;
-  int         status, i;
+  int         status, i, stripheight;
   const char *value;
   outputFormatObj *format;
   char *bandlist=NULL;
@@ -1926,6 +2142,27 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
   msSetOutputFormatOption(map->outputformat, "BAND_COUNT", numbands);
   free( bandlist );
 
+  /* large raw coverages are rendered and sent in strips, WCS 1.1 needs the image */
+  if( strncmp(params->version, "1.1",3) != 0 && !lp->mask
+      && (stripheight = msWCSGetStripHeight(map)) > 0 ) {
+    const char *fo_filename;
+    char *filename;
+
+    if( (filename = msWCSDrawCoverageStrips(map, lp, stripheight)) == NULL )
+      return msWCSException(map, NULL, NULL, params->version );
+
+    fo_filename = msGetOutputFormatOption( format, "FILENAME", NULL );
+    if( fo_filename )
+      msIO_setHeader("Content-Disposition","attachment; filename=%s",
+                     fo_filename );
+    msIO_setHeader("Content-Type",MS_IMAGE_MIME_TYPE(map->outputformat));
+    msIO_sendHeaders();
+    status = msWCSSendCoverageFile(filename);
+
+    msApplyOutputFormat(&(map->outputformat), NULL, MS_NOOVERRIDE, MS_NOOVERRIDE, MS_NOOVERRIDE);
+    return status;
+  }
+
   /* create the image object  */
   if(!map->outputformat) {
     msSetError(MS_WCSERR, "The map outputformat is missing!", "msWCSGetCoverage()");
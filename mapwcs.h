@@ -101,6 +101,9 @@ void msWCSSetDefaultBandsRangeSetInfo( wcsParamsObj *params,
                                        coverageMetadataObj *cm,
                                        layerObj *lp );
 const char *msWCSGetRequestParameter(cgiRequestObj *request, char *name);
+int msWCSGetStripHeight(mapObj *map);
+char *msWCSDrawCoverageStrips(mapObj *map, layerObj *lp, int stripheight);
+int msWCSSendCoverageFile(char *filename);
 
 /* -------------------------------------------------------------------- */
 /*      Some WCS 1.1 specific functions from mapwcs11.c                 */
@@ -3134,7 +3134,7 @@ int msWCSGetCoverage20(mapObj *map, cgiRequestObj *request,
   rectObj subsets, bbox;
   projectionObj imageProj;
 
-  int status, i;
+  int status, i, stripheight;
   double x_1, x_2, y_1, y_2;
   char *coverageName, *bandlist=NULL, numbands[8];
 
@@ -3478,6 +3478,34 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msLayerSetProcessingKey(layer, "CLOSE_CONNECTION", "NORMAL");
   }
 
+  /* large raw coverages without GML are rendered and sent in strips */
+  if (params->multipart == MS_FALSE && !layer->mask
+      && (stripheight = msWCSGetStripHeight(map)) > 0) {
+    const char *fo_filename;
+    char *filename;
+
+    msFree(bandlist);
+    msWCSClearCoverageMetadata20(&cm);
+
+    if ((filename = msWCSDrawCoverageStrips(map, layer, stripheight)) == NULL)
+      return msWCSException(map, NULL, NULL, params->version);
+
+    fo_filename = msGetOutputFormatOption(map->outputformat, "FILENAME", NULL);
+    msIO_setHeader("Content-Type",MS_IMAGE_MIME_TYPE(map->outputformat));
+    msIO_setHeader("Content-Description","coverage data");
+    msIO_setHeader("Content-Transfer-Encoding","binary");
+    if (fo_filename != NULL) {
+      msIO_setHeader("Content-ID","coverage/%s",fo_filename);
+      msIO_setHeader("Content-Disposition","INLINE; filename=%s",fo_filename);
+    } else {
+      msIO_setHeader("Content-ID","coverage/wcs.%s",MS_IMAGE_EXTENSION(map->outputformat));
+      msIO_setHeader("Content-Disposition","INLINE");
+    }
+    msIO_sendHeaders();
+
+    return msWCSSendCoverageFile(filename);
+  }
+
   /* create the image object  */
   if (!map->outputformat) {
     msWCSClearCoverageMetadata20(&cm);
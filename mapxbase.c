@@ -34,6 +34,12 @@
 #include <stdlib.h> /* for atof() and atoi() */
 #include <math.h>
 
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 
 
 /* try to use a large file version of fseek for files up to 4GB (#3514) */
@@ -239,6 +245,34 @@ DBFHandle msDBFOpen( const char * pszFilename, const char * pszAccess )
         psDBF->panFieldOffset[iField-1] + psDBF->panFieldSize[iField-1];
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      Map read only files, records are then read in place instead     */
+  /*      of being copied to pszCurrentRecord. Truncated files and        */
+  /*      failures fall back to regular reads.                            */
+  /*                                                                      */
+  /*      The mapping is private but pages not read yet still come from   */
+  /*      the file: a DBF file must not be rewritten in place while it is */
+  /*      open (replace it with a new file instead), and truncating it    */
+  /*      makes the reads past the new end fail with SIGBUS.              */
+  /* -------------------------------------------------------------------- */
+  psDBF->pabyMap = NULL;
+  psDBF->nMapSize = 0;
+#ifndef _WIN32
+  if( strchr(pszAccess, '+') == NULL && nRecLen > 0 ) {
+    struct stat sStat;
+
+    if( fstat(fileno(psDBF->fp), &sStat) == 0 &&
+        !(sStat.st_size < 0 || (uintmax_t) sStat.st_size > SIZE_MAX) &&
+        (off_t) nHeadLen + (off_t) nRecLen * nRecords <= sStat.st_size ) {
+      void *pMap = mmap(NULL, (size_t) sStat.st_size, PROT_READ, MAP_PRIVATE, fileno(psDBF->fp), 0);
+      if( pMap != MAP_FAILED ) {
+        psDBF->pabyMap = (uchar *) pMap;
+        psDBF->nMapSize = (size_t) sStat.st_size;
+      }
+    }
+  }
+#endif
+
   return( psDBF );
 }
 
@@ -282,6 +316,10 @@ void  msDBFClose(DBFHandle psDBF)
   /* -------------------------------------------------------------------- */
   /*      Close, and free resources.                                      */
   /* -------------------------------------------------------------------- */
+#ifndef _WIN32
+  if( psDBF->pabyMap )
+    munmap( psDBF->pabyMap, psDBF->nMapSize );
+#endif
   fclose( psDBF->fp );
 
   if( psDBF->panFieldOffset != NULL ) {
@@ -354,6 +392,9 @@ DBFHandle msDBFCreate( const char * pszFilename )
   psDBF->pszStringField = NULL;
   psDBF->nStringFieldLen = 0;
 
+  psDBF->pabyMap = NULL;
+  psDBF->nMapSize = 0;
+
   psDBF->bNoHeader = MS_TRUE;
   psDBF->bUpdated = MS_FALSE;
 
@@ -483,17 +524,20 @@ int DBFIsValueNULL( const char* pszValue, char type )
 }
 
 /************************************************************************/
-/*                          msDBFReadAttribute()                        */
+/*                         msDBFGetFieldView()                          */
 /*                                                                      */
-/*      Read one of the attribute fields of a record.                   */
+/*      Locate one of the attribute fields of a record without copying  */
+/*      it. Trailing blanks, leading blanks of numeric fields and NULL  */
+/*      numeric values are handled like msDBFReadAttribute() does. The  */
+/*      value is not nul terminated, its length is in *pnLength. It is  */
+/*      valid until the next read from psDBF.                           */
 /************************************************************************/
-static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
+static const char *msDBFGetFieldView(DBFHandle psDBF, int hEntity, int iField, int *pnLength)
 
 {
-  int         i;
-  unsigned int nRecordOffset;
-  uchar *pabyRec;
-  char  *pReturnField = NULL;
+  const char *pszField;
+  const char *pszEnd;
+  char        chType;
 
   /* -------------------------------------------------------------------- */
   /*  Is the request valid?                             */
@@ -509,67 +553,87 @@ static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
   }
 
   /* -------------------------------------------------------------------- */
-  /*  Have we read the record?              */
+  /*  Locate the record, in the mapped file or by reading it.           */
   /* -------------------------------------------------------------------- */
-  if( psDBF->nCurrentRecord != hEntity ) {
-    flushRecord( psDBF );
+  if( psDBF->pabyMap ) {
+    pszField = (const char *) psDBF->pabyMap + psDBF->nHeaderLength
+               + (size_t) psDBF->nRecordLength * hEntity;
+  } else {
+    if( psDBF->nCurrentRecord != hEntity ) {
+      unsigned int nRecordOffset;
 
-    nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
+      flushRecord( psDBF );
 
-    safe_fseek( psDBF->fp, nRecordOffset, 0 );
-    fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
+      nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
 
-    psDBF->nCurrentRecord = hEntity;
-  }
-
-  pabyRec = (uchar *) psDBF->pszCurrentRecord;
-  /* DEBUG */
-  /* printf("CurrentRecord(%c):%s\n", psDBF->pachFieldType[iField], pabyRec); */
+      safe_fseek( psDBF->fp, nRecordOffset, 0 );
+      fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
 
-  /* -------------------------------------------------------------------- */
-  /*  Ensure our field buffer is large enough to hold this buffer.      */
-  /* -------------------------------------------------------------------- */
-  if( psDBF->panFieldSize[iField]+1 > psDBF->nStringFieldLen ) {
-    psDBF->nStringFieldLen = psDBF->panFieldSize[iField]*2 + 10;
-    psDBF->pszStringField = (char *) SfRealloc(psDBF->pszStringField,psDBF->nStringFieldLen);
+      psDBF->nCurrentRecord = hEntity;
+    }
+    pszField = psDBF->pszCurrentRecord;
   }
+  /* DEBUG */
+  /* printf("CurrentRecord(%c):%s\n", psDBF->pachFieldType[iField], pszField); */
 
-  /* -------------------------------------------------------------------- */
-  /*  Extract the requested field.              */
-  /* -------------------------------------------------------------------- */
-  strncpy( psDBF->pszStringField,(char *) pabyRec+psDBF->panFieldOffset[iField], psDBF->panFieldSize[iField] );
-  psDBF->pszStringField[psDBF->panFieldSize[iField]] = '\0';
+  pszField += psDBF->panFieldOffset[iField];
+  pszEnd = memchr( pszField, '\0', psDBF->panFieldSize[iField] );
+  if( pszEnd == NULL )
+    pszEnd = pszField + psDBF->panFieldSize[iField];
 
   /*
   ** Trim trailing blanks (SDL Modification)
   */
-  for(i=strlen(psDBF->pszStringField)-1; i>=0; i--) {
-    if(psDBF->pszStringField[i] != ' ') {
-      psDBF->pszStringField[i+1] = '\0';
-      break;
-    }
-  }
-
-  if(i == -1) psDBF->pszStringField[0] = '\0'; /* whole string is blank (SDL fix)       */
+  while( pszEnd > pszField && pszEnd[-1] == ' ' )
+    pszEnd--;
 
   /*
   ** Trim/skip leading blanks (SDL/DM Modification - only on numeric types)
   */
-  if( psDBF->pachFieldType[iField] == 'N' || psDBF->pachFieldType[iField] == 'F' || psDBF->pachFieldType[iField] == 'D' ) {
-    for(i=0; psDBF->pszStringField[i] != '\0' ; i++) {
-      if(psDBF->pszStringField[i] != ' ')
-        break;
+  chType = psDBF->pachFieldType[iField];
+  if( chType == 'N' || chType == 'F' || chType == 'D' ) {
+    while( pszField < pszEnd && *pszField == ' ' )
+      pszField++;
+
+    /*  detect null values */
+    if( (chType == 'D' && pszEnd - pszField >= 8 && strncmp(pszField, "00000000", 8) == 0) ||
+        (chType != 'D' && pszEnd > pszField && *pszField == '*') ) {
+      *pnLength = 1;
+      return( "0" );
     }
-    pReturnField = psDBF->pszStringField+i;
-  } else
-    pReturnField = psDBF->pszStringField;
-
-  /*  detect null values */
-  if ( DBFIsValueNULL( pReturnField, psDBF->pachFieldType[iField] )  ) {
-    if (psDBF->pachFieldType[iField] == 'N' || psDBF->pachFieldType[iField] == 'F' || psDBF->pachFieldType[iField] == 'D')
-      pReturnField="0";
   }
-  return( pReturnField );
+
+  *pnLength = (int) (pszEnd - pszField);
+  return( pszField );
+}
+
+/************************************************************************/
+/*                          msDBFReadAttribute()                        */
+/*                                                                      */
+/*      Read one of the attribute fields of a record.                   */
+/************************************************************************/
+static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
+
+{
+  const char *pszField;
+  int         nLength;
+
+  pszField = msDBFGetFieldView( psDBF, hEntity, iField, &nLength );
+  if( pszField == NULL )
+    return( NULL );
+
+  /* -------------------------------------------------------------------- */
+  /*  Ensure our field buffer is large enough to hold this buffer.      */
+  /* -------------------------------------------------------------------- */
+  if( nLength+1 > psDBF->nStringFieldLen ) {
+    psDBF->nStringFieldLen = psDBF->panFieldSize[iField]*2 + 10;
+    psDBF->pszStringField = (char *) SfRealloc(psDBF->pszStringField,psDBF->nStringFieldLen);
+  }
+
+  memcpy( psDBF->pszStringField, pszField, nLength );
+  psDBF->pszStringField[nLength] = '\0';
+
+  return( psDBF->pszStringField );
 }
 
 /************************************************************************/
@@ -878,7 +942,7 @@ char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes, int nu
 {
   const char *value;
   char **values=NULL;
-  int i;
+  int i, length;
 
   if(numitems == 0) return(NULL);
 
@@ -886,12 +950,40 @@ char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes, int nu
   MS_CHECK_ALLOC(values, sizeof(char *)*numitems, NULL);
 
   for(i=0; i<numitems; i++) {
-    value = msDBFReadStringAttribute(dbffile, record, itemindexes[i]);
+    value = msDBFGetFieldView(dbffile, record, itemindexes[i], &length);
     if (value == NULL) {
+      while(--i >= 0) free(values[i]);
       free(values);
-      return NULL; /* Error already reported by msDBFReadStringAttribute() */
+      return NULL; /* Error already reported by msDBFGetFieldView() */
     }
-    values[i] = msStrdup(value);
+    values[i] = (char *) msSmallMalloc(length+1);
+    memcpy(values[i], value, length);
+    values[i][length] = '\0';
+  }
+
+  return(values);
+}
+
+/*
+** Same as msDBFGetValueList() but the values are carved out of a shape arena.
+*/
+char **msDBFGetArenaValueList(DBFHandle dbffile, int record, int *itemindexes, int numitems, shapeArenaObj *arena)
+{
+  const char *value;
+  char **values=NULL;
+  int i, length;
+
+  if(numitems == 0) return(NULL);
+
+  values = (char **)msShapeArenaAlloc(arena, sizeof(char *)*numitems);
+
+  for(i=0; i<numitems; i++) {
+    value = msDBFGetFieldView(dbffile, record, itemindexes[i], &length);
+    if (value == NULL)
+      return NULL; /* Error already reported by msDBFGetFieldView() */
+    values[i] = (char *) msShapeArenaAlloc(arena, length+1);
+    memcpy(values[i], value, length);
+    values[i][length] = '\0';
   }
 
   return(values);
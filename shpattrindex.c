@@ -0,0 +1,93 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Command line utility to write attribute indexes (.aix) for the
+ *           fields of a shapefile, used by shapefile layer filters.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapserver.h"
+
+int main(int argc, char *argv[])
+{
+  shapefileObj shapefile;
+  char szField[12], szPath[MS_MAXPATHLEN];
+  DBFFieldType type;
+  int i, iField, status = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(argc<3) {
+    fprintf(stdout,"Syntax:\n");
+    fprintf(stdout,"    shpattrindex <shpfile> <field> [<field>...]\n" );
+    fprintf(stdout,"Where:\n");
+    fprintf(stdout," <shpfile> is the name of the .shp file whose attributes to index.\n");
+    fprintf(stdout," <field>   is the name of a .dbf field to index.\n");
+    fprintf(stdout,"The index of a field is written to <shpfile>.<field>.aix. Numeric fields\n");
+    fprintf(stdout,"are indexed for =, <, <=, > and >= comparisons, character fields for =.\n");
+    fprintf(stdout,"Layer filters comparing indexed fields to a value then only read the\n");
+    fprintf(stdout,"matching records. Run shpattrindex again whenever the shapefile is\n");
+    fprintf(stdout,"modified, indexes that don't match the record count are ignored.\n");
+    exit(0);
+  }
+
+  if(msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    fprintf(stdout, "Error opening shapefile %s.\n", argv[1]);
+    exit(1);
+  }
+
+  if(!shapefile.hDBF) {
+    fprintf(stdout, "Shapefile %s has no .dbf file.\n", argv[1]);
+    exit(1);
+  }
+
+  for(i=2; i<argc; i++) {
+    if((iField = msDBFGetItemIndex(shapefile.hDBF, argv[i])) < 0) {
+      fprintf(stdout, "Field %s not found in %s.\n", argv[i], argv[1]);
+      status = 1;
+      continue;
+    }
+
+    type = msDBFGetFieldInfo(shapefile.hDBF, iField, szField, NULL, NULL);
+    msShapefileGetAttrIndexFilename(szPath, argv[1], szField);
+
+    printf("creating %s index of field %s in %s\n", (type == FTString) ? "character" : "numeric", szField, szPath);
+    if(msWriteAttrIndex(shapefile.hDBF, iField, szPath) != MS_SUCCESS) {
+      msWriteError(stdout);
+      status = 1;
+    }
+  }
+
+  msShapefileClose(&shapefile);
+
+  return(status);
+}
@@ -0,0 +1,279 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Command line utility to write generalized versions of a line or
+ *           polygon shapefile, read by shapefile layers at small scales.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "mapserver.h"
+
+#define DEFAULT_LEVELS 4
+#define LEVEL_FACTOR 4 /* tolerance ratio between two levels */
+
+#ifndef USE_GEOS
+/* squared distance of p to the segment a-b */
+static double segmentDistance2(pointObj *p, pointObj *a, pointObj *b)
+{
+  double dx = b->x - a->x, dy = b->y - a->y, t;
+
+  if(dx == 0 && dy == 0)
+    return (p->x - a->x) * (p->x - a->x) + (p->y - a->y) * (p->y - a->y);
+
+  t = ((p->x - a->x) * dx + (p->y - a->y) * dy) / (dx * dx + dy * dy);
+  if(t < 0) t = 0;
+  else if(t > 1) t = 1;
+
+  dx = a->x + t * dx - p->x;
+  dy = a->y + t * dy - p->y;
+  return dx * dx + dy * dy;
+}
+
+/* Douglas-Peucker, marks the points to keep between first and last */
+static void simplifyRange(pointObj *points, char *keep, int first, int last, double tolerance2)
+{
+  int i, index = -1;
+  double d, dmax = tolerance2;
+
+  for(i = first + 1; i < last; i++) {
+    d = segmentDistance2(&points[i], &points[first], &points[last]);
+    if(d > dmax) {
+      dmax = d;
+      index = i;
+    }
+  }
+
+  if(index > 0) {
+    keep[index] = 1;
+    simplifyRange(points, keep, first, index, tolerance2);
+    simplifyRange(points, keep, index, last, tolerance2);
+  }
+}
+
+/*
+** Simplify each part on its own. Rings collapsing to less than 4 points and lines
+** shorter than the tolerance are dropped, the topology between parts isn't checked.
+*/
+static shapeObj *simplifyShape(shapeObj *shape, double tolerance)
+{
+  shapeObj *simplified;
+  lineObj line;
+  char *keep;
+  int i, j, minpoints;
+
+  simplified = (shapeObj *) msSmallMalloc(sizeof(shapeObj));
+  msInitShape(simplified);
+  simplified->type = shape->type;
+
+  minpoints = (shape->type == MS_SHAPE_POLYGON) ? 4 : 2;
+
+  for(i = 0; i < shape->numlines; i++) {
+    lineObj *part = &shape->line[i];
+
+    if(part->numpoints < minpoints)
+      continue;
+
+    keep = (char *) msSmallCalloc(part->numpoints, sizeof(char));
+    keep[0] = keep[part->numpoints - 1] = 1;
+
+    if(shape->type == MS_SHAPE_POLYGON) {
+      /* split the ring at its farthest point to avoid a degenerate first segment */
+      int index = 0;
+      double d, dmax = -1;
+      for(j = 1; j < part->numpoints - 1; j++) {
+        d = segmentDistance2(&part->point[j], &part->point[0], &part->point[0]);
+        if(d > dmax) {
+          dmax = d;
+          index = j;
+        }
+      }
+      keep[index] = 1;
+      simplifyRange(part->point, keep, 0, index, tolerance * tolerance);
+      simplifyRange(part->point, keep, index, part->numpoints - 1, tolerance * tolerance);
+    } else
+      simplifyRange(part->point, keep, 0, part->numpoints - 1, tolerance * tolerance);
+
+    line.numpoints = 0;
+    line.point = (pointObj *) msSmallMalloc(sizeof(pointObj) * part->numpoints);
+    for(j = 0; j < part->numpoints; j++) {
+      if(keep[j])
+        line.point[line.numpoints++] = part->point[j];
+    }
+
+    if(line.numpoints >= minpoints &&
+        !(line.numpoints == 2 && segmentDistance2(&line.point[0], &line.point[1], &line.point[1]) < tolerance * tolerance))
+      msAddLine(simplified, &line);
+
+    free(line.point);
+    free(keep);
+  }
+
+  return simplified;
+}
+#endif
+
+static shapeObj *generalizeShape(shapeObj *shape, double tolerance)
+{
+#ifdef USE_GEOS
+  return msGEOSTopologyPreservingSimplify(shape, tolerance);
+#else
+  return simplifyShape(shape, tolerance);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+  shapefileObj shapefile;
+  SHPHandle hSHP;
+  shapeObj shape, *simplified;
+  char szPath[MS_MAXPATHLEN];
+  double tolerance = 0;
+  int numlevels = DEFAULT_LEVELS;
+  int i, level, numvertices, numgenvertices;
+  FILE *fp;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(argc<2) {
+    fprintf(stdout,"Syntax:\n");
+    fprintf(stdout,"    shpgen <shpfile> [<levels>] [<tolerance>]\n" );
+    fprintf(stdout,"Where:\n");
+    fprintf(stdout," <shpfile>   is the name of the line or polygon .shp file to generalize.\n");
+    fprintf(stdout," <levels>    (optional) is the number of generalized levels to write,\n");
+    fprintf(stdout,"             default is %d.\n", DEFAULT_LEVELS);
+    fprintf(stdout," <tolerance> (optional) is the simplification tolerance of the first\n");
+    fprintf(stdout,"             level in the shapefile units, each further level being %d\n", LEVEL_FACTOR);
+    fprintf(stdout,"             times coarser. The default is 1/8192 of the shapefile extent.\n");
+    fprintf(stdout,"Level n is written to <shpfile>.gen<n>.shp/.shx and the tolerances to\n");
+    fprintf(stdout,"<shpfile>.gen. The layer uses a level once the map cellsize reaches its\n");
+    fprintf(stdout,"tolerance. Run shpgen again whenever the shapefile is modified.\n");
+    exit(0);
+  }
+
+  if(argc >= 3)
+    numlevels = atoi(argv[2]);
+  if(numlevels < 1 || numlevels > MS_SHP_MAXGENLEVELS) {
+    fprintf(stdout, "The number of levels must be between 1 and %d.\n", MS_SHP_MAXGENLEVELS);
+    exit(1);
+  }
+
+  if(argc >= 4)
+    tolerance = atof(argv[3]);
+
+  if(msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    fprintf(stdout, "Error opening shapefile %s.\n", argv[1]);
+    exit(1);
+  }
+
+  if(shapefile.type != SHP_ARC && shapefile.type != SHP_POLYGON &&
+      shapefile.type != SHP_ARCZ && shapefile.type != SHP_POLYGONZ &&
+      shapefile.type != SHP_ARCM && shapefile.type != SHP_POLYGONM) {
+    fprintf(stdout, "Only line and polygon shapefiles can be generalized.\n");
+    exit(1);
+  }
+
+  if(tolerance <= 0)
+    tolerance = MS_MAX(shapefile.bounds.maxx - shapefile.bounds.minx,
+                       shapefile.bounds.maxy - shapefile.bounds.miny) / 8192;
+
+  /* remove the level list first, readers ignore the levels while they are written */
+  unlink(msShapefileGetGenFilename(szPath, argv[1], 0));
+
+  for(level = 1; level <= numlevels; level++) {
+    hSHP = msSHPCreate(msShapefileGetGenFilename(szPath, argv[1], level), shapefile.type);
+    if(!hSHP) {
+      msWriteError(stdout);
+      exit(1);
+    }
+
+    numvertices = numgenvertices = 0;
+    msInitShape(&shape);
+
+    for(i = 0; i < shapefile.numshapes; i++) {
+      int j;
+
+      msSHPReadShape(shapefile.hSHP, i, &shape);
+      for(j = 0; j < shape.numlines; j++)
+        numvertices += shape.line[j].numpoints;
+
+      simplified = NULL;
+      if(shape.type != MS_SHAPE_NULL)
+        simplified = generalizeShape(&shape, tolerance);
+
+      if(simplified) {
+        for(j = 0; j < simplified->numlines; j++)
+          numgenvertices += simplified->line[j].numpoints;
+        if(simplified->numlines == 0)
+          simplified->type = MS_SHAPE_NULL; /* vanished at this tolerance */
+        msSHPWriteShape(hSHP, simplified);
+        msFreeShape(simplified);
+        free(simplified);
+      } else {
+        /* keep the records aligned with the original shapefile */
+        msFreeShape(&shape);
+        msInitShape(&shape);
+        msSHPWriteShape(hSHP, &shape);
+      }
+
+      msFreeShape(&shape);
+    }
+
+    msSHPClose(hSHP);
+
+    printf("level %d: tolerance %g, %d of %d vertices kept\n", level, tolerance,
+           numgenvertices, numvertices);
+
+    tolerance *= LEVEL_FACTOR;
+  }
+
+  /* the level list is written last */
+  if((fp = fopen(msShapefileGetGenFilename(szPath, argv[1], 0), "w")) == NULL) {
+    fprintf(stdout, "Error writing %s.\n", szPath);
+    exit(1);
+  }
+
+  fprintf(fp, "# generalized levels of %s written by shpgen: <level> <tolerance>\n", argv[1]);
+  tolerance /= pow(LEVEL_FACTOR, numlevels);
+  for(level = 1; level <= numlevels; level++) {
+    fprintf(fp, "%d %.15g\n", level, tolerance);
+    tolerance *= LEVEL_FACTOR;
+  }
+  fclose(fp);
+
+  /*
+  ** Clean things up
+  */
+  msShapefileClose(&shapefile);
+
+  return(0);
+}
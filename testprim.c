@@ -0,0 +1,218 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Micro-benchmark of the primitive transform, bounds and clipping
+ *           kernels, comparing the scalar and vector versions on a shapefile.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapserver.h"
+#include "maptime.h"
+
+#define DEFAULT_ITERATIONS 20
+
+#define MULTIPART_SIZE 8 /* shapes merged into each shape of the multipart clipping run */
+
+enum { BENCH_ROUND, BENCH_DOUBLE, BENCH_BOUNDS, BENCH_CLIP, BENCH_CLIP_MULTIPART, BENCH_COUNT };
+
+static const char *benchNames[BENCH_COUNT] = { "transform (round)", "transform (double)", "bounds", "clip", "clip (multipart)" };
+static const char *kernelNames[] = { "ref", "scalar", "sse2", "avx2" }; /* indexed by kernels + 1 */
+
+/* order dependent checksum of the coordinates, to check all kernels agree with the reference code */
+static unsigned long checksumShapes(shapeObj *shapes, int numshapes)
+{
+  unsigned long sum = 5381;
+  unsigned char *c;
+  int i, j, k;
+  size_t b;
+
+  for(i=0; i<numshapes; i++) {
+    c = (unsigned char *) &(shapes[i].bounds);
+    for(b=0; b<sizeof(rectObj); b++) sum = sum * 33 + c[b];
+    for(j=0; j<shapes[i].numlines; j++) {
+      sum = sum * 33 + shapes[i].line[j].numpoints;
+      for(k=0; k<shapes[i].line[j].numpoints; k++) {
+        c = (unsigned char *) &(shapes[i].line[j].point[k]);
+        for(b=0; b<2*sizeof(double); b++) sum = sum * 33 + c[b];
+      }
+    }
+  }
+
+  return sum;
+}
+
+static double runBench(int bench, shapeObj *shapes, int numshapes, int iterations, rectObj extent, double cellsize, rectObj cliprect, unsigned long *checksum)
+{
+  shapeObj *work;
+  struct mstimeval start, end;
+  double elapsed = 0;
+  int i, n;
+
+  work = (shapeObj *) msSmallCalloc(numshapes, sizeof(shapeObj));
+
+  for(n=0; n<iterations; n++) {
+    for(i=0; i<numshapes; i++) {
+      msInitShape(&work[i]);
+      msCopyShape(&shapes[i], &work[i]);
+    }
+
+    msGettimeofday(&start, NULL);
+    for(i=0; i<numshapes; i++) {
+      switch(bench) {
+        case BENCH_ROUND:
+          msTransformShapeToPixelRound(&work[i], extent, cellsize);
+          break;
+        case BENCH_DOUBLE:
+          msTransformShapeToPixelDoublePrecision(&work[i], extent, cellsize);
+          break;
+        case BENCH_BOUNDS:
+          msComputeBounds(&work[i]);
+          break;
+        case BENCH_CLIP:
+        case BENCH_CLIP_MULTIPART:
+          if(work[i].type == MS_SHAPE_POLYGON)
+            msClipPolygonRect(&work[i], cliprect);
+          else
+            msClipPolylineRect(&work[i], cliprect);
+          break;
+      }
+    }
+    msGettimeofday(&end, NULL);
+    elapsed += (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0;
+
+    if(n == iterations-1)
+      *checksum = checksumShapes(work, numshapes);
+    for(i=0; i<numshapes; i++)
+      msFreeShape(&work[i]);
+  }
+
+  free(work);
+  return elapsed / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+  shapefileObj shapefile;
+  shapeObj *shapes, *multipart;
+  rectObj extent, cliprect;
+  double cellsize, reference[BENCH_COUNT], elapsed;
+  unsigned long refsum[BENCH_COUNT], checksum = 0;
+  int iterations = DEFAULT_ITERATIONS;
+  int i, j, numshapes, nummultipart, numpoints = 0, bench, kernels, best, status = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(argc < 2) {
+    fprintf(stdout,"Syntax:\n");
+    fprintf(stdout,"    testprim <shpfile> [<iterations>]\n" );
+    fprintf(stdout,"Times the map to image transforms, msComputeBounds() and the rectangle\n");
+    fprintf(stdout,"clipping over all the shapes of <shpfile> with each available set of\n");
+    fprintf(stdout,"kernels, and checks they all produce the results of the reference code\n");
+    fprintf(stdout,"(the scalar code without the clipping shortcuts).\n");
+    exit(0);
+  }
+
+  if(argc >= 3)
+    iterations = MS_MAX(1, atoi(argv[2]));
+
+  if(msShapefileOpen(&shapefile, "rb", argv[1], MS_TRUE) == -1) {
+    msWriteError(stdout);
+    exit(1);
+  }
+
+  shapes = (shapeObj *) msSmallCalloc(shapefile.numshapes, sizeof(shapeObj));
+  for(i=0, numshapes=0; i<shapefile.numshapes; i++) {
+    msInitShape(&shapes[numshapes]);
+    msSHPReadShape(shapefile.hSHP, i, &shapes[numshapes]);
+    if(shapes[numshapes].type == MS_SHAPE_NULL || shapes[numshapes].numlines == 0) {
+      msFreeShape(&shapes[numshapes]);
+      continue;
+    }
+    for(j=0; j<shapes[numshapes].numlines; j++)
+      numpoints += shapes[numshapes].line[j].numpoints;
+    numshapes++;
+  }
+
+  /* merge consecutive shapes of the same type, so the clipper sees parts */
+  /* inside the rectangle in shapes that are not */
+  multipart = (shapeObj *) msSmallCalloc(numshapes, sizeof(shapeObj));
+  for(i=0, nummultipart=0; i<numshapes; nummultipart++) {
+    msInitShape(&multipart[nummultipart]);
+    multipart[nummultipart].type = shapes[i].type;
+    for(j=0; j<MULTIPART_SIZE && i<numshapes && shapes[i].type == multipart[nummultipart].type; j++, i++) {
+      int k;
+      for(k=0; k<shapes[i].numlines; k++)
+        msAddLine(&multipart[nummultipart], &(shapes[i].line[k]));
+    }
+    msComputeBounds(&multipart[nummultipart]);
+  }
+
+  /* a 1024 pixel wide image of the whole file, clipped to its central half */
+  extent = shapefile.bounds;
+  cellsize = MS_MAX(extent.maxx - extent.minx, extent.maxy - extent.miny) / 1024;
+  if(cellsize <= 0) cellsize = 1;
+  cliprect.minx = extent.minx + (extent.maxx - extent.minx) / 4;
+  cliprect.maxx = extent.maxx - (extent.maxx - extent.minx) / 4;
+  cliprect.miny = extent.miny + (extent.maxy - extent.miny) / 4;
+  cliprect.maxy = extent.maxy - (extent.maxy - extent.miny) / 4;
+
+  printf("%s: %d shapes, %d points, %d iterations\n", argv[1], numshapes, numpoints, iterations);
+
+  best = msSetPrimitiveKernels(MS_PRIMITIVE_KERNELS_AVX2);
+  for(kernels = MS_PRIMITIVE_KERNELS_REFERENCE; kernels <= best; kernels++) {
+    msSetPrimitiveKernels(kernels);
+    for(bench = 0; bench < BENCH_COUNT; bench++) {
+      if(bench == BENCH_CLIP_MULTIPART)
+        elapsed = runBench(bench, multipart, nummultipart, iterations, extent, cellsize, cliprect, &checksum);
+      else
+        elapsed = runBench(bench, shapes, numshapes, iterations, extent, cellsize, cliprect, &checksum);
+      if(kernels == MS_PRIMITIVE_KERNELS_REFERENCE) {
+        reference[bench] = elapsed;
+        refsum[bench] = checksum;
+      }
+      printf("%-7s %-20s %10.3f ms  x%.2f  %s\n", kernelNames[kernels + 1], benchNames[bench], elapsed,
+             (elapsed > 0) ? reference[bench] / elapsed : 1.0, (checksum == refsum[bench]) ? "ok" : "MISMATCH");
+      if(checksum != refsum[bench])
+        status = 1;
+    }
+  }
+
+  for(i=0; i<numshapes; i++)
+    msFreeShape(&shapes[i]);
+  free(shapes);
+  for(i=0; i<nummultipart; i++)
+    msFreeShape(&multipart[i]);
+  free(multipart);
+  msShapefileClose(&shapefile);
+
+  return status;
+}
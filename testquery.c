@@ -0,0 +1,382 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Regression checks of the query code paths, run on small datasets
+ *           written by the test itself.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+
+#include "mapserver.h"
+#include "mapogcfilter.h"
+
+#define BOXES "testquery_boxes" /* written in the current directory */
+
+/* boxes of the test shapefile, indexed by shape */
+static const double boxes[][4] = {
+  {0, 0, 10, 10},   /* overlaps the selection box */
+  {15, 5, 25, 15},  /* shares an edge with it */
+  {15, 15, 25, 25}, /* shares a corner with it */
+  {30, 30, 40, 40}, /* disjoint */
+  {5, 15, 10, 20},  /* shares part of an edge with it */
+  {14, 0, 15, 6}    /* crosses an edge of it */
+};
+#define NUMBOXES (int)(sizeof(boxes)/sizeof(boxes[0]))
+
+/* VAL attribute of the boxes, -1 for NULL */
+static const int values[] = {1, 2, 1, -1, -1, -1};
+
+/* CODE attribute of the boxes, a string field holding some numbers */
+static const char *codes[] = {"A1", "10", "a1", "10", "B", "20"};
+
+static int numfailures = 0;
+
+static void check(int condition, const char *test)
+{
+  printf("%s: %s\n", condition ? "PASS" : "FAIL", test);
+  if(!condition) numfailures++;
+}
+
+/* polygon of a box, its bounds are left unset as for shapes built by MapScript */
+static void makeBox(shapeObj *shape, const double *box)
+{
+  lineObj line;
+  pointObj points[5];
+
+  points[0].x = box[0];
+  points[0].y = box[1];
+  points[1].x = box[0];
+  points[1].y = box[3];
+  points[2].x = box[2];
+  points[2].y = box[3];
+  points[3].x = box[2];
+  points[3].y = box[1];
+  points[4] = points[0];
+  line.numpoints = 5;
+  line.point = points;
+
+  msInitShape(shape);
+  shape->type = MS_SHAPE_POLYGON;
+  msAddLine(shape, &line);
+}
+
+static int writeBoxes(void)
+{
+  SHPHandle hSHP;
+  DBFHandle hDBF;
+  shapeObj shape;
+  int i;
+
+  hSHP = msSHPCreate(BOXES, SHP_POLYGON);
+  hDBF = msDBFCreate(BOXES ".dbf");
+  if(!hSHP || !hDBF)
+    return MS_FAILURE;
+
+  msDBFAddField(hDBF, "ID", FTInteger, 5, 0);
+  msDBFAddField(hDBF, "VAL", FTInteger, 5, 0);
+  msDBFAddField(hDBF, "CODE", FTString, 8, 0);
+  for(i=0; i<NUMBOXES; i++) {
+    makeBox(&shape, boxes[i]);
+    msComputeBounds(&shape);
+    msSHPWriteShape(hSHP, &shape);
+    msDBFWriteIntegerAttribute(hDBF, i, 0, i);
+    if(values[i] >= 0) /* left blank otherwise, which reads as NULL */
+      msDBFWriteIntegerAttribute(hDBF, i, 1, values[i]);
+    msDBFWriteStringAttribute(hDBF, i, 2, codes[i]);
+    msFreeShape(&shape);
+  }
+
+  msSHPClose(hSHP);
+  msDBFClose(hDBF);
+
+  return MS_SUCCESS;
+}
+
+static void removeBoxes(void)
+{
+  remove(BOXES ".shp");
+  remove(BOXES ".shx");
+  remove(BOXES ".dbf");
+}
+
+/*
+** msQueryByShape() with a zero tolerance: features touching the selection
+** polygon on its boundary only are hits, disjoint ones are not.
+*/
+static void checkQueryByShape(void)
+{
+  static const double selection[4] = {5, 5, 15, 15};
+  mapObj *map;
+  layerObj *lp;
+  shapeObj shape;
+  int i, hits[NUMBOXES];
+
+  map = msLoadMapFromString("MAP EXTENT 0 0 50 50 SIZE 100 100 "
+                            "LAYER NAME \"boxes\" TYPE POLYGON STATUS ON DATA \"" BOXES "\" TEMPLATE \"ttt\" TOLERANCE 0 END "
+                            "END", NULL);
+  if(!map) {
+    msWriteError(stderr);
+    check(MS_FALSE, "msQueryByShape(): load map");
+    return;
+  }
+
+  makeBox(&shape, selection);
+  map->query.type = MS_QUERY_BY_SHAPE;
+  map->query.mode = MS_QUERY_MULTIPLE;
+  map->query.layer = -1;
+  map->query.shape = &shape;
+
+  check(msQueryByShape(map) == MS_SUCCESS, "msQueryByShape(): status");
+
+  lp = GET_LAYER(map, 0);
+  for(i=0; i<NUMBOXES; i++)
+    hits[i] = MS_FALSE;
+  for(i=0; lp->resultcache && i<lp->resultcache->numresults; i++)
+    hits[lp->resultcache->results[i].shapeindex] = MS_TRUE;
+
+  check(hits[0] && hits[5], "msQueryByShape(): overlapping features");
+  check(hits[1] && hits[2] && hits[4], "msQueryByShape(): features touching the boundary");
+  check(!hits[3], "msQueryByShape(): disjoint feature");
+
+  map->query.shape = NULL;
+  msFreeShape(&shape);
+  msFreeMap(map);
+}
+
+/* hits of a filter expression on the boxes, as a string of shape indexes ("13") */
+static void queryByFilter(const char *filter, char *hits)
+{
+  mapObj *map;
+  layerObj *lp;
+  int i;
+
+  hits[0] = '\0';
+
+  map = msLoadMapFromString("MAP EXTENT 0 0 50 50 SIZE 100 100 "
+                            "LAYER NAME \"boxes\" TYPE POLYGON STATUS ON DATA \"" BOXES "\" TEMPLATE \"ttt\" END "
+                            "END", NULL);
+  if(!map) {
+    msWriteError(stderr);
+    strcpy(hits, "error");
+    return;
+  }
+
+  map->query.type = MS_QUERY_BY_FILTER;
+  map->query.layer = 0;
+  map->query.rect = map->extent;
+  map->query.filter = (expressionObj *) msSmallMalloc(sizeof(expressionObj));
+  initExpression(map->query.filter);
+  map->query.filter->string = msStrdup(filter);
+  map->query.filter->type = MS_EXPRESSION;
+
+  if(msQueryByFilter(map) != MS_SUCCESS) {
+    msWriteError(stderr);
+    strcpy(hits, "error");
+  } else {
+    lp = GET_LAYER(map, 0);
+    for(i=0; lp->resultcache && i<lp->resultcache->numresults; i++)
+      sprintf(hits + strlen(hits), "%ld", lp->resultcache->results[i].shapeindex);
+  }
+
+  msFreeMap(map);
+}
+
+/*
+** Attribute indexes (.aix) narrow the shapes read for a filter, but an index
+** older than the DBF file may miss updated values and must be ignored.
+*/
+static void checkAttrIndex(void)
+{
+  char szPath[MS_MAXPATHLEN], hits[64];
+  DBFHandle hDBF;
+  struct utimbuf times;
+
+  msShapefileGetAttrIndexFilename(szPath, BOXES, "VAL");
+  hDBF = msDBFOpen(BOXES ".dbf", "rb");
+  if(!hDBF || msWriteAttrIndex(hDBF, 1, szPath) != MS_SUCCESS) {
+    msWriteError(stderr);
+    check(MS_FALSE, "attribute index: build");
+    if(hDBF) msDBFClose(hDBF);
+    return;
+  }
+  msDBFClose(hDBF);
+
+  queryByFilter("([VAL] = 2)", hits);
+  check(strcmp(hits, "1") == 0, "attribute index: lookup");
+
+  /* update a value, the index now misses shape 3 and must be skipped */
+  hDBF = msDBFOpen(BOXES ".dbf", "r+b");
+  if(hDBF) {
+    msDBFWriteIntegerAttribute(hDBF, 3, 1, 2);
+    msDBFClose(hDBF);
+  }
+  times.actime = times.modtime = time(NULL) - 3600;
+  utime(szPath, &times);
+
+  queryByFilter("([VAL] = 2)", hits);
+  check(strcmp(hits, "13") == 0, "attribute index: older than the DBF file");
+
+  remove(szPath);
+  writeBoxes(); /* restores the data used by the other checks */
+}
+
+#ifdef USE_GEOS
+/*
+** GEOS predicates on shapes whose bounds are not set: the bounds prefilter
+** must not answer from the unset bounds.
+*/
+static void checkGEOSPredicates(void)
+{
+  static const double selection[4] = {5, 5, 15, 15};
+  shapeObj shape1, shape2;
+
+  makeBox(&shape1, boxes[0]);
+  msComputeBounds(&shape1);
+
+  makeBox(&shape2, selection);
+  check(msGEOSIntersects(&shape1, &shape2) == MS_TRUE, "msGEOSIntersects(): unset bounds");
+  check(msGEOSDisjoint(&shape1, &shape2) == MS_FALSE, "msGEOSDisjoint(): unset bounds");
+  msFreeShape(&shape2);
+
+  makeBox(&shape2, boxes[3]);
+  check(msGEOSIntersects(&shape1, &shape2) == MS_FALSE, "msGEOSIntersects(): disjoint shapes");
+  check(msGEOSDisjoint(&shape1, &shape2) == MS_TRUE, "msGEOSDisjoint(): disjoint shapes");
+  msFreeShape(&shape2);
+
+  msFreeShape(&shape1);
+}
+#endif
+
+#ifdef USE_OGR
+/*
+** Returns the hits of an OGC filter on the boxes read through OGR, as a
+** string of the shape indexes ("1345"). Most filters reach the driver as
+** an attribute filter.
+*/
+static void queryByOGCFilter(const char *filter, char *hits)
+{
+  mapObj *map;
+  layerObj *lp;
+  FilterEncodingNode *psNode;
+  int i;
+
+  hits[0] = '\0';
+
+  map = msLoadMapFromString("MAP EXTENT 0 0 50 50 SIZE 100 100 "
+                            "LAYER NAME \"boxes\" TYPE POLYGON STATUS ON CONNECTIONTYPE OGR CONNECTION \"" BOXES ".shp\" TEMPLATE \"ttt\" END "
+                            "END", NULL);
+  psNode = FLTParseFilterEncoding((char *) filter);
+  if(!map || !psNode) {
+    msWriteError(stderr);
+    strcpy(hits, "error");
+  } else if(FLTLayerApplyPlainFilterToLayer(psNode, map, 0) != MS_SUCCESS) {
+    msWriteError(stderr);
+    strcpy(hits, "error");
+  } else {
+    lp = GET_LAYER(map, 0);
+    for(i=0; lp->resultcache && i<lp->resultcache->numresults; i++)
+      sprintf(hits + strlen(hits), "%ld", lp->resultcache->results[i].shapeindex);
+  }
+
+  if(psNode) FLTFreeFilterEncodingNode(psNode);
+  if(map) msFreeMap(map);
+}
+
+/*
+** OGC filters pushed to OGR as "WHERE ..." clauses: NULL attributes are
+** empty for mapserver expressions, so NOT and inequalities must not drop
+** the features whose attributes are NULL.
+*/
+static void checkOGCFilterNulls(void)
+{
+  char hits[64];
+
+  queryByOGCFilter("<Filter><PropertyIsEqualTo><PropertyName>VAL</PropertyName><Literal>2</Literal></PropertyIsEqualTo></Filter>", hits);
+  check(strcmp(hits, "1") == 0, "OGC filter on OGR: PropertyIsEqualTo");
+
+  queryByOGCFilter("<Filter><PropertyIsNotEqualTo><PropertyName>VAL</PropertyName><Literal>1</Literal></PropertyIsNotEqualTo></Filter>", hits);
+  check(strcmp(hits, "1345") == 0, "OGC filter on OGR: PropertyIsNotEqualTo with NULL values");
+
+  queryByOGCFilter("<Filter><Not><PropertyIsEqualTo><PropertyName>VAL</PropertyName><Literal>1</Literal></PropertyIsEqualTo></Not></Filter>", hits);
+  check(strcmp(hits, "1345") == 0, "OGC filter on OGR: Not with NULL values");
+
+  queryByOGCFilter("<Filter><And><BBOX><PropertyName>Geometry</PropertyName><gml:Box><gml:coordinates>0,0 50,50</gml:coordinates></gml:Box></BBOX>"
+                   "<PropertyIsLessThan><PropertyName>VAL</PropertyName><Literal>2</Literal></PropertyIsLessThan></And></Filter>", hits);
+  check(strcmp(hits, "02345") == 0, "OGC filter on OGR: PropertyIsLessThan with NULL values");
+}
+
+/*
+** OGR SQL rejects a string field compared to a number and has no lower():
+** such operands must not be pushed to the driver.
+*/
+static void checkOGCFilterTypes(void)
+{
+  char hits[64];
+
+  queryByOGCFilter("<Filter><PropertyIsEqualTo><PropertyName>CODE</PropertyName><Literal>10</Literal></PropertyIsEqualTo></Filter>", hits);
+  check(strcmp(hits, "13") == 0, "OGC filter on OGR: string field compared to a number");
+
+  queryByOGCFilter("<Filter><PropertyIsEqualTo matchCase=\"false\"><PropertyName>CODE</PropertyName><Literal>a1</Literal></PropertyIsEqualTo></Filter>", hits);
+  check(strcmp(hits, "02") == 0, "OGC filter on OGR: PropertyIsEqualTo with matchCase=\"false\"");
+
+  queryByOGCFilter("<Filter><And><PropertyIsEqualTo><PropertyName>CODE</PropertyName><Literal>10</Literal></PropertyIsEqualTo>"
+                   "<PropertyIsEqualTo><PropertyName>VAL</PropertyName><Literal>2</Literal></PropertyIsEqualTo></And></Filter>", hits);
+  check(strcmp(hits, "1") == 0, "OGC filter on OGR: string field compared to a number in an And");
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(msSetup() != MS_SUCCESS || writeBoxes() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  checkQueryByShape();
+  checkAttrIndex();
+#ifdef USE_GEOS
+  checkGEOSPredicates();
+#endif
+#ifdef USE_OGR
+  checkOGCFilterNulls();
+  checkOGCFilterTypes();
+#endif
+
+  removeBoxes();
+  msCleanup(0);
+
+  printf("%d failure(s)\n", numfailures);
+  exit(numfailures > 0 ? 1 : 0);
+}
@@ -0,0 +1,174 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Micro-benchmark of the legend template and SLD builders on
+ *           layers with a growing number of classes.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapserver.h"
+#include "maptime.h"
+#include "maptemplate.h"
+#include "mapogcsld.h"
+
+#define DEFAULT_MAXCLASSES 16000
+#define MINCLASSES 1000
+
+#define LEGEND_TEMPLATE "testtemplate_legend.html" /* written in the current directory */
+
+static int writeLegendTemplate(void)
+{
+  FILE *stream;
+
+  if((stream = fopen(LEGEND_TEMPLATE, "w")) == NULL) {
+    msSetError(MS_IOERR, "(%s)", "writeLegendTemplate()", LEGEND_TEMPLATE);
+    return MS_FAILURE;
+  }
+
+  fprintf(stream, "<!-- MapServer Template -->\n");
+  fprintf(stream, "[leg_layer_html]<h2>[leg_layer_name]</h2>[/leg_layer_html]\n");
+  fprintf(stream, "[leg_class_html]<li>[leg_class_name] ([leg_class_index])</li>[/leg_class_html]\n");
+  fclose(stream);
+
+  return MS_SUCCESS;
+}
+
+/* a map with one layer of numclasses classes using the legend template */
+static mapObj *buildMap(int numclasses)
+{
+  msStringBuffer *mapBuffer;
+  char szTmp[256];
+  char *pszMap;
+  mapObj *map;
+  int i;
+
+  mapBuffer = msStringBufferAlloc();
+  msStringBufferAppend(mapBuffer, "MAP NAME \"bench\" EXTENT 0 0 100 100 SIZE 100 100 "
+                       "LEGEND TEMPLATE \"" LEGEND_TEMPLATE "\" END "
+                       "LAYER NAME \"classes\" TYPE POLYGON STATUS ON CLASSITEM \"VAL\" ");
+  for(i=0; i<numclasses; i++) {
+    snprintf(szTmp, sizeof(szTmp), "CLASS NAME \"class %d\" EXPRESSION \"%d\" STYLE COLOR %d %d %d END END ",
+             i, i, i % 256, (i / 256) % 256, 128);
+    msStringBufferAppend(mapBuffer, szTmp);
+  }
+  msStringBufferAppend(mapBuffer, "END END");
+
+  pszMap = msStringBufferReleaseStringAndFree(mapBuffer);
+  map = msLoadMapFromString(pszMap, NULL);
+  free(pszMap);
+
+  return map;
+}
+
+static double elapsedMs(struct mstimeval *start, struct mstimeval *end)
+{
+  return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct mstimeval start, end;
+  double legendtime, prevlegendtime = 0;
+#ifdef USE_OGR
+  double sldtime, prevsldtime = 0;
+#endif
+  int maxclasses = DEFAULT_MAXCLASSES;
+  int numclasses, status = 0;
+  char *pszResult;
+  mapObj *map;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(argc > 1 && strcmp(argv[1], "-h") == 0) {
+    fprintf(stdout,"Syntax:\n");
+    fprintf(stdout,"    testtemplate [<maxclasses>]\n" );
+    fprintf(stdout,"Times msProcessLegendTemplate() (and msSLDGenerateSLD() when built with\n");
+    fprintf(stdout,"OGR) on a layer of %d classes, doubling the number of classes up to\n", MINCLASSES);
+    fprintf(stdout,"<maxclasses> (%d by default). The \"x\" columns give the ratio to the\n", DEFAULT_MAXCLASSES);
+    fprintf(stdout,"previous run, close to 2 when the builders scale linearly.\n");
+    exit(0);
+  }
+
+  if(argc > 1)
+    maxclasses = MS_MAX(MINCLASSES, atoi(argv[1]));
+
+  if(msSetup() != MS_SUCCESS || writeLegendTemplate() != MS_SUCCESS) {
+    msWriteError(stdout);
+    exit(1);
+  }
+
+  for(numclasses = MINCLASSES; numclasses <= maxclasses; numclasses *= 2) {
+    if((map = buildMap(numclasses)) == NULL) {
+      msWriteError(stdout);
+      status = 1;
+      break;
+    }
+
+    msGettimeofday(&start, NULL);
+    pszResult = msProcessLegendTemplate(map, NULL, NULL, 0);
+    msGettimeofday(&end, NULL);
+    if(!pszResult) {
+      msWriteError(stdout);
+      msFreeMap(map);
+      status = 1;
+      break;
+    }
+    free(pszResult);
+    legendtime = elapsedMs(&start, &end);
+
+    printf("%6d classes  legend %10.3f ms  %7.3f us/class", numclasses, legendtime, legendtime * 1000 / numclasses);
+    if(prevlegendtime > 0)
+      printf("  x%.2f", legendtime / prevlegendtime);
+    prevlegendtime = legendtime;
+
+#ifdef USE_OGR
+    msGettimeofday(&start, NULL);
+    pszResult = msSLDGenerateSLD(map, -1, "1.0.0");
+    msGettimeofday(&end, NULL);
+    msFree(pszResult);
+    sldtime = elapsedMs(&start, &end);
+
+    printf("  SLD %10.3f ms  %7.3f us/class", sldtime, sldtime * 1000 / numclasses);
+    if(prevsldtime > 0)
+      printf("  x%.2f", sldtime / prevsldtime);
+    prevsldtime = sldtime;
+#endif
+    printf("\n");
+
+    msFreeMap(map);
+  }
+
+  remove(LEGEND_TEMPLATE);
+  msCleanup(0);
+
+  exit(status);
+}
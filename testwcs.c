@@ -0,0 +1,223 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Regression checks of the WCS coverage output, run on a small
+ *           raster written by the test itself.
+ * Author:   Steve Lime and the MapServer team.
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2005 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapserver.h"
+
+#if defined(USE_WCS_SVR) && defined(USE_GDAL)
+#include "mapwcs.h"
+#include "gdal.h"
+#include "cpl_string.h"
+#endif
+
+#define SOURCE "testwcs_src.tif" /* written in the current directory */
+#define MEMORY "testwcs_mem.tif"
+#define WIDTH 40
+#define HEIGHT 30
+
+static int numfailures = 0;
+
+#if defined(USE_WCS_SVR) && defined(USE_GDAL)
+
+static void check(int condition, const char *test)
+{
+  printf("%s: %s\n", condition ? "PASS" : "FAIL", test);
+  if(!condition) numfailures++;
+}
+
+/* Float32 raster of WIDTH x HEIGHT one unit pixels, value 100 * row + column */
+static int writeSource(void)
+{
+  static double geotransform[6] = {0, 1, 0, HEIGHT, 0, -1};
+  GDALDatasetH hDS;
+  float line[WIDTH];
+  int x, y, status = MS_SUCCESS;
+
+  msGDALInitialize();
+  hDS = GDALCreate(GDALGetDriverByName("GTiff"), SOURCE, WIDTH, HEIGHT, 1, GDT_Float32, NULL);
+  if(hDS == NULL)
+    return MS_FAILURE;
+
+  GDALSetGeoTransform(hDS, geotransform);
+  for(y=0; y<HEIGHT && status == MS_SUCCESS; y++) {
+    for(x=0; x<WIDTH; x++)
+      line[x] = (float) (100 * y + x);
+    if(GDALRasterIO(GDALGetRasterBand(hDS, 1), GF_Write, 0, y, WIDTH, 1, line, WIDTH, 1, GDT_Float32, 0, 0) != CE_None)
+      status = MS_FAILURE;
+  }
+  GDALClose(hDS);
+
+  return status;
+}
+
+/* MS_TRUE if both items are unset or have the same value */
+static int sameMetadataItem(GDALDatasetH hDS1, GDALDatasetH hDS2, const char *name)
+{
+  const char *value1 = GDALGetMetadataItem(hDS1, name, NULL);
+  const char *value2 = GDALGetMetadataItem(hDS2, name, NULL);
+
+  if(value1 == NULL || value2 == NULL)
+    return value1 == value2;
+  return strcmp(value1, value2) == 0;
+}
+
+/*
+** msWCSDrawCoverageStrips() with a MS_WCS_STRIP_MEMORY of a few lines: the
+** file written a strip at a time has the pixels, georeferencing, nodata
+** value and resolution of the one msSaveImageGDAL() writes from a single
+** image of the coverage.
+*/
+static void checkCoverageStrips(void)
+{
+  mapObj *map;
+  layerObj *lp;
+  imageObj *image;
+  GDALDatasetH hMemDS = NULL, hStripDS = NULL;
+  double gt1[6], gt2[6];
+  float *data1, *data2;
+  char *filename = NULL;
+  int stripheight, i;
+
+  map = msLoadMapFromString("MAP EXTENT 0.5 0.5 39.5 29.5 SIZE 40 30 RESOLUTION 150 IMAGETYPE \"f32\" "
+                            "CONFIG \"MS_WCS_STRIP_MEMORY\" \"0.001\" "
+                            "OUTPUTFORMAT NAME \"f32\" DRIVER \"GDAL/GTiff\" IMAGEMODE FLOAT32 "
+                            "FORMATOPTION \"NULLVALUE=-99\" END "
+                            "LAYER NAME \"grid\" TYPE RASTER STATUS ON DATA \"" SOURCE "\" END "
+                            "END", NULL);
+  if(!map) {
+    msWriteError(stderr);
+    check(MS_FALSE, "msWCSDrawCoverageStrips(): load map");
+    return;
+  }
+
+  map->cellsize = 1.0; /* as a GetCoverage of the full resolution sets it */
+  msMapComputeGeotransform(map);
+  lp = GET_LAYER(map, 0);
+
+  /* the whole coverage in a single image */
+  image = msImageCreate(map->width, map->height, map->outputformat, map->web.imagepath, map->web.imageurl,
+                        map->resolution, map->defresolution, NULL);
+  check(image != NULL && msDrawRasterLayerLow(map, lp, image, NULL) == MS_SUCCESS
+        && msSaveImageGDAL(map, image, MEMORY) == MS_SUCCESS, "msSaveImageGDAL(): status");
+  if(image)
+    msFreeImage(image);
+
+  /* and a few lines at a time */
+  stripheight = msWCSGetStripHeight(map);
+  check(stripheight > 1 && stripheight < map->height, "msWCSGetStripHeight(): strips within the memory limit");
+  if(stripheight > 1)
+    filename = msWCSDrawCoverageStrips(map, lp, stripheight);
+  check(filename != NULL, "msWCSDrawCoverageStrips(): status");
+  if(filename == NULL) {
+    msWriteError(stderr);
+    remove(MEMORY);
+    msFreeMap(map);
+    return;
+  }
+
+  hMemDS = GDALOpen(MEMORY, GA_ReadOnly);
+  hStripDS = GDALOpen(filename, GA_ReadOnly);
+  check(hMemDS != NULL && hStripDS != NULL, "msWCSDrawCoverageStrips(): open the outputs");
+  if(hMemDS && hStripDS) {
+    check(GDALGetRasterXSize(hStripDS) == WIDTH && GDALGetRasterYSize(hStripDS) == HEIGHT
+          && GDALGetRasterCount(hStripDS) == GDALGetRasterCount(hMemDS), "msWCSDrawCoverageStrips(): size");
+
+    data1 = (float *) msSmallMalloc(sizeof(float) * WIDTH * HEIGHT);
+    data2 = (float *) msSmallMalloc(sizeof(float) * WIDTH * HEIGHT);
+    GDALRasterIO(GDALGetRasterBand(hMemDS, 1), GF_Read, 0, 0, WIDTH, HEIGHT, data1, WIDTH, HEIGHT, GDT_Float32, 0, 0);
+    GDALRasterIO(GDALGetRasterBand(hStripDS, 1), GF_Read, 0, 0, WIDTH, HEIGHT, data2, WIDTH, HEIGHT, GDT_Float32, 0, 0);
+    check(memcmp(data1, data2, sizeof(float) * WIDTH * HEIGHT) == 0, "msWCSDrawCoverageStrips(): pixels");
+    check(data2[0] == 0 && data2[WIDTH * HEIGHT - 1] == 100 * (HEIGHT - 1) + WIDTH - 1,
+          "msWCSDrawCoverageStrips(): pixels of the source");
+    free(data1);
+    free(data2);
+
+    GDALGetGeoTransform(hMemDS, gt1);
+    GDALGetGeoTransform(hStripDS, gt2);
+    for(i=0; i<6 && gt1[i] == gt2[i]; i++);
+    check(i == 6, "msWCSDrawCoverageStrips(): geotransform");
+    check(strcmp(GDALGetProjectionRef(hMemDS), GDALGetProjectionRef(hStripDS)) == 0,
+          "msWCSDrawCoverageStrips(): projection");
+    check(GDALGetRasterNoDataValue(GDALGetRasterBand(hStripDS, 1), NULL) == -99,
+          "msWCSDrawCoverageStrips(): nodata value");
+
+    check(GDALGetMetadataItem(hStripDS, "TIFFTAG_XRESOLUTION", NULL) != NULL,
+          "msWCSDrawCoverageStrips(): resolution written");
+    check(sameMetadataItem(hMemDS, hStripDS, "TIFFTAG_XRESOLUTION")
+          && sameMetadataItem(hMemDS, hStripDS, "TIFFTAG_YRESOLUTION")
+          && sameMetadataItem(hMemDS, hStripDS, "TIFFTAG_RESOLUTIONUNIT"),
+          "msWCSDrawCoverageStrips(): resolution of msSaveImageGDAL()");
+  }
+  if(hMemDS)
+    GDALClose(hMemDS);
+  if(hStripDS)
+    GDALClose(hStripDS);
+
+  VSIUnlink(filename);
+  free(filename);
+  remove(MEMORY);
+  msFreeMap(map);
+}
+
+#endif /* USE_WCS_SVR && USE_GDAL */
+
+int main(int argc, char *argv[])
+{
+  if(argc > 1 && strcmp(argv[1], "-v") == 0) {
+    printf("%s\n", msGetVersion());
+    exit(0);
+  }
+
+  if(msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+#if defined(USE_WCS_SVR) && defined(USE_GDAL)
+  if(writeSource() != MS_SUCCESS) {
+    msWriteError(stderr);
+    exit(1);
+  }
+
+  checkCoverageStrips();
+
+  remove(SOURCE);
+#else
+  printf("WCS server or GDAL support not built in, nothing checked\n");
+#endif
+
+  msCleanup(0);
+
+  printf("%d failure(s)\n", numfailures);
+  exit(numfailures > 0 ? 1 : 0);
+}